@@ -185,6 +185,8 @@ struct options
 
 	int oneshot; /* Do PTW once */
 
+	char * ptw_state; /* directory of the saved PTW states */
+
 	char * logKeyToFile;
 
 	int forced_amode; /* signals disregarding automatic detection of encryption
@@ -200,10 +202,19 @@ typedef struct
 	int idx, val;
 } vote;
 
+/* a chunk of IV records, as seen when the IV list was last updated */
+
+struct WEP_ivchunk
+{
+	const unsigned char * plane[5]; /* IV bytes, then keystream     */
+	long nb_ivs; /* # of records usable          */
+};
+
 struct WEP_data
 {
 	unsigned char key[64]; /* the current chosen WEP key   */
-	unsigned char * ivbuf; /* buffer holding all the IVs   */
+	struct WEP_ivchunk * ivchunks; /* chunks holding all the IVs   */
+	size_t nb_ivchunks; /* # of chunks in ivchunks      */
 	int nb_aps; /* number of targeted APs       */
 	long nb_ivs; /* # of unique IVs in buffer    */
 	long nb_ivs_now; /* # of unique IVs available    */
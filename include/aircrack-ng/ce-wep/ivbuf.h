@@ -0,0 +1,78 @@
+/*
+ *  Chunked storage for captured WEP IVs.
+ *
+ *  Copyright (C) 2006-2020 Thomas d'Otreppe <tdotreppe@aircrack-ng.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ *
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL. *  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so. *  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version. *  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+/*
+ *  IVs are appended to a list of fixed-size chunks, which are carved out of
+ *  large slabs shared by all lists. A chunk never moves once allocated, so
+ *  readers may walk the records already stored while new ones are appended,
+ *  and growing a list never copies the IVs collected so far.
+ *
+ *  Within a chunk, records are stored as a structure of arrays: byte k of
+ *  every record lives in plane data[k], so that the KoreK attacks can load
+ *  the same byte of consecutive IVs with wide, contiguous reads.
+ */
+
+#ifndef _IVBUF_H
+#define _IVBUF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* size of one record: the 3 IV bytes and the first 2 encrypted bytes */
+
+#define IVBUF_RECORD_SIZE 5
+
+/* number of records per chunk, keeping a chunk just under 128 KB */
+
+#define IVBUF_CHUNK_IVS 26208
+
+struct ivbuf_chunk
+{
+	struct ivbuf_chunk * next; /* next chunk, in insertion order */
+	size_t nb_ivs; /* # of records stored in chunk */
+	uint8_t data[IVBUF_RECORD_SIZE][IVBUF_CHUNK_IVS]; /* one plane per byte */
+};
+
+struct ivbuf
+{
+	struct ivbuf_chunk * head; /* chunk holding the oldest IVs */
+	struct ivbuf_chunk * tail; /* chunk currently being filled */
+	long nb_ivs; /* total # of records stored    */
+};
+
+int ivbuf_append(struct ivbuf * ivb, const uint8_t record[IVBUF_RECORD_SIZE]);
+void ivbuf_clear(struct ivbuf * ivb);
+void ivbuf_arena_free(void);
+
+#endif
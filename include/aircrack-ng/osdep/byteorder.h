@@ -301,7 +301,8 @@ typedef uint8_t u_int8_t;
 
 #if (AIRCRACK_NG_BYTE_ORDER == AIRCRACK_NG_LITTLE_ENDIAN)
 
-#ifndef AIRCRACK_NG_BYTE_ORDER_DEFINED
+/* <asm/byteorder.h> (pulled in by e.g. <linux/if_packet.h>) has them */
+#if !defined(AIRCRACK_NG_BYTE_ORDER_DEFINED) && !defined(__cpu_to_le16)
 #define __be64_to_cpu(x) ___my_swab64(x)
 #define __be32_to_cpu(x) ___my_swab32(x)
 #define __be16_to_cpu(x) ___my_swab16(x)
@@ -358,7 +359,7 @@ typedef uint8_t u_int8_t;
 
 #if (AIRCRACK_NG_BYTE_ORDER == AIRCRACK_NG_BIG_ENDIAN)
 
-#ifndef AIRCRACK_NG_BYTE_ORDER_DEFINED
+#if !defined(AIRCRACK_NG_BYTE_ORDER_DEFINED) && !defined(__cpu_to_le16)
 #define __be64_to_cpu(x) (x)
 #define __be32_to_cpu(x) (x)
 #define __be16_to_cpu(x) (x)
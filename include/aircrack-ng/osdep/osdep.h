@@ -79,6 +79,16 @@ struct rx_info
 	uint32_t ri_antenna;
 } __packed;
 
+/* a frame returned by wi_read_batch(), or given to wi_write_batch() */
+struct wi_frame
+{
+	unsigned char * h80211; /* in the buffer given to wi_read_batch() */
+	int len;
+	int dlt;
+	struct timespec ts;
+	struct rx_info ri;
+};
+
 /* Normal code should not access this directly.  Only osdep.
  * This structure represents a single interface.  It should be created with
  * wi_open and destroyed with wi_close.
@@ -92,12 +102,21 @@ struct wif
 				   unsigned char * h80211,
 				   int len,
 				   struct rx_info * ri);
+	int (*wi_read_batch)(struct wif * wi,
+						 struct wi_frame * frames,
+						 int nb,
+						 unsigned char * buf,
+						 int len);
 	int (*wi_write)(struct wif * wi,
 					struct timespec * ts,
 					int dlt,
 					unsigned char * h80211,
 					int len,
 					struct tx_info * ti);
+	int (*wi_write_batch)(struct wif * wi,
+						  struct wi_frame * frames,
+						  int nb,
+						  struct tx_info * ti);
 	int (*wi_set_ht_channel)(struct wif * wi, int chan, unsigned int htval);
 	int (*wi_set_channel)(struct wif * wi, int chan);
 	int (*wi_get_channel)(struct wif * wi);
@@ -115,6 +134,7 @@ struct wif
 
 	void * wi_priv;
 	char wi_interface[MAX_IFACE_NAME];
+	int wi_rx_ring; /* wi_read_batch() may use a kernel receive ring */
 };
 
 /* Routines to be used by client code */
@@ -125,12 +145,30 @@ IMPORT int wi_read(struct wif * wi,
 				   unsigned char * h80211,
 				   int len,
 				   struct rx_info * ri);
+/* Reads up to nb frames into buf, waiting only for the first one. The
+ * buffer must hold at least 4096 bytes. Returns the number of frames read,
+ * or -1 on error. */
+IMPORT int wi_read_batch(struct wif * wi,
+						 struct wi_frame * frames,
+						 int nb,
+						 unsigned char * buf,
+						 int len);
+/* Lets wi_read_batch() read through a receive ring shared with the kernel,
+ * where the backend has one (TPACKET_V3 on Linux). Off by default. */
+IMPORT void wi_set_rx_ring(struct wif * wi, int on);
 IMPORT int wi_write(struct wif * wi,
 					struct timespec * ts,
 					int dlt,
 					unsigned char * h80211,
 					int len,
 					struct tx_info * ti);
+/* Writes the h80211/len of nb frames, with as few calls to the driver as it
+ * allows. Returns the number of frames written, less than nb when the
+ * driver ran out of buffers, or -1 on error. */
+IMPORT int wi_write_batch(struct wif * wi,
+						  struct wi_frame * frames,
+						  int nb,
+						  struct tx_info * ti);
 IMPORT int wi_set_channel(struct wif * wi, int chan);
 IMPORT int wi_set_ht_channel(struct wif * wi, int chan, unsigned int htval);
 IMPORT int wi_get_channel(struct wif * wi);
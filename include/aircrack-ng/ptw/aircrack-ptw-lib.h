@@ -35,6 +35,7 @@
 #define _AIRCRACK_PTW_H_
 
 #include <stdint.h>
+#include <stdio.h>
 
 // Number of bytes we use for our table of seen IVs, this is (2^24)/8
 #define PTW_IVTABLELEN 2097152
@@ -54,6 +55,16 @@
 // How many bytes of a keystream we collect, 16 are needed for a 104 bit key
 #define PTW_KSBYTES 32
 
+// How many sessions are stored in each chunk of allsessions
+#define PTW_SESSIONCHUNK 4096
+
+// Saved attackstates start with this magic, followed by their version
+#define PTW_STATEMAGIC "PTWS"
+#define PTW_STATEVERSION 1
+// Application data may precede a saved state: this magic, the length of
+// the data as an uint32_t, then the data. PTW_loadstate skips it.
+#define PTW_STATEEXTMAGIC "PTWX"
+
 // The MAGIC VALUE!!
 #define PTW_n 256
 
@@ -100,16 +111,24 @@ typedef struct
 	PTW_session sessions[PTW_CONTROLSESSIONS];
 	// The table with votes for the keybytesums
 	PTW_tableentry table[PTW_KEYHSBYTES][PTW_n];
-	// Sessions for the original klein attack
-	PTW_session * allsessions;
+	// Sessions for the original klein attack, in chunks of PTW_SESSIONCHUNK
+	PTW_session ** allsessions;
+	// How many chunk pointers allsessions has room for
 	int allsessions_size;
 	// rc4test function, optimized if available
 	rc4test_func rc4test;
+	// How many threads PTW_computeKey and PTW_addsessions may use, 0 for
+	// one per cpu
+	int threads;
 } PTW_attackstate;
 
 PTW_attackstate * PTW_newattackstate(void);
 void PTW_freeattackstate(PTW_attackstate *);
 int PTW_addsession(PTW_attackstate *, uint8_t *, uint8_t *, int *, int);
+int PTW_addsessions(PTW_attackstate *, PTW_session *, int, uint8_t *);
+int PTW_savestate(PTW_attackstate *, FILE *);
+PTW_attackstate * PTW_loadstate(FILE *);
+PTW_attackstate * PTW_copyattackstate(PTW_attackstate *);
 int PTW_computeKey(
 	PTW_attackstate *, uint8_t *, int, int, int *, int[][PTW_n], int attacks);
 
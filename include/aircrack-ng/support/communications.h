@@ -146,16 +146,17 @@ struct communication_options
 	size_t weplen;
 
 	int f_index; /* outfiles index       */
-	FILE * f_txt; /* output csv file      */
-	FILE * f_kis; /* output kismet csv file      */
-	FILE * f_kis_xml; /* output kismet netxml file */
 	FILE * f_gps; /* output gps file      */
 	FILE * f_cap; /* output cap file      */
 	FILE * f_ivs; /* output ivs file      */
 	FILE * f_xor; /* output prga file     */
 	FILE * f_logcsv; /* output rolling AP/GPS csv log */
+	FILE * f_events; /* output csv event log  */
 
 	char * f_cap_name;
+	char * f_txt_name;
+	char * f_kis_name;
+	char * f_kis_xml_name;
 	char * prefix;
 
 	int output_format_pcap;
@@ -163,6 +164,7 @@ struct communication_options
 	int output_format_kismet_csv;
 	int output_format_kismet_netxml;
 	int output_format_log_csv;
+	int output_format_events;
 
 	int usegpsd; /* do we use GPSd?      */
 	int record_data; /* do we record data?   */
@@ -307,23 +309,19 @@ enum Send_Packet_Option
 	kRewriteDuration = 1 << 2,
 };
 
-static inline int send_packet(struct wif * wi,
-							  void * buf,
-							  size_t count,
-							  enum Send_Packet_Option option)
+/* Applies the rewriting asked by option to the frame about to be sent as
+ * the seq'th one. */
+static inline void rewrite_packet(uint8_t * pkt,
+								  size_t count,
+								  enum Send_Packet_Option option,
+								  unsigned long seq)
 {
-	REQUIRE(buf != NULL);
-	REQUIRE(count > 0 && count < INT_MAX);
-	REQUIRE(option >= kNoChange && option <= kRewriteDuration); //-V1016
-
-	uint8_t * pkt = (uint8_t *) buf;
-
 	if ((option & kRewriteSequenceNumber) != 0 && (count > 24)
 		&& (pkt[1] & 0x04) == 0
 		&& (pkt[22] & 0x0F) == 0)
 	{
-		pkt[22] = (uint8_t)((nb_pkt_sent & 0x0000000F) << 4);
-		pkt[23] = (uint8_t)((nb_pkt_sent & 0x00000FF0) >> 4);
+		pkt[22] = (uint8_t)((seq & 0x0000000F) << 4);
+		pkt[23] = (uint8_t)((seq & 0x00000FF0) >> 4);
 	}
 
 	if ((option & kRewriteDuration) != 0 && count > 24)
@@ -335,6 +333,18 @@ static inline int send_packet(struct wif * wi,
 		// Reset Retry Flag
 		pkt[1] = (uint8_t)(pkt[1] & ~0x4);
 	}
+}
+
+static inline int send_packet(struct wif * wi,
+							  void * buf,
+							  size_t count,
+							  enum Send_Packet_Option option)
+{
+	REQUIRE(buf != NULL);
+	REQUIRE(count > 0 && count < INT_MAX);
+	REQUIRE(option >= kNoChange && option <= kRewriteDuration); //-V1016
+
+	rewrite_packet((uint8_t *) buf, count, option, nb_pkt_sent);
 
 	int rc;
 	do
@@ -357,6 +367,52 @@ static inline int send_packet(struct wif * wi,
 	return (0);
 }
 
+/* Like send_packet(), for nb frames handed to the driver at once. */
+static inline int send_packets(struct wif * wi,
+							   struct wi_frame * frames,
+							   int nb,
+							   enum Send_Packet_Option option)
+{
+	REQUIRE(frames != NULL);
+	REQUIRE(nb >= 0);
+	REQUIRE(option >= kNoChange && option <= kRewriteDuration); //-V1016
+
+	int i, rc, sent = 0;
+
+	for (i = 0; i < nb; i++)
+	{
+		REQUIRE(frames[i].h80211 != NULL);
+		REQUIRE(frames[i].len > 0);
+
+		rewrite_packet(frames[i].h80211,
+					   (size_t) frames[i].len,
+					   option,
+					   nb_pkt_sent + (unsigned long) i);
+		frames[i].dlt = LINKTYPE_IEEE802_11;
+	}
+
+	while (sent < nb)
+	{
+		rc = wi_write_batch(wi, frames + sent, nb - sent, NULL);
+		if (rc == -1 && errno == ENOBUFS)
+		{
+			usleep(10000);
+		}
+
+		if (rc == -1 && errno != EAGAIN && errno != ENOBUFS)
+		{
+			perror("wi_write_batch()");
+			return (-1);
+		}
+
+		if (rc > 0) sent += rc;
+	}
+
+	nb_pkt_sent += (unsigned long) nb;
+
+	return (0);
+}
+
 int getnet(struct wif * wi,
 		   uint8_t * capa,
 		   int filter,
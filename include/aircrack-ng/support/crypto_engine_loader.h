@@ -136,6 +136,16 @@ extern int (*dso_ac_crypto_engine_wpa_crack)(
 	const uint8_t cmpmic[20],
 	int nparallel,
 	int threadid);
+extern int (*dso_ac_crypto_engine_wpa_pmk_crack)(
+	ac_crypto_engine_t * engine,
+	const uint8_t pmk[MAX_KEYS_PER_CRYPT_SUPPORTED][32],
+	const uint8_t eapol[256],
+	uint32_t eapol_size,
+	uint8_t mic[MAX_KEYS_PER_CRYPT_SUPPORTED][20],
+	uint8_t keyver,
+	const uint8_t cmpmic[20],
+	int nparallel,
+	int threadid);
 extern int (*dso_ac_crypto_engine_wpa_pmkid_crack)(
 	ac_crypto_engine_t * engine,
 	const wpapsk_password key[MAX_KEYS_PER_CRYPT_SUPPORTED],
@@ -34,6 +34,7 @@
 
 #include <aircrack-ng/ce-wpa/crypto_engine.h>
 #include <aircrack-ng/adt/avl_tree.h>
+#include <aircrack-ng/ce-wep/ivbuf.h>
 #include <aircrack-ng/support/pcap_local.h>
 #include <aircrack-ng/ptw/aircrack-ptw-lib.h>
 
@@ -98,6 +99,22 @@ enum channel_width_enum
 	CHANNEL_160MHZ
 };
 
+/** text output formats a record caches its serialization for */
+enum text_format
+{
+	TEXT_CSV,
+	TEXT_KISMET_CSV,
+	TEXT_NETXML,
+	NB_TEXT_FORMATS
+};
+
+/** serialized record, owned by dump_write.c */
+struct text_record
+{
+	char * text;
+	size_t len;
+};
+
 /** linked list of detected access points. */
 struct AP_info
 {
@@ -131,15 +148,14 @@ struct AP_info
 	unsigned long nb_data_old; /* number of data packets/sec*/
 	int nb_dataps; /* number of data packets/sec*/
 	struct timeval tv; /* time for data per second */
-	char * manuf; /* the access point's manufacturer */
+	const char * manuf; /* the access point's manufacturer */
 	unsigned long long timestamp; /* Timestamp to calculate uptime   */
 
 	uint8_t bssid[6]; /* access point MAC address     */
 	uint8_t essid[ESSID_LENGTH + 1]; /* access point identifier      */
 	uint8_t lanip[4]; /* IP address if unencrypted    */
-	uint8_t * ivbuf; /* table holding WEP IV data    */
+	struct ivbuf ivbuf; /* chunks holding WEP IV data   */
 	uint8_t ** uiv_root; /* IV uniqueness root struct    */
-	long ivbuf_size; /* IV buffer allocated size     */
 	long nb_ivs; /* total number of unique IVs   */
 	long nb_ivs_clean; /* total number of unique IVs   */
 	long nb_ivs_vague; /* total number of unique IVs   */
@@ -151,6 +167,11 @@ struct AP_info
 	struct WPA_hdsk wpa; /* valid WPA handshake data     */
 	PTW_attackstate * ptw_clean;
 	PTW_attackstate * ptw_vague;
+	PTW_session * ptw_pending; /* IVS sessions not given to PTW yet */
+	int nb_ptw_pending; /* number of pending PTW sessions */
+	time_t ptw_saved; /* last time the PTW state was saved */
+	struct ptw_input * ptw_inputs; /* files the loaded PTW state holds */
+	int nb_ptw_inputs; /* number of files in ptw_inputs */
 
 	int wpa_stored; /* wpa stored in ivs file?   */
 	int essid_stored; /* essid stored in ivs file? */
@@ -180,6 +201,17 @@ struct AP_info
 	int marked;
 	int marked_color;
 	struct WPS_info wps;
+
+	unsigned long sort_seq; /* order of first sighting      */
+	unsigned int sort_gen; /* ordering sort_key belongs to */
+	int sort_stale; /* stale when last sorted       */
+	int64_t sort_key; /* key when last sorted        */
+
+	int text_dirty; /* updated since last written   */
+	int text_pending; /* update not yet in event log  */
+	int text_logged; /* state in the event log       */
+	struct text_record text[NB_TEXT_FORMATS]; /* cached text records */
+	int evicted; /* dropped by the retention sweep */
 };
 
 /** linked list of detected clients */
@@ -191,7 +223,7 @@ struct ST_info
 	uint8_t stmac[6]; /* the client's MAC address  */
 	struct WPA_hdsk wpa; /* WPA handshake data        */
 
-	char * manuf; /* the client's manufacturer */
+	const char * manuf; /* the client's manufacturer */
 
 	time_t tinit, tlast; /* first and last time seen  */
 	unsigned long nb_pkt; /* total number of packets   */
@@ -217,6 +249,17 @@ struct ST_info
 	float gps_loc_min[5]; /* min gps coordinates      */
 	float gps_loc_max[5]; /* max gps coordinates      */
 	float gps_loc_best[5]; /* best gps coordinates     */
+
+	unsigned long sort_seq; /* order of first sighting   */
+	unsigned int sort_gen; /* ordering sort_key belongs to */
+	int sort_stale; /* stale when last sorted    */
+	int64_t sort_key; /* key when last sorted     */
+
+	int text_dirty; /* updated since last written */
+	int text_pending; /* update not yet in event log */
+	int text_logged; /* state in the event log    */
+	struct text_record text[NB_TEXT_FORMATS]; /* cached text records */
+	int evicted; /* dropped by the retention sweep */
 };
 
 #endif //AIRCRACK_NG_STATION_H
@@ -32,6 +32,8 @@
 #ifndef AIRCRACK_NG_CONSOLE_H
 #define AIRCRACK_NG_CONSOLE_H
 
+#include <stdio.h>
+
 /**
  * Styling attributes for \a textstyle function.
  */
@@ -95,6 +97,9 @@ void textcolor(int attr, int fg, int bg);
 /// Changes the foreground character color, as shown in the
 /// user's terminal console.
 void textcolor_fg(int fg);
+/// The f-prefixed functions write the same sequences to \a f, without
+/// flushing it, e.g. to render a whole screen before printing it.
+void ftextcolor_fg(FILE * f, int fg);
 
 /// Changes the background character color, as shown in the
 /// user's terminal console.
@@ -103,17 +108,21 @@ void textcolor_bg(int bg);
 /// Switch to normal color or intensity, as shown in the
 /// user's terminal console.
 void textcolor_normal(void);
+void ftextcolor_normal(FILE * f);
 
 /// Switches the styling applied to future written characters to
 /// the user's terminal console.
 void textstyle(int attr);
+void ftextstyle(FILE * f, int attr);
 
 /// Moves the cursor to specified column and row, 1-based.
 void moveto(int x, int y);
+void fmoveto(FILE * f, int x, int y);
 
 /// Move the cursor a specified number of positions, in the specified
 /// direction.
 void move(int which, int n);
+void fmove(FILE * f, int which, int n);
 
 /// \brief Erase a subset of the terminal console.
 /**
@@ -128,9 +137,11 @@ void move(int which, int n);
  * added for xterm and is supported by other terminal applications).
  */
 void erase_display(int n);
+void ferase_display(FILE * f, int n);
 
 /// \brief Erase part of the line; of the user's terminal console.
 void erase_line(int n);
+void ferase_line(FILE * f, int n);
 
 /// Hide the cursor within the terminal console.
 void hide_cursor(void);
@@ -154,4 +165,11 @@ static inline void console_puts(const char * msg)
 	putchar('\n');
 }
 
+static inline void fconsole_puts(FILE * f, const char * msg)
+{
+	fprintf(f, "%s", msg);
+	ferase_line(f, 0);
+	fputc('\n', f);
+}
+
 #endif // AIRCRACK_NG_CONSOLE_H
@@ -0,0 +1,175 @@
+/*
+ *  Chunked storage for captured WEP IVs.
+ *
+ *  Copyright (C) 2006-2020 Thomas d'Otreppe <tdotreppe@aircrack-ng.org>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ *
+ *  In addition, as a special exception, the copyright holders give
+ *  permission to link the code of portions of this program with the
+ *  OpenSSL library under certain conditions as described in each
+ *  individual source file, and distribute linked combinations
+ *  including the two.
+ *  You must obey the GNU General Public License in all respects
+ *  for all of the code used other than OpenSSL. *  If you modify
+ *  file(s) with this exception, you may extend this exception to your
+ *  version of the file(s), but you are not obligated to do so. *  If you
+ *  do not wish to do so, delete this exception statement from your
+ *  version. *  If you delete this exception statement from all source
+ *  files in the program, then also delete it here.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "aircrack-ng/defs.h"
+#include "aircrack-ng/ce-wep/ivbuf.h"
+
+/* number of chunks carved out of a single slab (about 2 MB) */
+
+#define IVBUF_SLAB_CHUNKS 16
+
+struct ivbuf_slab
+{
+	struct ivbuf_slab * next;
+	struct ivbuf_chunk chunks[IVBUF_SLAB_CHUNKS];
+};
+
+/* the arena is shared by all lists, and only locked to hand out chunks */
+
+static pthread_mutex_t arena_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ivbuf_slab * arena_slabs = NULL;
+static struct ivbuf_chunk * arena_free = NULL;
+
+static struct ivbuf_chunk * ivbuf_chunk_alloc(void)
+{
+	struct ivbuf_chunk * chunk;
+	struct ivbuf_slab * slab;
+	int i;
+
+	ALLEGE(pthread_mutex_lock(&arena_lock) == 0);
+
+	if (arena_free == NULL)
+	{
+		/* carve a new slab into free chunks */
+
+		slab = (struct ivbuf_slab *) malloc(sizeof(struct ivbuf_slab));
+
+		if (slab == NULL)
+		{
+			ALLEGE(pthread_mutex_unlock(&arena_lock) == 0);
+			return (NULL);
+		}
+
+		slab->next = arena_slabs;
+		arena_slabs = slab;
+
+		for (i = IVBUF_SLAB_CHUNKS - 1; i >= 0; i--)
+		{
+			slab->chunks[i].next = arena_free;
+			arena_free = &slab->chunks[i];
+		}
+	}
+
+	chunk = arena_free;
+	arena_free = chunk->next;
+
+	ALLEGE(pthread_mutex_unlock(&arena_lock) == 0);
+
+	chunk->next = NULL;
+	chunk->nb_ivs = 0;
+
+	return (chunk);
+}
+
+/* add one record at the end of the list */
+
+int ivbuf_append(struct ivbuf * ivb, const uint8_t record[IVBUF_RECORD_SIZE])
+{
+	struct ivbuf_chunk * chunk;
+	int i;
+
+	REQUIRE(ivb != NULL);
+	REQUIRE(record != NULL);
+
+	chunk = ivb->tail;
+
+	if (chunk == NULL || chunk->nb_ivs == IVBUF_CHUNK_IVS)
+	{
+		chunk = ivbuf_chunk_alloc();
+
+		if (chunk == NULL) return (-1);
+
+		if (ivb->tail == NULL)
+			ivb->head = chunk;
+		else
+			ivb->tail->next = chunk;
+
+		ivb->tail = chunk;
+	}
+
+	for (i = 0; i < IVBUF_RECORD_SIZE; i++)
+		chunk->data[i][chunk->nb_ivs] = record[i];
+	chunk->nb_ivs++;
+	ivb->nb_ivs++;
+
+	return (0);
+}
+
+/* give all chunks of the list back to the arena */
+
+void ivbuf_clear(struct ivbuf * ivb)
+{
+	REQUIRE(ivb != NULL);
+
+	if (ivb->head == NULL) return;
+
+	ALLEGE(pthread_mutex_lock(&arena_lock) == 0);
+
+	ivb->tail->next = arena_free;
+	arena_free = ivb->head;
+
+	ALLEGE(pthread_mutex_unlock(&arena_lock) == 0);
+
+	ivb->head = NULL;
+	ivb->tail = NULL;
+	ivb->nb_ivs = 0;
+}
+
+/* release the memory of all slabs; no list may be in use anymore */
+
+void ivbuf_arena_free(void)
+{
+	struct ivbuf_slab * slab;
+
+	ALLEGE(pthread_mutex_lock(&arena_lock) == 0);
+
+	while (arena_slabs != NULL)
+	{
+		slab = arena_slabs;
+		arena_slabs = slab->next;
+		free(slab);
+	}
+
+	arena_free = NULL;
+
+	ALLEGE(pthread_mutex_unlock(&arena_lock) == 0);
+}
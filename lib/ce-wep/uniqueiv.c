@@ -33,10 +33,10 @@
  */
 
 /*
- *  Each IV byte is stored in corresponding "level". We have 3 levels with
- *  IV[2] as root index (level 0), IV[1] and IV[2] as level 2 and level 1
- *  indices respectively. Space required to allocate all data is at maximum
- *  2^24/8 (2 MB) and space required by filled index structures is 257 KB.
+ *  Seen IVs are kept in a flat bitmap of 2^24 bits (2 MB) indexed by the
+ *  whole IV, so that a lookup is a single memory access. The root only
+ *  holds a pointer to the bitmap, which is allocated on the first IV
+ *  marked; its pages are zero-filled by the kernel as they get touched.
  */
 
 #ifdef HAVE_CONFIG_H
@@ -44,26 +44,63 @@
 #endif
 
 #include <stdlib.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
 
 #include "aircrack-ng/defs.h"
 #include "aircrack-ng/ce-wep/uniqueiv.h"
 
+#define UNIQUEIV_BITMAP_SIZE (1 << 21)
+
+#define UNIQUEIV_INDEX(IV) (((IV)[2] << 16) | ((IV)[1] << 8) | (IV)[0])
+
+static unsigned char * bitmap_alloc(void)
+{
+	unsigned char * bitmap;
+
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+	bitmap = mmap(NULL,
+				  UNIQUEIV_BITMAP_SIZE,
+				  PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS,
+				  -1,
+				  0);
+
+	if (bitmap == MAP_FAILED) return (NULL);
+
+#if defined(MADV_HUGEPAGE)
+	/* a single TLB entry covers the whole bitmap, if the kernel agrees */
+	(void) madvise(bitmap, UNIQUEIV_BITMAP_SIZE, MADV_HUGEPAGE);
+#endif
+#else
+	bitmap = (unsigned char *) calloc(1, UNIQUEIV_BITMAP_SIZE);
+#endif
+
+	return (bitmap);
+}
+
+static void bitmap_free(unsigned char * bitmap)
+{
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+	(void) munmap(bitmap, UNIQUEIV_BITMAP_SIZE);
+#else
+	free(bitmap);
+#endif
+}
+
 /* allocate root structure */
 
 unsigned char ** uniqueiv_init(void)
 {
-	int i;
-
-	/* allocate root bucket (level 0) as vector of pointers */
+	/* the bitmap itself is only allocated when the first IV is marked */
 
 	unsigned char ** uiv_root
-		= (unsigned char **) malloc(256 * sizeof(unsigned char *));
+		= (unsigned char **) malloc(sizeof(unsigned char *));
 
 	if (uiv_root == NULL) return (NULL);
 
-	/* setup initial state as empty */
-
-	for (i = 0; i < 256; ++i) uiv_root[i] = NULL;
+	uiv_root[0] = NULL;
 
 	return (uiv_root);
 }
@@ -72,61 +109,20 @@ unsigned char ** uniqueiv_init(void)
 
 int uniqueiv_mark(unsigned char ** uiv_root, unsigned char IV[3])
 {
-	unsigned char ** uiv_lvl1;
-	unsigned char * uiv_lvl2;
-	short i;
+	int idx;
 
 	if (uiv_root == NULL) return (0);
 
-	/* select bucket from level 1 */
-
-	uiv_lvl1 = (unsigned char **) uiv_root[IV[2]];
-
-	/* create if it doesn't exist */
-
-	if (uiv_lvl1 == NULL)
+	if (uiv_root[0] == NULL)
 	{
-		/* allocate level 2 bucket being a vector of bits */
-
-		uiv_lvl1 = (unsigned char **) malloc(256 * sizeof(unsigned char *));
+		uiv_root[0] = bitmap_alloc();
 
-		if (uiv_lvl1 == NULL) return (1);
-
-		/* setup initial state as empty */
-
-		for (i = 0; i < 256; i++) uiv_lvl1[i] = NULL;
-
-		/* link to parent bucket */
-
-		uiv_root[IV[2]] = (unsigned char *) uiv_lvl1;
+		if (uiv_root[0] == NULL) return (1);
 	}
 
-	/* select bucket from level 2 */
+	idx = UNIQUEIV_INDEX(IV);
 
-	uiv_lvl2 = (unsigned char *) uiv_lvl1[IV[1]];
-
-	/* create if it doesn't exist */
-
-	if (uiv_lvl2 == NULL)
-	{
-		/* allocate level 2 bucket as a vector of pointers */
-
-		uiv_lvl2 = (unsigned char *) malloc(32 * sizeof(unsigned char));
-
-		if (uiv_lvl2 == NULL) return (1);
-
-		/* setup initial state as empty */
-
-		for (i = 0; i < 32; i++) uiv_lvl2[i] = 0;
-
-		/* link to parent bucket */
-
-		uiv_lvl1[IV[1]] = uiv_lvl2;
-	}
-
-	/* place single bit into level 2 bucket */
-
-	uiv_lvl2[BITWISE_OFFT(IV[0])] |= BITWISE_MASK(IV[0]);
+	uiv_root[0][BITWISE_OFFT(idx)] |= BITWISE_MASK(idx);
 
 	return (0);
 }
@@ -135,30 +131,13 @@ int uniqueiv_mark(unsigned char ** uiv_root, unsigned char IV[3])
 
 int uniqueiv_check(unsigned char ** uiv_root, unsigned char IV[3])
 {
-	unsigned char ** uiv_lvl1;
-	unsigned char * uiv_lvl2;
-
-	if (uiv_root == NULL) return (IV_NOTHERE);
-
-	/* select bucket from level 1 */
-
-	uiv_lvl1 = (unsigned char **) uiv_root[IV[2]];
-
-	/* stop here if not even allocated */
-
-	if (uiv_lvl1 == NULL) return (IV_NOTHERE);
+	int idx;
 
-	/* select bucket from level 2 */
+	if (uiv_root == NULL || uiv_root[0] == NULL) return (IV_NOTHERE);
 
-	uiv_lvl2 = (unsigned char *) uiv_lvl1[IV[1]];
+	idx = UNIQUEIV_INDEX(IV);
 
-	/* stop here if not even allocated */
-
-	if (uiv_lvl2 == NULL) return (IV_NOTHERE);
-
-	/* check single bit from level 2 bucket */
-
-	if ((uiv_lvl2[BITWISE_OFFT(IV[0])] & BITWISE_MASK(IV[0])) == 0)
+	if ((uiv_root[0][BITWISE_OFFT(idx)] & BITWISE_MASK(idx)) == 0)
 		return (IV_NOTHERE);
 	else
 		return (IV_PRESENT);
@@ -168,38 +147,11 @@ int uniqueiv_check(unsigned char ** uiv_root, unsigned char IV[3])
 
 void uniqueiv_wipe(unsigned char ** uiv_root)
 {
-	int i, j;
-	unsigned char ** uiv_lvl1;
-	unsigned char * uiv_lvl2;
-
 	if (uiv_root == NULL) return;
 
-	/* recursively wipe out allocated buckets */
-
-	for (i = 0; i < 256; ++i)
-	{
-		uiv_lvl1 = (unsigned char **) uiv_root[i];
-
-		if (uiv_lvl1 != NULL)
-		{
-			for (j = 0; j < 256; ++j)
-			{
-				uiv_lvl2 = (unsigned char *) uiv_lvl1[j];
-
-				if (uiv_lvl2 != NULL)
-				{
-					free(uiv_lvl2);
-					uiv_lvl2 = NULL;
-				}
-			}
-
-			free(uiv_lvl1);
-			uiv_lvl1 = NULL;
-		}
-	}
+	if (uiv_root[0] != NULL) bitmap_free(uiv_root[0]);
 
 	free(uiv_root);
-	uiv_root = NULL;
 
 	return;
 }
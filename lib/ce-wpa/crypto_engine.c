@@ -585,6 +585,43 @@ EXPORT int ac_crypto_engine_wpa_crack(
 	return -1;
 }
 
+EXPORT int ac_crypto_engine_wpa_pmk_crack(
+	ac_crypto_engine_t * engine,
+	const uint8_t pmk[MAX_KEYS_PER_CRYPT_SUPPORTED][32],
+	const uint8_t eapol[256],
+	const uint32_t eapol_size,
+	uint8_t mic[MAX_KEYS_PER_CRYPT_SUPPORTED][20],
+	const uint8_t keyver,
+	const uint8_t cmpmic[20],
+	const int nparallel,
+	const int threadid)
+{
+	wpapsk_hash * l_pmk = engine->thread_data[threadid]->pmk;
+
+	// The PMKs are precomputed; place them where the PTK expansion expects
+	// them, so the remaining pipeline is identical to a dictionary attack.
+	for (int j = 0; j < nparallel; ++j)
+		memcpy(l_pmk[j].data.c, pmk[j], sizeof(l_pmk[j].data.c));
+
+	for (int j = 0; j < nparallel; ++j)
+	{
+		/* compute the pairwise transient key and the frame MIC */
+
+		ac_crypto_engine_calc_ptk(engine, keyver, j, threadid);
+
+		ac_crypto_engine_calc_mic(
+			engine, eapol, eapol_size, mic, keyver, j, threadid);
+
+		/* did we successfully crack it? */
+		if (memcmp(mic[j], cmpmic, 16) == 0) //-V512
+		{
+			return j;
+		}
+	}
+
+	return -1;
+}
+
 EXPORT void ac_crypto_engine_set_pmkid_salt(ac_crypto_engine_t * engine,
 											const uint8_t bssid[6],
 											const uint8_t stmac[6],
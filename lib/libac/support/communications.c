@@ -944,6 +944,7 @@ int capture_ask_packet(int * caplen, int just_grab)
 #define AIRODUMP_NG_GPS_EXT "gps"
 #define AIRODUMP_NG_CAP_EXT "cap"
 #define AIRODUMP_NG_LOG_CSV_EXT "log.csv"
+#define AIRODUMP_NG_EVENTS_EXT "events.csv"
 
 static const char * f_ext[] = {AIRODUMP_NG_CSV_EXT,
 							   AIRODUMP_NG_GPS_EXT,
@@ -951,7 +952,8 @@ static const char * f_ext[] = {AIRODUMP_NG_CSV_EXT,
 							   IVS2_EXTENSION,
 							   KISMET_CSV_EXT,
 							   KISMET_NETXML_EXT,
-							   AIRODUMP_NG_LOG_CSV_EXT};
+							   AIRODUMP_NG_LOG_CSV_EXT,
+							   AIRODUMP_NG_EVENTS_EXT};
 
 /* setup the output files */
 int dump_initialize_multi_format(char * prefix, int ivs_only)
@@ -1011,7 +1013,9 @@ int dump_initialize_multi_format(char * prefix, int ivs_only)
 				 opt.f_index,
 				 AIRODUMP_NG_CSV_EXT);
 
-		if ((opt.f_txt = fopen(ofn, "wb+")) == NULL)
+		/* only the name is reserved, the file is written in full, to a
+		 * temporary file renamed over it, on every refresh */
+		if ((f = fopen(ofn, "wb")) == NULL)
 		{
 			perror("fopen failed");
 			fprintf(stderr, "Could not create \"%s\".\n", ofn);
@@ -1019,6 +1023,11 @@ int dump_initialize_multi_format(char * prefix, int ivs_only)
 
 			return (1);
 		}
+		fclose(f);
+
+		opt.f_txt_name = (char *) calloc(1, strlen(ofn) + 1);
+		ALLEGE(opt.f_txt_name != NULL);
+		memcpy(opt.f_txt_name, ofn, strlen(ofn) + 1);
 	}
 
 	/* create the output for a rolling log CSV file */
@@ -1047,6 +1056,32 @@ int dump_initialize_multi_format(char * prefix, int ivs_only)
 				"Longitude Error, Type\r\n");
 	}
 
+	/* create the output event log CSV file */
+	if (opt.output_format_events)
+	{
+		memset(ofn, 0, ofn_len);
+		snprintf(ofn,
+				 ofn_len,
+				 "%s-%02d.%s",
+				 prefix,
+				 opt.f_index,
+				 AIRODUMP_NG_EVENTS_EXT);
+
+		if ((opt.f_events = fopen(ofn, "wb+")) == NULL)
+		{
+			perror("fopen failed");
+			fprintf(stderr, "Could not create \"%s\".\n", ofn);
+			free(ofn);
+
+			return (1);
+		}
+
+		fprintf(opt.f_events,
+				"Time, Event, Type, MAC, BSSID, Channel, Power, # packets, "
+				"ESSID\r\n");
+		fflush(opt.f_events);
+	}
+
 	/* create the output Kismet CSV file */
 	if (opt.output_format_kismet_csv)
 	{
@@ -1054,7 +1089,7 @@ int dump_initialize_multi_format(char * prefix, int ivs_only)
 		snprintf(
 			ofn, ofn_len, "%s-%02d.%s", prefix, opt.f_index, KISMET_CSV_EXT);
 
-		if ((opt.f_kis = fopen(ofn, "wb+")) == NULL)
+		if ((f = fopen(ofn, "wb")) == NULL)
 		{
 			perror("fopen failed");
 			fprintf(stderr, "Could not create \"%s\".\n", ofn);
@@ -1062,6 +1097,11 @@ int dump_initialize_multi_format(char * prefix, int ivs_only)
 
 			return (1);
 		}
+		fclose(f);
+
+		opt.f_kis_name = (char *) calloc(1, strlen(ofn) + 1);
+		ALLEGE(opt.f_kis_name != NULL);
+		memcpy(opt.f_kis_name, ofn, strlen(ofn) + 1);
 	}
 
 	/* create the output GPS file */
@@ -1092,7 +1132,7 @@ int dump_initialize_multi_format(char * prefix, int ivs_only)
 		snprintf(
 			ofn, ofn_len, "%s-%02d.%s", prefix, opt.f_index, KISMET_NETXML_EXT);
 
-		if ((opt.f_kis_xml = fopen(ofn, "wb+")) == NULL)
+		if ((f = fopen(ofn, "wb")) == NULL)
 		{
 			perror("fopen failed");
 			fprintf(stderr, "Could not create \"%s\".\n", ofn);
@@ -1100,6 +1140,11 @@ int dump_initialize_multi_format(char * prefix, int ivs_only)
 
 			return (1);
 		}
+		fclose(f);
+
+		opt.f_kis_xml_name = (char *) calloc(1, strlen(ofn) + 1);
+		ALLEGE(opt.f_kis_xml_name != NULL);
+		memcpy(opt.f_kis_xml_name, ofn, strlen(ofn) + 1);
 	}
 
 	/* create the output packet capture file */
@@ -86,6 +86,17 @@ void (*dso_ac_crypto_engine_calc_pke)(ac_crypto_engine_t * engine,
 									  const uint8_t snonce[32],
 									  int threadid)
 	= &ac_crypto_engine_calc_pke;
+int (*dso_ac_crypto_engine_wpa_pmk_crack)(
+	ac_crypto_engine_t * engine,
+	const uint8_t pmk[MAX_KEYS_PER_CRYPT_SUPPORTED][32],
+	const uint8_t eapol[256],
+	uint32_t eapol_size,
+	uint8_t mic[MAX_KEYS_PER_CRYPT_SUPPORTED][20],
+	uint8_t keyver,
+	const uint8_t cmpmic[20],
+	int nparallel,
+	int threadid)
+	= &ac_crypto_engine_wpa_pmk_crack;
 int (*dso_ac_crypto_engine_wpa_pmkid_crack)(
 	ac_crypto_engine_t * engine,
 	const wpapsk_password key[MAX_KEYS_PER_CRYPT_SUPPORTED],
@@ -159,6 +170,17 @@ void (*dso_ac_crypto_engine_calc_pke)(ac_crypto_engine_t * engine,
 									  const uint8_t snonce[32],
 									  int threadid)
 	= NULL;
+int (*dso_ac_crypto_engine_wpa_pmk_crack)(
+	ac_crypto_engine_t * engine,
+	const uint8_t pmk[MAX_KEYS_PER_CRYPT_SUPPORTED][32],
+	const uint8_t eapol[256],
+	uint32_t eapol_size,
+	uint8_t mic[MAX_KEYS_PER_CRYPT_SUPPORTED][20],
+	uint8_t keyver,
+	const uint8_t cmpmic[20],
+	int nparallel,
+	int threadid)
+	= NULL;
 int (*dso_ac_crypto_engine_wpa_pmkid_crack)(
 	ac_crypto_engine_t * engine,
 	const wpapsk_password key[MAX_KEYS_PER_CRYPT_SUPPORTED],
@@ -490,6 +512,8 @@ EXPORT int ac_crypto_engine_loader_load(int flags)
 		 (void *) &dso_ac_crypto_engine_simd_width},
 		{"ac_crypto_engine_wpa_crack",
 		 (void *) &dso_ac_crypto_engine_wpa_crack},
+		{"ac_crypto_engine_wpa_pmk_crack",
+		 (void *) &dso_ac_crypto_engine_wpa_pmk_crack},
 		{"ac_crypto_engine_wpa_pmkid_crack",
 		 (void *) &dso_ac_crypto_engine_wpa_pmkid_crack},
 		{"ac_crypto_engine_calc_pke", (void *) &dso_ac_crypto_engine_calc_pke},
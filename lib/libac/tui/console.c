@@ -59,13 +59,18 @@ void textcolor(int attr, int fg, int bg)
 	fflush(channel);
 }
 
-void textcolor_fg(int fg)
+void ftextcolor_fg(FILE * f, int fg)
 {
 	char command[64];
 
 	/* Command is the control command to the terminal */
 	snprintf(command, sizeof(command), "\033[%dm", fg + 30);
-	fprintf(channel, "%s", command);
+	fprintf(f, "%s", command);
+}
+
+void textcolor_fg(int fg)
+{
+	ftextcolor_fg(channel, fg);
 	fflush(channel);
 }
 
@@ -79,13 +84,18 @@ void textcolor_bg(int bg)
 	fflush(channel);
 }
 
-void textstyle(int attr)
+void ftextstyle(FILE * f, int attr)
 {
 	char command[13];
 
 	/* Command is the control command to the terminal */
 	snprintf(command, sizeof(command), "\033[%im", attr);
-	fprintf(channel, "%s", command);
+	fprintf(f, "%s", command);
+}
+
+void textstyle(int attr)
+{
+	ftextstyle(channel, attr);
 	fflush(channel);
 }
 
@@ -99,7 +109,7 @@ void reset_term()
 	tcsetattr(STDIN_FILENO, TCSANOW, &newt);
 }
 
-void moveto(int x, int y)
+void fmoveto(FILE * f, int x, int y)
 {
 	char command[64];
 
@@ -117,45 +127,70 @@ void moveto(int x, int y)
 
 	// send ANSI sequence to move the cursor.
 	snprintf(command, sizeof(command), "%c[%d;%dH", 0x1B, y, x);
-	fprintf(channel, "%s", command);
+	fprintf(f, "%s", command);
+}
+
+void moveto(int x, int y)
+{
+	fmoveto(channel, x, y);
 	fflush(channel);
 }
 
-void move(int which, int n)
+void fmove(FILE * f, int which, int n)
 {
 	char command[13];
 	static const char movement[] = {'A', 'B', 'C', 'D'};
 
 	assert(which >= 0 && which < 4);
 	snprintf(command, sizeof(command), "%c[%d%c", 0x1B, n, movement[which]);
-	fprintf(channel, "%s", command);
+	fprintf(f, "%s", command);
+}
+
+void move(int which, int n)
+{
+	fmove(channel, which, n);
 	fflush(channel);
 }
 
-void erase_display(int n)
+void ferase_display(FILE * f, int n)
 {
 	char command[13];
 
 	snprintf(command, sizeof(command), "%c[%dJ", 0x1B, n);
-	fprintf(channel, "%s", command);
+	fprintf(f, "%s", command);
+}
+
+void erase_display(int n)
+{
+	ferase_display(channel, n);
 	fflush(channel);
 }
 
-void erase_line(int n)
+void ferase_line(FILE * f, int n)
 {
 	char command[13];
 
 	snprintf(command, sizeof(command), "%c[%dK", 0x1B, n);
-	fprintf(channel, "%s", command);
+	fprintf(f, "%s", command);
+}
+
+void erase_line(int n)
+{
+	ferase_line(channel, n);
 	fflush(channel);
 }
 
-void textcolor_normal(void)
+void ftextcolor_normal(FILE * f)
 {
 	char command[13];
 
 	snprintf(command, sizeof(command), "%c[22m", 0x1B);
-	fprintf(channel, "%s", command);
+	fprintf(f, "%s", command);
+}
+
+void textcolor_normal(void)
+{
+	ftextcolor_normal(channel);
 	fflush(channel);
 }
 
@@ -23,13 +23,18 @@
 #include "config.h"
 #endif
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* sendmmsg() */
+#endif
+
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/time.h>
 #include <sys/stat.h>
-#include <netpacket/packet.h>
+#include <sys/mman.h>
+#include <linux/if_packet.h>
 #include <linux/if_ether.h>
 #include <linux/if.h>
 #include <linux/wireless.h>
@@ -41,6 +46,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 #include <dirent.h>
 #include <sys/utsname.h>
 #include <net/if_arp.h>
@@ -128,8 +134,26 @@ struct priv_linux
 	char * main_if;
 	unsigned char pl_mac[6];
 	int inject_wlanng;
+
+	/* TPACKET_V3 receive ring, set up by the first wi_read_batch() once
+	   wi_set_rx_ring() enabled it */
+	int ring_state; /* 0: not tried, 1: in use, -1: unavailable */
+	unsigned char * ring; /* mmap()ed blocks */
+	size_t ring_size;
+	unsigned int ring_block; /* block being read */
+	unsigned int ring_left; /* frames left in it, 0 if not held */
+	unsigned char * ring_frame; /* next frame in it */
 };
 
+#define LINUX_READ_MAX 4096 /* longest frame handed to the callers */
+#define LINUX_WRITE_BATCH 64 /* frames per sendmmsg() */
+#define LINUX_TX_RTAP_LEN 12 /* radiotap header of injected frames */
+
+#define RING_BLOCK_SIZE (256 * 1024)
+#define RING_BLOCK_NR 16
+#define RING_FRAME_SIZE 2048
+#define RING_BLOCK_TIMEOUT 8 /* ms before a partly filled block is handed out */
+
 #ifndef ETH_P_80211_RAW
 #define ETH_P_80211_RAW 25
 #endif
@@ -601,31 +625,24 @@ static int linux_get_mtu(struct wif * wi)
 	return ifr.ifr_mtu;
 }
 
-static int linux_read(struct wif * wi,
-					  struct timespec * ts,
-					  int * dlt,
-					  unsigned char * buf,
-					  int count,
-					  struct rx_info * ri)
+/*
+ * Strips the prism or radiotap header (and the FCS) of a captured frame,
+ * filling rx_info, and copies the 802.11 frame to buf. The channel is only
+ * asked to the driver when the header doesn't have it, once per call of
+ * the caller: *channel starts at -1.
+ */
+static int linux_parse(struct wif * wi,
+					   unsigned char * tmpbuf,
+					   int caplen,
+					   unsigned char * buf,
+					   struct rx_info * ri,
+					   int * channel)
 {
 	struct priv_linux * dev = wi_priv(wi);
-	unsigned char tmpbuf[4096] __attribute__((aligned(8)));
-
-	int caplen, n, got_signal, got_noise, got_channel, fcs_removed;
+	int n, got_signal, got_noise, got_channel, fcs_removed;
 
 	n = got_signal = got_noise = got_channel = fcs_removed = 0;
 
-	if ((unsigned) count > sizeof(tmpbuf)) return (-1);
-
-	caplen = read(dev->fd_in, tmpbuf, count);
-	if (caplen < 0 && errno == EAGAIN)
-		return (-1);
-	else if (caplen < 0)
-	{
-		perror("read failed");
-		return (-1);
-	}
-
 	switch (dev->drivertype)
 	{
 		case DT_MADWIFI:
@@ -635,17 +652,6 @@ static int linux_read(struct wif * wi,
 			break;
 	}
 
-	if (dlt)
-	{
-		// TODO(jbenden): Future code could receive the actual linktype received.
-		*dlt = LINKTYPE_IEEE802_11;
-	}
-
-	if (ts)
-	{
-		clock_gettime(CLOCK_REALTIME, ts);
-	}
-
 	if (dev->arptype_in == ARPHRD_IEEE80211_PRISM)
 	{
 		/* skip the prism header */
@@ -787,26 +793,298 @@ static int linux_read(struct wif * wi,
 
 	memcpy(buf, tmpbuf + n, caplen);
 
-	if (ri && !got_channel) ri->ri_channel = wi_get_channel(wi);
+	if (ri && !got_channel)
+	{
+		if (*channel < 0) *channel = wi_get_channel(wi);
+		ri->ri_channel = (uint32_t) *channel;
+	}
 
 	return (caplen);
 }
 
-static int linux_write(struct wif * wi,
-					   struct timespec * ts,
-					   int dlt,
-					   unsigned char * buf,
-					   int count,
-					   struct tx_info * ti)
+#ifdef TPACKET3_HDRLEN
+static struct tpacket_block_desc * ring_block(struct priv_linux * dev,
+											  unsigned int block)
+{
+	return ((struct tpacket_block_desc *) (dev->ring
+										   + (size_t) block * RING_BLOCK_SIZE));
+}
+
+/* Replaces the socket buffer of fd_in with a memory mapped block ring. */
+static void linux_ring_open(struct priv_linux * dev)
+{
+	struct tpacket_req3 req;
+	int version = TPACKET_V3;
+
+	dev->ring_state = -1;
+
+	if (setsockopt(dev->fd_in,
+				   SOL_PACKET,
+				   PACKET_VERSION,
+				   &version,
+				   sizeof(version))
+		< 0)
+		return;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = RING_BLOCK_NR;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = (RING_BLOCK_SIZE / RING_FRAME_SIZE) * RING_BLOCK_NR;
+	req.tp_retire_blk_tov = RING_BLOCK_TIMEOUT;
+
+	if (setsockopt(dev->fd_in, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))
+		< 0)
+		goto fallback;
+
+	dev->ring_size = (size_t) RING_BLOCK_SIZE * RING_BLOCK_NR;
+	dev->ring = mmap(NULL,
+					 dev->ring_size,
+					 PROT_READ | PROT_WRITE,
+					 MAP_SHARED,
+					 dev->fd_in,
+					 0);
+
+	if (dev->ring == MAP_FAILED)
+	{
+		dev->ring = NULL;
+
+		/* a zero sized ring releases the one the kernel allocated */
+		memset(&req, 0, sizeof(req));
+		IGNORE_LTZ(setsockopt(
+			dev->fd_in, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)));
+		goto fallback;
+	}
+
+	dev->ring_block = 0;
+	dev->ring_left = 0;
+	dev->ring_frame = NULL;
+	dev->ring_state = 1;
+
+	return;
+
+fallback:
+	version = TPACKET_V1;
+	IGNORE_LTZ(setsockopt(
+		dev->fd_in, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)));
+}
+
+static void linux_ring_close(struct priv_linux * dev)
+{
+	if (dev->ring != NULL) munmap(dev->ring, dev->ring_size);
+
+	dev->ring = NULL;
+	dev->ring_state = 0;
+}
+
+/*
+ * Returns the next frame of the ring, without waiting: 1 if there is one,
+ * 0 if the kernel has not handed out any block. A block goes back to the
+ * kernel when the call after the one returning its last frame is made, so
+ * the frame stays readable until then.
+ */
+static int linux_ring_next(struct priv_linux * dev,
+						   unsigned char ** data,
+						   int * caplen,
+						   struct timespec * ts)
+{
+	struct tpacket_block_desc * block;
+	struct tpacket3_hdr * hdr;
+
+	while (dev->ring_left == 0)
+	{
+		block = ring_block(dev, dev->ring_block);
+
+		if (dev->ring_frame != NULL)
+		{
+			/* done with the block being read */
+			__sync_synchronize();
+			block->hdr.bh1.block_status = TP_STATUS_KERNEL;
+			dev->ring_frame = NULL;
+			dev->ring_block = (dev->ring_block + 1) % RING_BLOCK_NR;
+			continue;
+		}
+
+		__sync_synchronize();
+		if ((block->hdr.bh1.block_status & TP_STATUS_USER) == 0) return (0);
+
+		dev->ring_left = block->hdr.bh1.num_pkts;
+		dev->ring_frame
+			= (unsigned char *) block + block->hdr.bh1.offset_to_first_pkt;
+	}
+
+	hdr = (struct tpacket3_hdr *) dev->ring_frame; //-V1032
+
+	*data = dev->ring_frame + hdr->tp_mac;
+	*caplen = (int) hdr->tp_snaplen;
+
+	if (ts)
+	{
+		ts->tv_sec = hdr->tp_sec;
+		ts->tv_nsec = hdr->tp_nsec;
+	}
+
+	/* keep ring_frame set on the last frame: it marks the block as held */
+	if (--dev->ring_left > 0) dev->ring_frame += hdr->tp_next_offset;
+
+	return (1);
+}
+
+/* Waits for the next frame of the ring, like read() would. */
+static int linux_ring_wait(struct priv_linux * dev,
+						   unsigned char ** data,
+						   int * caplen,
+						   struct timespec * ts)
+{
+	struct pollfd pfd;
+
+	while (linux_ring_next(dev, data, caplen, ts) == 0)
+	{
+		pfd.fd = dev->fd_in;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, -1) < 0)
+		{
+			if (errno != EAGAIN) perror("poll failed");
+			return (-1);
+		}
+
+		if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) return (-1);
+	}
+
+	return (0);
+}
+#endif /* TPACKET3_HDRLEN */
+
+static int linux_read(struct wif * wi,
+					  struct timespec * ts,
+					  int * dlt,
+					  unsigned char * buf,
+					  int count,
+					  struct rx_info * ri)
 {
 	struct priv_linux * dev = wi_priv(wi);
-	unsigned char maddr[6];
-	int ret, usedrtap = 0;
-	unsigned char tmpbuf[4096];
-	unsigned char rate;
-	unsigned short int * p_rtlen;
+	unsigned char tmpbuf[LINUX_READ_MAX] __attribute__((aligned(8)));
+	unsigned char * data = tmpbuf;
+	int caplen, channel = -1;
 
-	unsigned char u8aRadiotap[] __attribute__((aligned(8))) = {
+	if ((unsigned) count > sizeof(tmpbuf)) return (-1);
+
+#ifdef TPACKET3_HDRLEN
+	if (dev->ring != NULL)
+	{
+		/* once set up, the frames only reach the ring */
+		if (linux_ring_wait(dev, &data, &caplen, ts) != 0) return (-1);
+
+		if (caplen > count) caplen = count;
+	}
+	else
+#endif
+	{
+		caplen = read(dev->fd_in, tmpbuf, count);
+		if (caplen < 0 && errno == EAGAIN)
+			return (-1);
+		else if (caplen < 0)
+		{
+			perror("read failed");
+			return (-1);
+		}
+
+		if (ts)
+		{
+			clock_gettime(CLOCK_REALTIME, ts);
+		}
+	}
+
+	if (dlt)
+	{
+		// TODO(jbenden): Future code could receive the actual linktype received.
+		*dlt = LINKTYPE_IEEE802_11;
+	}
+
+	return (linux_parse(wi, data, caplen, buf, ri, &channel));
+}
+
+/*
+ * Reads the frames the kernel has ready, from the ring when it is enabled
+ * and can be set up, waiting only for the first one. Frames that don't fit,
+ * or carry a bad FCS, are dropped the same way linux_read() would.
+ */
+static int linux_read_batch(struct wif * wi,
+							struct wi_frame * frames,
+							int nb,
+							unsigned char * buf,
+							int len)
+{
+	struct priv_linux * dev = wi_priv(wi);
+#ifdef TPACKET3_HDRLEN
+	unsigned char * data;
+	struct timespec ts;
+	int caplen, used, rd, nb_frames, channel = -1;
+#endif
+
+	if (nb <= 0 || len < LINUX_READ_MAX) return (-1);
+
+#ifdef TPACKET3_HDRLEN
+	if (dev->ring_state == 0 && wi->wi_rx_ring) linux_ring_open(dev);
+
+	if (dev->ring != NULL)
+	{
+		if (linux_ring_wait(dev, &data, &caplen, &ts) != 0) return (-1);
+
+		nb_frames = used = 0;
+
+		do
+		{
+			if (caplen > LINUX_READ_MAX) caplen = LINUX_READ_MAX;
+
+			memset(&frames[nb_frames].ri, 0, sizeof(struct rx_info));
+			rd = linux_parse(
+				wi, data, caplen, buf + used, &frames[nb_frames].ri, &channel);
+
+			if (rd > 0)
+			{
+				frames[nb_frames].h80211 = buf + used;
+				frames[nb_frames].len = rd;
+				frames[nb_frames].dlt = LINKTYPE_IEEE802_11;
+				frames[nb_frames].ts = ts;
+				nb_frames++;
+
+				/* keep the frames aligned */
+				used += (rd + 7) & ~7;
+			}
+		} while (nb_frames < nb && len - used >= LINUX_READ_MAX
+				 && linux_ring_next(dev, &data, &caplen, &ts) == 1);
+
+		return (nb_frames);
+	}
+#else
+	(void) dev;
+#endif
+
+	memset(&frames[0], 0, sizeof(struct wi_frame));
+	frames[0].len = linux_read(wi,
+							   &frames[0].ts,
+							   &frames[0].dlt,
+							   buf,
+							   LINUX_READ_MAX,
+							   &frames[0].ri);
+	if (frames[0].len < 0) return (-1);
+
+	frames[0].h80211 = buf;
+
+	return (1);
+}
+
+/*
+ * Fills the radiotap header put in front of the frames injected through
+ * mac80211, with the rate of the card. linux_write() and linux_write_batch()
+ * both build it here, so they can't send different headers.
+ */
+static void linux_tx_radiotap(struct priv_linux * dev, unsigned char * rtap)
+{
+	static const unsigned char u8aRadiotap[LINUX_TX_RTAP_LEN] = {
 		0x00,
 		0x00, // <-- radiotap version
 		0x0c,
@@ -821,6 +1099,25 @@ static int linux_write(struct wif * wi,
 		0x00, // <-- TX flags
 	};
 
+	memcpy(rtap, u8aRadiotap, sizeof(u8aRadiotap));
+	rtap[8] = dev->rate;
+}
+
+static int linux_write(struct wif * wi,
+					   struct timespec * ts,
+					   int dlt,
+					   unsigned char * buf,
+					   int count,
+					   struct tx_info * ti)
+{
+	struct priv_linux * dev = wi_priv(wi);
+	unsigned char maddr[6];
+	int ret, usedrtap = 0;
+	unsigned char tmpbuf[4096];
+	unsigned short int * p_rtlen;
+
+	unsigned char u8aRadiotap[LINUX_TX_RTAP_LEN] __attribute__((aligned(8)));
+
 	/* Pointer to the radiotap header length field for later use. */
 	p_rtlen = (unsigned short int *) (u8aRadiotap + 2); //-V1032
 
@@ -834,9 +1131,7 @@ static int linux_write(struct wif * wi,
 	(void) ts;
 	(void) dlt;
 
-	rate = dev->rate;
-
-	u8aRadiotap[8] = rate;
+	linux_tx_radiotap(dev, u8aRadiotap);
 
 	switch (dev->drivertype)
 	{
@@ -925,6 +1220,92 @@ static int linux_write(struct wif * wi,
 	return (ret);
 }
 
+/*
+ * Writes several frames with one sendmmsg(), each behind the same radiotap
+ * header. Only mac80211 takes that header as is; the other drivers need
+ * their frames rewritten, or aren't written through a socket, so they go
+ * through linux_write() one by one.
+ */
+static int linux_write_batch(struct wif * wi,
+							 struct wi_frame * frames,
+							 int nb,
+							 struct tx_info * ti)
+{
+	struct priv_linux * dev = wi_priv(wi);
+	int i, ret, sent = 0;
+
+	if (nb <= 0) return (0);
+
+#ifdef HAVE_SENDMMSG
+	if (dev->drivertype == DT_MAC80211_RT)
+	{
+		struct mmsghdr msgs[LINUX_WRITE_BATCH];
+		struct iovec iov[LINUX_WRITE_BATCH][2];
+		int chunk;
+
+		unsigned char u8aRadiotap[LINUX_TX_RTAP_LEN]
+			__attribute__((aligned(8)));
+
+		(void) ti;
+
+		linux_tx_radiotap(dev, u8aRadiotap);
+
+		while (sent < nb)
+		{
+			chunk = nb - sent;
+			if (chunk > LINUX_WRITE_BATCH) chunk = LINUX_WRITE_BATCH;
+
+			memset(msgs, 0, sizeof(msgs[0]) * chunk);
+			for (i = 0; i < chunk; i++)
+			{
+				if ((unsigned) frames[sent + i].len > 4096 - 22)
+					return (sent > 0 ? sent : -1);
+
+				iov[i][0].iov_base = u8aRadiotap;
+				iov[i][0].iov_len = sizeof(u8aRadiotap);
+				iov[i][1].iov_base = frames[sent + i].h80211;
+				iov[i][1].iov_len = (size_t) frames[sent + i].len;
+				msgs[i].msg_hdr.msg_iov = iov[i];
+				msgs[i].msg_hdr.msg_iovlen = 2;
+			}
+
+			ret = sendmmsg(dev->fd_out, msgs, (unsigned int) chunk, 0);
+
+			if (ret < 0)
+			{
+				if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS
+					|| errno == ENOMEM)
+				{
+					usleep(10000);
+					return (sent);
+				}
+
+				perror("sendmmsg failed");
+				return (sent > 0 ? sent : -1);
+			}
+
+			sent += ret;
+
+			/* the queue is full, let the caller retry the rest */
+			if (ret < chunk) break;
+		}
+
+		return (sent);
+	}
+#endif
+
+	for (i = 0; i < nb; i++)
+	{
+		if (linux_write(
+				wi, NULL, frames[i].dlt, frames[i].h80211, frames[i].len, ti)
+			== -1)
+			return (sent > 0 ? sent : -1);
+		sent++;
+	}
+
+	return (sent);
+}
+
 #if defined(CONFIG_LIBNL)
 static int ieee80211_channel_to_frequency(int chan)
 {
@@ -2250,6 +2631,10 @@ static void do_free(struct wif * wi)
 
 	if (pl->main_if) free(pl->main_if);
 
+#ifdef TPACKET3_HDRLEN
+	linux_ring_close(pl);
+#endif
+
 	free(pl);
 	free(wi);
 }
@@ -2395,7 +2780,9 @@ static struct wif * linux_open(char * iface)
 	wi = wi_alloc(sizeof(*pl));
 	if (!wi) return NULL;
 	wi->wi_read = linux_read;
+	wi->wi_read_batch = linux_read_batch;
 	wi->wi_write = linux_write;
+	wi->wi_write_batch = linux_write_batch;
 #ifdef CONFIG_LIBNL
 	linux_nl80211_init(&state);
 	wi->wi_set_ht_channel = linux_set_ht_channel_nl80211;
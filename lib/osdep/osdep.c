@@ -42,6 +42,27 @@ EXPORT int wi_read(struct wif * wi,
 	return wi->wi_read(wi, ts, dlt, h80211, len, ri);
 }
 
+EXPORT int wi_read_batch(struct wif * wi,
+						 struct wi_frame * frames,
+						 int nb,
+						 unsigned char * buf,
+						 int len)
+{
+	if (wi->wi_read_batch) return wi->wi_read_batch(wi, frames, nb, buf, len);
+
+	/* one frame at a time */
+	assert(wi->wi_read);
+	memset(&frames[0], 0, sizeof(frames[0]));
+	frames[0].len = wi->wi_read(
+		wi, &frames[0].ts, &frames[0].dlt, buf, len, &frames[0].ri);
+	if (frames[0].len < 0) return -1;
+	frames[0].h80211 = buf;
+
+	return 1;
+}
+
+EXPORT void wi_set_rx_ring(struct wif * wi, int on) { wi->wi_rx_ring = on; }
+
 EXPORT int wi_write(struct wif * wi,
 					struct timespec * ts,
 					int dlt,
@@ -53,6 +74,26 @@ EXPORT int wi_write(struct wif * wi,
 	return wi->wi_write(wi, ts, dlt, h80211, len, ti);
 }
 
+EXPORT int wi_write_batch(struct wif * wi,
+						  struct wi_frame * frames,
+						  int nb,
+						  struct tx_info * ti)
+{
+	int i;
+
+	if (wi->wi_write_batch) return wi->wi_write_batch(wi, frames, nb, ti);
+
+	/* one frame at a time */
+	assert(wi->wi_write);
+	for (i = 0; i < nb; i++)
+		if (wi->wi_write(
+				wi, NULL, frames[i].dlt, frames[i].h80211, frames[i].len, ti)
+			== -1)
+			return i > 0 ? i : -1;
+
+	return nb;
+}
+
 EXPORT int wi_set_ht_channel(struct wif * wi, int chan, unsigned int htval)
 {
 	assert(wi->wi_set_ht_channel);
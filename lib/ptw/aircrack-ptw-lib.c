@@ -61,6 +61,11 @@
 #define KSBYTES PTW_KSBYTES
 #define IVBYTES PTW_IVBYTES
 #define TESTBYTES 6
+#define SESSION(state, i)                                                      \
+	(&(state)->allsessions[(i) / PTW_SESSIONCHUNK][(i) % PTW_SESSIONCHUNK])
+
+// Below this many new sessions per thread, votes are not counted in parallel
+#define MTSESSIONS 16384
 
 static struct options opt;
 
@@ -126,6 +131,69 @@ static int tried, max_tries;
 static int depth[KEYHSBYTES];
 static PTW_tableentry keytable[KEYHSBYTES][n];
 
+// How many subtrees each thread should get when splitting a search
+#define TASKS_PER_THREAD 8
+
+// How many candidate keys are verified together
+#define PTW_BATCH 8
+
+// The keybytes fixed at the top of the search tree, left to a thread
+typedef struct
+{
+	uint8_t key[KEYHSBYTES];
+	uint8_t sum;
+} ptw_task;
+
+// Threads searching the subtrees of one round together
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cv_job; // a job was posted, or exiting
+	pthread_cond_t cv_done; // all helpers are done with it
+	int nb_helpers;
+	pthread_t * tid;
+	struct ptw_worker * workers;
+	unsigned long seq; // how many jobs were posted
+	int exiting;
+	int pending; // helpers still on the job
+
+	// The job: the arguments of doRound below the split level
+	PTW_attackstate * state;
+	PTW_tableentry (*table)[n];
+	int fixat;
+	uint8_t fixvalue;
+	int * searchborders;
+	int keylen;
+	int * strongbytes;
+	int * bf;
+	int (*validchars)[n];
+	int split;
+	ptw_task * tasks;
+	int nb_tasks;
+	int tasks_size;
+	int next_task;
+
+	// Set as soon as any thread verified a key
+	volatile int found;
+	uint8_t key[KEYHSBYTES];
+} ptw_pool;
+
+// What doRound needs to know about the thread running it
+typedef struct ptw_worker
+{
+	ptw_pool * pool;
+	// 0 for the calling thread, the only one drawing the stats
+	int id;
+	// Keys tested by a helper, added to tried after each job
+	int tried;
+	unsigned int seed;
+	// When set, subtrees at the split level are queued instead of searched
+	int collect;
+	// Candidate keys waiting to be verified
+	uint8_t batch[PTW_BATCH][PTW_KSBYTES] __attribute__((aligned(16)));
+	int nb_batch;
+} ptw_worker;
+
 // Check if optmizied RC4 for AMD64 has to be compiled
 #if defined(__amd64) && defined(__SSE2__)                                      \
 	&& (!defined(__clang__)                                                    \
@@ -378,6 +446,87 @@ static int rc4test(uint8_t * key, int keylen, uint8_t * iv, uint8_t * keystream)
 	return 1;
 }
 
+/*
+ * RC4 on up to PTW_BATCH keys at once, each lane with its own state; the
+ * lanes are interleaved so that the swaps of one hide the latency of the
+ * others. Returns the bitmask of the keys matching the keystream.
+ */
+static int rc4test_batch(uint8_t keys[][PTW_KSBYTES],
+						 int nkeys,
+						 int keylen,
+						 uint8_t * iv,
+						 uint8_t * keystream)
+{
+	REQUIRE(keys != NULL);
+	REQUIRE(nkeys > 0 && nkeys <= PTW_BATCH);
+	REQUIRE(keylen > 0 && keylen + IVBYTES <= PTW_KSBYTES);
+	REQUIRE(iv != NULL);
+	REQUIRE(keystream != NULL);
+
+	uint8_t s[PTW_BATCH][n];
+	uint8_t keybuf[PTW_BATCH][PTW_KSBYTES];
+	uint8_t j[PTW_BATCH];
+	uint8_t tmp, k;
+	int i, l, idx;
+	int ok = (1 << nkeys) - 1;
+
+	keylen += IVBYTES;
+
+	// unused lanes just redo the first key
+	for (l = 0; l < PTW_BATCH; l++)
+	{
+		memcpy(keybuf[l], iv, IVBYTES);
+		memcpy(&keybuf[l][IVBYTES],
+			   keys[(l < nkeys) ? l : 0],
+			   keylen - IVBYTES);
+		for (i = 0; i < n; i++)
+		{
+			s[l][i] = i;
+		}
+		j[l] = 0;
+	}
+
+	idx = 0;
+	for (i = 0; i < n; i++)
+	{
+		for (l = 0; l < PTW_BATCH; l++)
+		{
+			j[l] += s[l][i] + keybuf[l][idx];
+			tmp = s[l][i];
+			s[l][i] = s[l][j[l]];
+			s[l][j[l]] = tmp;
+		}
+		if (++idx == keylen) idx = 0;
+	}
+
+	for (l = 0; l < PTW_BATCH; l++)
+	{
+		j[l] = 0;
+	}
+
+	for (i = 1; i <= TESTBYTES; i++)
+	{
+		for (l = 0; l < PTW_BATCH; l++)
+		{
+			j[l] += s[l][i];
+			tmp = s[l][i];
+			s[l][i] = s[l][j[l]];
+			s[l][j[l]] = tmp;
+			k = s[l][i] + s[l][j[l]];
+			if (s[l][k] != keystream[i - 1])
+			{
+				ok &= ~(1 << l);
+			}
+		}
+		if (ok == 0)
+		{
+			break;
+		}
+	}
+
+	return ok;
+}
+
 // For sorting
 static int comparesorthelper(const void * ina, const void * inb)
 {
@@ -404,29 +553,32 @@ static void guesskeybytes(
 	REQUIRE(keystream != NULL);
 	REQUIRE(result != NULL);
 
-	uint32_t state[n];
+	// the inverse permutation replaces a linear search of the state
+	uint8_t state[n];
+	uint8_t inv[n];
 	uint8_t j = 0;
 	uint8_t tmp;
 	int i;
 	int jj = ivlen;
 	uint8_t ii;
 	uint8_t s = 0;
-	memcpy(state, &rc4initial, sizeof(rc4initial));
+	for (i = 0; i < n; i++)
+	{
+		state[i] = inv[i] = i;
+	}
 	for (i = 0; i < ivlen; i++)
 	{
 		j += state[i] + iv[i];
 		tmp = state[i];
 		state[i] = state[j];
 		state[j] = tmp;
+		inv[state[i]] = i;
+		inv[state[j]] = j;
 	}
 	for (i = 0; i < kb; i++)
 	{
 		tmp = jj - keystream[jj - 1];
-		ii = 0;
-		while (tmp != state[ii])
-		{
-			ii++;
-		}
+		ii = inv[tmp];
 		s += state[jj];
 		ii -= (j + s);
 		result[i] = ii;
@@ -438,10 +590,12 @@ static void guesskeybytes(
 /*
  * Is a guessed key correct?
  */
-static int correct(PTW_attackstate * state, uint8_t * key, int keylen)
+static int
+correct(PTW_attackstate * state, uint8_t * key, int keylen, ptw_worker * w)
 {
 	REQUIRE(state != NULL);
 	REQUIRE(key != NULL && keylen > 0);
+	REQUIRE(w != NULL);
 
 	int i;
 	int k;
@@ -452,9 +606,16 @@ static int correct(PTW_attackstate * state, uint8_t * key, int keylen)
 		return 0;
 	}
 
-	tried++;
-
-	k = rand_u32() % (state->sessions_collected - 10);
+	if (w->id == 0)
+	{
+		tried++;
+		k = rand_u32() % (state->sessions_collected - 10);
+	}
+	else
+	{
+		w->tried++;
+		k = rand_r(&w->seed) % (state->sessions_collected - 10);
+	}
 	for (i = k; i < k + 10; i++)
 	{
 		if (!state->rc4test(key,
@@ -466,6 +627,69 @@ static int correct(PTW_attackstate * state, uint8_t * key, int keylen)
 	return 1;
 }
 
+/*
+ * Verify the keys batched by a worker against the same control sessions,
+ * leaving the correct one, if any, in key
+ */
+static int
+flushbatch(PTW_attackstate * state, uint8_t * key, int keylen, ptw_worker * w)
+{
+	REQUIRE(state != NULL);
+	REQUIRE(key != NULL && keylen > 0);
+	REQUIRE(w != NULL);
+
+	int i, k, l, ok;
+	int nkeys = w->nb_batch;
+
+	w->nb_batch = 0;
+
+	// We need at least 3 sessions to be somehow certain
+	if (nkeys == 0 || state->sessions_collected < 3)
+	{
+		return 0;
+	}
+
+	if (w->id == 0)
+	{
+		tried += nkeys;
+		k = rand_u32() % (state->sessions_collected - 10);
+	}
+	else
+	{
+		w->tried += nkeys;
+		k = rand_r(&w->seed) % (state->sessions_collected - 10);
+	}
+
+	ok = rc4test_batch(w->batch,
+					   nkeys,
+					   keylen,
+					   state->sessions[k].iv,
+					   state->sessions[k].keystream);
+
+	// the few keys passing the first session are checked one by one
+	for (l = 0; ok != 0 && l < nkeys; l++)
+	{
+		if (!(ok & (1 << l)))
+		{
+			continue;
+		}
+		for (i = k + 1; i < k + 10; i++)
+		{
+			if (!state->rc4test(w->batch[l],
+								keylen,
+								state->sessions[i].iv,
+								state->sessions[i].keystream))
+				break;
+		}
+		if (i == k + 10)
+		{
+			memcpy(key, w->batch[l], keylen);
+			return 1;
+		}
+	}
+	return 0;
+}
+
 /*
  * Calculate the squaresum of the errors for both distributions
  */
@@ -536,13 +760,19 @@ static int doRound(PTW_tableentry sortedtable[][n],
 				   uint8_t sum,
 				   int * strongbytes,
 				   int * bf,
-				   int validchars[][n])
+				   int validchars[][n],
+				   ptw_worker * w)
 {
 	int i;
 	uint8_t tmp;
+	ptw_pool * pool = w->pool;
 
-	if (!opt.is_quiet && keybyte < 4)
+	if (!opt.is_quiet && keybyte < 4 && w->id == 0)
 		show_wep_stats(keylen - 1, 0, keytable, searchborders, depth, tried);
+	if (pool != NULL && pool->found)
+	{
+		return 0;
+	}
 	if (keybyte > 0)
 	{
 		if (!validchars[keybyte - 1][key[keybyte - 1]])
@@ -550,9 +780,30 @@ static int doRound(PTW_tableentry sortedtable[][n],
 			return 0;
 		}
 	}
+	if (w->collect && keybyte == pool->split)
+	{
+		// leave this subtree to one of the threads
+		if (pool->nb_tasks == pool->tasks_size)
+		{
+			pool->tasks_size = pool->tasks_size ? pool->tasks_size * 2 : 64;
+			ptw_task * tmp_tasks
+				= realloc(pool->tasks, pool->tasks_size * sizeof(ptw_task));
+			ALLEGE(tmp_tasks != NULL);
+			pool->tasks = tmp_tasks;
+		}
+		memcpy(pool->tasks[pool->nb_tasks].key, key, keybyte);
+		pool->tasks[pool->nb_tasks].sum = sum;
+		pool->nb_tasks++;
+		return 0;
+	}
 	if (keybyte == keylen)
 	{
-		return correct(state, key, keylen);
+		memcpy(w->batch[w->nb_batch++], key, keylen);
+		if (w->nb_batch < PTW_BATCH)
+		{
+			return 0;
+		}
+		return flushbatch(state, key, keylen, w);
 	}
 	else if (bf[keybyte] == 1)
 	{
@@ -570,7 +821,8 @@ static int doRound(PTW_tableentry sortedtable[][n],
 						sum + i % n,
 						strongbytes,
 						bf,
-						validchars))
+						validchars,
+						w))
 			{
 				return 1;
 			}
@@ -591,7 +843,8 @@ static int doRound(PTW_tableentry sortedtable[][n],
 					   fixvalue,
 					   strongbytes,
 					   bf,
-					   validchars);
+					   validchars,
+					   w);
 	}
 	else if (strongbytes[keybyte] == 1)
 	{
@@ -612,7 +865,8 @@ static int doRound(PTW_tableentry sortedtable[][n],
 						(n - tmp + sum) % n,
 						strongbytes,
 						bf,
-						validchars)
+						validchars,
+						w)
 				== 1)
 			{
 				printf("hit with strongbyte for keybyte %d\n", keybyte);
@@ -629,7 +883,7 @@ static int doRound(PTW_tableentry sortedtable[][n],
 		for (i = 0; i < searchborders[keybyte]; i++)
 		{
 			key[keybyte] = sortedtable[keybyte][i].b - sum;
-			if (!opt.is_quiet)
+			if (!opt.is_quiet && w->id == 0)
 			{
 				depth[keybyte] = i;
 				keytable[keybyte][i].b = key[keybyte];
@@ -645,7 +899,8 @@ static int doRound(PTW_tableentry sortedtable[][n],
 						sortedtable[keybyte][i].b,
 						strongbytes,
 						bf,
-						validchars))
+						validchars,
+						w))
 			{
 				return 1;
 			}
@@ -654,6 +909,297 @@ static int doRound(PTW_tableentry sortedtable[][n],
 	}
 }
 
+/*
+ * How many subtrees doRound walks into from a keybyte
+ */
+static int fanout(int keybyte,
+				  int fixat,
+				  int * searchborders,
+				  int * strongbytes,
+				  int * bf)
+{
+	if (bf[keybyte] == 1)
+	{
+		return n;
+	}
+	else if (keybyte == fixat)
+	{
+		return 1;
+	}
+	else if (strongbytes[keybyte] == 1)
+	{
+		return (keybyte > 1) ? keybyte - 1 : 0;
+	}
+	return searchborders[keybyte];
+}
+
+/*
+ * Search the subtrees queued in the pool until none is left or a key is found
+ */
+static void runTasks(ptw_worker * w)
+{
+	REQUIRE(w != NULL && w->pool != NULL);
+
+	ptw_pool * pool = w->pool;
+	uint8_t key[PTW_KSBYTES] __attribute__((aligned(16)));
+	int t;
+
+	memset(key, 0, sizeof(key));
+
+	while (!pool->found)
+	{
+		ALLEGE(pthread_mutex_lock(&pool->lock) == 0);
+		t = pool->next_task++;
+		ALLEGE(pthread_mutex_unlock(&pool->lock) == 0);
+
+		if (t >= pool->nb_tasks)
+		{
+			break;
+		}
+
+		memcpy(key, pool->tasks[t].key, pool->split);
+		if (doRound(pool->table,
+					pool->split,
+					pool->fixat,
+					pool->fixvalue,
+					pool->searchborders,
+					key,
+					pool->keylen,
+					pool->state,
+					pool->tasks[t].sum,
+					pool->strongbytes,
+					pool->bf,
+					pool->validchars,
+					w)
+			|| flushbatch(pool->state, key, pool->keylen, w))
+		{
+			ALLEGE(pthread_mutex_lock(&pool->lock) == 0);
+			if (!pool->found)
+			{
+				memcpy(pool->key, key, pool->keylen);
+				pool->found = 1;
+			}
+			ALLEGE(pthread_mutex_unlock(&pool->lock) == 0);
+		}
+	}
+}
+
+static void * helperThread(void * arg)
+{
+	ptw_worker * w = (ptw_worker *) arg;
+	ptw_pool * pool = w->pool;
+	unsigned long seq = 0;
+
+	while (1)
+	{
+		ALLEGE(pthread_mutex_lock(&pool->lock) == 0);
+		while (pool->seq == seq && !pool->exiting)
+		{
+			ALLEGE(pthread_cond_wait(&pool->cv_job, &pool->lock) == 0);
+		}
+		if (pool->seq == seq)
+		{
+			ALLEGE(pthread_mutex_unlock(&pool->lock) == 0);
+			break;
+		}
+		seq = pool->seq;
+		ALLEGE(pthread_mutex_unlock(&pool->lock) == 0);
+
+		runTasks(w);
+
+		ALLEGE(pthread_mutex_lock(&pool->lock) == 0);
+		if (--pool->pending == 0)
+		{
+			ALLEGE(pthread_cond_signal(&pool->cv_done) == 0);
+		}
+		ALLEGE(pthread_mutex_unlock(&pool->lock) == 0);
+	}
+
+	return NULL;
+}
+
+/*
+ * Start the threads helping the caller, none if there is a single cpu
+ */
+static ptw_pool * newPool(int threads)
+{
+	ptw_pool * pool;
+	int i;
+
+	if (threads <= 0)
+	{
+		threads = get_nb_cpus();
+	}
+	if (threads <= 1)
+	{
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(ptw_pool));
+	ALLEGE(pool != NULL);
+	pool->tid = calloc(threads - 1, sizeof(pthread_t));
+	ALLEGE(pool->tid != NULL);
+	pool->workers = calloc(threads - 1, sizeof(ptw_worker));
+	ALLEGE(pool->workers != NULL);
+	ALLEGE(pthread_mutex_init(&pool->lock, NULL) == 0);
+	ALLEGE(pthread_cond_init(&pool->cv_job, NULL) == 0);
+	ALLEGE(pthread_cond_init(&pool->cv_done, NULL) == 0);
+
+	for (i = 0; i < threads - 1; i++)
+	{
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i + 1;
+		pool->workers[i].seed = rand_u32();
+		if (pthread_create(
+				&pool->tid[i], NULL, &helperThread, &pool->workers[i])
+			!= 0)
+		{
+			break;
+		}
+		pool->nb_helpers++;
+	}
+
+	return pool;
+}
+
+static void freePool(ptw_pool * pool)
+{
+	int i;
+
+	if (pool == NULL)
+	{
+		return;
+	}
+
+	ALLEGE(pthread_mutex_lock(&pool->lock) == 0);
+	pool->exiting = 1;
+	ALLEGE(pthread_cond_broadcast(&pool->cv_job) == 0);
+	ALLEGE(pthread_mutex_unlock(&pool->lock) == 0);
+
+	for (i = 0; i < pool->nb_helpers; i++)
+	{
+		ALLEGE(pthread_join(pool->tid[i], NULL) == 0);
+	}
+
+	ALLEGE(pthread_cond_destroy(&pool->cv_done) == 0);
+	ALLEGE(pthread_cond_destroy(&pool->cv_job) == 0);
+	ALLEGE(pthread_mutex_destroy(&pool->lock) == 0);
+	free(pool->tasks);
+	free(pool->workers);
+	free(pool->tid);
+	free(pool);
+}
+
+/*
+ * Try all keys of a round; with a pool, the top keybytes are enumerated first
+ * and the subtrees below them are shared between the threads
+ */
+static int searchRound(PTW_tableentry table[][n],
+					   int fixat,
+					   uint8_t fixvalue,
+					   int * searchborders,
+					   uint8_t * key,
+					   int keylen,
+					   PTW_attackstate * state,
+					   int * strongbytes,
+					   int * bf,
+					   int validchars[][n],
+					   ptw_worker * w)
+{
+	ptw_pool * pool = w->pool;
+	int i, prod;
+
+	if (pool == NULL || pool->nb_helpers == 0)
+	{
+		return doRound(table,
+					   0,
+					   fixat,
+					   fixvalue,
+					   searchborders,
+					   key,
+					   keylen,
+					   state,
+					   0,
+					   strongbytes,
+					   bf,
+					   validchars,
+					   w)
+			   || flushbatch(state, key, keylen, w);
+	}
+
+	pool->table = table;
+	pool->fixat = fixat;
+	pool->fixvalue = fixvalue;
+	pool->searchborders = searchborders;
+	pool->keylen = keylen;
+	pool->state = state;
+	pool->strongbytes = strongbytes;
+	pool->bf = bf;
+	pool->validchars = validchars;
+	pool->nb_tasks = 0;
+	pool->next_task = 0;
+	pool->found = 0;
+
+	// split where there are enough subtrees to keep all threads busy
+	pool->split = 0;
+	prod = 1;
+	while (pool->split < keylen
+		   && prod < TASKS_PER_THREAD * (pool->nb_helpers + 1))
+	{
+		prod *= fanout(pool->split, fixat, searchborders, strongbytes, bf);
+		pool->split++;
+	}
+
+	w->collect = 1;
+	doRound(table,
+			0,
+			fixat,
+			fixvalue,
+			searchborders,
+			key,
+			keylen,
+			state,
+			0,
+			strongbytes,
+			bf,
+			validchars,
+			w);
+	w->collect = 0;
+
+	if (pool->nb_tasks == 0)
+	{
+		return 0;
+	}
+
+	ALLEGE(pthread_mutex_lock(&pool->lock) == 0);
+	pool->pending = pool->nb_helpers;
+	pool->seq++;
+	ALLEGE(pthread_cond_broadcast(&pool->cv_job) == 0);
+	ALLEGE(pthread_mutex_unlock(&pool->lock) == 0);
+
+	runTasks(w);
+
+	ALLEGE(pthread_mutex_lock(&pool->lock) == 0);
+	while (pool->pending > 0)
+	{
+		ALLEGE(pthread_cond_wait(&pool->cv_done, &pool->lock) == 0);
+	}
+	ALLEGE(pthread_mutex_unlock(&pool->lock) == 0);
+
+	for (i = 0; i < pool->nb_helpers; i++)
+	{
+		tried += pool->workers[i].tried;
+		pool->workers[i].tried = 0;
+	}
+
+	if (pool->found)
+	{
+		memcpy(key, pool->key, keylen);
+		return 1;
+	}
+	return 0;
+}
+
 /*
  * Do the actual computation of the key
  */
@@ -665,7 +1211,8 @@ static int doComputation(PTW_attackstate * state,
 						 int * strongbytes,
 						 int keylimit,
 						 int * bf,
-						 int validchars[][n])
+						 int validchars[][n],
+						 ptw_worker * w)
 {
 	int i, j;
 	int choices[KEYHSBYTES];
@@ -695,18 +1242,17 @@ static int doComputation(PTW_attackstate * state,
 
 	while (prod < keylimit)
 	{
-		if (doRound(table,
-					0,
-					fixat,
-					fixvalue,
-					choices,
-					key,
-					keylen,
-					state,
-					0,
-					strongbytes,
-					bf,
-					validchars)
+		if (searchRound(table,
+						fixat,
+						fixvalue,
+						choices,
+						key,
+						keylen,
+						state,
+						strongbytes,
+						bf,
+						validchars,
+						w)
 			== 1)
 		{
 			// printf("hit with %d choices\n", prod);
@@ -771,7 +1317,8 @@ int PTW_computeKey(PTW_attackstate * state,
 	double ausreisser[KEYHSBYTES];
 	doublesorthelper helper[KEYHSBYTES];
 	int simple, onestrong, twostrong;
-	int i, j;
+	int i, j, found;
+	ptw_worker w;
 #ifdef USE_AMD64_RC4_OPTIMIZED
 	/*
 	 * The 64-bit SSE2-optimized rc4test() requires this buffer to be
@@ -800,6 +1347,7 @@ int PTW_computeKey(PTW_attackstate * state,
 
 	tried = 0;
 	sh = NULL;
+	memset(&w, 0, sizeof(w));
 
 	if (!(attacks & NO_KLEIN))
 	{
@@ -813,15 +1361,11 @@ int PTW_computeKey(PTW_attackstate * state,
 			}
 			for (j = 0; j < state->packets_collected; j++)
 			{
-				// fullkeybuf[0] = state->allsessions[j].iv[0];
-				memcpy(
-					fullkeybuf, state->allsessions[j].iv, 3 * sizeof(uint8_t));
-				guesskeybytes(i + 3,
-							  fullkeybuf,
-							  state->allsessions[j].keystream,
-							  guessbuf,
-							  1);
-				table[i][guessbuf[0]].votes += state->allsessions[j].weight;
+				PTW_session * session = SESSION(state, j);
+				memcpy(fullkeybuf, session->iv, 3 * sizeof(uint8_t));
+				guesskeybytes(
+					i + 3, fullkeybuf, session->keystream, guessbuf, 1);
+				table[i][guessbuf[0]].votes += session->weight;
 			}
 			qsort(&table[i][0], n, sizeof(PTW_tableentry), &compare);
 			j = 0;
@@ -832,7 +1376,7 @@ int PTW_computeKey(PTW_attackstate * state,
 			// printf("guessing i = %d, b = %d\n", i, table[0][0].b);
 			fullkeybuf[i + 3] = table[i][j].b;
 		}
-		if (correct(state, &fullkeybuf[3], keylen))
+		if (correct(state, &fullkeybuf[3], keylen, &w))
 		{
 			memcpy(keybuf, &fullkeybuf[3], keylen * sizeof(uint8_t));
 			// printf("hit without correction\n");
@@ -869,71 +1413,332 @@ int PTW_computeKey(PTW_attackstate * state,
 		}
 		qsort(sh, (n - 1) * keylen, sizeof(sorthelper), &comparesorthelper);
 
-		if (doComputation(state,
-						  keybuf,
-						  keylen,
-						  table,
-						  (sorthelper *) sh,
-						  strongbytes,
-						  simple,
-						  bf,
-						  validchars))
+		w.pool = newPool(state->threads);
+
+		found = doComputation(state,
+							  keybuf,
+							  keylen,
+							  table,
+							  (sorthelper *) sh,
+							  strongbytes,
+							  simple,
+							  bf,
+							  validchars,
+							  &w);
+
+		if (!found)
+		{
+			// Now one strong byte
+			getdrv(state->table, keylen, normal, ausreisser);
+			for (i = 0; i < keylen - 1; i++)
+			{
+				helper[i].keybyte = i + 1;
+				helper[i].difference = normal[i + 1] - ausreisser[i + 1];
+			}
+			qsort(helper,
+				  keylen - 1,
+				  sizeof(doublesorthelper),
+				  &comparedoublesorthelper);
+			// do not use bf-bytes as strongbytes
+			i = 0;
+			while (bf[helper[i].keybyte] == 1)
+			{
+				i++;
+			}
+			strongbytes[helper[i].keybyte] = 1;
+			found = doComputation(state,
+								  keybuf,
+								  keylen,
+								  table,
+								  (sorthelper *) sh,
+								  strongbytes,
+								  onestrong,
+								  bf,
+								  validchars,
+								  &w);
+		}
+
+		if (!found)
+		{
+			// two strong bytes
+			i++;
+			while (bf[helper[i].keybyte] == 1)
+			{
+				i++;
+			}
+			strongbytes[helper[i].keybyte] = 1;
+			found = doComputation(state,
+								  keybuf,
+								  keylen,
+								  table,
+								  (sorthelper *) sh,
+								  strongbytes,
+								  twostrong,
+								  bf,
+								  validchars,
+								  &w);
+		}
+
+		freePool(w.pool);
+
+		if (found)
 		{
 			return (FAILURE);
 		}
+	}
+	return (SUCCESS);
+}
 
-		// Now one strong byte
-		getdrv(state->table, keylen, normal, ausreisser);
-		for (i = 0; i < keylen - 1; i++)
+/*
+ * Get room for one more session in the chunks of allsessions
+ */
+static PTW_session * newsession(PTW_attackstate * state)
+{
+	int c = state->packets_collected / PTW_SESSIONCHUNK;
+
+	if (state->packets_collected % PTW_SESSIONCHUNK == 0)
+	{
+		if (c == state->allsessions_size)
 		{
-			helper[i].keybyte = i + 1;
-			helper[i].difference = normal[i + 1] - ausreisser[i + 1];
+			// only the chunk pointers move, never the sessions
+			state->allsessions_size = state->allsessions_size
+										  ? state->allsessions_size << 1
+										  : 64;
+			PTW_session ** tmp_allsessions
+				= realloc(state->allsessions,
+						  state->allsessions_size * sizeof(PTW_session *));
+			ALLEGE(tmp_allsessions != NULL);
+			state->allsessions = tmp_allsessions;
 		}
-		qsort(helper,
-			  keylen - 1,
-			  sizeof(doublesorthelper),
-			  &comparedoublesorthelper);
-		// do not use bf-bytes as strongbytes
-		i = 0;
-		while (bf[helper[i].keybyte] == 1)
+		state->allsessions[c] = malloc(PTW_SESSIONCHUNK * sizeof(PTW_session));
+		ALLEGE(state->allsessions[c] != NULL);
+	}
+
+	c = state->packets_collected++;
+
+	return SESSION(state, c);
+}
+
+/*
+ * Remember a session for the votes and the original klein attack
+ */
+static void storesession(PTW_attackstate * state,
+						 uint8_t * iv,
+						 uint8_t * keystream,
+						 int weight)
+{
+	PTW_session * session = newsession(state);
+
+	memcpy(session->iv, iv, IVBYTES);
+	memcpy(session->keystream, keystream, KSBYTES);
+	session->weight = weight;
+}
+
+/*
+ * Add the votes of count sessions to table. Only the IVBYTES swaps of the
+ * key schedule are applied to an identity permutation and its inverse,
+ * and undone afterwards, so a session costs neither a copy of the whole
+ * rc4 state nor a linear search in it.
+ */
+static void votesessions(PTW_session * session,
+						 int count,
+						 PTW_tableentry (*table)[n])
+{
+	uint8_t state[n];
+	uint8_t inv[n];
+	uint8_t jv[IVBYTES];
+	uint8_t j, s, tmp;
+	int i, k;
+
+	for (i = 0; i < n; i++)
+	{
+		state[i] = inv[i] = i;
+	}
+
+	for (k = 0; k < count; k++, session++)
+	{
+		j = 0;
+		for (i = 0; i < IVBYTES; i++)
 		{
-			i++;
+			j += state[i] + session->iv[i];
+			jv[i] = j;
+			tmp = state[i];
+			state[i] = state[j];
+			state[j] = tmp;
+			inv[state[i]] = i;
+			inv[state[j]] = j;
 		}
-		strongbytes[helper[i].keybyte] = 1;
-		if (doComputation(state,
-						  keybuf,
-						  keylen,
-						  table,
-						  (sorthelper *) sh,
-						  strongbytes,
-						  onestrong,
-						  bf,
-						  validchars))
+
+		s = 0;
+		for (i = 0; i < PTW_KEYHSBYTES; i++)
 		{
-			return (FAILURE);
+			tmp = (IVBYTES + i) - session->keystream[IVBYTES + i - 1];
+			s += state[IVBYTES + i];
+			table[i][(uint8_t)(inv[tmp] - (j + s))].votes += session->weight;
 		}
 
-		// two strong bytes
-		i++;
-		while (bf[helper[i].keybyte] == 1)
+		for (i = IVBYTES - 1; i >= 0; i--)
 		{
-			i++;
+			tmp = state[i];
+			state[i] = state[jv[i]];
+			state[jv[i]] = tmp;
+			inv[state[i]] = i;
+			inv[state[jv[i]]] = jv[i];
 		}
-		strongbytes[helper[i].keybyte] = 1;
-		if (doComputation(state,
-						  keybuf,
-						  keylen,
-						  table,
-						  (sorthelper *) sh,
-						  strongbytes,
-						  twostrong,
-						  bf,
-						  validchars))
+	}
+}
+
+/*
+ * Add the votes of the stored sessions first to last - 1 to table
+ */
+static void voterange(PTW_attackstate * state,
+					  int first,
+					  int last,
+					  PTW_tableentry (*table)[n])
+{
+	int count;
+
+	while (first < last)
+	{
+		count = PTW_SESSIONCHUNK - first % PTW_SESSIONCHUNK;
+		if (count > last - first)
 		{
-			return (FAILURE);
+			count = last - first;
 		}
+		votesessions(SESSION(state, first), count, table);
+		first += count;
+	}
+}
+
+typedef struct
+{
+	PTW_attackstate * state;
+	int first;
+	int last;
+	PTW_tableentry (*table)[n];
+} vote_job;
+
+static void * voteThread(void * arg)
+{
+	vote_job * job = (vote_job *) arg;
+
+	voterange(job->state, job->first, job->last, job->table);
+
+	return NULL;
+}
+
+/*
+ * Count the votes of the stored sessions first to last - 1. Large ranges
+ * are split between threads, each voting into a table of its own which
+ * is merged once it is done.
+ */
+static void addvotes(PTW_attackstate * state, int first, int last)
+{
+	vote_job * jobs;
+	pthread_t * tid;
+	int threads = state->threads;
+	int i, k, b, started;
+
+	if ((last - first) / MTSESSIONS <= 1)
+	{
+		threads = 1;
+	}
+	else if (threads <= 0)
+	{
+		threads = get_nb_cpus();
+	}
+	if (threads > (last - first) / MTSESSIONS)
+	{
+		threads = (last - first) / MTSESSIONS;
+	}
+	if (threads <= 1)
+	{
+		voterange(state, first, last, state->table);
+		return;
+	}
+
+	jobs = calloc(threads, sizeof(vote_job));
+	ALLEGE(jobs != NULL);
+	tid = calloc(threads, sizeof(pthread_t));
+	ALLEGE(tid != NULL);
+
+	for (i = 0; i < threads; i++)
+	{
+		jobs[i].state = state;
+		jobs[i].first = first + (int) ((long) (last - first) * i / threads);
+		jobs[i].last = first + (int) ((long) (last - first) * (i + 1) / threads);
+		jobs[i].table = calloc(PTW_KEYHSBYTES, sizeof(PTW_tableentry[n]));
+		ALLEGE(jobs[i].table != NULL);
+	}
+
+	// the caller takes the first part
+	for (started = 1; started < threads; started++)
+	{
+		if (pthread_create(&tid[started], NULL, &voteThread, &jobs[started])
+			!= 0)
+		{
+			break;
+		}
+	}
+	for (i = started; i < threads; i++)
+	{
+		voteThread(&jobs[i]);
+	}
+	voteThread(&jobs[0]);
+
+	for (i = 0; i < threads; i++)
+	{
+		if (i > 0 && i < started)
+		{
+			ALLEGE(pthread_join(tid[i], NULL) == 0);
+		}
+		for (k = 0; k < PTW_KEYHSBYTES; k++)
+		{
+			for (b = 0; b < n; b++)
+			{
+				state->table[k][b].votes += jobs[i].table[k][b].votes;
+			}
+		}
+		free(jobs[i].table);
+	}
+
+	free(tid);
+	free(jobs);
+}
+
+/*
+ * Mark an IV as seen, returns 0 if it already was
+ */
+static int markiv(PTW_attackstate * state, uint8_t * iv)
+{
+	int i = (iv[0] << 16) | (iv[1] << 8) | (iv[2]);
+	int il = i / 8;
+	int ir = 1 << (i % 8);
+
+	if (state->seen_iv[il] & ir)
+	{
+		return 0;
+	}
+	state->seen_iv[il] |= ir;
+
+	return 1;
+}
+
+/*
+ * Keep the session as control session if there is still room for it
+ */
+static void addcontrol(PTW_attackstate * state,
+					   uint8_t * iv,
+					   uint8_t * keystream)
+{
+	if ((state->sessions_collected < CONTROLSESSIONS))
+	{
+		memcpy(state->sessions[state->sessions_collected].iv, iv, IVBYTES);
+		memcpy(state->sessions[state->sessions_collected].keystream,
+			   keystream,
+			   KSBYTES);
+		state->sessions_collected++;
 	}
-	return (SUCCESS);
 }
 
 /*
@@ -953,58 +1758,64 @@ int PTW_addsession(PTW_attackstate * state,
 	REQUIRE(keystream != NULL);
 	REQUIRE(weight != NULL);
 
-	int i, j;
-	int il;
-	int ir;
-	uint8_t buf[PTW_KEYHSBYTES];
+	int j;
+	int first = state->packets_collected;
+
+	if (!markiv(state, iv))
+	{
+		return (SUCCESS);
+	}
+
+	for (j = 0; j < total; j++)
+	{
+		storesession(state, iv, &keystream[KSBYTES * j], weight[j]);
+	}
+	addvotes(state, first, state->packets_collected);
+	addcontrol(state, iv, keystream);
+
+	return (FAILURE);
+}
+
+/*
+ * Add a batch of sessions with a single keystream each to the attack
+ * state - state of attack
+ * sessions - the sessions, duplicate IVs are skipped
+ * count - how many sessions there are
+ * added - if not NULL, set to 1 for each session that was new, 0 otherwise
+ * Returns the number of sessions added
+ */
+int PTW_addsessions(PTW_attackstate * state,
+					PTW_session * sessions,
+					int count,
+					uint8_t * added)
+{
+	REQUIRE(state != NULL);
+	REQUIRE(sessions != NULL || count == 0);
+
+	int i;
+	int first = state->packets_collected;
 
-	i = (iv[0] << 16) | (iv[1] << 8) | (iv[2]);
-	il = i / 8;
-	ir = 1 << (i % 8);
-	if ((state->seen_iv[il] & ir) == 0)
+	// the IVs have to be checked in order, duplicates may be in the batch
+	for (i = 0; i < count; i++)
 	{
-		state->seen_iv[il] |= ir;
-		for (j = 0; j < total; j++)
+		int new = markiv(state, sessions[i].iv);
+
+		if (new)
 		{
-			state->packets_collected++;
-			guesskeybytes(
-				IVBYTES, iv, &keystream[KSBYTES * j], buf, PTW_KEYHSBYTES);
-			for (i = 0; i < KEYHSBYTES; i++)
-			{
-				state->table[i][buf[i]].votes += weight[j];
-			}
-			if (state->allsessions_size < state->packets_collected)
-			{
-				state->allsessions_size = state->allsessions_size << 1;
-				PTW_session * tmp_allsessions
-					= realloc(state->allsessions,
-							  state->allsessions_size * sizeof(PTW_session));
-				ALLEGE(tmp_allsessions != NULL);
-				state->allsessions = tmp_allsessions;
-			}
-			memcpy(state->allsessions[state->packets_collected - 1].iv,
-				   iv,
-				   IVBYTES);
-			memcpy(state->allsessions[state->packets_collected - 1].keystream,
-				   &keystream[KSBYTES * j],
-				   KSBYTES);
-			state->allsessions[state->packets_collected - 1].weight = weight[j];
+			storesession(state,
+						 sessions[i].iv,
+						 sessions[i].keystream,
+						 sessions[i].weight);
+			addcontrol(state, sessions[i].iv, sessions[i].keystream);
 		}
-		if ((state->sessions_collected < CONTROLSESSIONS))
+		if (added != NULL)
 		{
-			memcpy(state->sessions[state->sessions_collected].iv, iv, IVBYTES);
-			memcpy(state->sessions[state->sessions_collected].keystream,
-				   keystream,
-				   KSBYTES);
-			state->sessions_collected++;
+			added[i] = (uint8_t) new;
 		}
-
-		return (FAILURE);
-	}
-	else
-	{
-		return (SUCCESS);
 	}
+	addvotes(state, first, state->packets_collected);
+
+	return state->packets_collected - first;
 }
 
 /*
@@ -1024,9 +1835,6 @@ PTW_attackstate * PTW_newattackstate(void)
 			state->table[i][k].b = k;
 		}
 	}
-	state->allsessions = malloc(4096 * sizeof(PTW_session));
-	ALLEGE(state->allsessions != NULL);
-	state->allsessions_size = 4096;
 
 	return state;
 }
@@ -1036,7 +1844,208 @@ PTW_attackstate * PTW_newattackstate(void)
  */
 void PTW_freeattackstate(PTW_attackstate * state)
 {
+	int i;
+
+	if (state == NULL)
+	{
+		return;
+	}
+	for (i = 0; i * PTW_SESSIONCHUNK < state->packets_collected; i++)
+	{
+		free(state->allsessions[i]);
+	}
 	free(state->allsessions);
 	free(state);
 	return;
 }
+
+/*
+ * Make a copy of an attackstate, that can be saved while more sessions are
+ * added to the original
+ */
+PTW_attackstate * PTW_copyattackstate(PTW_attackstate * state)
+{
+	REQUIRE(state != NULL);
+
+	PTW_attackstate * copy;
+	int i, count;
+
+	copy = malloc(sizeof(PTW_attackstate));
+	ALLEGE(copy != NULL);
+	memcpy(copy, state, sizeof(PTW_attackstate));
+
+	copy->allsessions = NULL;
+	copy->allsessions_size = 0;
+	copy->packets_collected = 0;
+
+	for (i = 0; i < state->packets_collected; i += count)
+	{
+		count = state->packets_collected - i;
+		if (count > PTW_SESSIONCHUNK)
+		{
+			count = PTW_SESSIONCHUNK;
+		}
+		newsession(copy);
+		copy->packets_collected = i + count;
+		memcpy(SESSION(copy, i), SESSION(state, i), count * sizeof(PTW_session));
+	}
+
+	return copy;
+}
+
+// Header of a saved attackstate
+typedef struct
+{
+	char magic[4];
+	uint32_t version;
+	// Layout checks, a state only loads into the build that saved it
+	uint32_t keyhsbytes;
+	uint32_t sessionsize;
+	int32_t packets_collected;
+	int32_t sessions_collected;
+} PTW_stateheader;
+
+/*
+ * Write an attackstate to a file, it can be loaded back with PTW_loadstate
+ * and more sessions added to it
+ * Returns 0 on success, -1 if writing failed
+ */
+int PTW_savestate(PTW_attackstate * state, FILE * f)
+{
+	REQUIRE(state != NULL);
+	REQUIRE(f != NULL);
+
+	PTW_stateheader hdr;
+	int32_t votes[PTW_KEYHSBYTES][n];
+	int i, k, count;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, PTW_STATEMAGIC, sizeof(hdr.magic));
+	hdr.version = PTW_STATEVERSION;
+	hdr.keyhsbytes = PTW_KEYHSBYTES;
+	hdr.sessionsize = sizeof(PTW_session);
+	hdr.packets_collected = state->packets_collected;
+	hdr.sessions_collected = state->sessions_collected;
+
+	for (i = 0; i < PTW_KEYHSBYTES; i++)
+	{
+		for (k = 0; k < n; k++)
+		{
+			votes[i][k] = state->table[i][k].votes;
+		}
+	}
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1
+		|| fwrite(votes, sizeof(votes), 1, f) != 1
+		|| fwrite(state->seen_iv, PTW_IVTABLELEN, 1, f) != 1
+		|| fwrite(state->sessions,
+				  sizeof(PTW_session),
+				  state->sessions_collected,
+				  f)
+			   != (size_t) state->sessions_collected)
+	{
+		return -1;
+	}
+
+	for (i = 0; i < state->packets_collected; i += count)
+	{
+		count = state->packets_collected - i;
+		if (count > PTW_SESSIONCHUNK)
+		{
+			count = PTW_SESSIONCHUNK;
+		}
+		if (fwrite(SESSION(state, i), sizeof(PTW_session), count, f)
+			!= (size_t) count)
+		{
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Read an attackstate written by PTW_savestate
+ * Returns a new attackstate, NULL if the file is damaged or was written
+ * by an incompatible version
+ */
+PTW_attackstate * PTW_loadstate(FILE * f)
+{
+	REQUIRE(f != NULL);
+
+	PTW_stateheader hdr;
+	PTW_attackstate * state;
+	int32_t votes[PTW_KEYHSBYTES][n];
+	uint32_t extlen;
+	int i, k, count;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1) return NULL;
+
+	// skip the application data written before the state
+	if (memcmp(hdr.magic, PTW_STATEEXTMAGIC, sizeof(hdr.magic)) == 0)
+	{
+		memcpy(&extlen, &hdr.version, sizeof(extlen));
+		if (fseek(f,
+				  (long) extlen - (long) (sizeof(hdr) - 2 * sizeof(uint32_t)),
+				  SEEK_CUR)
+				!= 0
+			|| fread(&hdr, sizeof(hdr), 1, f) != 1)
+		{
+			return NULL;
+		}
+	}
+
+	if (memcmp(hdr.magic, PTW_STATEMAGIC, sizeof(hdr.magic)) != 0
+		|| hdr.version != PTW_STATEVERSION
+		|| hdr.keyhsbytes != PTW_KEYHSBYTES
+		|| hdr.sessionsize != sizeof(PTW_session)
+		|| hdr.packets_collected < 0
+		|| hdr.sessions_collected < 0
+		|| hdr.sessions_collected > CONTROLSESSIONS)
+	{
+		return NULL;
+	}
+
+	state = PTW_newattackstate();
+
+	if (fread(votes, sizeof(votes), 1, f) != 1
+		|| fread(state->seen_iv, PTW_IVTABLELEN, 1, f) != 1
+		|| fread(state->sessions,
+				 sizeof(PTW_session),
+				 hdr.sessions_collected,
+				 f)
+			   != (size_t) hdr.sessions_collected)
+	{
+		PTW_freeattackstate(state);
+		return NULL;
+	}
+
+	for (i = 0; i < PTW_KEYHSBYTES; i++)
+	{
+		for (k = 0; k < n; k++)
+		{
+			state->table[i][k].votes = votes[i][k];
+		}
+	}
+	state->sessions_collected = hdr.sessions_collected;
+
+	// the sessions are read a chunk at a time, straight into place
+	for (i = 0; i < hdr.packets_collected; i += count)
+	{
+		count = hdr.packets_collected - i;
+		if (count > PTW_SESSIONCHUNK)
+		{
+			count = PTW_SESSIONCHUNK;
+		}
+		newsession(state);
+		state->packets_collected = i + count;
+		if (fread(SESSION(state, i), sizeof(PTW_session), count, f)
+			!= (size_t) count)
+		{
+			PTW_freeattackstate(state);
+			return NULL;
+		}
+	}
+
+	return state;
+}
@@ -88,6 +88,7 @@
 #define MAX_FRAME_EXTENSION 100
 
 #define RTC_RESOLUTION 512
+#define BEACON_BATCH 16
 
 #define ALLOW_MACS 0
 #define BLOCK_MACS 1
@@ -757,6 +758,19 @@ static int my_send_packet(void * buf, size_t count)
 	return (rc);
 }
 
+static int my_send_packets(struct wi_frame * frames, int nb)
+{
+	int i, rc = send_packets(_wi_out, frames, nb, kRewriteSequenceNumber);
+
+	ALLEGE(pthread_mutex_lock(&mx_cap) == 0);
+	if (lopt.record_data)
+		for (i = 0; i < nb; i++)
+			capture_packet(frames[i].h80211, frames[i].len);
+	ALLEGE(pthread_mutex_unlock(&mx_cap) == 0);
+
+	return (rc);
+}
+
 #define IEEE80211_LLC_SNAP                                                     \
 	"\x08\x00\x00\x00\xDD\xDD\xDD\xDD\xDD\xDD\xBB\xBB\xBB\xBB\xBB\xBB"         \
 	"\xCC\xCC\xCC\xCC\xCC\xCC\xE0\x32\xAA\xAA\x03\x00\x00\x00\x08\x00"
@@ -2770,23 +2784,151 @@ packet_recv(uint8_t * packet, size_t length, struct AP_conf * apc, int external)
 	return (0);
 }
 
-static THREAD_ENTRY(beacon_thread)
+/* Fills beacon for the next ESSID to announce, returns its length. */
+static size_t build_beacon(struct AP_conf * apc, uint8_t * beacon, int seq)
 {
-	REQUIRE(arg != NULL);
+	REQUIRE(apc != NULL);
+	REQUIRE(beacon != NULL);
 
-	struct AP_conf apc;
-	struct timeval tv, tv1, tv2;
+	struct timeval tv1;
 	u_int64_t timestamp;
-	uint8_t beacon[512];
 	size_t beacon_len = 0;
-	int seq = 0, i = 0, n = 0;
 	size_t essid_len;
-	int temp_channel;
+	int temp_channel, i;
 	uint8_t essid[MAX_IE_ELEMENT_SIZE + 1];
+
+	memset(essid, 0, MAX_IE_ELEMENT_SIZE + 1);
+
+	gettimeofday(&tv1, NULL);
+	timestamp = tv1.tv_sec * 1000000UL + tv1.tv_usec;
+
+	/* flush expired ESSID entries */
+	flushESSID();
+	essid_len = (size_t) getNextESSID((char *) essid);
+	if (!essid_len)
+	{
+		strncpy((char *) essid, "default", sizeof(essid) - 1);
+		essid_len = strlen("default");
+	}
+
+	memcpy(beacon, "\x80\x00\x00\x00", 4); // type/subtype/framecontrol/duration
+	beacon_len += 4;
+	memcpy(beacon + beacon_len, BROADCAST, 6); // destination
+	beacon_len += 6;
+	if (!lopt.adhoc)
+		memcpy(beacon + beacon_len, apc->bssid, 6); // source
+	else
+		memcpy(beacon + beacon_len, opt.r_smac, 6); // source
+	beacon_len += 6;
+	memcpy(beacon + beacon_len, apc->bssid, 6); // bssid
+	beacon_len += 6;
+	memcpy(beacon + beacon_len, "\x00\x00", 2); // seq+frag
+	beacon_len += 2;
+
+	memcpy(beacon + beacon_len,
+		   "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
+		   12); // fixed information
+
+	beacon[beacon_len + 8]
+		= (uint8_t)((apc->interval * MAX(getESSIDcount(), 1))
+					& 0xFF); // beacon interval
+	beacon[beacon_len + 9] = (uint8_t)(
+		((apc->interval * MAX(getESSIDcount(), 1)) >> 8) & 0xFF);
+	memcpy(beacon + beacon_len + 10, apc->capa, 2); // capability
+	beacon_len += 12;
+
+	beacon[beacon_len] = 0x00; // essid tag
+	beacon[beacon_len + 1] = (uint8_t) essid_len; // essid tag
+	beacon_len += 2;
+	memcpy(beacon + beacon_len, essid, essid_len); // actual essid
+	beacon_len += essid_len;
+
+	memcpy(beacon + beacon_len, RATES, sizeof(RATES) - 1); // rates
+	beacon_len += sizeof(RATES) - 1;
+
+	beacon[beacon_len] = 0x03; // channel tag
+	beacon[beacon_len + 1] = 0x01;
+	temp_channel = wi_get_channel(_wi_in); // current channel
+	if (!invalid_channel_displayed)
+	{
+		if (temp_channel > 255)
+		{
+			// Display error message once
+			invalid_channel_displayed = 1;
+			fprintf(stderr,
+					"Error: Got channel %d, expected a value < 256.\n",
+					temp_channel);
+		}
+		else if (temp_channel < 1)
+		{
+			invalid_channel_displayed = 1;
+			fprintf(stderr,
+					"Error: Got channel %d, expected a value > 0.\n",
+					temp_channel);
+		}
+	}
+	beacon[beacon_len + 2] = (uint8_t)(
+		((temp_channel > 255 || temp_channel < 1) && lopt.channel != 0)
+			? lopt.channel
+			: temp_channel);
+
+	beacon_len += 3;
+
+	if (lopt.allwpa)
+	{
+		memcpy(beacon + beacon_len, ALL_WPA2_TAGS, sizeof(ALL_WPA2_TAGS) - 1);
+		beacon_len += sizeof(ALL_WPA2_TAGS) - 1;
+	}
+	else if (lopt.wpa2type > 0)
+	{
+		memcpy(beacon + beacon_len, WPA2_TAG, 22);
+		beacon[beacon_len + 7] = (uint8_t) lopt.wpa2type;
+		beacon[beacon_len + 13] = (uint8_t) lopt.wpa2type;
+		beacon_len += 22;
+	}
+
+	// Add extended rates
+	memcpy(beacon + beacon_len, EXTENDED_RATES, sizeof(EXTENDED_RATES) - 1);
+	beacon_len += sizeof(EXTENDED_RATES) - 1;
+
+	if (lopt.allwpa)
+	{
+		memcpy(beacon + beacon_len, ALL_WPA1_TAGS, sizeof(ALL_WPA1_TAGS) - 1);
+		beacon_len += sizeof(ALL_WPA1_TAGS) - 1;
+	}
+	else if (lopt.wpa1type > 0)
+	{
+		memcpy(beacon + beacon_len, WPA1_TAG, 24);
+		beacon[beacon_len + 11] = (uint8_t) lopt.wpa1type;
+		beacon[beacon_len + 17] = (uint8_t) lopt.wpa1type;
+		beacon_len += 24;
+	}
+
+	// copy timestamp into beacon; a mod 2^64 counter incremented each
+	// microsecond
+	for (i = 0; i < 8; i++)
+	{
+		beacon[24 + i] = (uint8_t)((timestamp >> (i * 8)) & 0xFF);
+	}
+
+	beacon[22] = (uint8_t)((seq << 4) & 0xFF);
+	beacon[23] = (uint8_t)((seq >> 4) & 0xFF);
+
+	return (beacon_len);
+}
+
+static THREAD_ENTRY(beacon_thread)
+{
+	REQUIRE(arg != NULL);
+
+	struct AP_conf apc;
+	struct timeval tv, tv2;
+	uint8_t beacons[BEACON_BATCH][512];
+	struct wi_frame frames[BEACON_BATCH];
+	int seq = 0, n = 0, nb;
 	float f, ticks[3];
 	ssize_t rc;
 
-	memset(essid, 0, MAX_IE_ELEMENT_SIZE + 1);
 	memcpy(&apc, arg, sizeof(struct AP_conf));
 
 	ticks[0] = 0;
@@ -2828,148 +2970,24 @@ static THREAD_ENTRY(beacon_thread)
 			ticks[2] += f / (1000000.f / RTC_RESOLUTION);
 		}
 
-		if (((double) ticks[2] / (double) RTC_RESOLUTION)
-			>= ((double) apc.interval / 1000.0) * (double) seq)
+		/* one beacon per elapsed interval, sent together if the timer lagged */
+		nb = 0;
+		while (nb < BEACON_BATCH
+			   && ((double) ticks[2] / (double) RTC_RESOLUTION)
+					  >= ((double) apc.interval / 1000.0) * (double) seq)
 		{
-			/* threshold reach, send one frame */
-			//             ticks[2] = 0;
-			fflush(stdout);
-			gettimeofday(&tv1, NULL);
-			timestamp = tv1.tv_sec * 1000000UL + tv1.tv_usec;
-			fflush(stdout);
-
-			/* flush expired ESSID entries */
-			flushESSID();
-			essid_len = (size_t) getNextESSID((char *) essid);
-			if (!essid_len)
-			{
-				strncpy((char *) essid, "default", sizeof(essid) - 1);
-				essid_len = strlen("default");
-			}
-
-			beacon_len = 0;
-
-			memcpy(beacon,
-				   "\x80\x00\x00\x00",
-				   4); // type/subtype/framecontrol/duration
-			beacon_len += 4;
-			memcpy(beacon + beacon_len, BROADCAST, 6); // destination
-			beacon_len += 6;
-			if (!lopt.adhoc)
-				memcpy(beacon + beacon_len, apc.bssid, 6); // source
-			else
-				memcpy(beacon + beacon_len, opt.r_smac, 6); // source
-			beacon_len += 6;
-			memcpy(beacon + beacon_len, apc.bssid, 6); // bssid
-			beacon_len += 6;
-			memcpy(beacon + beacon_len, "\x00\x00", 2); // seq+frag
-			beacon_len += 2;
-
-			memcpy(beacon + beacon_len,
-				   "\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00",
-				   12); // fixed information
-
-			beacon[beacon_len + 8]
-				= (uint8_t)((apc.interval * MAX(getESSIDcount(), 1))
-							& 0xFF); // beacon interval
-			beacon[beacon_len + 9] = (uint8_t)(
-				((apc.interval * MAX(getESSIDcount(), 1)) >> 8) & 0xFF);
-			memcpy(beacon + beacon_len + 10, apc.capa, 2); // capability
-			beacon_len += 12;
-
-			beacon[beacon_len] = 0x00; // essid tag
-			beacon[beacon_len + 1] = (uint8_t) essid_len; // essid tag
-			beacon_len += 2;
-			memcpy(beacon + beacon_len, essid, essid_len); // actual essid
-			beacon_len += essid_len;
-
-			memcpy(beacon + beacon_len, RATES, sizeof(RATES) - 1); // rates
-			beacon_len += sizeof(RATES) - 1;
-
-			beacon[beacon_len] = 0x03; // channel tag
-			beacon[beacon_len + 1] = 0x01;
-			temp_channel = wi_get_channel(_wi_in); // current channel
-			if (!invalid_channel_displayed)
-			{
-				if (temp_channel > 255)
-				{
-					// Display error message once
-					invalid_channel_displayed = 1;
-					fprintf(stderr,
-							"Error: Got channel %d, expected a value < 256.\n",
-							temp_channel);
-				}
-				else if (temp_channel < 1)
-				{
-					invalid_channel_displayed = 1;
-					fprintf(stderr,
-							"Error: Got channel %d, expected a value > 0.\n",
-							temp_channel);
-				}
-			}
-			beacon[beacon_len + 2] = (uint8_t)(
-				((temp_channel > 255 || temp_channel < 1) && lopt.channel != 0)
-					? lopt.channel
-					: temp_channel);
-
-			beacon_len += 3;
-
-			if (lopt.allwpa)
-			{
-				memcpy(beacon + beacon_len,
-					   ALL_WPA2_TAGS,
-					   sizeof(ALL_WPA2_TAGS) - 1);
-				beacon_len += sizeof(ALL_WPA2_TAGS) - 1;
-			}
-			else if (lopt.wpa2type > 0)
-			{
-				memcpy(beacon + beacon_len, WPA2_TAG, 22);
-				beacon[beacon_len + 7] = (uint8_t) lopt.wpa2type;
-				beacon[beacon_len + 13] = (uint8_t) lopt.wpa2type;
-				beacon_len += 22;
-			}
-
-			// Add extended rates
-			memcpy(beacon + beacon_len,
-				   EXTENDED_RATES,
-				   sizeof(EXTENDED_RATES) - 1);
-			beacon_len += sizeof(EXTENDED_RATES) - 1;
-
-			if (lopt.allwpa)
-			{
-				memcpy(beacon + beacon_len,
-					   ALL_WPA1_TAGS,
-					   sizeof(ALL_WPA1_TAGS) - 1);
-				beacon_len += sizeof(ALL_WPA1_TAGS) - 1;
-			}
-			else if (lopt.wpa1type > 0)
-			{
-				memcpy(beacon + beacon_len, WPA1_TAG, 24);
-				beacon[beacon_len + 11] = (uint8_t) lopt.wpa1type;
-				beacon[beacon_len + 17] = (uint8_t) lopt.wpa1type;
-				beacon_len += 24;
-			}
-
-			// copy timestamp into beacon; a mod 2^64 counter incremented each
-			// microsecond
-			for (i = 0; i < 8; i++)
-			{
-				beacon[24 + i] = (uint8_t)((timestamp >> (i * 8)) & 0xFF);
-			}
-
-			beacon[22] = (uint8_t)((seq << 4) & 0xFF);
-			beacon[23] = (uint8_t)((seq >> 4) & 0xFF);
-
 			fflush(stdout);
-
-			if (my_send_packet(beacon, beacon_len) < 0)
-			{
-				printf("Error sending beacon!\n");
-				return (NULL);
-			}
-
+			frames[nb].h80211 = beacons[nb];
+			frames[nb].len = (int) build_beacon(&apc, beacons[nb], seq);
+			nb++;
 			seq++;
 		}
+
+		if (nb > 0 && my_send_packets(frames, nb) < 0)
+		{
+			printf("Error sending beacon!\n");
+			return (NULL);
+		}
 	}
 
 	return (NULL);
@@ -149,14 +149,12 @@ static c_avl_tree_t * access_points = NULL;
 static c_avl_tree_t * targets = NULL;
 static pthread_mutex_t mx_apl; /* lock write access to ap LL   */
 static pthread_mutex_t mx_eof; /* lock write access to nb_eof  */
-static pthread_mutex_t mx_ivb; /* lock access to ivbuf array   */
+static pthread_mutex_t mx_ivb; /* lock access to IV chunk list */
 static pthread_mutex_t mx_dic; /* lock access to opt.dict      */
 static pthread_cond_t cv_eof; /* read EOF condition variable  */
 static int nb_eof = 0; /* # of threads who reached eof */
 static volatile long nb_pkt = 0; /* # of packets read so far     */
 static volatile long nb_prev_pkt = 0; /* # of packets read in prior pass */
-static int mc_pipe[256][2]; /* master->child control pipe   */
-static int cm_pipe[256][2]; /* child->master results pipe   */
 static int bf_pipe[256][2]; /* bruteforcer 'queue' pipe	 */
 static int bf_nkeys[256];
 static unsigned char bf_wepkey[64];
@@ -170,6 +168,7 @@ static struct WPA_data wpa_data[MAX_THREADS];
 static volatile int wpa_wordlists_done = 0;
 static pthread_mutex_t mx_nb = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t mx_wpastats = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t mx_key = PTHREAD_MUTEX_INITIALIZER; /* key_found() */
 static ac_cpuset_t * cpuset = NULL;
 
 typedef struct
@@ -188,12 +187,82 @@ typedef struct
 	int off2;
 	void * buf1;
 	void * buf2;
+	off_t pos; /* bytes consumed from the file */
 } read_buf;
 
+/* how far a capture file was read, saved along with the PTW states */
+struct ptw_input
+{
+	char * path;
+	off_t pos;
+};
+
+/* capture files of this run, protected by mx_apl */
+static struct ptw_input ptw_inputs[MAX_THREADS];
+static int nb_ptw_inputs = 0;
+
+static void ptw_inputs_free(struct ptw_input * inputs, int nb)
+{
+	int i;
+
+	for (i = 0; i < nb; i++) free(inputs[i].path);
+}
+
 static int K_COEFF[N_ATTACKS]
 	= {15, 13, 12, 12, 12, 5, 5, 5, 3, 4, 3, 4, 3, 13, 4, 4, -20};
 
+/* range of IVs a KoreK thread computes the votes of keybyte B over */
+
+typedef struct
+{
+	int B;
+	long first;
+	long last;
+} korek_job;
+
+/* raw KoreK votes for a key prefix, over the first nb_ivs IVs; the IV list
+ * only ever grows, so new IVs are folded in instead of recomputing them all */
+
+#define KOREK_CACHE_SIZE 1024
+
+typedef struct
+{
+	int B;
+	unsigned char prefix[64];
+	long nb_ivs;
+	int votes[N_ATTACKS][256];
+} korek_votes;
+
+static korek_votes * korek_cache[KOREK_CACHE_SIZE];
+
+/* the KoreK threads share one job at a time: each of them claims the next
+ * KOREK_CHUNK IVs of the range until none are left, and adds their votes to
+ * its own table, which the master sums up once every thread is done */
+
+#define KOREK_CHUNK 4096
+
+static struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cv_job; /* a job was posted, or exiting  */
+	pthread_cond_t cv_done; /* all threads are done with it  */
+	korek_job job; /* the job being worked on       */
+	unsigned long seq; /* # of jobs posted so far       */
+	long next; /* first IV not claimed yet      */
+	int pending; /* # of threads still on the job */
+	int (*votes)[N_ATTACKS][256]; /* one vote table per thread     */
+} korek_pool = {PTHREAD_MUTEX_INITIALIZER,
+				PTHREAD_COND_INITIALIZER,
+				PTHREAD_COND_INITIALIZER,
+				{0, 0, 0},
+				0,
+				0,
+				0,
+				NULL};
+
 static int PTW_DEFAULTWEIGHT[1] = {256};
+
+#define PTW_PENDING 4096
 static int PTW_DEFAULTBF[PTW_KEYHSBYTES]
 	= {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -257,6 +326,7 @@ static const char usage[]
 	  "      -D         : WEP decloak, skips broken keystreams\n"
 	  "      -P <num>   : PTW debug:  1: disable Klein, 2: PTW\n"
 	  "      -1         : run only 1 try to crack key with PTW\n"
+	  "      --ptw-state <dir> : keep the PTW state of each AP in dir\n"
 	  "      -V         : run in visual inspection mode\n"
 	  "\n"
 	  "  WEP and WPA-PSK cracking options:\n"
@@ -356,7 +426,7 @@ static void destroy_ap(struct AP_info * ap)
 
 	struct ST_info * st_tmp = NULL;
 
-	destroy(ap->ivbuf, free);
+	ivbuf_clear(&ap->ivbuf);
 
 	if (ap->stations != NULL)
 	{
@@ -373,11 +443,12 @@ static void destroy_ap(struct AP_info * ap)
 
 	destroy(ap->uiv_root, uniqueiv_wipe);
 
-	if (ap->ptw_clean) destroy(ap->ptw_clean->allsessions, free);
-	destroy(ap->ptw_clean, free);
+	destroy(ap->ptw_clean, PTW_freeattackstate);
+	destroy(ap->ptw_vague, PTW_freeattackstate);
+	destroy(ap->ptw_pending, free);
 
-	if (ap->ptw_vague) destroy(ap->ptw_vague->allsessions, free);
-	destroy(ap->ptw_vague, free);
+	ptw_inputs_free(ap->ptw_inputs, ap->nb_ptw_inputs);
+	destroy(ap->ptw_inputs, free);
 }
 
 static void ac_aplist_free(void)
@@ -446,24 +517,11 @@ add_wep_iv(struct AP_info * ap, unsigned char * buffer, packet_reader_t * me)
 		{
 			/* add the IV & first two encrypted bytes */
 
-			long n = ap->nb_ivs * 5;
-
-			if (n + 5 > ap->ivbuf_size || ap->ivbuf == NULL)
+			if (ivbuf_append(&ap->ivbuf, buffer) != 0)
 			{
-				/* enlarge the IVs buffer */
-
-				ap->ivbuf_size += 131072;
-				uint8_t * tmp_ivbuf
-					= realloc(ap->ivbuf, (size_t) ap->ivbuf_size);
-				if (tmp_ivbuf == NULL)
-				{
-					perror("realloc failed");
-					return (-1);
-				}
-				ap->ivbuf = tmp_ivbuf;
+				perror("malloc failed");
+				return (-1);
 			}
-
-			memcpy(ap->ivbuf + n, buffer, 5);
 		}
 
 		uniqueiv_mark(ap->uiv_root, buffer);
@@ -473,6 +531,339 @@ add_wep_iv(struct AP_info * ap, unsigned char * buffer, packet_reader_t * me)
 	return (0);
 }
 
+/* hand the sessions read from IVS files over to both PTW attacks, with
+ * the access point list locked */
+
+static void ptw_flush(struct AP_info * ap_cur)
+{
+	REQUIRE(ap_cur != NULL);
+
+	if (ap_cur->nb_ptw_pending == 0) return;
+
+	ap_cur->nb_ivs_clean += PTW_addsessions(
+		ap_cur->ptw_clean, ap_cur->ptw_pending, ap_cur->nb_ptw_pending, NULL);
+	ap_cur->nb_ivs_vague += PTW_addsessions(
+		ap_cur->ptw_vague, ap_cur->ptw_pending, ap_cur->nb_ptw_pending, NULL);
+
+	ap_cur->nb_ptw_pending = 0;
+}
+
+static void ptw_flush_all(void)
+{
+	struct AP_info * ap_cur;
+	void * key;
+
+	c_avl_iterator_t * it = c_avl_get_iterator(access_points);
+	while (c_avl_iterator_next(it, &key, (void **) &ap_cur) == 0)
+		ptw_flush(ap_cur);
+	c_avl_iterator_destroy(it);
+}
+
+/* the PTW attacks of an AP are saved to <dir>/<BSSID>.ptw, so that a new
+ * run only has to add the IVs it did not know yet */
+
+#define PTW_STATE_INTERVAL 30 /* seconds between two saves of an AP */
+
+#define PTW_STATE_HEADER_VERSION 1
+
+/* copy of the state of an AP, written out without holding mx_apl
+ *
+ * The file starts with PTW_STATEEXTMAGIC and the length of the header:
+ * its version, crypt, essid and the capture files with the offset up to
+ * which their IVs are in the states. Both states follow. */
+struct ptw_snapshot
+{
+	uint8_t bssid[ETHER_ADDR_LEN];
+	uint32_t crypt;
+	uint8_t essid[ESSID_LENGTH + 1];
+	struct ptw_input * inputs;
+	int nb_inputs;
+	PTW_attackstate * clean;
+	PTW_attackstate * vague;
+};
+
+static void ptw_state_path(char * path, size_t len, const uint8_t * bssid)
+{
+	snprintf(path,
+			 len,
+			 "%s/%02X-%02X-%02X-%02X-%02X-%02X.ptw",
+			 opt.ptw_state,
+			 bssid[0],
+			 bssid[1],
+			 bssid[2],
+			 bssid[3],
+			 bssid[4],
+			 bssid[5]);
+}
+
+static long ptw_count_ivs(const PTW_attackstate * state)
+{
+	long count = 0;
+	size_t i;
+
+	for (i = 0; i < PTW_IVTABLELEN; i++)
+		count += __builtin_popcount(state->seen_iv[i]);
+
+	return (count);
+}
+
+/* reads the header of a state file, files without one are rewound */
+static int ptw_state_read_header(FILE * f, struct ptw_snapshot * snap)
+{
+	REQUIRE(f != NULL);
+	REQUIRE(snap != NULL);
+
+	char magic[4];
+	uint32_t len, version, nb, path_len;
+	int64_t pos;
+	int i;
+
+	if (fread(magic, sizeof(magic), 1, f) != 1) return (-1);
+
+	if (memcmp(magic, PTW_STATEEXTMAGIC, sizeof(magic)) != 0)
+	{
+		rewind(f);
+		return (0);
+	}
+
+	if (fread(&len, sizeof(len), 1, f) != 1
+		|| fread(&version, sizeof(version), 1, f) != 1
+		|| version != PTW_STATE_HEADER_VERSION
+		|| fread(&snap->crypt, sizeof(snap->crypt), 1, f) != 1
+		|| fread(snap->essid, sizeof(snap->essid), 1, f) != 1
+		|| fread(&nb, sizeof(nb), 1, f) != 1 || nb > MAX_THREADS)
+		return (-1);
+
+	snap->essid[ESSID_LENGTH] = '\0';
+	snap->inputs = calloc(nb ? nb : 1, sizeof(struct ptw_input));
+	ALLEGE(snap->inputs != NULL);
+
+	for (i = 0; i < (int) nb; i++)
+	{
+		struct ptw_input * input = &snap->inputs[i];
+
+		if (fread(&path_len, sizeof(path_len), 1, f) != 1
+			|| path_len >= PATH_MAX)
+			return (-1);
+
+		input->path = calloc(1, path_len + 1);
+		ALLEGE(input->path != NULL);
+		snap->nb_inputs++;
+
+		if (fread(input->path, 1, path_len, f) != path_len
+			|| fread(&pos, sizeof(pos), 1, f) != 1)
+			return (-1);
+
+		input->pos = (off_t) pos;
+	}
+
+	return (0);
+}
+
+static void ptw_state_load(struct AP_info * ap_cur)
+{
+	REQUIRE(ap_cur != NULL);
+
+	char path[PATH_MAX];
+	struct ptw_snapshot snap;
+	PTW_attackstate *clean = NULL, *vague = NULL;
+	FILE * f;
+
+	ptw_state_path(path, sizeof(path), ap_cur->bssid);
+
+	if ((f = fopen(path, "rb")) == NULL) return;
+
+	memset(&snap, 0, sizeof(snap));
+
+	if (ptw_state_read_header(f, &snap) == 0)
+	{
+		clean = PTW_loadstate(f);
+		vague = (clean != NULL) ? PTW_loadstate(f) : NULL;
+	}
+
+	fclose(f);
+
+	if (vague == NULL)
+	{
+		fprintf(stderr,
+				"Ignoring %s: damaged or saved by another version.\n",
+				path);
+		PTW_freeattackstate(clean);
+		ptw_inputs_free(snap.inputs, snap.nb_inputs);
+		free(snap.inputs);
+		return;
+	}
+
+	clean->threads = ap_cur->ptw_clean->threads;
+	vague->threads = ap_cur->ptw_vague->threads;
+
+	PTW_freeattackstate(ap_cur->ptw_clean);
+	PTW_freeattackstate(ap_cur->ptw_vague);
+
+	ap_cur->ptw_clean = clean;
+	ap_cur->ptw_vague = vague;
+	ap_cur->nb_ivs_clean = ptw_count_ivs(clean);
+	ap_cur->nb_ivs_vague = ptw_count_ivs(vague);
+
+	/* the frames telling these may be in the part that is skipped */
+	if (ap_cur->crypt == (unsigned int) -1 && snap.crypt != 0)
+		ap_cur->crypt = snap.crypt;
+	if (ap_cur->essid[0] == '\0')
+		memcpy(ap_cur->essid, snap.essid, sizeof(ap_cur->essid));
+
+	ap_cur->ptw_inputs = snap.inputs;
+	ap_cur->nb_ptw_inputs = snap.nb_inputs;
+}
+
+/* the offset up to which the saved state of an AP holds a file */
+static off_t ptw_state_offset(struct AP_info * ap_cur, const char * path)
+{
+	REQUIRE(ap_cur != NULL);
+	REQUIRE(path != NULL);
+
+	int i;
+
+	for (i = 0; i < ap_cur->nb_ptw_inputs; i++)
+		if (strcmp(ap_cur->ptw_inputs[i].path, path) == 0)
+			return (ap_cur->ptw_inputs[i].pos);
+
+	return (0);
+}
+
+/* takes a snapshot of the state, the caller holds mx_apl */
+static int ptw_state_snapshot(struct AP_info * ap_cur,
+							  struct ptw_snapshot * snap)
+{
+	REQUIRE(ap_cur != NULL);
+	REQUIRE(snap != NULL);
+
+	time_t now = time(NULL);
+	int i, j;
+
+	if (ap_cur->ptw_clean == NULL || ap_cur->ptw_vague == NULL) return (0);
+
+	if (ap_cur->ptw_saved != 0
+		&& now - ap_cur->ptw_saved < PTW_STATE_INTERVAL)
+		return (0);
+
+	ap_cur->ptw_saved = now;
+
+	memcpy(snap->bssid, ap_cur->bssid, ETHER_ADDR_LEN);
+	memcpy(snap->essid, ap_cur->essid, sizeof(snap->essid));
+	snap->crypt = ap_cur->crypt;
+	snap->clean = PTW_copyattackstate(ap_cur->ptw_clean);
+	snap->vague = PTW_copyattackstate(ap_cur->ptw_vague);
+
+	/* the files of this run, and those of the loaded state this run did
+	 * not read as far */
+	snap->inputs = calloc((size_t) (nb_ptw_inputs + ap_cur->nb_ptw_inputs) + 1,
+						  sizeof(struct ptw_input));
+	ALLEGE(snap->inputs != NULL);
+	snap->nb_inputs = 0;
+
+	for (i = 0; i < nb_ptw_inputs; i++)
+	{
+		snap->inputs[snap->nb_inputs].path = strdup(ptw_inputs[i].path);
+		ALLEGE(snap->inputs[snap->nb_inputs].path != NULL);
+		snap->inputs[snap->nb_inputs].pos = MAX(
+			ptw_inputs[i].pos, ptw_state_offset(ap_cur, ptw_inputs[i].path));
+		snap->nb_inputs++;
+	}
+
+	for (i = 0; i < ap_cur->nb_ptw_inputs; i++)
+	{
+		for (j = 0; j < nb_ptw_inputs; j++)
+			if (strcmp(ap_cur->ptw_inputs[i].path, ptw_inputs[j].path) == 0)
+				break;
+		if (j < nb_ptw_inputs) continue;
+
+		snap->inputs[snap->nb_inputs].path = strdup(ap_cur->ptw_inputs[i].path);
+		ALLEGE(snap->inputs[snap->nb_inputs].path != NULL);
+		snap->inputs[snap->nb_inputs].pos = ap_cur->ptw_inputs[i].pos;
+		snap->nb_inputs++;
+	}
+
+	return (1);
+}
+
+static int ptw_state_write_header(FILE * f, const struct ptw_snapshot * snap)
+{
+	REQUIRE(f != NULL);
+	REQUIRE(snap != NULL);
+
+	uint32_t len, version = PTW_STATE_HEADER_VERSION, nb, path_len;
+	int64_t pos;
+	int i;
+
+	len = sizeof(version) + sizeof(snap->crypt) + sizeof(snap->essid)
+		  + sizeof(nb);
+	for (i = 0; i < snap->nb_inputs; i++)
+		len += sizeof(path_len) + strlen(snap->inputs[i].path) + sizeof(pos);
+
+	nb = (uint32_t) snap->nb_inputs;
+
+	if (fwrite(PTW_STATEEXTMAGIC, 4, 1, f) != 1
+		|| fwrite(&len, sizeof(len), 1, f) != 1
+		|| fwrite(&version, sizeof(version), 1, f) != 1
+		|| fwrite(&snap->crypt, sizeof(snap->crypt), 1, f) != 1
+		|| fwrite(snap->essid, sizeof(snap->essid), 1, f) != 1
+		|| fwrite(&nb, sizeof(nb), 1, f) != 1)
+		return (-1);
+
+	for (i = 0; i < snap->nb_inputs; i++)
+	{
+		path_len = (uint32_t) strlen(snap->inputs[i].path);
+		pos = (int64_t) snap->inputs[i].pos;
+
+		if (fwrite(&path_len, sizeof(path_len), 1, f) != 1
+			|| fwrite(snap->inputs[i].path, 1, path_len, f) != path_len
+			|| fwrite(&pos, sizeof(pos), 1, f) != 1)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/* writes and frees a snapshot, without holding mx_apl */
+static void ptw_state_save(struct ptw_snapshot * snap)
+{
+	REQUIRE(snap != NULL);
+
+	char path[PATH_MAX];
+	char tmp[PATH_MAX + 4];
+	FILE * f;
+	int rc = -1;
+
+	ptw_state_path(path, sizeof(path), snap->bssid);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	if ((f = fopen(tmp, "wb")) == NULL)
+		perror("fopen(PTW state) failed");
+	else
+	{
+		rc = ptw_state_write_header(f, snap);
+		if (rc == 0) rc = PTW_savestate(snap->clean, f);
+		if (rc == 0) rc = PTW_savestate(snap->vague, f);
+		if (fclose(f) != 0) rc = -1;
+
+		/* the previous state stays in place until this one is complete */
+		if (rc != 0 || rename(tmp, path) != 0)
+		{
+			fprintf(stderr, "Failed to save the PTW state to %s\n", path);
+			unlink(tmp);
+		}
+	}
+
+	PTW_freeattackstate(snap->clean);
+	PTW_freeattackstate(snap->vague);
+	snap->clean = NULL;
+	snap->vague = NULL;
+
+	ptw_inputs_free(snap->inputs, snap->nb_inputs);
+	destroy(snap->inputs, free);
+	snap->nb_inputs = 0;
+}
+
 static int parse_ivs2(struct AP_info * ap_cur,
 					  struct ivs2_pkthdr * pivs2,
 					  unsigned char * buffer,
@@ -484,7 +875,6 @@ static int parse_ivs2(struct AP_info * ap_cur,
 
 	int weight[16];
 	struct ivs2_pkthdr ivs2 = *pivs2;
-	long n = 0;
 
 	if (ivs2.flags & IVS2_ESSID)
 	{
@@ -502,19 +892,22 @@ static int parse_ivs2(struct AP_info * ap_cur,
 
 			if (clearsize < opt.keylen + 3) return (-2);
 
-			if (PTW_addsession(ap_cur->ptw_clean,
-							   buffer,
-							   buffer + 4,
-							   PTW_DEFAULTWEIGHT,
-							   1))
-				ap_cur->nb_ivs_clean++;
-
-			if (PTW_addsession(ap_cur->ptw_vague,
-							   buffer,
-							   buffer + 4,
-							   PTW_DEFAULTWEIGHT,
-							   1))
-				ap_cur->nb_ivs_vague++;
+			/* queued, to be added to the attacks a block at a time */
+
+			if (ap_cur->ptw_pending == NULL)
+			{
+				ap_cur->ptw_pending = malloc(PTW_PENDING * sizeof(PTW_session));
+				ALLEGE(ap_cur->ptw_pending != NULL);
+			}
+
+			PTW_session * session
+				= &ap_cur->ptw_pending[ap_cur->nb_ptw_pending++];
+
+			memcpy(session->iv, buffer, PTW_IVBYTES);
+			memcpy(session->keystream, buffer + 4, PTW_KSBYTES);
+			session->weight = PTW_DEFAULTWEIGHT[0];
+
+			if (ap_cur->nb_ptw_pending == PTW_PENDING) ptw_flush(ap_cur);
 
 			return (-2);
 		}
@@ -533,24 +926,11 @@ static int parse_ivs2(struct AP_info * ap_cur,
 			{
 				/* add the IV & first two encrypted bytes */
 
-				n = ap_cur->nb_ivs * 5;
-
-				if (n + 5 > ap_cur->ivbuf_size)
+				if (ivbuf_append(&ap_cur->ivbuf, buffer) != 0)
 				{
-					/* enlarge the IVs buffer */
-
-					ap_cur->ivbuf_size += 131072;
-					uint8_t * tmp_ivbuf
-						= realloc(ap_cur->ivbuf, (size_t) ap_cur->ivbuf_size);
-					if (tmp_ivbuf == NULL)
-					{
-						perror("realloc failed");
-						return (-1);
-					}
-					ap_cur->ivbuf = tmp_ivbuf;
+					perror("malloc failed");
+					return (-1);
 				}
-
-				memcpy(ap_cur->ivbuf + n, buffer, 5);
 			}
 			uniqueiv_mark(ap_cur->uiv_root, buffer);
 			ap_cur->nb_ivs++;
@@ -597,24 +977,11 @@ static int parse_ivs2(struct AP_info * ap_cur,
 			{
 				/* add the IV & first two encrypted bytes */
 
-				n = ap_cur->nb_ivs * 5;
-
-				if (n + 5 > ap_cur->ivbuf_size)
+				if (ivbuf_append(&ap_cur->ivbuf, buffer) != 0)
 				{
-					/* enlarge the IVs buffer */
-
-					ap_cur->ivbuf_size += 131072;
-					uint8_t * tmp_ivbuf
-						= realloc(ap_cur->ivbuf, (size_t) ap_cur->ivbuf_size);
-					if (tmp_ivbuf == NULL)
-					{
-						perror("realloc failed");
-						return (-1);
-					}
-					ap_cur->ivbuf = tmp_ivbuf;
+					perror("malloc failed");
+					return (-1);
 				}
-
-				memcpy(ap_cur->ivbuf + n, buffer, 5);
 			}
 			uniqueiv_mark(ap_cur->uiv_root, buffer);
 			ap_cur->nb_ivs++;
@@ -658,22 +1025,20 @@ static __attribute__((noinline)) void clean_exit(int ret)
 		ALLEGE(pthread_mutex_unlock(&mx_dic) == 0);
 	}
 
+	/* wake up the KoreK threads waiting for a job */
+
+	ALLEGE(pthread_mutex_lock(&korek_pool.lock) == 0);
+	ALLEGE(pthread_cond_broadcast(&korek_pool.cv_job) == 0);
+	ALLEGE(pthread_mutex_unlock(&korek_pool.lock) == 0);
+
 	for (i = 0; i < opt.nbcpu; i++)
 	{
 #ifndef CYGWIN
-		if (mc_pipe[i][1] != -1)
-			safe_write(mc_pipe[i][1], (void *) "EXIT\r", 5);
 		if (bf_pipe[i][1] != -1) safe_write(bf_pipe[i][1], (void *) tmpbuf, 64);
 #endif
-		if (mc_pipe[i][0] != -1) close(mc_pipe[i][0]);
-		if (mc_pipe[i][1] != -1) close(mc_pipe[i][1]);
-		if (cm_pipe[i][0] != -1) close(cm_pipe[i][0]);
-		if (cm_pipe[i][1] != -1) close(cm_pipe[i][1]);
 		if (bf_pipe[i][0] != -1) close(bf_pipe[i][0]);
 		if (bf_pipe[i][1] != -1) close(bf_pipe[i][1]);
 
-		mc_pipe[i][0] = mc_pipe[i][1] = -1;
-		cm_pipe[i][0] = cm_pipe[i][1] = -1;
 		bf_pipe[i][0] = bf_pipe[i][1] = -1;
 	}
 
@@ -719,12 +1084,21 @@ static __attribute__((noinline)) void clean_exit(int ret)
 		}
 	}
 
-	destroy(wep.ivbuf, free);
+	destroy(wep.ivchunks, free);
+
+	for (i = 0; i < KOREK_CACHE_SIZE; i++) destroy(korek_cache[i], free);
+
+	destroy(korek_pool.votes, free);
 
 	destroy(opt.logKeyToFile, free);
+	destroy(opt.ptw_state, free);
+	ptw_inputs_free(ptw_inputs, nb_ptw_inputs);
+	nb_ptw_inputs = 0;
 
 	ac_aplist_free();
 
+	ivbuf_arena_free();
+
 	destroy(access_points, c_avl_destroy);
 
 	destroy(targets, c_avl_destroy);
@@ -1231,6 +1605,7 @@ static int atomic_read(read_buf * rb, int fd, int len, void * buf)
 	{
 		memcpy(buf, (char *) rb->buf1 + rb->off1, (size_t) len);
 		rb->off1 += len;
+		rb->pos += len;
 		return (1);
 	}
 	else
@@ -1256,6 +1631,7 @@ static int atomic_read(read_buf * rb, int fd, int len, void * buf)
 		{
 			memcpy(buf, (char *) rb->buf1 + rb->off1, (size_t) len);
 			rb->off1 += len;
+			rb->pos += len;
 			return (1);
 		}
 		else
@@ -1819,6 +2195,60 @@ skip_station:
 	return (0);
 }
 
+/* creates an access point and adds it to the list, the caller holds mx_apl
+ * Returns NULL if memory ran out */
+static struct AP_info * ap_create(const uint8_t * bssid)
+{
+	REQUIRE(bssid != NULL);
+
+	struct AP_info * ap_cur;
+
+	if (!(ap_cur = (struct AP_info *) malloc(sizeof(struct AP_info))))
+	{
+		perror("malloc failed");
+		return (NULL);
+	}
+
+	memset(ap_cur, 0, sizeof(struct AP_info));
+	memcpy(ap_cur->bssid, bssid, ETHER_ADDR_LEN);
+
+	ap_cur->crypt = -1;
+
+	// Shortcut to set encryption:
+	// - WEP is 2 for 'crypt' and 1 for 'amode'.
+	// - WPA is 3 for 'crypt' and 2 for 'amode'.
+	if (opt.forced_amode) ap_cur->crypt = opt.amode + 1;
+
+	if (opt.do_ptw == 1)
+	{
+		ap_cur->ptw_clean = PTW_newattackstate();
+		if (!ap_cur->ptw_clean)
+		{
+			perror("PTW_newattackstate()");
+			free(ap_cur);
+			return (NULL);
+		}
+
+		ap_cur->ptw_vague = PTW_newattackstate();
+		if (!ap_cur->ptw_vague)
+		{
+			perror("PTW_newattackstate()");
+			free(ap_cur);
+			return (NULL);
+		}
+
+		/* votes of large IVS batches are counted on -p threads */
+		ap_cur->ptw_clean->threads = opt.nbcpu;
+		ap_cur->ptw_vague->threads = opt.nbcpu;
+
+		if (opt.ptw_state != NULL) ptw_state_load(ap_cur);
+	}
+	ap_cur->stations = c_avl_create(station_compare);
+	append_ap(ap_cur);
+
+	return (ap_cur);
+}
+
 /**
  * Process a single packet, to extract useful access point data.
  *
@@ -1942,44 +2372,7 @@ static int packet_reader_process_packet(packet_reader_t * me,
 	/* if it's a new access point, add it */
 	if (not_found)
 	{
-		if (!(*ap_cur = (struct AP_info *) malloc(sizeof(struct AP_info))))
-		{
-			perror("malloc failed");
-			return (-1);
-		}
-
-		memset((*ap_cur), 0, sizeof(struct AP_info));
-		memcpy((*ap_cur)->bssid, bssid, ETHER_ADDR_LEN);
-
-		(*ap_cur)->crypt = -1;
-
-		// Shortcut to set encryption:
-		// - WEP is 2 for 'crypt' and 1 for 'amode'.
-		// - WPA is 3 for 'crypt' and 2 for 'amode'.
-		if (opt.forced_amode) (*ap_cur)->crypt = opt.amode + 1;
-
-		if (opt.do_ptw == 1)
-		{
-			(*ap_cur)->ptw_clean = PTW_newattackstate();
-			if (!(*ap_cur)->ptw_clean)
-			{
-				perror("PTW_newattackstate()");
-				free(*ap_cur);
-				*ap_cur = NULL;
-				return (-1);
-			}
-
-			(*ap_cur)->ptw_vague = PTW_newattackstate();
-			if (!(*ap_cur)->ptw_vague)
-			{
-				perror("PTW_newattackstate()");
-				free(*ap_cur);
-				*ap_cur = NULL;
-				return (-1);
-			}
-		}
-		(*ap_cur)->stations = c_avl_create(station_compare);
-		append_ap(*ap_cur);
+		if ((*ap_cur = ap_create(bssid)) == NULL) return (-1);
 	}
 
 	int rv = packet_reader__update_ap_info(
@@ -2002,10 +2395,80 @@ static int packet_reader_process_packet(packet_reader_t * me,
 	return (0);
 }
 
-/**
- * Thread controlling the processing of packet data from a file or stream.
- *
- * This thread is called in one of two possible ways:
+/* registers a capture file in ptw_inputs, returns its index or -1 */
+static int ptw_input_add(const char * filename)
+{
+	REQUIRE(filename != NULL);
+
+	char path[PATH_MAX];
+	int i;
+
+	if (realpath(filename, path) == NULL) return (-1);
+
+	ALLEGE(pthread_mutex_lock(&mx_apl) == 0);
+
+	for (i = 0; i < nb_ptw_inputs; i++)
+		if (strcmp(ptw_inputs[i].path, path) == 0) break;
+
+	if (i == MAX_THREADS)
+		i = -1;
+	else if (i == nb_ptw_inputs)
+	{
+		ptw_inputs[i].path = strdup(path);
+		ALLEGE(ptw_inputs[i].path != NULL);
+		ptw_inputs[i].pos = 0;
+		nb_ptw_inputs++;
+	}
+
+	ALLEGE(pthread_mutex_unlock(&mx_apl) == 0);
+
+	return (i);
+}
+
+/* skips the part of a file the saved state of the target AP holds */
+static void
+ptw_state_resume(int input, int fd, read_buf * rb, const char * filename)
+{
+	REQUIRE(input >= 0);
+	REQUIRE(rb != NULL);
+	REQUIRE(filename != NULL);
+
+	struct AP_info * ap_cur = NULL;
+	struct stat st;
+	char path[PATH_MAX];
+	off_t pos = 0;
+
+	ptw_state_path(path, sizeof(path), opt.bssid);
+
+	ALLEGE(pthread_mutex_lock(&mx_apl) == 0);
+	if (c_avl_get(access_points, opt.bssid, (void **) &ap_cur) != 0)
+		ap_cur = (access(path, R_OK) == 0) ? ap_create(opt.bssid) : NULL;
+	if (ap_cur != NULL) pos = ptw_state_offset(ap_cur, ptw_inputs[input].path);
+	ALLEGE(pthread_mutex_unlock(&mx_apl) == 0);
+
+	/* a file shorter than the offset is not the one that was read */
+	if (pos <= rb->pos || fstat(fd, &st) != 0 || st.st_size < pos
+		|| lseek(fd, pos, SEEK_SET) != pos)
+		return;
+
+	rb->off1 = 0;
+	rb->off2 = 0;
+	rb->pos = pos;
+
+	ALLEGE(pthread_mutex_lock(&mx_apl) == 0);
+	if (pos > ptw_inputs[input].pos) ptw_inputs[input].pos = pos;
+	ALLEGE(pthread_mutex_unlock(&mx_apl) == 0);
+
+	if (!opt.is_quiet)
+		printf("Resuming %s at byte %lld from the saved PTW state\n",
+			   filename,
+			   (long long) pos);
+}
+
+/**
+ * Thread controlling the processing of packet data from a file or stream.
+ *
+ * This thread is called in one of two possible ways:
  *
  * a. With a BSSID specified from the command-line parameters.
  *
@@ -2047,6 +2510,7 @@ static THREAD_ENTRY(packet_reader_thread)
 	struct pcap_pkthdr pkh = {0};
 	struct pcap_file_header pfh = {0};
 	struct AP_info * ap_cur = NULL;
+	int input = -1;
 
 	REQUIRE(request->filename != NULL);
 	REQUIRE((request->mode == PACKET_READER_CHECK_MODE)
@@ -2084,6 +2548,9 @@ static THREAD_ENTRY(packet_reader_thread)
 					strerror(errno));
 			goto read_fail;
 		}
+
+		if (opt.ptw_state != NULL && opt.do_ptw == 1)
+			input = ptw_input_add(request->filename);
 	}
 
 	if (!atomic_read(&rb, fd, 4, &pfh))
@@ -2181,6 +2648,11 @@ static THREAD_ENTRY(packet_reader_thread)
 		}
 	}
 
+	/* with -b, only the IVs the saved state misses are read again */
+	if (input >= 0 && request->mode == PACKET_READER_READ_MODE
+		&& opt.bssid_set && (fmt == FORMAT_CAP || fmt == FORMAT_IVS2))
+		ptw_state_resume(input, fd, &rb, request->filename);
+
 	while (1)
 	{
 		if (close_aircrack) break;
@@ -2301,6 +2773,9 @@ static THREAD_ENTRY(packet_reader_thread)
 		int rv = packet_reader_process_packet(
 			request, bssid, dest, fmt, buffer, h80211, &ivs2, &pkh, &ap_cur);
 
+		if (input >= 0 && rb.pos > ptw_inputs[input].pos)
+			ptw_inputs[input].pos = rb.pos;
+
 		ALLEGE(pthread_mutex_unlock(&mx_apl) == 0);
 
 		if (rv < 0)
@@ -2328,6 +2803,10 @@ static THREAD_ENTRY(packet_reader_thread)
 	}
 
 done_reading:
+	ALLEGE(pthread_mutex_lock(&mx_apl) == 0);
+	ptw_flush_all();
+	ALLEGE(pthread_mutex_unlock(&mx_apl) == 0);
+
 	++nb_eof;
 
 read_fail:
@@ -2426,280 +2905,426 @@ static ssize_t safe_write(int fd, void * buf, size_t len)
 	return (sum);
 }
 
-/* each thread computes the votes over a subset of the IVs */
+/* position of a reader within the chunks of IVs being cracked */
 
-static THREAD_ENTRY(crack_wep_thread)
+typedef struct
 {
-	long xv, min, max;
-	unsigned char jj[256] = {0};
-	unsigned char S[256], Si[256];
-	unsigned char K[64];
+	size_t chunk;
+	long idx;
+} wep_iv_cursor;
 
-	unsigned char io1, o1, io2, o2;
-	unsigned char Sq, dq, Kq, jq, q;
-	unsigned char S1, S2, J2, t2;
+/* place the cursor on IV record number n */
 
-	int i, j, B = 0, cid = (int) ((long) arg);
-	int votes[N_ATTACKS][256];
-	int first = 1, first2, oldB = 0, oldq = 0;
+static inline void wep_iv_seek(wep_iv_cursor * cur, long n)
+{
+	REQUIRE(cur != NULL);
 
-	memcpy(S, R, 256);
-	memcpy(Si, R, 256);
+	cur->chunk = 0;
 
-	while (1)
+	while (cur->chunk < wep.nb_ivchunks && n >= wep.ivchunks[cur->chunk].nb_ivs)
 	{
-		if (safe_read(mc_pipe[cid][0], (void *) &B, sizeof(int)) != sizeof(int))
-		{
-			return ((void *) FAILURE); //-V566
-		}
-		if (close_aircrack) break;
+		n -= wep.ivchunks[cur->chunk].nb_ivs;
+		cur->chunk++;
+	}
 
-		first2 = 1;
+	cur->idx = n;
+}
 
-		min = 5 * (((cid) *wep.nb_ivs) / opt.nbcpu);
-		max = 5 * (((1 + cid) * wep.nb_ivs) / opt.nbcpu);
+/* copy the IV record under the cursor, then move to the next one */
 
-		q = (uint8_t)(3 + B);
+static inline void wep_iv_next(wep_iv_cursor * cur,
+							   unsigned char iv[IVBUF_RECORD_SIZE])
+{
+	REQUIRE(cur != NULL);
+	INVARIANT(cur->chunk < wep.nb_ivchunks);
 
-		if (B > 0 && (size_t) B < sizeof(wep.key) - 3)
-			memcpy(K + 3, wep.key, (size_t) B);
-		memset(votes, 0, sizeof(votes));
+	const struct WEP_ivchunk * ch = &wep.ivchunks[cur->chunk];
+	int k;
 
-		/* START: KoreK attacks */
+	for (k = 0; k < IVBUF_RECORD_SIZE; k++) iv[k] = ch->plane[k][cur->idx];
 
-		for (xv = min; xv < max; xv += 5)
-		{
-			if (!first)
-			{
-				for (i = 0; i < oldq; i++)
-				{
-					S[i] = Si[i] = (uint8_t) i;
-					S[jj[i]] = Si[jj[i]] = jj[i];
-				}
-			}
+	if (++cur->idx == ch->nb_ivs)
+	{
+		cur->chunk++;
+		cur->idx = 0;
+	}
+}
 
-			ALLEGE(pthread_mutex_lock(&mx_ivb) == 0);
+/* point planes at up to max contiguous records under the cursor, move past
+ * them and return how many there are */
 
-			memcpy(K, &wep.ivbuf[xv], 3); //-V512
+static inline long wep_iv_run(wep_iv_cursor * cur,
+							  long max,
+							  const unsigned char * planes[IVBUF_RECORD_SIZE])
+{
+	REQUIRE(cur != NULL);
+	INVARIANT(cur->chunk < wep.nb_ivchunks);
 
-			INVARIANT((size_t) q < sizeof(K));
-			for (i = j = 0; i < q; i++)
-			{
-				INVARIANT((size_t) i < sizeof(K));
-				INVARIANT((size_t) i < sizeof(S));
+	const struct WEP_ivchunk * ch = &wep.ivchunks[cur->chunk];
+	long n = ch->nb_ivs - cur->idx;
+	int k;
+
+	if (n > max) n = max;
+
+	for (k = 0; k < IVBUF_RECORD_SIZE; k++)
+		planes[k] = ch->plane[k] + cur->idx;
+
+	cur->idx += n;
+
+	if (cur->idx == ch->nb_ivs)
+	{
+		cur->chunk++;
+		cur->idx = 0;
+	}
+
+	return (n);
+}
+
+/* the KoreK attacks are evaluated over blocks of IVs in three passes: the
+ * RC4 key scheduling (inherently sequential) gathers a few bytes of state
+ * for each IV into arrays, the attack conditions are then tested for all
+ * IVs of the block at once in a branch-free loop the compiler vectorizes,
+ * and only the IVs matching at least one attack are finally voted for */
+
+#define KOREK_BLOCK 256
+#define KOREK_LANES 4
+
+enum korek_condition
+{
+	KC_NEG_S2,
+	KC_NEG_O2,
+	KC_U15,
+	KC_NEG_S1,
+	KC_NEG_S0,
+	KC_S13,
+	KC_U13_1,
+	KC_U5_1,
+	KC_U5_2,
+	KC_U13_2,
+	KC_U13_3,
+	KC_U5_3,
+	KC_S5_1,
+	KC_S5_2,
+	KC_S5_3,
+	KC_S3,
+	KC_4_S13,
+	KC_4_U5_1,
+	KC_4_U5_2,
+	KC_U5_4
+};
+
+#define KC(c) (1u << (c))
+
+/* RC4 state gathered for each IV of a block */
 
-				jj[i] = (uint8_t)((j + S[i] + K[i]) & 0xFF);
-				j = (j + S[i] + K[i]) & 0xFF;
-				SWAP(S[i], S[j]);
+typedef struct
+{
+	uint8_t o1[KOREK_BLOCK], o2[KOREK_BLOCK];
+	uint8_t S0[KOREK_BLOCK], S1[KOREK_BLOCK], S2[KOREK_BLOCK];
+	uint8_t S4[KOREK_BLOCK], Sq[KOREK_BLOCK], dq[KOREK_BLOCK];
+	uint8_t io1[KOREK_BLOCK], io2[KOREK_BLOCK], jj1[KOREK_BLOCK];
+	uint8_t Si0[KOREK_BLOCK], Si254[KOREK_BLOCK], Si255[KOREK_BLOCK];
+	uint8_t SS1[KOREK_BLOCK]; /* S[S1]               */
+	uint8_t SJ2[KOREK_BLOCK]; /* S[S1 + S2]          */
+	uint8_t SiA[KOREK_BLOCK]; /* Si[io1 - q]         */
+	uint8_t SiB[KOREK_BLOCK]; /* Si[S1 - S2]         */
+	uint32_t match[KOREK_BLOCK]; /* KC() of the attacks that apply */
+} korek_block;
+
+/* pass 1: run the key scheduling for q bytes of each IV */
+
+static void korek_block_ksa(korek_block * kb,
+							const unsigned char * planes[IVBUF_RECORD_SIZE],
+							long n,
+							const unsigned char * K,
+							int q)
+{
+	unsigned char S[KOREK_LANES][256], Si[KOREK_LANES][256];
+	unsigned char KL[KOREK_LANES][64], jj[KOREK_LANES][64];
+	unsigned char io1, io2, *s, *si;
+	int j[KOREK_LANES];
+	long k, x;
+	int i, l;
+
+	REQUIRE(n <= KOREK_BLOCK);
+	REQUIRE(q > 2 && q < 64);
+
+	for (l = 0; l < KOREK_LANES; l++)
+	{
+		memcpy(S[l], R, 256);
+		memcpy(Si[l], R, 256);
+		memcpy(KL[l] + 3, K + 3, (size_t) q - 3);
+	}
+
+	/* the lanes are independent, interleaving them hides the latency of
+	 * the swaps; lanes past the end of the block just redo the last IV */
+
+	for (k = 0; k < n; k += KOREK_LANES)
+	{
+		for (l = 0; l < KOREK_LANES; l++)
+		{
+			x = (k + l < n) ? k + l : n - 1;
+			KL[l][0] = planes[0][x];
+			KL[l][1] = planes[1][x];
+			KL[l][2] = planes[2][x];
+			j[l] = 0;
+		}
+
+		for (i = 0; i < q; i++)
+			for (l = 0; l < KOREK_LANES; l++)
+			{
+				j[l] = (j[l] + S[l][i] + KL[l][i]) & 0xFF;
+				jj[l][i] = (uint8_t) j[l];
+				SWAP(S[l][i], S[l][j[l]]);
 			}
 
+		for (l = 0; l < KOREK_LANES; l++)
+		{
+			s = S[l];
+			si = Si[l];
+			x = (k + l < n) ? k + l : n - 1;
+
 			i = q;
 			do
 			{
 				i--;
-				SWAP(Si[i], Si[jj[i]]);
+				SWAP(si[i], si[jj[l][i]]);
 			} while (i != 0);
 
-			o1 = (uint8_t)(wep.ivbuf[xv + 3] ^ 0xAA);
-			io1 = Si[o1];
-			S1 = S[1];
-			o2 = (uint8_t)(wep.ivbuf[xv + 4] ^ 0xAA);
-			io2 = Si[o2];
-			S2 = S[2];
-
-			ALLEGE(pthread_mutex_unlock(&mx_ivb) == 0);
-
-			if (first) first = 0;
-			if (first2)
+			kb->o1[k + l] = (uint8_t)(planes[3][x] ^ 0xAA);
+			kb->o2[k + l] = (uint8_t)(planes[4][x] ^ 0xAA);
+			io1 = si[kb->o1[k + l]];
+			io2 = si[kb->o2[k + l]];
+
+			kb->io1[k + l] = io1;
+			kb->io2[k + l] = io2;
+			kb->S0[k + l] = s[0];
+			kb->S1[k + l] = s[1];
+			kb->S2[k + l] = s[2];
+			kb->S4[k + l] = s[4];
+			kb->Sq[k + l] = s[q];
+			kb->dq[k + l] = (uint8_t)(s[q] + jj[l][q - 1]);
+			kb->jj1[k + l] = jj[l][1];
+			kb->Si0[k + l] = si[0];
+			kb->Si254[k + l] = si[254];
+			kb->Si255[k + l] = si[255];
+			kb->SS1[k + l] = s[s[1]];
+			kb->SJ2[k + l] = s[(s[1] + s[2]) & 0xFF];
+			kb->SiA[k + l] = si[(io1 - q) & 0xFF];
+			kb->SiB[k + l] = si[(s[1] - s[2]) & 0xFF];
+
+			/* only the first q entries and their swap targets were touched */
+
+			for (i = 0; i < q; i++)
 			{
-				oldB = B;
-				oldq = 3 + oldB;
-				first2 = 0;
+				s[i] = si[i] = (uint8_t) i;
+				s[jj[l][i]] = si[jj[l][i]] = jj[l][i];
 			}
+		}
+	}
+}
 
-			Sq = S[q];
-			dq = Sq + jj[q - 1];
+/* pass 2: test the conditions of all the attacks, without branching */
 
-			if (S2 == 0)
-			{
-				if ((S1 == 2) && (o1 == 2))
-				{
-					Kq = (uint8_t) 1 - dq;
-					votes[A_neg][Kq]++;
-					Kq = (uint8_t) 2 - dq;
-					votes[A_neg][Kq]++;
-				}
-				else if (o2 == 0)
-				{
-					Kq = (uint8_t) 2 - dq;
-					votes[A_neg][Kq]++;
-				}
-			}
-			else
-			{
-				if ((o2 == 0) && (Sq == 0))
-				{
-					Kq = (uint8_t) 2 - dq;
-					votes[A_u15][Kq]++;
-				}
-			}
+static void korek_block_match(korek_block * kb, long n, int q)
+{
+	const uint8_t uq = (uint8_t) q, nq = (uint8_t)(-q);
+	const uint32_t q4 = (q == 4), qgt4 = (q > 4);
+	long k;
+
+	for (k = 0; k < n; k++)
+	{
+		const uint8_t o1 = kb->o1[k], o2 = kb->o2[k];
+		const uint8_t S1 = kb->S1[k], S2 = kb->S2[k], Sq = kb->Sq[k];
+		const uint8_t io1 = kb->io1[k], io2 = kb->io2[k];
+		const uint8_t J2 = (uint8_t)(S1 + S2);
+		const uint32_t s1q = (S1 == uq), sqq = (Sq == uq);
+		const uint32_t neg_s2 = (S2 == 0) & (S1 == 2) & (o1 == 2);
+		const uint32_t u13_1 = s1q & (o1 != uq) & ((uint8_t)(1 - uq - o1) == 0);
+		const uint32_t u13_2 = sqq & (S1 == 0) & (o1 == uq);
+		const uint32_t u13_3 = sqq & !u13_2 & ((uint8_t)(1 - uq - S1) == 0)
+							   & (o1 == S1);
+		const uint32_t s5 = (S1 > uq) & ((uint8_t)(S2 + S1 - uq) == 0);
+		const uint32_t s1_2 = (S1 == 2);
+		uint32_t m;
+
+		m = neg_s2 << KC_NEG_S2;
+		m |= ((S2 == 0) & !neg_s2 & (o2 == 0)) << KC_NEG_O2;
+		m |= ((S2 != 0) & (o2 == 0) & (Sq == 0)) << KC_U15;
+		m |= ((S1 == 1) & (o1 == S2)) << KC_NEG_S1;
+		m |= ((S1 == 0) & (kb->S0[k] == 1) & (o1 == 1)) << KC_NEG_S0;
+		m |= (s1q & (o1 == uq)) << KC_S13;
+		m |= u13_1 << KC_U13_1;
+		m |= (s1q & (o1 != uq) & !u13_1 & (io1 < uq) & (kb->SiA[k] != 1))
+			 << KC_U5_1;
+		m |= ((io1 == 2) & (Sq == 1)) << KC_U5_2;
+		m |= u13_2 << KC_U13_2;
+		m |= u13_3 << KC_U13_3;
+		m |= (sqq & !u13_2 & !u13_3 & (S1 >= nq)
+			  & ((uint8_t)(uq + S1 - io1) == 0))
+			 << KC_U5_3;
+		m |= ((S1 < uq) & ((uint8_t)(S1 + kb->SS1[k] - uq) == 0) & (io1 != 1)
+			  & (io1 != kb->SS1[k]))
+			 << KC_S5_1;
+		m |= (s5 & (o2 == S1) & (kb->SiB[k] != 1) & (kb->SiB[k] != 2))
+			 << KC_S5_2;
+		m |= (s5 & (o2 != S1) & (o2 == (uint8_t)(2 - S2)) & (io2 != 1)
+			  & (io2 != 2))
+			 << KC_S5_3;
+		m |= ((S1 != 2) & (S2 != 0) & (J2 < uq)
+			  & ((uint8_t)(kb->SJ2[k] + S2) == uq) & (io2 != 1) & (io2 != 2)
+			  & (io2 != J2))
+			 << KC_S3;
+		m |= (s1_2 & q4 & (o2 == 0)) << KC_4_S13;
+		m |= (s1_2 & q4 & (o2 != 0) & (kb->jj1[k] == 2) & (io2 == 0))
+			 << KC_4_U5_1;
+		m |= (s1_2 & q4 & (o2 != 0) & (kb->jj1[k] == 2) & (io2 == 2))
+			 << KC_4_U5_2;
+		m |= (s1_2 & qgt4 & (kb->S4[k] + 2 == q) & (io2 != 1) & (io2 != 4))
+			 << KC_U5_4;
+
+		kb->match[k] = m;
+	}
+}
 
-			if ((S1 == 1) && (o1 == S2))
-			{
-				Kq = (uint8_t) 1 - dq;
-				votes[A_neg][Kq]++;
-				Kq = (uint8_t) 2 - dq;
-				votes[A_neg][Kq]++;
-			}
+/* pass 3: vote for the few IVs an attack applies to */
 
-			if ((S1 == 0) && (S[0] == 1) && (o1 == 1))
-			{
-				Kq = (uint8_t) 0 - dq;
-				votes[A_neg][Kq]++;
-				Kq = (uint8_t) 1 - dq;
-				votes[A_neg][Kq]++;
-			}
+static void korek_block_vote(const korek_block * kb,
+							 long n,
+							 int votes[N_ATTACKS][256])
+{
+	uint32_t m;
+	uint8_t dq;
+	long k;
 
-			if (S1 == q)
-			{
-				if (o1 == q)
-				{
-					Kq = Si[0] - dq;
-					votes[A_s13][Kq]++;
-				}
-				else if (((1 - q - o1) & 0xFF) == 0)
-				{
-					Kq = io1 - dq;
-					votes[A_u13_1][Kq]++;
-				}
-				else if (io1 < q)
-				{
-					jq = Si[(io1 - q) & 0xFF];
+	for (k = 0; k < n; k++)
+	{
+		if ((m = kb->match[k]) == 0) continue;
 
-					if (jq != 1)
-					{
-						Kq = jq - dq;
-						votes[A_u5_1][Kq]++;
-					}
-				}
-			}
+		dq = kb->dq[k];
 
-			if ((io1 == 2) && (S[q] == 1))
-			{
-				Kq = (uint8_t) 1 - dq;
-				votes[A_u5_2][Kq]++;
-			}
+		if (m & KC(KC_NEG_S2))
+		{
+			votes[A_neg][(uint8_t)(1 - dq)]++;
+			votes[A_neg][(uint8_t)(2 - dq)]++;
+		}
+		if (m & KC(KC_NEG_S1))
+		{
+			votes[A_neg][(uint8_t)(1 - dq)]++;
+			votes[A_neg][(uint8_t)(2 - dq)]++;
+		}
+		if (m & KC(KC_NEG_O2)) votes[A_neg][(uint8_t)(2 - dq)]++;
+		if (m & KC(KC_U15)) votes[A_u15][(uint8_t)(2 - dq)]++;
+		if (m & KC(KC_NEG_S0))
+		{
+			votes[A_neg][(uint8_t)(0 - dq)]++;
+			votes[A_neg][(uint8_t)(1 - dq)]++;
+		}
+		if (m & KC(KC_S13)) votes[A_s13][(uint8_t)(kb->Si0[k] - dq)]++;
+		if (m & KC(KC_U13_1)) votes[A_u13_1][(uint8_t)(kb->io1[k] - dq)]++;
+		if (m & KC(KC_U5_1)) votes[A_u5_1][(uint8_t)(kb->SiA[k] - dq)]++;
+		if (m & KC(KC_U5_2)) votes[A_u5_2][(uint8_t)(1 - dq)]++;
+		if (m & KC(KC_U13_2)) votes[A_u13_2][(uint8_t)(1 - dq)]++;
+		if (m & KC(KC_U13_3)) votes[A_u13_3][(uint8_t)(1 - dq)]++;
+		if (m & KC(KC_U5_3)) votes[A_u5_3][(uint8_t)(1 - dq)]++;
+		if (m & KC(KC_S5_1)) votes[A_s5_1][(uint8_t)(kb->io1[k] - dq)]++;
+		if (m & KC(KC_S5_2)) votes[A_s5_2][(uint8_t)(kb->SiB[k] - dq)]++;
+		if (m & KC(KC_S5_3)) votes[A_s5_3][(uint8_t)(kb->io2[k] - dq)]++;
+		if (m & KC(KC_S3)) votes[A_s3][(uint8_t)(kb->io2[k] - dq)]++;
+		if (m & KC(KC_4_S13)) votes[A_4_s13][(uint8_t)(kb->Si0[k] - dq)]++;
+		if (m & KC(KC_4_U5_1))
+			votes[A_4_u5_1][(uint8_t)(kb->Si254[k] - dq)]++;
+		if (m & KC(KC_4_U5_2))
+			votes[A_4_u5_2][(uint8_t)(kb->Si255[k] - dq)]++;
+		if (m & KC(KC_U5_4)) votes[A_u5_4][(uint8_t)(kb->io2[k] - dq)]++;
+	}
+}
 
-			if (S[q] == q)
-			{
-				if ((S1 == 0) && (o1 == q))
-				{
-					Kq = (uint8_t) 1 - dq;
-					votes[A_u13_2][Kq]++;
-				}
-				else if ((((1 - q - S1) & 0xFF) == 0) && (o1 == S1))
-				{
-					Kq = (uint8_t) 1 - dq;
-					votes[A_u13_3][Kq]++;
-				}
-				else if ((S1 >= ((-q) & 0xFF))
-						 && (((q + S1 - io1) & 0xFF) == 0))
-				{
-					Kq = (uint8_t) 1 - dq;
-					votes[A_u5_3][Kq]++;
-				}
-			}
+/* each thread computes the votes over the chunks of IVs it claims */
 
-			if ((S1 < q) && (((S1 + S[S1] - q) & 0xFF) == 0) && (io1 != 1)
-				&& (io1 != S[S1]))
-			{
-				Kq = io1 - dq;
-				votes[A_s5_1][Kq]++;
-			}
+static THREAD_ENTRY(crack_wep_thread)
+{
+	long xv, min, max, n;
+	unsigned char K[64];
+	const unsigned char * planes[IVBUF_RECORD_SIZE];
 
-			if ((S1 > q) && (((S2 + S1 - q) & 0xFF) == 0))
-			{
-				if (o2 == S1)
-				{
-					jq = Si[(S1 - S2) & 0xFF];
+	int B = 0, q, cid = (int) ((long) arg);
+	int(*votes)[256];
+	unsigned long seq = 0;
+	wep_iv_cursor cur;
+	korek_job job;
+	korek_block * kb;
 
-					if ((jq != 1) && (jq != 2))
-					{
-						Kq = jq - dq;
-						votes[A_s5_2][Kq]++;
-					}
-				}
-				else if (o2 == ((2 - S2) & 0xFF))
-				{
-					jq = io2;
+	kb = (korek_block *) malloc(sizeof(korek_block));
+	ALLEGE(kb != NULL);
 
-					if ((jq != 1) && (jq != 2))
-					{
-						Kq = jq - dq;
-						votes[A_s5_3][Kq]++;
-					}
-				}
-			}
+	while (1)
+	{
+		ALLEGE(pthread_mutex_lock(&korek_pool.lock) == 0);
+		while (korek_pool.seq == seq && !close_aircrack)
+			ALLEGE(pthread_cond_wait(&korek_pool.cv_job, &korek_pool.lock)
+				   == 0);
+		if (korek_pool.seq == seq)
+		{
+			/* exiting, and no job left to report on */
+			ALLEGE(pthread_mutex_unlock(&korek_pool.lock) == 0);
+			break;
+		}
+		seq = korek_pool.seq;
+		job = korek_pool.job;
+		ALLEGE(pthread_mutex_unlock(&korek_pool.lock) == 0);
 
-			if ((S[1] != 2) && (S[2] != 0))
-			{
-				J2 = S[1] + S[2];
+		B = job.B;
+		q = 3 + B;
 
-				if (J2 < q)
-				{
-					t2 = S[J2] + S[2];
+		if (B > 0 && (size_t) B < sizeof(wep.key) - 3)
+			memcpy(K + 3, wep.key, (size_t) B);
 
-					if ((t2 == q) && (io2 != 1) && (io2 != 2) && (io2 != J2))
-					{
-						Kq = io2 - dq;
-						votes[A_s3][Kq]++;
-					}
-				}
-			}
+		votes = korek_pool.votes[cid];
+		memset(votes, 0, sizeof(korek_pool.votes[cid]));
+
+		/* START: KoreK attacks */
 
-			if (S1 == 2)
+		while (!close_aircrack)
+		{
+			ALLEGE(pthread_mutex_lock(&korek_pool.lock) == 0);
+			min = korek_pool.next;
+			max = (job.last - min > KOREK_CHUNK) ? min + KOREK_CHUNK : job.last;
+			korek_pool.next = max;
+			ALLEGE(pthread_mutex_unlock(&korek_pool.lock) == 0);
+
+			if (min >= max) break;
+
+			ALLEGE(pthread_mutex_lock(&mx_ivb) == 0);
+			wep_iv_seek(&cur, min);
+			ALLEGE(pthread_mutex_unlock(&mx_ivb) == 0);
+
+			for (xv = min; xv < max; xv += n)
 			{
-				if (q == 4)
-				{
-					if (o2 == 0)
-					{
-						Kq = Si[0] - dq;
-						votes[A_4_s13][Kq]++;
-					}
-					else
-					{
-						if ((jj[1] == 2) && (io2 == 0))
-						{
-							Kq = Si[254] - dq;
-							votes[A_4_u5_1][Kq]++;
-						}
-						if ((jj[1] == 2) && (io2 == 2))
-						{
-							Kq = Si[255] - dq;
-							votes[A_4_u5_2][Kq]++;
-						}
-					}
-				}
-				else if ((q > 4) && ((S[4] + 2) == q) && (io2 != 1)
-						 && (io2 != 4))
-				{
-					Kq = io2 - dq;
-					votes[A_u5_4][Kq]++;
-				}
+				/* chunks never move, only the list of them may */
+
+				ALLEGE(pthread_mutex_lock(&mx_ivb) == 0);
+				n = wep_iv_run(&cur,
+							   (max - xv < KOREK_BLOCK) ? max - xv : KOREK_BLOCK,
+							   planes);
+				ALLEGE(pthread_mutex_unlock(&mx_ivb) == 0);
+
+				korek_block_ksa(kb, planes, n, K, q);
+				korek_block_match(kb, n, q);
+				korek_block_vote(kb, n, votes);
 			}
-			if (close_aircrack) break;
 		}
-		if (close_aircrack) break;
+
 		/* END: KoreK attacks */
 
-		if (safe_write(cm_pipe[cid][1], votes, sizeof(votes)) != sizeof(votes))
-		{
-			perror("write failed");
-			kill(0, SIGTERM);
-			_exit(EXIT_FAILURE);
-		}
+		ALLEGE(pthread_mutex_lock(&korek_pool.lock) == 0);
+		if (--korek_pool.pending == 0)
+			ALLEGE(pthread_cond_signal(&korek_pool.cv_done) == 0);
+		ALLEGE(pthread_mutex_unlock(&korek_pool.lock) == 0);
 	}
 
+	free(kb);
+
 	return ((void *) SUCCESS);
 }
 
@@ -2862,7 +3487,11 @@ void show_wep_stats(int B,
 	printf("\n");
 }
 
-static void key_found(unsigned char * wepkey, int keylen, int B)
+/* reports a key, several dictionary threads may find one at once: only
+ * the first of them is reported */
+
+static void
+key_found(unsigned char * wepkey, int keylen, int B, int probability)
 {
 	REQUIRE(wepkey != NULL);
 	REQUIRE(keylen >= 0);
@@ -2871,11 +3500,19 @@ static void key_found(unsigned char * wepkey, int keylen, int B)
 	int i, n;
 	int nb_ascii = 0;
 
-	if (opt.probability < 1) return;
+	if (probability < 1) return;
 
 	for (i = 0; i < keylen; i++)
 		if (wepkey[i] == 0 || (wepkey[i] >= 32 && wepkey[i] < 127)) nb_ascii++;
 
+	ALLEGE(pthread_mutex_lock(&mx_key) == 0);
+
+	if (wepkey_crack_success)
+	{
+		ALLEGE(pthread_mutex_unlock(&mx_key) == 0);
+		return;
+	}
+
 	wepkey_crack_success = 1;
 	memcpy(bf_wepkey, wepkey, (size_t) keylen);
 
@@ -2924,7 +3561,7 @@ static void key_found(unsigned char * wepkey, int keylen, int B)
 		textcolor_normal();
 	}
 
-	printf("\n\tDecrypted correctly: %d%%\n", opt.probability);
+	printf("\n\tDecrypted correctly: %d%%\n", probability);
 	printf("\n");
 
 	// Write the key to a file
@@ -2937,103 +3574,247 @@ static void key_found(unsigned char * wepkey, int keylen, int B)
 			fclose(keyFile);
 		}
 	}
+
+	ALLEGE(pthread_mutex_unlock(&mx_key) == 0);
 }
 
-/* test if the current WEP key is valid */
+#define WEP_LANES 8
 
-static int check_wep_key(unsigned char * wepkey, int B, int keylen)
+/* test up to WEP_LANES candidate keys at once, running their KSAs side
+ * by side; returns the index of the valid key or -1 if there is none */
+
+static int
+check_wep_keys(unsigned char (*wepkeys)[64], int nkeys, int B, int keylen)
 {
 	unsigned char x1, x2;
-	unsigned long xv;
-	size_t i, j, n, bad;
-	unsigned long tests;
+	size_t i, n, l, tests, limit;
+	unsigned int alive;
 
-	unsigned char K[64];
-	unsigned char S[256];
+	unsigned char K[WEP_LANES][64];
+	unsigned char S[WEP_LANES][256];
+	unsigned char jj[WEP_LANES];
+	size_t bad[WEP_LANES];
+	unsigned char ivs[TEST_MAX_IVS][IVBUF_RECORD_SIZE];
+	wep_iv_cursor cur;
+
+	REQUIRE(nkeys > 0 && nkeys <= WEP_LANES);
 
 	if (keylen <= 0) keylen = opt.keylen;
 
 	ALLEGE(pthread_mutex_lock(&mx_nb) == 0);
-	nb_tried++;
+	nb_tried += nkeys;
 	ALLEGE(pthread_mutex_unlock(&mx_nb) == 0);
 
-	bad = 0;
+	tests = 32;
+
+	if (opt.dict) tests = (size_t) wep.nb_ivs;
+
+	if (tests < TEST_MIN_IVS) tests = TEST_MIN_IVS;
+	if (tests > TEST_MAX_IVS) tests = TEST_MAX_IVS;
+
+	/* the IV list is append-only, so its head can be copied once */
+
+	ALLEGE(pthread_mutex_lock(&mx_ivb) == 0);
+	if (tests > (size_t) wep.nb_ivs) tests = (size_t) wep.nb_ivs;
+	if (tests == 0)
+	{
+		ALLEGE(pthread_mutex_unlock(&mx_ivb) == 0);
+		return (-1);
+	}
+	wep_iv_seek(&cur, 0);
+	for (n = 0; n < tests; n++) wep_iv_next(&cur, ivs[n]);
+	ALLEGE(pthread_mutex_unlock(&mx_ivb) == 0);
+
+	limit = (tests * (size_t) opt.probability) / 100;
+	alive = (1u << nkeys) - 1;
+
+	for (l = 0; l < (size_t) nkeys; l++)
+	{
+		memcpy(K[l] + 3, wepkeys[l], (size_t) keylen);
+		bad[l] = 0;
+	}
+
+	for (n = 0; n < tests && alive != 0; n++)
+	{
+		for (l = 0; l < (size_t) nkeys; l++)
+		{
+			memcpy(K[l], ivs[n], 3); //-V512
+			memcpy(S[l], R, sizeof(S[l]));
+			jj[l] = 0;
+		}
+
+		for (i = 0; i < 256; i++)
+		{
+			unsigned char k = (unsigned char) (i % (3 + (size_t) keylen));
+
+			for (l = 0; l < (size_t) nkeys; l++)
+			{
+				jj[l] = (unsigned char) (jj[l] + S[l][i] + K[l][k]);
+				SWAP(S[l][i], S[l][jj[l]]);
+			}
+		}
+
+		for (l = 0; l < (size_t) nkeys; l++)
+		{
+			unsigned char * s = S[l];
+			unsigned char j;
+
+			if (!(alive & (1u << l))) continue;
+
+			j = s[1];
+			SWAP(s[1], s[j]);
+			x1 = ivs[n][3] ^ s[(s[1] + s[j]) & 0xFF];
+
+			j = (unsigned char) (j + s[2]);
+			SWAP(s[2], s[j]);
+			x2 = ivs[n][4] ^ s[(s[2] + s[j]) & 0xFF];
+
+			if ((x1 != 0xAA || x2 != 0xAA) && (x1 != 0xE0 || x2 != 0xE0)
+				&& (x1 != 0x42 || x2 != 0x42)
+				&& (x1 != 0x02 || x2 != 0xAA)) // llc sub layer management
+				bad[l]++;
+
+			if (bad[l] > limit) alive &= ~(1u << l);
+		}
+	}
+
+	for (l = 0; l < (size_t) nkeys; l++)
+	{
+		if (!(alive & (1u << l))) continue;
+
+		key_found(wepkeys[l],
+				  keylen,
+				  B,
+				  (int) (((tests - bad[l]) * 100) / tests));
+
+		return ((int) l);
+	}
+
+	return (-1);
+}
+
+/* test if the current WEP key is valid */
 
-	memcpy(K + 3, wepkey, (size_t) keylen);
+static int check_wep_key(unsigned char * wepkey, int B, int keylen)
+{
+	unsigned char keys[1][64];
 
-	tests = 32;
+	memcpy(keys[0], wepkey, sizeof(keys[0]));
 
-	if (opt.dict) tests = (unsigned long) wep.nb_ivs;
+	return (check_wep_keys(keys, 1, B, keylen) < 0 ? FAILURE : SUCCESS);
+}
 
-	if (tests < TEST_MIN_IVS) tests = TEST_MIN_IVS;
-	if (tests > TEST_MAX_IVS) tests = TEST_MAX_IVS;
+/* bruteforce the keybyte at position pos, WEP_LANES values at a time;
+ * the valid key, if any, is left in wepkey */
 
-	for (n = 0; n < tests; n++)
-	{
-		xv = 5u * n;
+static int check_wep_key_byte(unsigned char * wepkey, int pos, int B)
+{
+	unsigned char keys[WEP_LANES][64];
+	int i, l, found;
 
-		ALLEGE(pthread_mutex_lock(&mx_ivb) == 0);
+	REQUIRE(pos >= 0 && pos < 64);
 
-		memcpy(K, &wep.ivbuf[xv], 3); //-V512
-		memcpy(S, R, sizeof(S));
+	for (i = 0; i < 256; i += WEP_LANES)
+	{
+		for (l = 0; l < WEP_LANES; l++)
+		{
+			memcpy(keys[l], wepkey, sizeof(keys[l]));
+			keys[l][pos] = (uint8_t)(i + l);
+		}
 
-		for (i = j = 0; i < 256; i++)
+		if ((found = check_wep_keys(keys, WEP_LANES, B, 0)) >= 0)
 		{
-			j = (j + S[i] + K[i % (3 + keylen)]) & 0xFF;
-			SWAP(S[i], S[j]);
+			wepkey[pos] = (uint8_t)(i + found);
+			return (SUCCESS);
 		}
+	}
 
-		i = 1;
-		j = (size_t)((0 + S[i]) & 0xFF);
-		SWAP(S[i], S[j]);
-		x1 = wep.ivbuf[xv + 3] ^ S[(S[i] + S[j]) & 0xFF];
+	return (FAILURE);
+}
 
-		i = 2;
-		j = (size_t)((j + S[i]) & 0xFF);
-		SWAP(S[i], S[j]);
-		x2 = wep.ivbuf[xv + 4] ^ S[(S[i] + S[j]) & 0xFF];
+/* find the cached votes for the current key prefix of keybyte B */
 
-		ALLEGE(pthread_mutex_unlock(&mx_ivb) == 0);
+static korek_votes * korek_cache_get(int B)
+{
+	REQUIRE(B >= 0 && (size_t) B < sizeof(wep.key));
 
-		if ((x1 != 0xAA || x2 != 0xAA) && (x1 != 0xE0 || x2 != 0xE0)
-			&& (x1 != 0x42 || x2 != 0x42)
-			&& (x1 != 0x02 || x2 != 0xAA)) // llc sub layer management
-			bad++;
+	uint32_t h = 2166136261u ^ (uint32_t) B;
+	korek_votes * kv;
+	int i;
+
+	for (i = 0; i < B; i++) h = (h ^ wep.key[i]) * 16777619u;
 
-		if (bad > ((tests * opt.probability) / 100)) return (FAILURE);
+	h %= KOREK_CACHE_SIZE;
+
+	if (korek_cache[h] == NULL)
+	{
+		korek_cache[h] = (korek_votes *) malloc(sizeof(korek_votes));
+		ALLEGE(korek_cache[h] != NULL);
+		korek_cache[h]->B = -1;
 	}
 
-	opt.probability = (int) (((tests - bad) * 100) / tests);
-	key_found(wepkey, keylen, B);
+	kv = korek_cache[h];
 
-	return (SUCCESS);
+	if (kv->B != B || memcmp(kv->prefix, wep.key, (size_t) B) != 0)
+	{
+		/* evict whatever prefix was there before */
+		kv->B = B;
+		memcpy(kv->prefix, wep.key, (size_t) B);
+		kv->nb_ivs = 0;
+		memset(kv->votes, 0, sizeof(kv->votes));
+	}
+
+	return (kv);
 }
 
 /* sum up the votes and sort them */
 
 static int calc_poll(int B)
 {
-	int i, cid, *vi;
+	int i, cid;
 	size_t n;
-	int votes[N_ATTACKS][256];
+	korek_votes * kv = korek_cache_get(B);
 
 	memset(&opt.votes, '\0', sizeof(opt.votes));
 
-	/* send the current keybyte # to each thread */
-
-	for (cid = 0; cid < opt.nbcpu; cid++)
+	if (kv->nb_ivs < wep.nb_ivs)
 	{
-		n = sizeof(int);
+		/* post the keybyte # and the IVs not yet voted on to the threads */
+
+		ALLEGE(pthread_mutex_lock(&korek_pool.lock) == 0);
+
+		korek_pool.job.B = B;
+		korek_pool.job.first = kv->nb_ivs;
+		korek_pool.job.last = wep.nb_ivs;
+		korek_pool.next = kv->nb_ivs;
+		korek_pool.pending = opt.nbcpu;
+		korek_pool.seq++;
 
-		if ((size_t) safe_write(mc_pipe[cid][1], &B, n) != n)
+		ALLEGE(pthread_cond_broadcast(&korek_pool.cv_job) == 0);
+
+		while (korek_pool.pending > 0)
+			ALLEGE(pthread_cond_wait(&korek_pool.cv_done, &korek_pool.lock)
+				   == 0);
+
+		ALLEGE(pthread_mutex_unlock(&korek_pool.lock) == 0);
+
+		if (close_aircrack)
 		{
-			perror("write failed");
-			kill(0, SIGTERM);
-			_exit(EXIT_FAILURE);
+			kv->B = -1;
+			return (FAILURE);
 		}
+
+		/* fold the new votes into the cached ones */
+
+		for (cid = 0; cid < opt.nbcpu; cid++)
+			for (n = 0; n < N_ATTACKS; n++)
+				for (i = 0; i < 256; i++)
+					kv->votes[n][i] += korek_pool.votes[cid][n][i];
+
+		kv->nb_ivs = wep.nb_ivs;
 	}
 
-	/* collect the votes, multiply by the korek coeffs */
+	/* multiply the votes by the korek coeffs */
 
 	for (i = 0; i < 256; i++)
 	{
@@ -3041,23 +3822,13 @@ static int calc_poll(int B)
 		wep.poll[B][i].val = 0;
 	}
 
-	for (cid = 0; cid < opt.nbcpu; cid++)
-	{
-		n = sizeof(votes);
-
-		if ((size_t) safe_read(cm_pipe[cid][0], votes, n) != n)
+	for (n = 0; n < N_ATTACKS; n++)
+		for (i = 0; i < 256; i++)
 		{
-			return (FAILURE);
+			wep.poll[B][i].val += kv->votes[n][i] * K_COEFF[n];
+			if (K_COEFF[n]) opt.votes[n] += kv->votes[n][i];
 		}
 
-		for (n = 0, vi = (int *) votes; n < N_ATTACKS; n++)
-			for (i = 0; i < 256; i++, vi++)
-			{
-				wep.poll[B][i].val += *vi * K_COEFF[n];
-				if (K_COEFF[n]) opt.votes[n] += *vi;
-			}
-	}
-
 	/* set votes to the max if the keybyte is user-defined */
 
 	if (opt.debug_row[B]) wep.poll[B][opt.debug[B]].val = 32767;
@@ -3093,10 +3864,25 @@ static int calc_poll(int B)
 	return (SUCCESS);
 }
 
+/* how far the IV list of each targeted AP has been added to wep.ivchunks */
+
+typedef struct
+{
+	const struct AP_info * ap;
+	const struct ivbuf_chunk * chunk;
+	size_t nb_ivs;
+} wep_iv_source;
+
 static int update_ivbuf(void)
 {
-	size_t n;
+	static size_t ivchunks_size = 0;
+	static wep_iv_source * sources = NULL;
+	static size_t nb_sources = 0;
+	wep_iv_source * src;
+	const struct ivbuf_chunk * chunk;
 	struct AP_info * ap_cur;
+	size_t i, filled, avail;
+	int j;
 	void * key;
 
 	/* 1st pass: compute the total number of available IVs */
@@ -3115,40 +3901,80 @@ static int update_ivbuf(void)
 	}
 	c_avl_iterator_destroy(it);
 
-	/* 2nd pass: create the main IVs buffer if necessary */
+	/* 2nd pass: update the list of IV chunks if necessary */
 
 	if (wep.nb_ivs == 0
 		|| (opt.keylen == 5 && wep.nb_ivs_now - wep.nb_ivs > 20000)
 		|| (opt.keylen >= 13 && wep.nb_ivs_now - wep.nb_ivs > 40000))
 	{
-		/* one buffer to rule them all */
+		/* one list to rule them all; only pointers to the IVs that were not
+		 * there yet are appended, so the index of an IV never changes */
 
 		ALLEGE(pthread_mutex_lock(&mx_ivb) == 0);
 
-		destroy(wep.ivbuf, free);
-
-		wep.nb_ivs = 0;
-
 		it = c_avl_get_iterator(access_points);
 		while (c_avl_iterator_next(it, &key, (void **) &ap_cur) == 0)
 		{
-			if (ap_cur->ivbuf != NULL && ap_cur->crypt == 2 && ap_cur->target)
+			if (ap_cur->crypt != 2 || !ap_cur->target) continue;
+
+			for (i = 0; i < nb_sources && sources[i].ap != ap_cur; i++)
+				;
+
+			if (i == nb_sources)
+			{
+				src = realloc(sources, (nb_sources + 1) * sizeof(*sources));
+				ALLEGE(src != NULL);
+				sources = src;
+				sources[nb_sources].ap = ap_cur;
+				sources[nb_sources].chunk = NULL;
+				sources[nb_sources].nb_ivs = 0;
+				nb_sources++;
+			}
+
+			src = &sources[i];
+
+			if (src->chunk == NULL) src->chunk = ap_cur->ivbuf.head;
+
+			while ((chunk = src->chunk) != NULL)
 			{
-				n = (size_t) ap_cur->nb_ivs;
+				filled = chunk->nb_ivs; /* may grow while we look */
+				avail = filled - src->nb_ivs;
+
+				if (avail == 0)
+				{
+					/* a chunk only gets a successor once it is full */
+					if (filled < IVBUF_CHUNK_IVS || chunk->next == NULL)
+						break;
 
-				uint8_t * tmp_ivbuf = realloc(wep.ivbuf, (wep.nb_ivs + n) * 5u);
-				if (tmp_ivbuf == NULL)
+					src->chunk = chunk->next;
+					src->nb_ivs = 0;
+					continue;
+				}
+
+				if (wep.nb_ivchunks == ivchunks_size)
 				{
-					ALLEGE(pthread_mutex_unlock(&mx_ivb) == 0);
-					perror("realloc failed");
-					kill(0, SIGTERM);
-					_exit(EXIT_FAILURE);
+					ivchunks_size = ivchunks_size ? ivchunks_size * 2 : 64;
+
+					struct WEP_ivchunk * tmp_ivchunks = realloc(
+						wep.ivchunks, ivchunks_size * sizeof(*wep.ivchunks));
+					if (tmp_ivchunks == NULL)
+					{
+						ALLEGE(pthread_mutex_unlock(&mx_ivb) == 0);
+						perror("realloc failed");
+						kill(0, SIGTERM);
+						_exit(EXIT_FAILURE);
+					}
+					wep.ivchunks = tmp_ivchunks;
 				}
-				wep.ivbuf = tmp_ivbuf;
 
-				memcpy(wep.ivbuf + wep.nb_ivs * 5u, ap_cur->ivbuf, 5u * n);
+				for (j = 0; j < IVBUF_RECORD_SIZE; j++)
+					wep.ivchunks[wep.nb_ivchunks].plane[j]
+						= chunk->data[j] + src->nb_ivs;
+				wep.ivchunks[wep.nb_ivchunks].nb_ivs = (long) avail;
+				wep.nb_ivchunks++;
 
-				wep.nb_ivs += n;
+				wep.nb_ivs += (long) avail;
+				src->nb_ivs += avail;
 			}
 		}
 		c_avl_iterator_destroy(it);
@@ -3209,7 +4035,7 @@ static int remove_votes(int keybyte, unsigned char value)
 
 static int do_wep_crack1(int B)
 {
-	int i, j, l, m, tsel, charread;
+	int i, l, m, tsel, charread;
 	int remove_keybyte_nr, remove_keybyte_value;
 	static int k = 0;
 	char user_guess[4];
@@ -3390,14 +4216,10 @@ get_ivs:
 							{
 								wep.key[opt.brutebytes[2]] = (uint8_t) i;
 
-								for (j = 0; j < 256; j++)
-								{
-									wep.key[opt.brutebytes[3]] = (uint8_t) j;
-
-									if (check_wep_key(wep.key, B + 1, 0)
-										== SUCCESS)
-										return (SUCCESS);
-								}
+								if (check_wep_key_byte(
+										wep.key, opt.brutebytes[3], B + 1)
+									== SUCCESS)
+									return (SUCCESS);
 							}
 						}
 					}
@@ -3412,13 +4234,10 @@ get_ivs:
 						{
 							wep.key[opt.brutebytes[1]] = (uint8_t) i;
 
-							for (j = 0; j < 256; j++)
-							{
-								wep.key[opt.brutebytes[2]] = (uint8_t) j;
-
-								if (check_wep_key(wep.key, B + 1, 0) == SUCCESS)
-									return (SUCCESS);
-							}
+							if (check_wep_key_byte(
+									wep.key, opt.brutebytes[2], B + 1)
+								== SUCCESS)
+								return (SUCCESS);
 						}
 					}
 				}
@@ -3428,24 +4247,17 @@ get_ivs:
 					{
 						wep.key[opt.brutebytes[0]] = (uint8_t) i;
 
-						for (j = 0; j < 256; j++)
-						{
-							wep.key[opt.brutebytes[1]] = (uint8_t) j;
-
-							if (check_wep_key(wep.key, B + 1, 0) == SUCCESS)
-								return (SUCCESS);
-						}
+						if (check_wep_key_byte(
+								wep.key, opt.brutebytes[1], B + 1)
+							== SUCCESS)
+							return (SUCCESS);
 					}
 				}
 				else
 				{
-					for (i = 0; i < 256; i++)
-					{
-						wep.key[opt.brutebytes[0]] = (uint8_t) i;
-
-						if (check_wep_key(wep.key, B + 1, 0) == SUCCESS)
-							return (SUCCESS);
-					}
+					if (check_wep_key_byte(wep.key, opt.brutebytes[0], B + 1)
+						== SUCCESS)
+						return (SUCCESS);
 				}
 			}
 			else
@@ -3525,7 +4337,7 @@ get_ivs:
 
 static int do_wep_crack2(int B)
 {
-	int i, j;
+	int i;
 
 	switch (update_ivbuf())
 	{
@@ -3602,13 +4414,9 @@ static int do_wep_crack2(int B)
 		{
 			wep.key[opt.keylen - 2] = (uint8_t) i;
 
-			for (j = 0; j < 256; j++)
-			{
-				wep.key[opt.keylen - 1] = (uint8_t) j;
-
-				if (check_wep_key(wep.key, opt.keylen - 2, 0) == SUCCESS)
-					return (SUCCESS);
-			}
+			if (check_wep_key_byte(wep.key, opt.keylen - 1, opt.keylen - 2)
+				== SUCCESS)
+				return (SUCCESS);
 		}
 	}
 
@@ -3617,7 +4425,7 @@ static int do_wep_crack2(int B)
 
 static THREAD_ENTRY(inner_bruteforcer_thread)
 {
-	int i, j, k, l;
+	int i, k, l;
 	size_t nthread = (size_t) arg;
 	unsigned char wepkey[64];
 	void * ret = NULL;
@@ -3653,13 +4461,10 @@ inner_bruteforcer_thread_start:
 				{
 					wepkey[opt.brutebytes[2]] = (uint8_t) i;
 
-					for (j = 0; j < 256; j++)
-					{
-						wepkey[opt.brutebytes[3]] = (uint8_t) j;
-
-						if (check_wep_key(wepkey, opt.keylen - 2, 0) == SUCCESS)
-							return ((void *) SUCCESS);
-					}
+					if (check_wep_key_byte(
+							wepkey, opt.brutebytes[3], opt.keylen - 2)
+						== SUCCESS)
+						return ((void *) SUCCESS);
 				}
 			}
 		}
@@ -3674,13 +4479,10 @@ inner_bruteforcer_thread_start:
 			{
 				wepkey[opt.brutebytes[1]] = (uint8_t) i;
 
-				for (j = 0; j < 256; j++)
-				{
-					wepkey[opt.brutebytes[2]] = (uint8_t) j;
-
-					if (check_wep_key(wepkey, opt.keylen - 2, 0) == SUCCESS)
-						return ((void *) SUCCESS);
-				}
+				if (check_wep_key_byte(
+						wepkey, opt.brutebytes[2], opt.keylen - 2)
+					== SUCCESS)
+					return ((void *) SUCCESS);
 			}
 		}
 	}
@@ -3690,24 +4492,16 @@ inner_bruteforcer_thread_start:
 		{
 			wepkey[opt.brutebytes[0]] = (uint8_t) i;
 
-			for (j = 0; j < 256; j++)
-			{
-				wepkey[opt.brutebytes[1]] = (uint8_t) j;
-
-				if (check_wep_key(wepkey, opt.keylen - 2, 0) == SUCCESS)
-					return ((void *) SUCCESS);
-			}
+			if (check_wep_key_byte(wepkey, opt.brutebytes[1], opt.keylen - 2)
+				== SUCCESS)
+				return ((void *) SUCCESS);
 		}
 	}
 	else
 	{
-		for (j = 0; j < 256; j++)
-		{
-			wepkey[opt.brutebytes[0]] = (uint8_t) j;
-
-			if (check_wep_key(wepkey, opt.keylen - 2, 0) == SUCCESS)
-				return ((void *) SUCCESS);
-		}
+		if (check_wep_key_byte(wepkey, opt.brutebytes[0], opt.keylen - 2)
+			== SUCCESS)
+			return ((void *) SUCCESS);
 	}
 
 	--bf_nkeys[nthread];
@@ -4363,83 +5157,118 @@ static __attribute__((noinline)) int next_dict(int nb)
 }
 
 #ifdef HAVE_SQLITE
-static int
-sql_wpacallback(void * arg, int ccount, char ** values, char ** columnnames)
+/// Number of airolib-ng rows fetched per block, before being distributed
+/// to the cracking threads.
+#define PMK_DB_BLOCK_ROWS 4096
+
+/// A precomputed passphrase and PMK pair, as stored by airolib-ng.
+/// The passphrase comes first, so that the pipeline shutdown sentinel
+/// is recognized the same way as for a wordlist.
+typedef struct
+{
+	char passwd[MAX_PASSPHRASE_LENGTH + 1];
+	uint8_t pmk[32];
+	uint8_t padding[32]; // circular queue elements are a power of two
+} pmk_db_row;
+COMPILE_TIME_ASSERT(sizeof(pmk_db_row) == 128);
+
+static THREAD_ENTRY(crack_wpa_pmk_db_thread)
 {
-	UNUSED_PARAM(ccount);
-	UNUSED_PARAM(values);
-	UNUSED_PARAM(columnnames);
 	REQUIRE(arg != NULL);
 
-	struct AP_info * ap = (struct AP_info *) arg;
+	uint8_t mic[MAX_KEYS_PER_CRYPT_SUPPORTED][20] __attribute__((aligned(32)));
+	uint8_t pmk[MAX_KEYS_PER_CRYPT_SUPPORTED][32] __attribute__((aligned(32)));
+	wpapsk_password keys[MAX_KEYS_PER_CRYPT_SUPPORTED]
+		__attribute__((aligned(64)));
+	pmk_db_row row;
+	pmk_db_row * row_ptr = &row;
 
-	unsigned char ptk[80];
-	unsigned char mic[20];
-	FILE * keyFile;
+	struct WPA_data * data;
+	struct AP_info * ap;
+	int threadid = 0;
+	void * ret = NULL;
+	int nkeys;
+	int j;
+
+	data = (struct WPA_data *) arg;
+	ap = data->ap;
+	threadid = data->threadid;
+
+	// The attack below requires a full handshake.
+	ALLEGE(ap->wpa.state == 7);
 
-	calc_mic(ap, (unsigned char *) values[0], ptk, mic);
+	dso_ac_crypto_engine_thread_init(&engine, threadid);
+
+	dso_ac_crypto_engine_calc_pke(&engine,
+								  ap->bssid,
+								  ap->wpa.stmac,
+								  ap->wpa.anonce,
+								  ap->wpa.snonce,
+								  threadid);
 
-	if (memcmp(mic, ap->wpa.keymic, 16) == 0)
+	bool done = false;
+	while (!done) // Continue until HAZARD value seen.
 	{
-		// Write the key to a file
-		if (opt.logKeyToFile != NULL)
+		memset(keys, 0, sizeof(keys));
+
+		for (nkeys = 0; nkeys < MAX_KEYS_PER_CRYPT_SUPPORTED; ++nkeys)
 		{
-			keyFile = fopen(opt.logKeyToFile, "w");
-			if (keyFile != NULL)
+			circular_queue_pop(
+				data->cqueue, (void * const *) &row_ptr, sizeof(row));
+
+			// Do we see our HAZARD value?
+			if ((uint8_t) row.passwd[0] == 0xff
+				&& (uint8_t) row.passwd[1] == 0xff
+				&& (uint8_t) row.passwd[2] == 0xff
+				&& (uint8_t) row.passwd[3] == 0xff)
 			{
-				fprintf(keyFile, "%s", values[1]);
-				ALLEGE(fclose(keyFile) != -1);
+				done = true;
+				break;
 			}
-		}
 
-		if (opt.is_quiet)
-		{
-			printf("KEY FOUND! [ %s ]\n", values[1]);
-			return (FAILURE);
+			memcpy(pmk[nkeys], row.pmk, sizeof(pmk[0]));
+			memcpy(keys[nkeys].v, row.passwd, sizeof(row.passwd));
+			keys[nkeys].length
+				= (uint32_t) strnlen(row.passwd, MAX_PASSPHRASE_LENGTH);
 		}
 
-		show_wpa_stats(values[1],
-					   (int) strlen(values[1]),
-					   (unsigned char *) (values[0]),
-					   ptk,
-					   mic,
-					   1);
+		if (nkeys == 0) continue;
 
-		if (opt.l33t)
+		if (unlikely((j = dso_ac_crypto_engine_wpa_pmk_crack(&engine,
+															 pmk,
+															 ap->wpa.eapol,
+															 ap->wpa.eapol_size,
+															 mic,
+															 ap->wpa.keyver,
+															 ap->wpa.keymic,
+															 nkeys,
+															 threadid))
+					 >= 0))
 		{
-			textstyle(TEXT_BRIGHT);
-			textcolor_fg(TEXT_RED);
+			crack_wpa_successfully_cracked(
+				data, keys, mic, nkeys, threadid, j);
 		}
 
-		moveto((80 - 15 - (int) strlen(values[1])) / 2, 8);
-		erase_line(2);
-		printf("KEY FOUND! [ %s ]\n", values[1]);
-		move(CURSOR_DOWN, 11);
+		increment_passphrase_counts(keys, nkeys);
 
-		if (opt.l33t)
+		if (threadid == first_wpa_threadid && !opt.is_quiet)
 		{
-			textcolor_normal();
-			textcolor_fg(TEXT_GREEN);
+			show_wpa_stats((char *) keys[0].v,
+						   keys[0].length,
+						   dso_ac_crypto_engine_get_pmk(&engine, threadid, 0),
+						   dso_ac_crypto_engine_get_ptk(&engine, threadid, 0),
+						   mic[0],
+						   0);
 		}
-
-		// abort the query
-		return (FAILURE);
 	}
 
-	ALLEGE(pthread_mutex_lock(&mx_nb) == 0);
-	nb_tried++;
-	nb_kprev++;
-	ALLEGE(pthread_mutex_unlock(&mx_nb) == 0);
+	ALLEGE(pthread_mutex_lock(&(data->mutex)) == 0);
+	data->active = 0; // We are no longer an active consumer.
+	ALLEGE(pthread_mutex_unlock(&(data->mutex)) == 0);
 
-	if (!opt.is_quiet)
-		show_wpa_stats(values[1],
-					   (int) strlen(values[1]),
-					   (unsigned char *) (values[0]),
-					   ptk,
-					   mic,
-					   0);
+	dso_ac_crypto_engine_thread_destroy(&engine, threadid);
 
-	return (SUCCESS);
+	return (ret);
 }
 #endif
 
@@ -4900,25 +5729,153 @@ static int do_wpa_crack(void)
 				|| (size_t) calculate_passphrase_length((uint8_t *) key1)
 					   < MIN_WPA_PASSPHRASE_LEN)
 			{
-				ALLEGE(pthread_mutex_lock(&mx_nb) == 0);
-				++nb_tried;
-				ALLEGE(pthread_mutex_unlock(&mx_nb) == 0);
-
-				continue;
+				ALLEGE(pthread_mutex_lock(&mx_nb) == 0);
+				++nb_tried;
+				ALLEGE(pthread_mutex_unlock(&mx_nb) == 0);
+
+				continue;
+			}
+		}
+
+		/* count number of lines in next wordlist chunk */
+		wl_count_next_block(&(wpa_data[cid]));
+
+		/* send the passphrase */
+		cid = (cid + 1) % opt.nbcpu;
+
+		(void) wpa_send_passphrase(key1, &(wpa_data[cid]), 1);
+	}
+
+	return (FAILURE);
+}
+
+#ifdef HAVE_SQLITE
+/// Hands a block of precomputed rows out to the cracking threads.
+static void wpa_send_pmk_db_block(pmk_db_row * block, size_t nrows, int * cid)
+{
+	REQUIRE(block != NULL);
+	REQUIRE(cid != NULL);
+
+	for (size_t i = 0; i < nrows && !wpa_cracked; ++i)
+	{
+		if (close_aircrack)
+		{
+			circular_queue_reset(wpa_data[*cid].cqueue);
+			return;
+		}
+
+		*cid = (*cid + 1) % opt.nbcpu;
+
+		circular_queue_push(wpa_data[*cid].cqueue, &block[i], sizeof(*block));
+	}
+}
+
+static int do_wpa_db_crack(struct AP_info * ap_cur)
+{
+	REQUIRE(ap_cur != NULL);
+	REQUIRE(db != NULL);
+
+	const char looper[4] = {'|', '/', '-', '\\'};
+	int looperc = 0;
+	int waited = 0;
+	int cid = 0;
+	int rc;
+	size_t nrows = 0;
+	sqlite3_stmt * stmt = NULL;
+	pmk_db_row * block;
+
+	// display program banner
+	if (!opt.is_quiet && !_speed_test)
+	{
+		if (opt.l33t) textcolor(TEXT_RESET, TEXT_WHITE, TEXT_BLACK);
+		erase_line(2);
+		if (opt.l33t) textcolor(TEXT_BRIGHT, TEXT_BLUE, TEXT_BLACK);
+		moveto((80 - (int) strlen(progname)) / 2, 2);
+		printf("%s", progname);
+	}
+
+	if (sqlite3_prepare_v2(db,
+						   "SELECT pmk.PMK, passwd.passwd FROM pmk INNER JOIN "
+						   "passwd ON passwd.passwd_id = pmk.passwd_id INNER "
+						   "JOIN essid ON essid.essid_id = pmk.essid_id WHERE "
+						   "essid.essid = ?1",
+						   -1,
+						   &stmt,
+						   NULL)
+		!= SQLITE_OK)
+	{
+		fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
+		wpa_wordlists_done = 1;
+		return (FAILURE);
+	}
+
+	ALLEGE(sqlite3_bind_text(stmt, 1, (char *) ap_cur->essid, -1, SQLITE_STATIC)
+		   == SQLITE_OK);
+
+	block = calloc(PMK_DB_BLOCK_ROWS, sizeof(pmk_db_row));
+	ALLEGE(block != NULL);
+
+	// Loop until no rows remain or a passphrase is found.
+	while (!wpa_cracked && !close_aircrack)
+	{
+		rc = sqlite3_step(stmt);
+
+		if (rc == SQLITE_ROW)
+		{
+			const void * pmk = sqlite3_column_blob(stmt, 0);
+			const unsigned char * passwd = sqlite3_column_text(stmt, 1);
+
+			// skip rows which are not fully computed, or are invalid
+			if (pmk == NULL || passwd == NULL
+				|| sqlite3_column_bytes(stmt, 0) < (int) sizeof(block->pmk))
+			{
+				continue;
+			}
+
+			memset(block[nrows].passwd, 0, sizeof(block->passwd));
+			strlcpy(block[nrows].passwd,
+					(const char *) passwd,
+					sizeof(block->passwd));
+			memcpy(block[nrows].pmk, pmk, sizeof(block->pmk));
+
+			if (++nrows == PMK_DB_BLOCK_ROWS)
+			{
+				wpa_send_pmk_db_block(block, nrows, &cid);
+				nrows = 0;
+			}
+		}
+		else if (rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+		{
+			fprintf(stdout,
+					"Database is locked or busy. Waiting %is ... %1c    \r",
+					++waited,
+					looper[looperc]);
+			fflush(stdout);
+			looperc = (looperc + 1) % sizeof(looper);
+			sleep(1);
+		}
+		else
+		{
+			if (rc != SQLITE_DONE)
+			{
+				fprintf(stderr, "SQL error: %s\n", sqlite3_errmsg(db));
 			}
+			break;
 		}
+	}
 
-		/* count number of lines in next wordlist chunk */
-		wl_count_next_block(&(wpa_data[cid]));
+	// send the partial, last block
+	wpa_send_pmk_db_block(block, nrows, &cid);
 
-		/* send the passphrase */
-		cid = (cid + 1) % opt.nbcpu;
+	if (waited != 0) printf("\n\n");
+	wpa_wordlists_done = 1;
 
-		(void) wpa_send_passphrase(key1, &(wpa_data[cid]), 1);
-	}
+	free(block);
+	sqlite3_finalize(stmt);
 
 	return (FAILURE);
 }
+#endif
 
 static int next_key(char ** key, int keysize)
 {
@@ -5106,6 +6063,79 @@ static int set_dicts(const char * args)
 	return (0);
 }
 
+/* the dictionary is read by one thread at a time, a batch of keys per
+ * turn, so that they all see the end of a wordlist exactly once */
+
+static pthread_mutex_t mx_wep_dict = PTHREAD_MUTEX_INITIALIZER;
+
+/* read up to WEP_LANES keys from the dictionary, each repeated up to the
+ * key length; returns the number of keys */
+
+static int next_wep_dict_keys(unsigned char (*keys)[64], char * key)
+{
+	int n, i, origlen;
+
+	ALLEGE(pthread_mutex_lock(&mx_wep_dict) == 0);
+
+	for (n = 0; n < WEP_LANES; n++)
+	{
+		if (next_key(&key, opt.keylen + 1) != SUCCESS) break;
+
+		origlen = (int) strlen(key);
+
+		for (i = 0; i < opt.keylen; i++)
+			keys[n][i] = (unsigned char) key[(origlen > 0) ? i % origlen : 0];
+	}
+
+	ALLEGE(pthread_mutex_unlock(&mx_wep_dict) == 0);
+
+	return (n);
+}
+
+/* test dictionary keys until they run out or the key is found; the main
+ * thread (arg is NULL) also refreshes the stats */
+
+static THREAD_ENTRY(wep_dict_thread)
+{
+	struct timeval t_last;
+	struct timeval t_now;
+	unsigned char keys[WEP_LANES][64];
+	char * key;
+	int n;
+
+	key = (char *) calloc(1, (size_t) opt.keylen + 1);
+	ALLEGE(key != NULL);
+
+	memset(keys, 0, sizeof(keys));
+
+	gettimeofday(&t_last, NULL);
+	t_last.tv_sec--;
+
+	while (!close_aircrack && !wepkey_crack_success)
+	{
+		if ((n = next_wep_dict_keys(keys, key)) == 0) break;
+
+		if (arg == NULL)
+		{
+			memcpy(wep.key, keys[0], (size_t) opt.keylen);
+
+			gettimeofday(&t_now, NULL);
+			if (!opt.is_quiet && (t_now.tv_sec - t_last.tv_sec) > 0)
+			{
+				show_wep_stats(opt.keylen - 1, 1, NULL, NULL, NULL, 0);
+				gettimeofday(&t_last, NULL);
+			}
+		}
+
+		if (check_wep_keys(keys, n, opt.keylen, 0) >= 0)
+			wepkey_crack_success = 1;
+	}
+
+	free(key);
+
+	return (NULL);
+}
+
 /*
 Uses the specified dictionary to crack the WEP key.
 
@@ -5114,12 +6144,8 @@ Return: SUCCESS if it cracked the key,
 */
 static int crack_wep_dict(void)
 {
-	struct timeval t_last;
-	struct timeval t_now;
-	int i, origlen, keysize;
-	char * key;
-
-	keysize = opt.keylen + 1;
+	pthread_t tid[MAX_THREADS];
+	int i, nthreads;
 
 	update_ivbuf();
 
@@ -5132,54 +6158,27 @@ static int crack_wep_dict(void)
 		return (FAILURE);
 	}
 
-	key = (char *) malloc(sizeof(char) * (opt.keylen + 1));
-	if (key == NULL) return (FAILURE);
-
-	gettimeofday(&t_last, NULL);
-	t_last.tv_sec--;
-
-	while (1)
+	nthreads = 0;
+	for (i = 1; i < opt.nbcpu && i < MAX_THREADS; i++)
 	{
-		if (next_key(&key, keysize) != SUCCESS)
+		if (pthread_create(&tid[nthreads], NULL, &wep_dict_thread, (void *) 1)
+			!= 0)
 		{
-			free(key);
-			return (FAILURE);
+			perror("pthread_create failed");
+			break;
 		}
+		nthreads++;
+	}
 
-		i = (int) strlen(key);
-
-		origlen = i;
-
-		while (i < opt.keylen)
-		{
-			key[i] = key[i - origlen];
-			i++;
-		}
+	wep_dict_thread(NULL);
 
-		key[i] = '\0';
+	for (i = 0; i < nthreads; i++) ALLEGE(pthread_join(tid[i], NULL) == 0);
 
-		if (!opt.is_quiet)
-		{
-			gettimeofday(&t_now, NULL);
-			if ((t_now.tv_sec - t_last.tv_sec) > 0)
-			{
-				show_wep_stats(opt.keylen - 1, 1, NULL, NULL, NULL, 0);
-				gettimeofday(&t_last, NULL);
-			}
-		}
+	if (!wepkey_crack_success) return (FAILURE);
 
-		for (i = 0; i <= opt.keylen; i++)
-		{
-			wep.key[i] = (unsigned char) key[i];
-		}
+	memcpy(wep.key, bf_wepkey, (size_t) opt.keylen);
 
-		if (check_wep_key(wep.key, opt.keylen, 0) == SUCCESS)
-		{
-			free(key);
-			wepkey_crack_success = 1;
-			return (SUCCESS);
-		}
-	}
+	return (SUCCESS);
 }
 
 /*
@@ -5194,6 +6193,8 @@ static int crack_wep_ptw(struct AP_info * ap_cur)
 
 	int(*all)[256];
 	int i, j, len = 0;
+	struct ptw_snapshot snap;
+	int save;
 
 	opt.ap = ap_cur;
 
@@ -5227,6 +6228,17 @@ static int crack_wep_ptw(struct AP_info * ap_cur)
 		}
 	}
 
+	ALLEGE(pthread_mutex_lock(&mx_apl) == 0);
+	ptw_flush(ap_cur);
+	save = opt.ptw_state != NULL && ptw_state_snapshot(ap_cur, &snap);
+	ALLEGE(pthread_mutex_unlock(&mx_apl) == 0);
+
+	if (save) ptw_state_save(&snap);
+
+	// the key search runs on as many threads as the KoreK attack
+	if (ap_cur->ptw_clean != NULL) ap_cur->ptw_clean->threads = opt.nbcpu;
+	if (ap_cur->ptw_vague != NULL) ap_cur->ptw_vague->threads = opt.nbcpu;
+
 	if (ap_cur->nb_ivs_clean > 99)
 	{
 		ap_cur->nb_ivs = ap_cur->nb_ivs_clean;
@@ -5334,8 +6346,7 @@ static int crack_wep_ptw(struct AP_info * ap_cur)
 
 	if (!len) return (FAILURE);
 
-	opt.probability = 100;
-	key_found(wep.key, len, -1);
+	key_found(wep.key, len, -1, 100);
 
 	return (SUCCESS);
 }
@@ -5426,6 +6437,10 @@ static int perform_wep_crack(struct AP_info * ap_cur)
 								  - (ap_cur->nb_ivs_vague % PTW_TRY_STEP));
 		do
 		{
+			ALLEGE(pthread_mutex_lock(&mx_apl) == 0);
+			ptw_flush(ap_cur);
+			ALLEGE(pthread_mutex_unlock(&mx_apl) == 0);
+
 			if (!opt.is_quiet)
 			{
 				char buf[1024];
@@ -5478,6 +6493,9 @@ static int perform_wep_crack(struct AP_info * ap_cur)
 	}
 	else
 	{
+		korek_pool.votes = calloc((size_t) opt.nbcpu, sizeof(*korek_pool.votes));
+		ALLEGE(korek_pool.votes != NULL);
+
 		for (int i = 0; i < opt.nbcpu; i++)
 		{
 			/* start one thread per cpu */
@@ -5605,20 +6623,6 @@ static int perform_wpa_crack(struct AP_info * ap_cur)
 {
 	REQUIRE(ap_cur != NULL);
 
-#ifdef HAVE_SQLITE
-	int rc;
-	char * zErrMsg = 0;
-	const char looper[4] = {'|', '/', '-', '\\'};
-	int looperc = 0;
-	int waited = 0;
-	const char * sqlformat
-		= "SELECT pmk.PMK, passwd.passwd FROM pmk INNER JOIN "
-		  "passwd ON passwd.passwd_id = pmk.passwd_id INNER JOIN "
-		  "essid ON essid.essid_id = pmk.essid_id WHERE "
-		  "essid.essid = '%q'";
-	char * sql;
-#endif
-
 	dso_ac_crypto_engine_init(&engine);
 
 	if (opt.dict == NULL && db == NULL)
@@ -5652,239 +6656,203 @@ static int perform_wpa_crack(struct AP_info * ap_cur)
 
 	dso_ac_crypto_engine_set_essid(&engine, ap_cur->essid);
 
-	if (db == NULL)
+	if (db != NULL && ap_cur->wpa.state != 7)
 	{
-		int starting_thread_id = id;
-		first_wpa_threadid = id;
+		fprintf(stderr,
+				"A full handshake is required to crack using an airolib-ng "
+				"database.\n");
+		return (FAILURE);
+	}
 
-		ALLEGE(opt.nbcpu >= 1);
+	int starting_thread_id = id;
+	first_wpa_threadid = id;
 
-		for (int i = 0; i < opt.nbcpu; i++)
-		{
-			if (ap_cur->ivbuf_size)
-			{
-				free(ap_cur->ivbuf);
-				ap_cur->ivbuf = NULL;
-				ap_cur->ivbuf_size = 0;
-			}
+	ALLEGE(opt.nbcpu >= 1);
 
-			uniqueiv_wipe(ap_cur->uiv_root);
-			ap_cur->uiv_root = NULL;
-			ap_cur->nb_ivs = 0;
+	for (int i = 0; i < opt.nbcpu; i++)
+	{
+		ivbuf_clear(&ap_cur->ivbuf);
 
-			// assumption: an eapol exists.
-			if (ap_cur->wpa.state <= 0)
-			{
-				fprintf(stderr,
-						"Packets contained no EAPOL data; unable "
-						"to process this AP.\n");
-				return (FAILURE);
-			}
+		uniqueiv_wipe(ap_cur->uiv_root);
+		ap_cur->uiv_root = NULL;
+		ap_cur->nb_ivs = 0;
+
+		// assumption: an eapol exists.
+		if (ap_cur->wpa.state <= 0)
+		{
+			fprintf(stderr,
+					"Packets contained no EAPOL data; unable "
+					"to process this AP.\n");
+			return (FAILURE);
+		}
 
-			const size_t key_size = MAX_PASSPHRASE_LENGTH + 1;
-			const size_t kb_size = WL_CIRCULAR_QUEUE_SIZE * key_size;
+#ifdef HAVE_SQLITE
+		const size_t key_size
+			= (db != NULL) ? sizeof(pmk_db_row) : MAX_PASSPHRASE_LENGTH + 1;
+#else
+		const size_t key_size = MAX_PASSPHRASE_LENGTH + 1;
+#endif
+		const size_t kb_size = WL_CIRCULAR_QUEUE_SIZE * key_size;
+		void * (*thread_entry)(void *)
+			= (ap_cur->wpa.state == 7 ? &crack_wpa_thread
+									  : &crack_wpa_pmkid_thread);
 
-			/* start one thread per cpu */
-			wpa_data[i].active = 1;
-			wpa_data[i].ap = ap_cur;
-			wpa_data[i].thread = i;
-			wpa_data[i].threadid = id;
+#ifdef HAVE_SQLITE
+		if (db != NULL) thread_entry = &crack_wpa_pmk_db_thread;
+#endif
+
+		/* start one thread per cpu */
+		wpa_data[i].active = 1;
+		wpa_data[i].ap = ap_cur;
+		wpa_data[i].thread = i;
+		wpa_data[i].threadid = id;
 #if HAVE_POSIX_MEMALIGN
-			if (posix_memalign((void **) &(wpa_data[i].key_buffer),
-							   CACHELINE_SIZE,
-							   kb_size))
-				perror("posix_memalign");
+		if (posix_memalign((void **) &(wpa_data[i].key_buffer),
+						   CACHELINE_SIZE,
+						   kb_size))
+			perror("posix_memalign");
 #else
-			wpa_data[i].key_buffer = calloc(1, kb_size);
+		wpa_data[i].key_buffer = calloc(1, kb_size);
 #endif
-			ALLEGE(wpa_data[i].key_buffer);
-			wpa_data[i].cqueue = circular_queue_init(
-				wpa_data[i].key_buffer, kb_size, key_size);
-			ALLEGE(wpa_data[i].cqueue);
-			memset(wpa_data[i].key, 0, sizeof(wpa_data[i].key));
-			ALLEGE(pthread_mutex_init(&wpa_data[i].mutex, NULL) == 0);
-
-			if (pthread_create(&(tid[id]),
-							   NULL,
-							   (ap_cur->wpa.state == 7
-									? &crack_wpa_thread
-									: &crack_wpa_pmkid_thread),
-							   (void *) &(wpa_data[i]))
-				!= 0)
-			{
-				perror("pthread_create failed");
-				return (FAILURE);
-			}
+		ALLEGE(wpa_data[i].key_buffer);
+		wpa_data[i].cqueue = circular_queue_init(
+			wpa_data[i].key_buffer, kb_size, key_size);
+		ALLEGE(wpa_data[i].cqueue);
+		memset(wpa_data[i].key, 0, sizeof(wpa_data[i].key));
+		ALLEGE(pthread_mutex_init(&wpa_data[i].mutex, NULL) == 0);
 
-			ac_cpuset_bind_thread_at(cpuset, tid[id], (size_t) i);
-
-			id++;
+		if (pthread_create(
+				&(tid[id]), NULL, thread_entry, (void *) &(wpa_data[i]))
+			!= 0)
+		{
+			perror("pthread_create failed");
+			return (FAILURE);
 		}
 
-		int ret = do_wpa_crack(); // we feed keys to the cracking threads
-
-		// Shutdown the circular queue.
-		bool shutdown;
-		do
-		{
-			shutdown = true;
+		ac_cpuset_bind_thread_at(cpuset, tid[id], (size_t) i);
 
-			for (int i = 0; i < opt.nbcpu; ++i)
-			{
-				int active;
+		id++;
+	}
 
-				if (close_aircrack_fast || wpa_cracked)
-				{
-					circular_queue_reset(wpa_data[i].cqueue);
-				}
+	// we feed keys to the cracking threads
+#ifdef HAVE_SQLITE
+	int ret = (db != NULL) ? do_wpa_db_crack(ap_cur) : do_wpa_crack();
+#else
+	int ret = do_wpa_crack();
+#endif
 
-				ALLEGE(pthread_mutex_lock(&(wpa_data[i].mutex)) == 0);
-				active = wpa_data[i].active;
-				ALLEGE(pthread_mutex_unlock(&(wpa_data[i].mutex)) == 0);
+	// Shutdown the circular queue.
+	bool shutdown;
+	do
+	{
+		shutdown = true;
 
-				if (active)
-				{
-					bool result = circular_queue_try_push(
-									  wpa_data[i].cqueue, "\xff\xff\xff\xff", 4)
-								  == 0;
-					if (!result) shutdown = false;
-				}
-			}
-		} while (!shutdown);
+		for (int i = 0; i < opt.nbcpu; ++i)
+		{
+			int active;
 
-		// we wait for the cracking threads to end
-		for (int i = starting_thread_id; i < opt.nbcpu + starting_thread_id;
-			 i++)
-			if (tid[i] != 0)
+			if (close_aircrack_fast || wpa_cracked)
 			{
-				ALLEGE(pthread_join(tid[i], NULL) == 0);
-				tid[i] = 0;
+				circular_queue_reset(wpa_data[i].cqueue);
 			}
 
-		// find the matching passphrase
-		int i;
-		for (i = 0; i < opt.nbcpu; i++)
-		{
-			if (wpa_data[i].key[0] != 0)
+			ALLEGE(pthread_mutex_lock(&(wpa_data[i].mutex)) == 0);
+			active = wpa_data[i].active;
+			ALLEGE(pthread_mutex_unlock(&(wpa_data[i].mutex)) == 0);
+
+			if (active)
 			{
-				ret = SUCCESS;
-				break;
+				bool result = circular_queue_try_push(
+								  wpa_data[i].cqueue, "\xff\xff\xff\xff", 4)
+							  == 0;
+				if (!result) shutdown = false;
 			}
 		}
+	} while (!shutdown);
 
-		if (ret == SUCCESS)
+	// we wait for the cracking threads to end
+	for (int i = starting_thread_id; i < opt.nbcpu + starting_thread_id;
+		 i++)
+		if (tid[i] != 0)
 		{
-			if (opt.is_quiet)
-			{
-				printf("KEY FOUND! [ %s ]\n", wpa_data[i].key);
-				clean_exit(EXIT_SUCCESS);
-				return (SUCCESS);
-			}
+			ALLEGE(pthread_join(tid[i], NULL) == 0);
+			tid[i] = 0;
+		}
 
-			if (opt.l33t)
-			{
-				textstyle(TEXT_BRIGHT);
-				textcolor_fg(TEXT_RED);
-			}
+	// find the matching passphrase
+	int i;
+	for (i = 0; i < opt.nbcpu; i++)
+	{
+		if (wpa_data[i].key[0] != 0)
+		{
+			ret = SUCCESS;
+			break;
+		}
+	}
 
-			moveto((80 - 15 - (int) strlen(wpa_data[i].key)) / 2, 8);
-			erase_line(2);
+	if (ret == SUCCESS)
+	{
+		if (opt.is_quiet)
+		{
 			printf("KEY FOUND! [ %s ]\n", wpa_data[i].key);
-			move(CURSOR_DOWN, 11);
-
-			if (opt.l33t)
-			{
-				textcolor_normal();
-				textcolor_fg(TEXT_GREEN);
-			}
-
-			moveto(0, 22);
-
 			clean_exit(EXIT_SUCCESS);
+			return (SUCCESS);
 		}
-		else if (!close_aircrack)
+
+		if (opt.l33t)
 		{
-			if (opt.is_quiet)
-			{
-				printf("\nKEY NOT FOUND\n");
-				clean_exit(EXIT_FAILURE);
-				return (FAILURE);
-			}
+			textstyle(TEXT_BRIGHT);
+			textcolor_fg(TEXT_RED);
+		}
 
-			if (opt.stdin_dict)
-			{
-				moveto(30, 5);
-				printf(" %zd\n", nb_tried);
-			}
-			else
-			{
-				uint8_t ptk[64] = {0};
-				uint8_t mic[32] = {0};
+		moveto((80 - 15 - (int) strlen(wpa_data[i].key)) / 2, 8);
+		erase_line(2);
+		printf("KEY FOUND! [ %s ]\n", wpa_data[i].key);
+		move(CURSOR_DOWN, 11);
 
-				show_wpa_stats(wpa_data[i].key,
-							   (int) strlen(wpa_data[i].key),
-							   (unsigned char *) (wpa_data[i].key),
-							   ptk,
-							   mic,
-							   1);
+		if (opt.l33t)
+		{
+			textcolor_normal();
+			textcolor_fg(TEXT_GREEN);
+		}
 
-				moveto((80 - 13) / 2, 8);
-				erase_line(2);
-				printf("KEY NOT FOUND\n");
+		moveto(0, 22);
 
-				moveto(0, 22);
-			}
-		}
+		clean_exit(EXIT_SUCCESS);
 	}
-#ifdef HAVE_SQLITE
-	else
+	else if (!close_aircrack)
 	{
-		if (!opt.is_quiet && !_speed_test)
+		if (opt.is_quiet)
 		{
-			if (opt.l33t) textcolor(TEXT_RESET, TEXT_WHITE, TEXT_BLACK);
-			erase_line(2);
-			if (opt.l33t) textcolor(TEXT_BRIGHT, TEXT_BLUE, TEXT_BLACK);
-			moveto((80 - (int) strlen(progname)) / 2, 2);
-			printf("%s", progname);
+			printf("\nKEY NOT FOUND\n");
+			clean_exit(EXIT_FAILURE);
+			return (FAILURE);
 		}
-		sql = sqlite3_mprintf(sqlformat, ap_cur->essid);
-		while (1)
+
+		if (opt.stdin_dict)
 		{
-			rc = sqlite3_exec(db, sql, sql_wpacallback, ap_cur, &zErrMsg);
-			if (rc == SQLITE_LOCKED || rc == SQLITE_BUSY)
-			{
-				fprintf(stdout,
-						"Database is locked or busy. Waiting %is ... %1c    \r",
-						++waited,
-						looper[looperc]);
-				fflush(stdout);
-				looperc = (looperc + 1) % sizeof(looper);
-				sleep(1);
-				if (zErrMsg)
-				{
-					sqlite3_free(zErrMsg);
-					zErrMsg = NULL;
-				}
-			}
-			else
-			{
-				if (rc != SQLITE_OK && rc != SQLITE_ABORT)
-				{
-					fprintf(stderr, "SQL error: %s\n", zErrMsg);
-				}
-				if (waited != 0) printf("\n\n");
-				wpa_wordlists_done = 1;
-				if (zErrMsg)
-				{
-					sqlite3_free(zErrMsg);
-					zErrMsg = NULL;
-				}
-				break;
-			}
+			moveto(30, 5);
+			printf(" %zd\n", nb_tried);
+		}
+		else
+		{
+			uint8_t ptk[64] = {0};
+			uint8_t mic[32] = {0};
+
+			show_wpa_stats(wpa_data[i].key,
+						   (int) strlen(wpa_data[i].key),
+						   (unsigned char *) (wpa_data[i].key),
+						   ptk,
+						   mic,
+						   1);
+
+			moveto((80 - 13) / 2, 8);
+			erase_line(2);
+			printf("KEY NOT FOUND\n");
+
+			moveto(0, 22);
 		}
-		sqlite3_free(sql);
 	}
-#endif
 
 	return (SUCCESS);
 }
@@ -5936,8 +6904,6 @@ int main(int argc, char * argv[])
 
 	rand_init();
 
-	memset(&mc_pipe[0][0], -1, sizeof(mc_pipe));
-	memset(&cm_pipe[0][0], -1, sizeof(cm_pipe));
 	memset(&bf_pipe[0][0], -1, sizeof(bf_pipe));
 
 #if DYNAMIC
@@ -6047,6 +7013,7 @@ int main(int argc, char * argv[])
 			   {"restore-session", 1, 0, 'R'},
 			   {"simd", 1, 0, 'W'},
 			   {"simd-list", 0, 0, 0},
+			   {"ptw-state", 1, 0, 0},
 			   {0, 0, 0, 0}};
 
 		// Load argc/argv either from the cracking session or from arguments
@@ -6073,6 +7040,15 @@ int main(int argc, char * argv[])
 
 				exit(EXIT_SUCCESS);
 			}
+
+			if (strcmp(long_options[option_index].name, "ptw-state") == 0
+				&& option == 0)
+			{
+				destroy(opt.ptw_state, free);
+				opt.ptw_state = strdup(optarg);
+				ALLEGE(opt.ptw_state != NULL);
+				continue;
+			}
 		}
 
 		switch (option)
@@ -6996,9 +7972,8 @@ int main(int argc, char * argv[])
 		}
 
 		ap_cur->nb_ivs = 0;
-		ap_cur->ivbuf_size = 0;
 
-		destroy(ap_cur->ivbuf, free);
+		ivbuf_clear(&ap_cur->ivbuf);
 
 		// Destroy WPA struct in all stations of the selected AP
 		if (ap_cur->stations != NULL)
@@ -7109,13 +8084,10 @@ int main(int argc, char * argv[])
 		goto exit_main;
 	}
 
-	/* create the cracker<->master communication pipes */
+	/* create the bruteforcer communication pipes */
 
 	for (i = 0; i < opt.nbcpu; i++)
 	{
-		IGNORE_NZ(pipe(mc_pipe[i]));
-		IGNORE_NZ(pipe(cm_pipe[i]));
-
 		if (opt.amode <= 1 && opt.nbcpu > 1 && opt.do_brute && opt.do_mt_brute)
 		{
 			IGNORE_NZ(pipe(bf_pipe[i]));
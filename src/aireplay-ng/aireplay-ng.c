@@ -82,6 +82,7 @@
 #include "aircrack-ng/tui/console.h"
 
 #define RTC_RESOLUTION 8192
+#define REPLAY_BATCH 32
 
 #define REQUESTS 30
 #define MAX_APS 50
@@ -407,6 +408,35 @@ static void send_fragments(unsigned char * packet,
 	}
 }
 
+/*
+ * Sends buf as many times as needed to catch up with the -x rate, "ticks"
+ * RTC ticks after the first frame: at least once, and up to REPLAY_BATCH
+ * times in a single batch when the timer lagged.
+ */
+static int replay_packet(uint8_t * buf, size_t count, float ticks)
+{
+	REQUIRE(buf != NULL);
+	REQUIRE(count > 0 && count <= 4096);
+
+	static uint8_t copies[REPLAY_BATCH][4096];
+	struct wi_frame frames[REPLAY_BATCH];
+	double due;
+	int i, nb = 1;
+
+	due = ((double) ticks / (double) RTC_RESOLUTION) * (double) opt.r_nbpps
+		  - (double) nb_pkt_sent;
+	if (due > 1.0) nb = (due >= REPLAY_BATCH) ? REPLAY_BATCH : (int) due + 1;
+
+	for (i = 0; i < nb; i++)
+	{
+		memcpy(copies[i], buf, count);
+		frames[i].h80211 = copies[i];
+		frames[i].len = (int) count;
+	}
+
+	return (send_packets(_wi_out, frames, nb, kRewriteSequenceNumber));
+}
+
 static int do_attack_deauth(void)
 {
 	int i, n;
@@ -1564,19 +1594,8 @@ read_packets:
 
 		if (nb_pkt_sent == 0) ticks[0] = 0;
 
-		if (send_packet(
-				_wi_out, h80211, (size_t) caplen, kRewriteSequenceNumber)
-			< 0)
+		if (replay_packet(h80211, (size_t) caplen, ticks[0]) < 0)
 			return (EXIT_FAILURE);
-
-		if (((double) ticks[0] / (double) RTC_RESOLUTION) * (double) opt.r_nbpps
-			> (double) nb_pkt_sent)
-		{
-			if (send_packet(
-					_wi_out, h80211, (size_t) caplen, kRewriteSequenceNumber)
-				< 0)
-				return (EXIT_FAILURE);
-		}
 	}
 
 	return (EXIT_SUCCESS);
@@ -1756,10 +1775,9 @@ static int do_attack_arp_resend(void)
 			{
 				if (nb_pkt_sent == 0) ticks[0] = 0;
 
-				if (send_packet(_wi_out,
-								arp[arp_off1].buf,
-								(size_t) arp[arp_off1].len,
-								kRewriteSequenceNumber)
+				if (replay_packet(arp[arp_off1].buf,
+								  (size_t) arp[arp_off1].len,
+								  ticks[0])
 					< 0)
 				{
 					free(arp);
@@ -1767,22 +1785,6 @@ static int do_attack_arp_resend(void)
 					return (EXIT_FAILURE);
 				}
 
-				if (((double) ticks[0] / (double) RTC_RESOLUTION)
-						* (double) opt.r_nbpps
-					> (double) nb_pkt_sent)
-				{
-					if (send_packet(_wi_out,
-									arp[arp_off1].buf,
-									(size_t) arp[arp_off1].len,
-									kRewriteSequenceNumber)
-						< 0)
-					{
-						free(arp);
-						fclose(f_cap_out);
-						return (EXIT_FAILURE);
-					}
-				}
-
 				if (++arp_off1 >= nb_arp) arp_off1 = 0;
 			}
 		}
@@ -2214,31 +2216,15 @@ static int do_attack_caffe_latte(void)
 			{
 				if (nb_pkt_sent == 0) ticks[0] = 0;
 
-				if (send_packet(_wi_out,
-								arp[arp_off1].buf,
-								(size_t) arp[arp_off1].len,
-								kRewriteSequenceNumber)
+				if (replay_packet(arp[arp_off1].buf,
+								  (size_t) arp[arp_off1].len,
+								  ticks[0])
 					< 0)
 				{
 					free(arp);
 					fclose(f_cap_out);
 					return (1);
 				}
-				if (((double) ticks[0] / (double) RTC_RESOLUTION)
-						* (double) opt.r_nbpps
-					> (double) nb_pkt_sent)
-				{
-					if (send_packet(_wi_out,
-									arp[arp_off1].buf,
-									(size_t) arp[arp_off1].len,
-									kRewriteSequenceNumber)
-						< 0)
-					{
-						free(arp);
-						fclose(f_cap_out);
-						return (1);
-					}
-				}
 
 				if (++arp_off1 >= nb_arp) arp_off1 = 0;
 			}
@@ -2700,10 +2686,9 @@ static int do_attack_migmode(void)
 			{
 				if (nb_pkt_sent == 0) ticks[0] = 0;
 
-				if (send_packet(_wi_out,
-								arp[arp_off1].buf,
-								(size_t) arp[arp_off1].len,
-								kRewriteSequenceNumber)
+				if (replay_packet(arp[arp_off1].buf,
+								  (size_t) arp[arp_off1].len,
+								  ticks[0])
 					< 0)
 				{
 					free(arp);
@@ -2711,22 +2696,6 @@ static int do_attack_migmode(void)
 					return (1);
 				}
 
-				if (((double) ticks[0] / (double) RTC_RESOLUTION)
-						* (double) opt.r_nbpps
-					> (double) nb_pkt_sent)
-				{
-					if (send_packet(_wi_out,
-									arp[arp_off1].buf,
-									(size_t) arp[arp_off1].len,
-									kRewriteSequenceNumber)
-						< 0)
-					{
-						free(arp);
-						fclose(f_cap_out);
-						return (1);
-					}
-				}
-
 				if (++arp_off1 >= nb_arp) arp_off1 = 0;
 			}
 		}
@@ -65,6 +65,10 @@
 #include <pthread.h>
 #include <termios.h>
 #include <limits.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
 
 #include <sys/wait.h>
 
@@ -109,7 +113,7 @@ static const char * OUI_PATHS[]
 	   "/usr/share/wireshark/manuf/oui.txt",
 	   NULL};
 
-static int read_pkts = 0;
+static unsigned long read_pkts = 0;
 
 static int abg_chans[]
 	= {1,   7,   13,  2,   8,   3,   14,  9,   4,   10,  5,   11,  6,
@@ -132,8 +136,8 @@ static volatile int quitting = 0;
 static volatile time_t quitting_event_ts = 0;
 
 static void dump_sort(void);
-static void dump_print(int ws_row, int ws_col, int if_num);
-static char *
+static void dump_print(FILE * out, int ws_row, int ws_col, int if_num);
+static const char *
 get_manufacturer(unsigned char mac0, unsigned char mac1, unsigned char mac2);
 int is_filtered_essid(const uint8_t * essid);
 
@@ -143,8 +147,12 @@ static struct local_options
 {
 	struct AP_info *ap_1st, *ap_end;
 	struct ST_info *st_1st, *st_end;
-	struct NA_info * na_1st;
-	struct oui * manufList;
+	struct NA_info *na_1st, *na_end;
+	struct mac_table ap_index, st_index, na_index; /* lookup by MAC */
+	struct oui * manufList; /* sorted by OUI              */
+	size_t manufCount;
+	size_t manufSize;
+	int manufLoaded; /* whole OUI file in manufList */
 
 	unsigned char prev_bssid[6];
 	char ** f_essid;
@@ -225,6 +233,9 @@ static struct local_options
 	char * s_iface; /* source interface to read from */
 	FILE * f_cap_in;
 	struct pcap_file_header pfh_in;
+	unsigned char * map_in; /* mmap()ed input file, if any */
+	size_t map_len;
+	size_t map_pos; /* next frame in map_in */
 	int detect_anomaly; /* Detect WIPS protecting WEP in action */
 
 	char * freqstring;
@@ -252,9 +263,39 @@ static struct local_options
 	int num_cards;
 	int do_pause;
 	int do_sort_always;
-
-	pthread_mutex_t mx_print; /* lock write access to ap LL   */
+	int sorted_by; /* ordering of the lists      */
+	int sorted_inv;
+	unsigned int sort_gen; /* bumped when it changes     */
+	unsigned long ap_seq; /* APs seen so far            */
+	unsigned long st_seq; /* stations seen so far       */
+	void ** sort_buf; /* entries moved by dump_sort */
+	size_t sort_buf_size;
+
+	pthread_mutex_t mx_print; /* lock access to the AP/ST lists */
 	pthread_mutex_t mx_sort; /* lock write access to ap LL   */
+	pthread_mutex_t mx_manuf; /* lock growing the OUI list    */
+
+	struct capture_ring rings[MAX_CARDS]; /* one per reader thread */
+	pthread_mutex_t mx_capture; /* wakes up the main thread     */
+	pthread_cond_t cv_capture; /* signaled when frames come in */
+	int capture_pending; /* frames came in since the wait */
+	pthread_t display_tid; /* redraws the screen           */
+	pthread_t writer_tid; /* updates the output files     */
+	time_t start_time; /* for the elapsed time         */
+
+	int capture_only; /* write the frames, keep no AP/ST state */
+	struct pcap_writer pcap; /* drains the rings in that mode        */
+	int rx_ring; /* read the cards through a kernel ring  */
+
+	int offline; /* parse the input file at full speed    */
+	int print_waiters; /* display/writer threads after mx_print */
+
+	struct slab_pool ap_pool; /* AP_info records                 */
+	struct slab_pool st_pool; /* ST_info records                 */
+	struct slab_pool na_pool; /* NA_info records                 */
+	struct slab_pool pkt_pool; /* decloak pkt_buf entries         */
+	int max_age; /* drop records unseen that long   */
+	size_t max_entries; /* APs, clients and NAs kept, each */
 
 	unsigned char selected_bssid[6]; /* bssid that is selected */
 
@@ -302,9 +343,6 @@ static void color_off(void)
 		ap_cur->marked_color = 1;
 		ap_cur = ap_cur->next;
 	}
-
-	textcolor_normal();
-	textcolor_fg(TEXT_WHITE);
 }
 
 static void color_on(void)
@@ -378,10 +416,33 @@ static void color_on(void)
 	}
 }
 
+/* Renders the screen with mx_print held. It is only written to the terminal
+   by screen_show(), once the lock is released: a stalled terminal then holds
+   up the display alone, instead of the parser and the capture files. */
+static void screen_render(struct text_record * screen)
+{
+	FILE * f = text_record_open(screen);
+
+	dump_print(f, lopt.ws.ws_row, lopt.ws.ws_col, lopt.num_cards);
+	text_record_close(f, screen);
+}
+
+static void screen_show(struct text_record * screen)
+{
+	if (screen->len > 0) fwrite(screen->text, 1, screen->len, stdout);
+	fflush(stdout);
+
+	free(screen->text);
+	screen->text = NULL;
+	screen->len = 0;
+}
+
 static THREAD_ENTRY(input_thread)
 {
 	UNUSED_PARAM(arg);
 
+	struct text_record screen = {NULL, 0};
+
 	while (lopt.do_exit == 0)
 	{
 		int keycode = 0;
@@ -403,13 +464,21 @@ static THREAD_ENTRY(input_thread)
 
 		if (keycode == KEY_o)
 		{
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 			color_on();
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
+			textcolor_normal();
+			textcolor_fg(TEXT_WHITE);
 			snprintf(lopt.message, sizeof(lopt.message), "][ color on");
 		}
 
 		if (keycode == KEY_p)
 		{
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 			color_off();
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
+			textcolor_normal();
+			textcolor_fg(TEXT_WHITE);
 			snprintf(lopt.message, sizeof(lopt.message), "][ color off");
 		}
 
@@ -484,9 +553,11 @@ static THREAD_ENTRY(input_thread)
 				default:
 					break;
 			}
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 			ALLEGE(pthread_mutex_lock(&(lopt.mx_sort)) == 0);
 			dump_sort();
 			ALLEGE(pthread_mutex_unlock(&(lopt.mx_sort)) == 0);
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
 		}
 
 		if (keycode == KEY_SPACE)
@@ -498,9 +569,11 @@ static THREAD_ENTRY(input_thread)
 					lopt.message, sizeof(lopt.message), "][ paused output");
 				ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 
-				dump_print(lopt.ws.ws_row, lopt.ws.ws_col, lopt.num_cards);
+				screen_render(&screen);
 
 				ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
+
+				screen_show(&screen);
 			}
 			else
 				snprintf(
@@ -530,20 +603,25 @@ static THREAD_ENTRY(input_thread)
 
 		if (keycode == KEY_ARROW_DOWN)
 		{
+			/* the selected AP may be dropped by evict_records() */
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 			if (lopt.p_selected_ap && lopt.p_selected_ap->prev)
 			{
 				lopt.p_selected_ap = lopt.p_selected_ap->prev;
 				lopt.en_selection_direction = selection_direction_down;
 			}
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
 		}
 
 		if (keycode == KEY_ARROW_UP)
 		{
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 			if (lopt.p_selected_ap && lopt.p_selected_ap->next)
 			{
 				lopt.p_selected_ap = lopt.p_selected_ap->next;
 				lopt.en_selection_direction = selection_direction_up;
 			}
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
 		}
 
 		if (keycode == KEY_i)
@@ -561,6 +639,7 @@ static THREAD_ENTRY(input_thread)
 
 		if (keycode == KEY_TAB)
 		{
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 			if (lopt.p_selected_ap == NULL)
 			{
 				lopt.p_selected_ap = lopt.ap_end;
@@ -579,6 +658,7 @@ static THREAD_ENTRY(input_thread)
 						 sizeof(lopt.message),
 						 "][ disabled selection");
 			}
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
 		}
 
 		if (keycode == KEY_a)
@@ -627,9 +707,11 @@ static THREAD_ENTRY(input_thread)
 		{
 			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 
-			dump_print(lopt.ws.ws_row, lopt.ws.ws_col, lopt.num_cards);
+			screen_render(&screen);
 
 			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
+
+			screen_show(&screen);
 		}
 	}
 
@@ -653,90 +735,134 @@ static FILE * open_oui_file(void)
 	return (fp);
 }
 
-static struct oui * load_oui_file(void)
+/* parses a "XX-XX-XX   (hex)   Manufacturer" line of the OUI file */
+static int parse_oui_line(char * buffer, struct oui * oui)
+{
+	unsigned int a, b, c;
+
+	if (strstr(buffer, "(hex)") == NULL) return (-1);
+
+	// Remove leading/trailing whitespaces.
+	trim(buffer);
+	if (sscanf(buffer, "%2x-%2x-%2x", &a, &b, &c) != 3) return (-1);
+
+	oui->id = (a << 16) | (b << 8) | c;
+	oui->manuf = NULL;
+
+	return (0);
+}
+
+static int oui_cmp(const void * a, const void * b)
+{
+	const struct oui * oui_a = (const struct oui *) a;
+	const struct oui * oui_b = (const struct oui *) b;
+
+	if (oui_a->id != oui_b->id) return ((oui_a->id > oui_b->id) ? 1 : -1);
+
+	return ((oui_a->order > oui_b->order) - (oui_a->order < oui_b->order));
+}
+
+/* index of the first entry with an id not lower than the given one */
+static size_t oui_find(uint32_t id)
+{
+	size_t lo = 0, hi = lopt.manufCount, mid;
+
+	while (lo < hi)
+	{
+		mid = lo + (hi - lo) / 2;
+
+		if (lopt.manufList[mid].id < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (lo);
+}
+
+static int oui_reserve(size_t count)
+{
+	struct oui * bigger;
+	size_t size;
+
+	if (count <= lopt.manufSize) return (0);
+
+	size = (lopt.manufSize == 0) ? 1024 : lopt.manufSize;
+	while (size < count) size *= 2;
+
+	bigger = (struct oui *) realloc(lopt.manufList, size * sizeof(struct oui));
+	if (bigger == NULL) return (-1);
+
+	lopt.manufList = bigger;
+	lopt.manufSize = size;
+
+	return (0);
+}
+
+static void free_oui_list(void)
+{
+	size_t i;
+
+	for (i = 0; i < lopt.manufCount; i++) free(lopt.manufList[i].manuf);
+
+	free(lopt.manufList);
+	lopt.manufList = NULL;
+	lopt.manufCount = 0;
+	lopt.manufSize = 0;
+	lopt.manufLoaded = 0;
+}
+
+static int load_oui_file(void)
 {
 	FILE * fp;
-	char * manuf;
 	char buffer[BUFSIZ];
-	unsigned char a[2];
-	unsigned char b[2];
-	unsigned char c[2];
-	struct oui *oui_ptr = NULL, *oui_head = NULL;
+	struct oui oui;
+	size_t i, j;
 
 	fp = open_oui_file();
 	if (!fp)
 	{
-		return (NULL);
+		return (-1);
 	}
 
 	memset(buffer, 0x00, sizeof(buffer));
 	while (fgets(buffer, sizeof(buffer), fp) != NULL)
 	{
-		if (!(strstr(buffer, "(hex)"))) continue;
+		if (parse_oui_line(buffer, &oui) != 0) continue;
 
-		memset(a, 0x00, sizeof(a));
-		memset(b, 0x00, sizeof(b));
-		memset(c, 0x00, sizeof(c));
-		// Remove leading/trailing whitespaces.
-		trim(buffer);
-		if (sscanf(buffer, "%2c-%2c-%2c", (char *) a, (char *) b, (char *) c)
-			== 3)
+		if (oui_reserve(lopt.manufCount + 1) != 0)
 		{
-			if (oui_ptr == NULL)
-			{
-				if (!(oui_ptr = (struct oui *) malloc(sizeof(struct oui))))
-				{
-					fclose(fp);
-					perror("malloc failed");
-					return (NULL);
-				}
-			}
-			else
-			{
-				if (!(oui_ptr->next
-					  = (struct oui *) malloc(sizeof(struct oui))))
-				{
-					fclose(fp);
-					perror("malloc failed");
-
-					while (oui_head != NULL)
-					{
-						oui_ptr = oui_head->next;
-						free(oui_head);
-						oui_head = oui_ptr;
-					}
-					return (NULL);
-				}
-				oui_ptr = oui_ptr->next;
-			}
-			memset(oui_ptr->id, 0x00, sizeof(oui_ptr->id));
-			memset(oui_ptr->manuf, 0x00, sizeof(oui_ptr->manuf));
-			snprintf(oui_ptr->id,
-					 sizeof(oui_ptr->id),
-					 "%c%c:%c%c:%c%c",
-					 a[0],
-					 a[1],
-					 b[0],
-					 b[1],
-					 c[0],
-					 c[1]);
-			manuf = get_manufacturer_from_string(buffer);
-			if (manuf != NULL)
-			{
-				snprintf(oui_ptr->manuf, sizeof(oui_ptr->manuf), "%s", manuf);
-				free(manuf);
-			}
-			else
-			{
-				snprintf(oui_ptr->manuf, sizeof(oui_ptr->manuf), "Unknown");
-			}
-			if (oui_head == NULL) oui_head = oui_ptr;
-			oui_ptr->next = NULL;
+			fclose(fp);
+			perror("malloc failed");
+			free_oui_list();
+			return (-1);
 		}
+
+		oui.order = (uint32_t) lopt.manufCount;
+		oui.manuf = get_manufacturer_from_string(buffer);
+		lopt.manufList[lopt.manufCount++] = oui;
 	}
 
 	fclose(fp);
-	return (oui_head);
+
+	/* sort by OUI, keeping only the first entry of an OUI */
+	qsort(lopt.manufList, lopt.manufCount, sizeof(struct oui), oui_cmp);
+
+	for (i = j = 0; i < lopt.manufCount; i++)
+	{
+		if (j > 0 && lopt.manufList[j - 1].id == lopt.manufList[i].id)
+		{
+			free(lopt.manufList[i].manuf);
+			continue;
+		}
+
+		lopt.manufList[j++] = lopt.manufList[i];
+	}
+
+	lopt.manufCount = j;
+	lopt.manufLoaded = 1;
+
+	return (0);
 }
 
 static const char usage[] =
@@ -760,10 +886,17 @@ static const char usage[] =
 	"      --berlin       <secs> : Time before removing the AP/client\n"
 	"                              from the screen when no more packets\n"
 	"                              are received (Default: 120 seconds)\n"
+	"      --max-age      <secs> : Free the APs and clients not seen for\n"
+	"                              that long (Default: never)\n"
+	"      --max-entries   <num> : Keep at most num APs and num clients,\n"
+	"                              freeing the least recently seen ones\n"
 	"      -r             <file> : Read packets from that file\n"
 	"      -T                    : While reading packets from a file,\n"
 	"                              simulate the arrival rate of them\n"
 	"                              as if they were \"live\".\n"
+	"      --offline             : While reading packets from a file,\n"
+	"                              parse them at full speed and print\n"
+	"                              the frame rate when done\n"
 	"      -x            <msecs> : Active Scanning Simulation\n"
 	"      --manufacturer        : Display manufacturer from IEEE OUI list\n"
 	"      --uptime              : Display AP Uptime from Beacon Timestamp\n"
@@ -771,12 +904,17 @@ static const char usage[] =
 	"      --output-format\n"
 	"                  <formats> : Output format. Possible values:\n"
 	"                              pcap, ivs, csv, gps, kismet, netxml, "
-	"logcsv\n"
+	"logcsv,\n"
+	"                              events\n"
 	"      --ignore-negative-one : Removes the message that says\n"
 	"                              fixed channel <interface>: -1\n"
 	"      --write-interval\n"
 	"                  <seconds> : Output file(s) write interval in seconds\n"
 	"      --background <enable> : Override background detection.\n"
+	"      --capture-only        : Only write the frames to the pcap\n"
+	"                              file and print capture counters\n"
+	"      --rx-ring             : Read the interfaces through a\n"
+	"                              kernel receive ring (Linux)\n"
 	"      -n              <int> : Minimum AP packets recv'd before\n"
 	"                              for displaying it\n"
 	"\n"
@@ -1034,6 +1172,86 @@ static int update_dataps(void)
 	return (0);
 }
 
+#define SLAB_SIZE (64 * 1024)
+#define SLAB_ALIGN 16
+
+static void slab_pool_init(struct slab_pool * pool, size_t size)
+{
+	REQUIRE(pool != NULL);
+	REQUIRE(size != 0);
+
+	memset(pool, 0, sizeof(*pool));
+	pool->size = (size + SLAB_ALIGN - 1) & ~(size_t)(SLAB_ALIGN - 1);
+	pool->per_slab = (SLAB_SIZE - SLAB_ALIGN) / pool->size;
+	if (pool->per_slab == 0) pool->per_slab = 1;
+}
+
+/* Returns a zeroed object, NULL when out of memory. */
+static void * slab_alloc(struct slab_pool * pool)
+{
+	unsigned char * slab;
+	void * item;
+	size_t i;
+
+	REQUIRE(pool != NULL);
+	REQUIRE(pool->size != 0);
+
+	if (pool->free_list == NULL)
+	{
+		/* the first SLAB_ALIGN bytes chain the slabs together */
+		slab = (unsigned char *) malloc(SLAB_ALIGN
+										+ pool->per_slab * pool->size);
+		if (slab == NULL) return (NULL);
+
+		*(void **) slab = pool->slabs;
+		pool->slabs = slab;
+
+		for (i = pool->per_slab; i > 0; i--)
+		{
+			item = slab + SLAB_ALIGN + (i - 1) * pool->size;
+			*(void **) item = pool->free_list;
+			pool->free_list = item;
+		}
+	}
+
+	item = pool->free_list;
+	pool->free_list = *(void **) item;
+	pool->used++;
+
+	memset(item, 0, pool->size);
+
+	return (item);
+}
+
+static void slab_free(struct slab_pool * pool, void * item)
+{
+	REQUIRE(pool != NULL);
+
+	if (item == NULL) return;
+
+	*(void **) item = pool->free_list;
+	pool->free_list = item;
+	pool->used--;
+}
+
+/* Releases the slabs, and every object still in use with them. */
+static void slab_pool_free(struct slab_pool * pool)
+{
+	void * next;
+
+	REQUIRE(pool != NULL);
+
+	while (pool->slabs != NULL)
+	{
+		next = *(void **) pool->slabs;
+		free(pool->slabs);
+		pool->slabs = next;
+	}
+
+	pool->free_list = NULL;
+	pool->used = 0;
+}
+
 static int list_tail_free(struct pkt_buf ** list)
 {
 	struct pkt_buf ** pkts;
@@ -1052,7 +1270,7 @@ static int list_tail_free(struct pkt_buf ** list)
 			(*pkts)->packet = NULL;
 		}
 
-		free(*pkts);
+		slab_free(&lopt.pkt_pool, *pkts);
 		*pkts = NULL;
 		*pkts = next;
 	}
@@ -1073,10 +1291,19 @@ list_add_packet(struct pkt_buf ** list, int length, unsigned char * packet)
 
 	next = *list;
 
-	*list = (struct pkt_buf *) malloc(sizeof(struct pkt_buf));
-	if (*list == NULL) return 1;
+	*list = (struct pkt_buf *) slab_alloc(&lopt.pkt_pool);
+	if (*list == NULL)
+	{
+		*list = next;
+		return 1;
+	}
 	(*list)->packet = (unsigned char *) malloc((size_t) length);
-	if ((*list)->packet == NULL) return 1;
+	if ((*list)->packet == NULL)
+	{
+		slab_free(&lopt.pkt_pool, *list);
+		*list = next;
+		return 1;
+	}
 
 	memcpy((*list)->packet, packet, (size_t) length);
 	(*list)->next = next;
@@ -1086,6 +1313,26 @@ list_add_packet(struct pkt_buf ** list, int length, unsigned char * packet)
 	return (0);
 }
 
+/* Drops the packets older than BUFFER_TIME, the list being newest first. */
+static void list_age_packets(struct pkt_buf ** list, const struct timeval * tv)
+{
+	unsigned long timediff;
+
+	while (*list != NULL)
+	{
+		timediff = (((tv->tv_sec - ((*list)->ctime.tv_sec)) * 1000000UL)
+					+ (tv->tv_usec - ((*list)->ctime.tv_usec)))
+				   / 1000;
+		if (timediff > BUFFER_TIME)
+		{
+			list_tail_free(list);
+			break;
+		}
+
+		list = &((*list)->next);
+	}
+}
+
 /*
  * Check if the same IV was used if the first two bytes were the same.
  * If they are not identical, it would complain.
@@ -1168,47 +1415,189 @@ list_check_decloak(struct pkt_buf ** list, int length, const uint8_t * packet)
 	return (1); // didn't find decloak
 }
 
-static int remove_namac(unsigned char * mac)
+#define MAC_TABLE_MIN_SIZE 1024
+
+static inline size_t mac_hash(const unsigned char * mac, size_t mask)
 {
-	struct NA_info * na_cur = NULL;
-	struct NA_info * na_prv = NULL;
+	uint64_t h = ((uint64_t) mac[0] << 40) | ((uint64_t) mac[1] << 32)
+				 | ((uint64_t) mac[2] << 24) | ((uint64_t) mac[3] << 16)
+				 | ((uint64_t) mac[4] << 8) | (uint64_t) mac[5];
 
-	if (mac == NULL) return (-1);
+	/* Fibonacci hashing: the high bits mix the OUI with the NIC part */
+	h *= 0x9E3779B97F4A7C15ULL;
 
-	na_cur = lopt.na_1st;
-	na_prv = NULL;
+	return ((size_t)(h >> 32) & mask);
+}
 
-	while (na_cur != NULL)
+static int mac_table_init(struct mac_table * table, size_t size)
+{
+	REQUIRE(table != NULL);
+	REQUIRE(size != 0 && (size & (size - 1)) == 0);
+
+	table->slots = (struct mac_slot *) calloc(size, sizeof(struct mac_slot));
+	if (table->slots == NULL) return (-1);
+
+	table->mask = size - 1;
+	table->used = 0;
+
+	return (0);
+}
+
+static void mac_table_free(struct mac_table * table)
+{
+	REQUIRE(table != NULL);
+
+	free(table->slots);
+	table->slots = NULL;
+	table->mask = 0;
+	table->used = 0;
+}
+
+static void * mac_table_find(const struct mac_table * table,
+							 const unsigned char * mac)
+{
+	size_t i;
+
+	REQUIRE(table != NULL);
+	REQUIRE(mac != NULL);
+
+	if (table->slots == NULL) return (NULL);
+
+	for (i = mac_hash(mac, table->mask); table->slots[i].item != NULL;
+		 i = (i + 1) & table->mask)
 	{
-		if (!memcmp(na_cur->namac, mac, 6)) break;
+		if (!memcmp(table->slots[i].mac, mac, 6)) return (table->slots[i].item);
+	}
 
-		na_prv = na_cur;
-		na_cur = na_cur->next;
+	return (NULL);
+}
+
+static int mac_table_grow(struct mac_table * table)
+{
+	struct mac_table bigger;
+	size_t i, j;
+
+	if (mac_table_init(&bigger, (table->mask + 1) * 2) != 0) return (-1);
+
+	for (i = 0; i <= table->mask; i++)
+	{
+		if (table->slots[i].item == NULL) continue;
+
+		for (j = mac_hash(table->slots[i].mac, bigger.mask);
+			 bigger.slots[j].item != NULL;
+			 j = (j + 1) & bigger.mask)
+			;
+
+		bigger.slots[j] = table->slots[i];
+	}
+
+	bigger.used = table->used;
+	free(table->slots);
+	*table = bigger;
+
+	return (0);
+}
+
+/* the MAC must not be indexed yet */
+static int
+mac_table_insert(struct mac_table * table, const unsigned char * mac, void * item)
+{
+	size_t i;
+
+	REQUIRE(table != NULL);
+	REQUIRE(mac != NULL);
+	REQUIRE(item != NULL);
+
+	if (table->slots == NULL
+		&& mac_table_init(table, MAC_TABLE_MIN_SIZE) != 0)
+		return (-1);
+
+	/* keep probe sequences short: at most half full */
+	if ((table->used + 1) * 2 > table->mask + 1 && mac_table_grow(table) != 0)
+		return (-1);
+
+	for (i = mac_hash(mac, table->mask); table->slots[i].item != NULL;
+		 i = (i + 1) & table->mask)
+		;
+
+	memcpy(table->slots[i].mac, mac, 6);
+	table->slots[i].item = item;
+	table->used++;
+
+	return (0);
+}
+
+static void mac_table_remove(struct mac_table * table, const unsigned char * mac)
+{
+	size_t i, j, home;
+
+	REQUIRE(table != NULL);
+	REQUIRE(mac != NULL);
+
+	if (table->slots == NULL) return;
+
+	for (i = mac_hash(mac, table->mask); table->slots[i].item != NULL;
+		 i = (i + 1) & table->mask)
+	{
+		if (!memcmp(table->slots[i].mac, mac, 6)) break;
+	}
+
+	if (table->slots[i].item == NULL) return;
+
+	/* shift the following entries back instead of leaving a tombstone */
+	for (j = (i + 1) & table->mask; table->slots[j].item != NULL;
+		 j = (j + 1) & table->mask)
+	{
+		home = mac_hash(table->slots[j].mac, table->mask);
+
+		/* leave entries whose home slot lies cyclically in (i, j] */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+
+		table->slots[i] = table->slots[j];
+		i = j;
 	}
 
+	table->slots[i].item = NULL;
+	table->used--;
+}
+
+static int remove_namac(unsigned char * mac)
+{
+	struct NA_info * na_cur = NULL;
+
+	if (mac == NULL) return (-1);
+
+	na_cur = (struct NA_info *) mac_table_find(&lopt.na_index, mac);
+
 	/* if it's known, remove it */
 	if (na_cur != NULL)
 	{
-		/* first in linked list */
-		if (na_cur == lopt.na_1st)
-		{
+		mac_table_remove(&lopt.na_index, mac);
+
+		if (na_cur->prev != NULL)
+			na_cur->prev->next = na_cur->next;
+		else
 			lopt.na_1st = na_cur->next;
-		}
+
+		if (na_cur->next != NULL)
+			na_cur->next->prev = na_cur->prev;
 		else
-		{
-			na_prv->next = na_cur->next;
-		}
-		free(na_cur);
+			lopt.na_end = na_cur->prev;
+
+		slab_free(&lopt.na_pool, na_cur);
 	}
 
 	return (0);
 }
 
 // NOTE(jbenden): This is also in ivstools.c
+/* tv_read is when the frame was read, NULL for now */
 static int dump_add_packet(unsigned char * h80211,
 						   int caplen,
 						   struct rx_info * ri,
-						   int cardnum)
+						   int cardnum,
+						   const struct timeval * tv_read)
 {
 	REQUIRE(h80211 != NULL);
 
@@ -1290,24 +1679,23 @@ static int dump_add_packet(unsigned char * h80211,
 
 	/* update our chained list of access points */
 
-	ap_cur = lopt.ap_1st;
-	ap_prv = NULL;
-
-	while (ap_cur != NULL)
-	{
-		if (!memcmp(ap_cur->bssid, bssid, 6)) break;
-
-		ap_prv = ap_cur;
-		ap_cur = ap_cur->next;
-	}
+	ap_cur = (struct AP_info *) mac_table_find(&lopt.ap_index, bssid);
+	ap_prv = lopt.ap_end;
 
 	/* if it's a new access point, add it */
 
 	if (ap_cur == NULL)
 	{
-		if (!(ap_cur = (struct AP_info *) calloc(1, sizeof(struct AP_info))))
+		if (!(ap_cur = (struct AP_info *) slab_alloc(&lopt.ap_pool)))
+		{
+			perror("malloc failed");
+			return (1);
+		}
+
+		if (mac_table_insert(&lopt.ap_index, bssid, ap_cur) != 0)
 		{
 			perror("calloc failed");
+			slab_free(&lopt.ap_pool, ap_cur);
 			return (1);
 		}
 
@@ -1328,6 +1716,7 @@ static int dump_add_packet(unsigned char * h80211,
 
 		ap_cur->nb_pkt = 0;
 		ap_cur->prev = ap_prv;
+		ap_cur->sort_seq = lopt.ap_seq++;
 
 		ap_cur->tinit = time(NULL);
 		ap_cur->tlast = time(NULL);
@@ -1342,8 +1731,7 @@ static int dump_add_packet(unsigned char * h80211,
 		ap_cur->max_speed = -1;
 		ap_cur->security = 0;
 
-		ap_cur->ivbuf = NULL;
-		ap_cur->ivbuf_size = 0;
+		memset(&ap_cur->ivbuf, 0, sizeof(ap_cur->ivbuf));
 		ap_cur->uiv_root = uniqueiv_init();
 
 		ap_cur->nb_data = 0;
@@ -1409,6 +1797,7 @@ static int dump_add_packet(unsigned char * h80211,
 	/* update the last time seen */
 
 	ap_cur->tlast = time(NULL);
+	ap_cur->text_dirty = 1;
 
 	/* only update power if packets comes from
 	 * the AP: either type == mgmt and SA == BSSID,
@@ -1526,24 +1915,23 @@ static int dump_add_packet(unsigned char * h80211,
 
 	/* update our chained list of wireless stations */
 
-	st_cur = lopt.st_1st;
-	st_prv = NULL;
-
-	while (st_cur != NULL)
-	{
-		if (!memcmp(st_cur->stmac, stmac, 6)) break;
-
-		st_prv = st_cur;
-		st_cur = st_cur->next;
-	}
+	st_cur = (struct ST_info *) mac_table_find(&lopt.st_index, stmac);
+	st_prv = lopt.st_end;
 
 	/* if it's a new client, add it */
 
 	if (st_cur == NULL)
 	{
-		if (!(st_cur = (struct ST_info *) calloc(1, sizeof(struct ST_info))))
+		if (!(st_cur = (struct ST_info *) slab_alloc(&lopt.st_pool)))
+		{
+			perror("malloc failed");
+			return (1);
+		}
+
+		if (mac_table_insert(&lopt.st_index, stmac, st_cur) != 0)
 		{
 			perror("calloc failed");
+			slab_free(&lopt.st_pool, st_cur);
 			return (1);
 		}
 
@@ -1568,6 +1956,7 @@ static int dump_add_packet(unsigned char * h80211,
 		st_cur->nb_pkt = 0;
 
 		st_cur->prev = st_prv;
+		st_cur->sort_seq = lopt.st_seq++;
 
 		st_cur->tinit = time(NULL);
 		st_cur->tlast = time(NULL);
@@ -1607,7 +1996,13 @@ static int dump_add_packet(unsigned char * h80211,
 	}
 
 	if (st_cur->base == NULL || memcmp(ap_cur->bssid, BROADCAST, 6) != 0)
+	{
+		/* the previous AP lists the station in its netxml record */
+		if (st_cur->base != NULL && st_cur->base != ap_cur)
+			st_cur->base->text_dirty = 1;
+
 		st_cur->base = ap_cur;
+	}
 
 	// update bitrate to station
 	if ((h80211[1] & 3) == 2) st_cur->rate_to = ri->ri_rate;
@@ -1615,6 +2010,7 @@ static int dump_add_packet(unsigned char * h80211,
 	/* update the last time seen */
 
 	st_cur->tlast = time(NULL);
+	st_cur->text_dirty = 1;
 
 	/* only update power if packets comes from the
 	 * client: either type == Mgmt and SA != BSSID,
@@ -2912,37 +3308,17 @@ write_packet:
 
 				if (lopt.hide_known)
 				{
-					/* check AP list */
-					ap_cur = lopt.ap_1st;
+					/* if it's an AP, try next mac */
 
-					while (ap_cur != NULL)
-					{
-						if (!memcmp(ap_cur->bssid, namac, 6)) break;
-
-						ap_cur = ap_cur->next;
-					}
-
-					/* if it's an AP, try next mac */
-
-					if (ap_cur != NULL)
+					if (mac_table_find(&lopt.ap_index, namac) != NULL)
 					{
 						p += 6;
 						continue;
 					}
 
-					/* check ST list */
-					st_cur = lopt.st_1st;
-
-					while (st_cur != NULL)
-					{
-						if (!memcmp(st_cur->stmac, namac, 6)) break;
-
-						st_cur = st_cur->next;
-					}
-
 					/* if it's a client, try next mac */
 
-					if (st_cur != NULL)
+					if (mac_table_find(&lopt.st_index, namac) != NULL)
 					{
 						p += 6;
 						continue;
@@ -2951,30 +3327,26 @@ write_packet:
 
 				/* not found in either AP list or ST list, look through NA list
 				 */
-				na_cur = lopt.na_1st;
-				na_prv = NULL;
-
-				while (na_cur != NULL)
-				{
-					if (!memcmp(na_cur->namac, namac, 6)) break;
-
-					na_prv = na_cur;
-					na_cur = na_cur->next;
-				}
+				na_cur = (struct NA_info *) mac_table_find(&lopt.na_index, namac);
+				na_prv = lopt.na_end;
 
 				/* update our chained list of unknown stations */
 				/* if it's a new mac, add it */
 
 				if (na_cur == NULL)
 				{
-					if (!(na_cur
-						  = (struct NA_info *) malloc(sizeof(struct NA_info))))
+					if (!(na_cur = (struct NA_info *) slab_alloc(&lopt.na_pool)))
 					{
 						perror("malloc failed");
 						return (1);
 					}
 
-					memset(na_cur, 0, sizeof(struct NA_info));
+					if (mac_table_insert(&lopt.na_index, namac, na_cur) != 0)
+					{
+						perror("malloc failed");
+						slab_free(&lopt.na_pool, na_cur);
+						return (1);
+					}
 
 					if (lopt.na_1st == NULL)
 						lopt.na_1st = na_cur;
@@ -2984,6 +3356,7 @@ write_packet:
 					memcpy(na_cur->namac, namac, 6);
 
 					na_cur->prev = na_prv;
+					lopt.na_end = na_cur;
 
 					gettimeofday(&(na_cur->tv), NULL);
 					na_cur->tinit = time(NULL);
@@ -3035,7 +3408,11 @@ write_packet:
 	{
 		pkh.len = pkh.caplen = (uint32_t) caplen;
 
-		gettimeofday(&tv, NULL);
+		/* the frame may have waited in a ring since it was read */
+		if (tv_read != NULL)
+			tv = *tv_read;
+		else
+			gettimeofday(&tv, NULL);
 
 		pkh.tv_sec = (int32_t) tv.tv_sec;
 		pkh.tv_usec = (int32_t) tv.tv_usec;
@@ -3064,206 +3441,486 @@ write_packet:
 	return (0);
 }
 
+static int64_t ap_sort_key(const struct AP_info * ap)
+{
+	const uint8_t * p;
+	unsigned long h;
+
+	switch (lopt.sort_by)
+	{
+		case SORT_BY_BSSID:
+			return ((int64_t) (((uint64_t) ap->bssid[0] << 40)
+							   | ((uint64_t) ap->bssid[1] << 32)
+							   | ((uint64_t) ap->bssid[2] << 24)
+							   | ((uint64_t) ap->bssid[3] << 16)
+							   | ((uint64_t) ap->bssid[4] << 8)
+							   | (uint64_t) ap->bssid[5]));
+		case SORT_BY_BEACON:
+			return ((int64_t) ap->nb_bcn);
+		case SORT_BY_DATA:
+			return ((int64_t) ap->nb_data);
+		case SORT_BY_PRATE:
+			return (ap->nb_dataps);
+		case SORT_BY_CHAN:
+			return (ap->channel);
+		case SORT_BY_MBIT:
+			return (ap->max_speed);
+		case SORT_BY_ENC:
+			return ((int64_t) (ap->security & STD_FIELD));
+		case SORT_BY_CIPHER:
+			return ((int64_t) (ap->security & ENC_FIELD));
+		case SORT_BY_AUTH:
+			return ((int64_t) (ap->security & AUTH_FIELD));
+		case SORT_BY_ESSID:
+			/* only tells when the ESSID changed, see ap_sort_cmp() */
+			h = 2166136261UL;
+			for (p = ap->essid; p < ap->essid + ESSID_LENGTH && *p; p++)
+				h = (h ^ (unsigned long) tolower(*p)) * 16777619UL;
+			return ((int64_t) h);
+		default: // sort by power
+			return (ap->avg_power);
+	}
+}
+
+/* order of the AP list: stale first, then by key, then by first sighting */
+static int ap_sort_cmp(const void * a, const void * b)
+{
+	const struct AP_info * ap_a = *(const struct AP_info * const *) a;
+	const struct AP_info * ap_b = *(const struct AP_info * const *) b;
+	int inv = (lopt.sort_by == SORT_BY_NOTHING) ? 1 : lopt.sort_inv;
+	int cmp;
+
+	if (ap_a->sort_stale != ap_b->sort_stale)
+		return (ap_b->sort_stale - ap_a->sort_stale);
+
+	if (lopt.sort_by == SORT_BY_ESSID)
+		cmp = strncasecmp(
+			(const char *) ap_a->essid, (const char *) ap_b->essid, ESSID_LENGTH);
+	else
+		cmp = (ap_a->sort_key > ap_b->sort_key)
+			  - (ap_a->sort_key < ap_b->sort_key);
+
+	if (cmp != 0) return (cmp * inv);
+
+	return ((ap_a->sort_seq > ap_b->sort_seq)
+			- (ap_a->sort_seq < ap_b->sort_seq));
+}
+
+static int st_sort_cmp(const void * a, const void * b)
+{
+	const struct ST_info * st_a = *(const struct ST_info * const *) a;
+	const struct ST_info * st_b = *(const struct ST_info * const *) b;
+
+	if (st_a->sort_stale != st_b->sort_stale)
+		return (st_b->sort_stale - st_a->sort_stale);
+
+	if (st_a->sort_key != st_b->sort_key)
+		return ((st_a->sort_key > st_b->sort_key) ? 1 : -1);
+
+	return ((st_a->sort_seq > st_b->sort_seq)
+			- (st_a->sort_seq < st_b->sort_seq));
+}
+
+static int grow_sort_buf(void *** buf, size_t * size, size_t needed)
+{
+	void ** bigger;
+
+	if (needed <= *size) return (0);
+
+	bigger = (void **) realloc(*buf, needed * 2 * sizeof(void *));
+	if (bigger == NULL) return (-1);
+
+	*buf = bigger;
+	*size = needed * 2;
+
+	return (0);
+}
+
+/*
+ * The AP and station lists are kept sorted between calls: only the entries
+ * whose key changed since the last call, and the new ones, are taken out,
+ * sorted, and merged back into the list.
+ */
 static void dump_sort(void)
 {
 	time_t tt = time(NULL);
 
-	/* thanks to Arnaud Cornet :-) */
+	struct AP_info *ap_cur, *ap_next, *ap_pos, **ap_moved;
+	struct ST_info *st_cur, *st_next, *st_pos, **st_moved;
+	size_t nb_moved, i, needed;
+	int stale;
+	int64_t key;
+
+	if (lopt.sort_gen == 0 || lopt.sort_by != lopt.sorted_by
+		|| lopt.sort_inv != lopt.sorted_inv)
+	{
+		/* new ordering: every entry has to move */
+		if (++lopt.sort_gen == 0) lopt.sort_gen = 1;
+		lopt.sorted_by = lopt.sort_by;
+		lopt.sorted_inv = lopt.sort_inv;
+	}
 
-	struct AP_info * new_ap_1st = NULL;
-	struct AP_info * new_ap_end = NULL;
+	/* take the aps whose key changed out of the list */
 
-	struct ST_info * new_st_1st = NULL;
-	struct ST_info * new_st_end = NULL;
+	needed = 0;
+	for (ap_cur = lopt.ap_1st; ap_cur != NULL; ap_cur = ap_cur->next) needed++;
 
-	struct ST_info *st_cur, *st_min;
-	struct AP_info *ap_cur, *ap_min;
+	if (grow_sort_buf(&lopt.sort_buf, &lopt.sort_buf_size, needed) != 0)
+	{
+		perror("realloc failed");
+		return;
+	}
 
-	/* sort the aps by WHATEVER first */
+	ap_moved = (struct AP_info **) lopt.sort_buf;
+	nb_moved = 0;
 
-	while (lopt.ap_1st)
+	for (ap_cur = lopt.ap_1st; ap_cur != NULL; ap_cur = ap_next)
 	{
-		ap_min = NULL;
-		ap_cur = lopt.ap_1st;
+		ap_next = ap_cur->next;
 
-		while (ap_cur != NULL)
-		{
-			if (tt - ap_cur->tlast > 20) ap_min = ap_cur;
+		stale = (tt - ap_cur->tlast > 20);
+		key = ap_sort_key(ap_cur);
 
-			ap_cur = ap_cur->next;
-		}
+		if (ap_cur->sort_gen == lopt.sort_gen && ap_cur->sort_stale == stale
+			&& ap_cur->sort_key == key)
+			continue;
 
-		if (ap_min == NULL)
-		{
-			ap_min = ap_cur = lopt.ap_1st;
+		ap_cur->sort_gen = lopt.sort_gen;
+		ap_cur->sort_stale = stale;
+		ap_cur->sort_key = key;
 
-			/*#define SORT_BY_BSSID	1
-#define SORT_BY_POWER	2
-#define SORT_BY_BEACON	3
-#define SORT_BY_DATA	4
-#define SORT_BY_PRATE	6
-#define SORT_BY_CHAN	7
-#define	SORT_BY_MBIT	8
-#define SORT_BY_ENC	9
-#define SORT_BY_CIPHER	10
-#define SORT_BY_AUTH	11
-#define SORT_BY_ESSID	12*/
+		if (ap_cur->prev) ap_cur->prev->next = ap_cur->next;
+		if (ap_cur->next) ap_cur->next->prev = ap_cur->prev;
+		if (ap_cur == lopt.ap_1st) lopt.ap_1st = ap_cur->next;
+		if (ap_cur == lopt.ap_end) lopt.ap_end = ap_cur->prev;
 
-			while (ap_cur != NULL)
-			{
-				switch (lopt.sort_by)
-				{
-					case SORT_BY_BSSID:
-						if (memcmp(ap_cur->bssid, ap_min->bssid, 6)
-								* lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_POWER:
-						if ((ap_cur->avg_power - ap_min->avg_power)
-								* lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_BEACON:
-						if ((ap_cur->nb_bcn < ap_min->nb_bcn) && lopt.sort_inv)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_DATA:
-						if ((ap_cur->nb_data < ap_min->nb_data)
-							&& lopt.sort_inv)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_PRATE:
-						if ((ap_cur->nb_dataps - ap_min->nb_dataps)
-								* lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_CHAN:
-						if ((ap_cur->channel - ap_min->channel) * lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_MBIT:
-						if ((ap_cur->max_speed - ap_min->max_speed)
-								* lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_ENC:
-						if (((int) (ap_cur->security & STD_FIELD)
-							 - (int) (ap_min->security & STD_FIELD))
-								* lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_CIPHER:
-						if (((int) (ap_cur->security & ENC_FIELD)
-							 - (int) (ap_min->security & ENC_FIELD))
-								* lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_AUTH:
-						if (((int) (ap_cur->security & AUTH_FIELD)
-							 - (int) (ap_min->security & AUTH_FIELD))
-								* lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					case SORT_BY_ESSID:
-						if ((strncasecmp((char *) ap_cur->essid,
-										 (char *) ap_min->essid,
-										 ESSID_LENGTH))
-								* lopt.sort_inv
-							< 0)
-							ap_min = ap_cur;
-						break;
-					default: // sort by power
-						if (ap_cur->avg_power < ap_min->avg_power)
-							ap_min = ap_cur;
-						break;
-				}
-				ap_cur = ap_cur->next;
-			}
-		}
+		ap_moved[nb_moved++] = ap_cur;
+	}
+
+	qsort(ap_moved, nb_moved, sizeof(struct AP_info *), ap_sort_cmp);
+
+	/* and merge them back */
 
-		if (ap_min == lopt.ap_1st) lopt.ap_1st = ap_min->next;
+	ap_pos = lopt.ap_1st;
 
-		if (ap_min == lopt.ap_end) lopt.ap_end = ap_min->prev;
+	for (i = 0; i < nb_moved; i++)
+	{
+		ap_cur = ap_moved[i];
 
-		if (ap_min->next) ap_min->next->prev = ap_min->prev;
+		while (ap_pos != NULL && ap_sort_cmp(&ap_pos, &ap_cur) <= 0)
+			ap_pos = ap_pos->next;
 
-		if (ap_min->prev) ap_min->prev->next = ap_min->next;
+		ap_cur->next = ap_pos;
 
-		if (new_ap_end)
+		if (ap_pos != NULL)
 		{
-			new_ap_end->next = ap_min;
-			ap_min->prev = new_ap_end;
-			new_ap_end = ap_min;
-			new_ap_end->next = NULL;
+			ap_cur->prev = ap_pos->prev;
+			ap_pos->prev = ap_cur;
 		}
 		else
 		{
-			new_ap_1st = new_ap_end = ap_min;
-			ap_min->next = ap_min->prev = NULL;
+			ap_cur->prev = lopt.ap_end;
+			lopt.ap_end = ap_cur;
 		}
+
+		if (ap_cur->prev != NULL)
+			ap_cur->prev->next = ap_cur;
+		else
+			lopt.ap_1st = ap_cur;
 	}
 
-	lopt.ap_1st = new_ap_1st;
-	lopt.ap_end = new_ap_end;
+	/* now the stations */
 
-	/* now sort the stations */
+	needed = 0;
+	for (st_cur = lopt.st_1st; st_cur != NULL; st_cur = st_cur->next) needed++;
 
-	while (lopt.st_1st)
+	if (grow_sort_buf(&lopt.sort_buf, &lopt.sort_buf_size, needed) != 0)
 	{
-		st_min = NULL;
-		st_cur = lopt.st_1st;
+		perror("realloc failed");
+		return;
+	}
 
-		while (st_cur != NULL)
+	st_moved = (struct ST_info **) lopt.sort_buf;
+	nb_moved = 0;
+
+	for (st_cur = lopt.st_1st; st_cur != NULL; st_cur = st_next)
+	{
+		st_next = st_cur->next;
+
+		stale = (tt - st_cur->tlast > 60);
+		key = st_cur->power;
+
+		if (st_cur->sort_gen == lopt.sort_gen && st_cur->sort_stale == stale
+			&& st_cur->sort_key == key)
+			continue;
+
+		st_cur->sort_gen = lopt.sort_gen;
+		st_cur->sort_stale = stale;
+		st_cur->sort_key = key;
+
+		if (st_cur->prev) st_cur->prev->next = st_cur->next;
+		if (st_cur->next) st_cur->next->prev = st_cur->prev;
+		if (st_cur == lopt.st_1st) lopt.st_1st = st_cur->next;
+		if (st_cur == lopt.st_end) lopt.st_end = st_cur->prev;
+
+		st_moved[nb_moved++] = st_cur;
+	}
+
+	qsort(st_moved, nb_moved, sizeof(struct ST_info *), st_sort_cmp);
+
+	st_pos = lopt.st_1st;
+
+	for (i = 0; i < nb_moved; i++)
+	{
+		st_cur = st_moved[i];
+
+		while (st_pos != NULL && st_sort_cmp(&st_pos, &st_cur) <= 0)
+			st_pos = st_pos->next;
+
+		st_cur->next = st_pos;
+
+		if (st_pos != NULL)
+		{
+			st_cur->prev = st_pos->prev;
+			st_pos->prev = st_cur;
+		}
+		else
 		{
-			if (tt - st_cur->tlast > 60) st_min = st_cur;
+			st_cur->prev = lopt.st_end;
+			lopt.st_end = st_cur;
+		}
+
+		if (st_cur->prev != NULL)
+			st_cur->prev->next = st_cur;
+		else
+			lopt.st_1st = st_cur;
+	}
+}
+
+/* Orders the records from the least recently seen one. */
+static int ap_cmp_lru(const void * a, const void * b)
+{
+	const struct AP_info * ap_a = *(const struct AP_info * const *) a;
+	const struct AP_info * ap_b = *(const struct AP_info * const *) b;
+
+	if (ap_a->tlast != ap_b->tlast)
+		return ((ap_a->tlast > ap_b->tlast) ? 1 : -1);
+
+	return ((ap_a->sort_seq > ap_b->sort_seq)
+			- (ap_a->sort_seq < ap_b->sort_seq));
+}
+
+static int st_cmp_lru(const void * a, const void * b)
+{
+	const struct ST_info * st_a = *(const struct ST_info * const *) a;
+	const struct ST_info * st_b = *(const struct ST_info * const *) b;
+
+	if (st_a->tlast != st_b->tlast)
+		return ((st_a->tlast > st_b->tlast) ? 1 : -1);
+
+	return ((st_a->sort_seq > st_b->sort_seq)
+			- (st_a->sort_seq < st_b->sort_seq));
+}
+
+static int na_cmp_lru(const void * a, const void * b)
+{
+	const struct NA_info * na_a = *(const struct NA_info * const *) a;
+	const struct NA_info * na_b = *(const struct NA_info * const *) b;
+
+	if (na_a->tlast != na_b->tlast)
+		return ((na_a->tlast > na_b->tlast) ? 1 : -1);
+
+	return ((na_a->tinit > na_b->tinit) - (na_a->tinit < na_b->tinit));
+}
+
+/*
+ * Marks the records to drop: the ones not seen since oldest, and the least
+ * recently seen ones past lopt.max_entries of each kind. The sort buffer is
+ * shared with dump_sort(), both run with mx_print held. Returns the number
+ * of records marked.
+ */
+static size_t evict_mark(time_t oldest)
+{
+	struct AP_info * ap_cur;
+	struct ST_info * st_cur;
+	struct NA_info * na_cur;
+	size_t nb, i, marked = 0;
+
+	nb = 0;
+	for (ap_cur = lopt.ap_1st; ap_cur != NULL; ap_cur = ap_cur->next)
+	{
+		ap_cur->evicted = (ap_cur->tlast < oldest);
+		marked += (size_t) ap_cur->evicted;
+		nb++;
+	}
+
+	if (lopt.max_entries > 0 && nb > lopt.max_entries
+		&& grow_sort_buf(&lopt.sort_buf, &lopt.sort_buf_size, nb) == 0)
+	{
+		i = 0;
+		for (ap_cur = lopt.ap_1st; ap_cur != NULL; ap_cur = ap_cur->next)
+			lopt.sort_buf[i++] = ap_cur;
+
+		qsort(lopt.sort_buf, nb, sizeof(void *), ap_cmp_lru);
 
-			st_cur = st_cur->next;
+		for (i = 0; i < nb - lopt.max_entries; i++)
+		{
+			ap_cur = (struct AP_info *) lopt.sort_buf[i];
+			marked += (size_t) !ap_cur->evicted;
+			ap_cur->evicted = 1;
 		}
+	}
+
+	/* a client goes with its AP */
+
+	nb = 0;
+	for (st_cur = lopt.st_1st; st_cur != NULL; st_cur = st_cur->next)
+	{
+		st_cur->evicted = (st_cur->tlast < oldest
+						   || (st_cur->base != NULL && st_cur->base->evicted));
+		marked += (size_t) st_cur->evicted;
+		nb++;
+	}
+
+	if (lopt.max_entries > 0 && nb > lopt.max_entries
+		&& grow_sort_buf(&lopt.sort_buf, &lopt.sort_buf_size, nb) == 0)
+	{
+		i = 0;
+		for (st_cur = lopt.st_1st; st_cur != NULL; st_cur = st_cur->next)
+			lopt.sort_buf[i++] = st_cur;
 
-		if (st_min == NULL)
+		qsort(lopt.sort_buf, nb, sizeof(void *), st_cmp_lru);
+
+		for (i = 0; i < nb - lopt.max_entries; i++)
 		{
-			st_min = st_cur = lopt.st_1st;
+			st_cur = (struct ST_info *) lopt.sort_buf[i];
+			marked += (size_t) !st_cur->evicted;
+			st_cur->evicted = 1;
+		}
+	}
 
-			while (st_cur != NULL)
-			{
-				if (st_cur->power < st_min->power) st_min = st_cur;
+	nb = 0;
+	for (na_cur = lopt.na_1st; na_cur != NULL; na_cur = na_cur->next)
+	{
+		na_cur->evicted = (na_cur->tlast < oldest);
+		marked += (size_t) na_cur->evicted;
+		nb++;
+	}
 
-				st_cur = st_cur->next;
-			}
+	if (lopt.max_entries > 0 && nb > lopt.max_entries
+		&& grow_sort_buf(&lopt.sort_buf, &lopt.sort_buf_size, nb) == 0)
+	{
+		i = 0;
+		for (na_cur = lopt.na_1st; na_cur != NULL; na_cur = na_cur->next)
+			lopt.sort_buf[i++] = na_cur;
+
+		qsort(lopt.sort_buf, nb, sizeof(void *), na_cmp_lru);
+
+		for (i = 0; i < nb - lopt.max_entries; i++)
+		{
+			na_cur = (struct NA_info *) lopt.sort_buf[i];
+			marked += (size_t) !na_cur->evicted;
+			na_cur->evicted = 1;
 		}
+	}
+
+	return (marked);
+}
+
+/*
+ * Applies the retention limits given with --max-age and --max-entries: the
+ * records marked by evict_mark() are logged to the event log, then given
+ * back to their pool. Also ages the decloak buffers, which otherwise only
+ * shrink when their AP sends more data. Must be called with mx_print held.
+ */
+static void evict_records(time_t now)
+{
+	struct AP_info *ap_cur, *ap_next;
+	struct ST_info *st_cur, *st_next;
+	struct NA_info *na_cur, *na_next;
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	for (ap_cur = lopt.ap_1st; ap_cur != NULL; ap_cur = ap_cur->next)
+		if (ap_cur->packets != NULL) list_age_packets(&(ap_cur->packets), &tv);
 
-		if (st_min == lopt.st_1st) lopt.st_1st = st_min->next;
+	if (lopt.max_age <= 0 && lopt.max_entries == 0) return;
 
-		if (st_min == lopt.st_end) lopt.st_end = st_min->prev;
+	if (evict_mark((lopt.max_age > 0) ? now - lopt.max_age : 0) == 0) return;
 
-		if (st_min->next) st_min->next->prev = st_min->prev;
+	for (st_cur = lopt.st_1st; st_cur != NULL; st_cur = st_next)
+	{
+		st_next = st_cur->next;
 
-		if (st_min->prev) st_min->prev->next = st_min->next;
+		if (!st_cur->evicted) continue;
 
-		if (new_st_end)
+		if (st_cur->base != NULL)
 		{
-			new_st_end->next = st_min;
-			st_min->prev = new_st_end;
-			new_st_end = st_min;
-			new_st_end->next = NULL;
+			dump_write_evicted(st_cur->base, st_cur, lopt.f_encrypt);
+
+			/* the AP's netxml record lists its clients */
+			st_cur->base->text_dirty = 1;
 		}
+
+		if (st_cur->prev != NULL)
+			st_cur->prev->next = st_cur->next;
+		else
+			lopt.st_1st = st_cur->next;
+
+		if (st_cur->next != NULL)
+			st_cur->next->prev = st_cur->prev;
 		else
+			lopt.st_end = st_cur->prev;
+
+		mac_table_remove(&lopt.st_index, st_cur->stmac);
+		dump_write_forget(st_cur->text);
+		slab_free(&lopt.st_pool, st_cur);
+	}
+
+	for (ap_cur = lopt.ap_1st; ap_cur != NULL; ap_cur = ap_next)
+	{
+		ap_next = ap_cur->next;
+
+		if (!ap_cur->evicted) continue;
+
+		dump_write_evicted(ap_cur, NULL, lopt.f_encrypt);
+
+		if (lopt.p_selected_ap == ap_cur)
 		{
-			new_st_1st = new_st_end = st_min;
-			st_min->next = st_min->prev = NULL;
+			lopt.p_selected_ap = NULL;
+			lopt.en_selection_direction = selection_direction_no;
 		}
+
+		if (ap_cur->prev != NULL)
+			ap_cur->prev->next = ap_cur->next;
+		else
+			lopt.ap_1st = ap_cur->next;
+
+		if (ap_cur->next != NULL)
+			ap_cur->next->prev = ap_cur->prev;
+		else
+			lopt.ap_end = ap_cur->prev;
+
+		mac_table_remove(&lopt.ap_index, ap_cur->bssid);
+
+		uniqueiv_wipe(ap_cur->uiv_root);
+		list_tail_free(&(ap_cur->packets));
+		if (lopt.detect_anomaly) data_wipe(ap_cur->data_root);
+
+		dump_write_forget(ap_cur->text);
+		slab_free(&lopt.ap_pool, ap_cur);
 	}
 
-	lopt.st_1st = new_st_1st;
-	lopt.st_end = new_st_end;
+	for (na_cur = lopt.na_1st; na_cur != NULL; na_cur = na_next)
+	{
+		na_next = na_cur->next;
+
+		if (!na_cur->evicted) continue;
+
+		dump_write_evicted_na(na_cur);
+		remove_namac(na_cur->namac);
+	}
 }
 
 static int getBatteryState(void) { return get_battery_state(); }
@@ -3399,18 +4056,35 @@ static int IsAp2BeSkipped(struct AP_info * ap_cur)
 	return (0);
 }
 
+/* Sums the frames read from the cards, and those their rings had no room
+   for, which are missing from the capture files. */
+static void capture_counters(unsigned long * received, unsigned long * dropped)
+{
+	int i;
+
+	*received = *dropped = 0;
+
+	for (i = 0; i < lopt.num_cards; i++)
+	{
+		*received
+			+= __atomic_load_n(&(lopt.rings[i].received), __ATOMIC_RELAXED);
+		*dropped
+			+= __atomic_load_n(&(lopt.rings[i].dropped), __ATOMIC_RELAXED);
+	}
+}
+
 #define CHECK_END_OF_SCREEN()                                                  \
 	do                                                                         \
 	{                                                                          \
 		++nlines;                                                              \
 		if (nlines >= (ws_row - 1))                                            \
 		{                                                                      \
-			erase_display(0);                                                  \
+			ferase_display(out, 0);                                            \
 			return;                                                            \
 		};                                                                     \
 	} while (0)
 
-static void dump_print(int ws_row, int ws_col, int if_num)
+static void dump_print(FILE * out, int ws_row, int ws_col, int if_num)
 {
 	time_t tt;
 	struct tm * lt;
@@ -3427,6 +4101,7 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 
 	int num_ap;
 	int num_sta;
+	unsigned long received, dropped;
 
 	if (!lopt.singlechan) columns_ap -= 4; // no RXQ in scan mode
 	if (lopt.show_uptime) columns_ap += 15; // show uptime needs more space
@@ -3474,9 +4149,9 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 
 	memset(strbuf, '\0', sizeof(strbuf));
 
-	moveto(1, 2);
-	textcolor_normal();
-	textcolor_fg(TEXT_WHITE);
+	fmoveto(out, 1, 2);
+	ftextcolor_normal(out);
+	ftextcolor_fg(out, TEXT_WHITE);
 
 	if (lopt.freqoption)
 	{
@@ -3569,6 +4244,15 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 	strlcat(strbuf, buffer, sizeof(strbuf));
 	memset(buffer, '\0', sizeof(buffer));
 
+	capture_counters(&received, &dropped);
+
+	if (dropped > 0)
+	{
+		snprintf(buffer, sizeof(buffer) - 1, "][ Dropped: %lu ", dropped);
+		strlcat(strbuf, buffer, sizeof(strbuf));
+		memset(buffer, '\0', sizeof(buffer));
+	}
+
 	if (strlen(lopt.message) > 0)
 	{
 		strlcat(strbuf, lopt.message, sizeof(strbuf));
@@ -3577,13 +4261,13 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 	strbuf[ws_col - 1] = '\0';
 
 	ALLEGE(strchr(strbuf, '\n') == NULL);
-	console_puts(strbuf);
+	fconsole_puts(out, strbuf);
 	CHECK_END_OF_SCREEN();
 
 	/* print some information about each detected AP */
 
-	erase_line(0);
-	move(CURSOR_DOWN, 1);
+	ferase_line(out, 0);
+	fmove(out, CURSOR_DOWN, 1);
 	CHECK_END_OF_SCREEN();
 
 	if (lopt.show_ap)
@@ -3642,11 +4326,11 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 			}
 		}
 		strbuf[ws_col - 1] = '\0';
-		console_puts(strbuf);
+		fconsole_puts(out, strbuf);
 		CHECK_END_OF_SCREEN();
 
-		erase_line(0);
-		move(CURSOR_DOWN, 1);
+		ferase_line(out, 0);
+		fmove(out, CURSOR_DOWN, 1);
 		CHECK_END_OF_SCREEN();
 
 		ap_cur = lopt.ap_end;
@@ -3880,13 +4564,13 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 					}
 					lopt.mark_cur_ap = 0;
 				}
-				textstyle(TEXT_REVERSE);
+				ftextstyle(out, TEXT_REVERSE);
 				memcpy(lopt.selected_bssid, ap_cur->bssid, 6);
 			}
 
 			if (ap_cur->marked)
 			{
-				textcolor_fg(ap_cur->marked_color);
+				ftextcolor_fg(out, ap_cur->marked_color);
 			}
 
 			memset(strbuf + len, 32, sizeof(strbuf) - len - 1);
@@ -4027,12 +4711,12 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 			}
 
 			strbuf[ws_col - 1] = '\0';
-			console_puts(strbuf);
+			fconsole_puts(out, strbuf);
 
 			if ((lopt.p_selected_ap && (lopt.p_selected_ap == ap_cur))
 				|| (ap_cur->marked))
 			{
-				textstyle(TEXT_RESET);
+				ftextstyle(out, TEXT_RESET);
 			}
 
 			ap_cur = ap_cur->prev;
@@ -4040,8 +4724,8 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 
 		/* print some information about each detected station */
 
-		erase_line(0);
-		move(CURSOR_DOWN, 1);
+		ferase_line(out, 0);
+		fmove(out, CURSOR_DOWN, 1);
 		CHECK_END_OF_SCREEN();
 	}
 
@@ -4052,11 +4736,11 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 				"           PWR   Rate    Lost    Frames  Notes  Probes",
 				sizeof(strbuf));
 		strbuf[ws_col - 1] = '\0';
-		console_puts(strbuf);
+		fconsole_puts(out, strbuf);
 		CHECK_END_OF_SCREEN();
 
-		erase_line(0);
-		move(CURSOR_DOWN, 1);
+		ferase_line(out, 0);
+		fmove(out, CURSOR_DOWN, 1);
 		CHECK_END_OF_SCREEN();
 
 		ap_cur = lopt.ap_end;
@@ -4093,12 +4777,12 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 			if (lopt.p_selected_ap
 				&& (memcmp(lopt.selected_bssid, ap_cur->bssid, 6) == 0))
 			{
-				textstyle(TEXT_REVERSE);
+				ftextstyle(out, TEXT_REVERSE);
 			}
 
 			if (ap_cur->marked)
 			{
-				textcolor_fg(ap_cur->marked_color);
+				ftextcolor_fg(out, ap_cur->marked_color);
 			}
 
 			while (st_cur != NULL)
@@ -4125,35 +4809,38 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 				if (nlines >= (ws_row - 1)) return;
 
 				if (!memcmp(ap_cur->bssid, BROADCAST, 6))
-					printf(" (not associated) ");
+					fprintf(out, " (not associated) ");
 				else
-					printf(" %02X:%02X:%02X:%02X:%02X:%02X",
-						   ap_cur->bssid[0],
-						   ap_cur->bssid[1],
-						   ap_cur->bssid[2],
-						   ap_cur->bssid[3],
-						   ap_cur->bssid[4],
-						   ap_cur->bssid[5]);
-
-				printf("  %02X:%02X:%02X:%02X:%02X:%02X",
-					   st_cur->stmac[0],
-					   st_cur->stmac[1],
-					   st_cur->stmac[2],
-					   st_cur->stmac[3],
-					   st_cur->stmac[4],
-					   st_cur->stmac[5]);
-
-				printf("  %3d ", st_cur->power);
-				printf("  %2d", st_cur->rate_to / 1000000);
-				printf("%c", (st_cur->qos_fr_ds) ? 'e' : ' ');
-				printf("-%2d", st_cur->rate_from / 1000000);
-				printf("%c", (st_cur->qos_to_ds) ? 'e' : ' ');
-				printf("  %4d", st_cur->missed);
-				printf(" %8lu", st_cur->nb_pkt);
-				printf("  %-5s",
-					   (st_cur->wpa.pmkid[0] != 0)
-						   ? "PMKID"
-						   : (st_cur->wpa.state == 7 ? "EAPOL" : ""));
+					fprintf(out,
+							" %02X:%02X:%02X:%02X:%02X:%02X",
+							ap_cur->bssid[0],
+							ap_cur->bssid[1],
+							ap_cur->bssid[2],
+							ap_cur->bssid[3],
+							ap_cur->bssid[4],
+							ap_cur->bssid[5]);
+
+				fprintf(out,
+						"  %02X:%02X:%02X:%02X:%02X:%02X",
+						st_cur->stmac[0],
+						st_cur->stmac[1],
+						st_cur->stmac[2],
+						st_cur->stmac[3],
+						st_cur->stmac[4],
+						st_cur->stmac[5]);
+
+				fprintf(out, "  %3d ", st_cur->power);
+				fprintf(out, "  %2d", st_cur->rate_to / 1000000);
+				fprintf(out, "%c", (st_cur->qos_fr_ds) ? 'e' : ' ');
+				fprintf(out, "-%2d", st_cur->rate_from / 1000000);
+				fprintf(out, "%c", (st_cur->qos_to_ds) ? 'e' : ' ');
+				fprintf(out, "  %4d", st_cur->missed);
+				fprintf(out, " %8lu", st_cur->nb_pkt);
+				fprintf(out,
+						"  %-5s",
+						(st_cur->wpa.pmkid[0] != 0)
+							? "PMKID"
+							: (st_cur->wpa.state == 7 ? "EAPOL" : ""));
 
 				if (ws_col > (columns_sta - 6))
 				{
@@ -4180,11 +4867,11 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 						? abort()
 						: (void) 0;
 					strbuf[MAX(ws_col - 75, 0)] = '\0';
-					printf(" %s", strbuf);
+					fprintf(out, " %s", strbuf);
 				}
 
-				erase_line(0);
-				putchar('\n');
+				ferase_line(out, 0);
+				fputc('\n', out);
 
 				st_cur = st_cur->prev;
 			}
@@ -4193,7 +4880,7 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 				 && (memcmp(lopt.selected_bssid, ap_cur->bssid, 6) == 0))
 				|| (ap_cur->marked))
 			{
-				textstyle(TEXT_RESET);
+				ftextstyle(out, TEXT_RESET);
 			}
 
 			ap_cur = ap_cur->prev;
@@ -4204,8 +4891,8 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 	{
 		/* print some information about each unknown station */
 
-		erase_line(0);
-		move(CURSOR_DOWN, 1);
+		ferase_line(out, 0);
+		fmove(out, CURSOR_DOWN, 1);
 		CHECK_END_OF_SCREEN();
 
 		strlcpy(strbuf,
@@ -4213,12 +4900,12 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 				"          CH PWR    ACK ACK/s    CTS RTS_RX RTS_TX  OTHER",
 				sizeof(strbuf));
 		strbuf[ws_col - 1] = '\0';
-		console_puts(strbuf);
+		fconsole_puts(out, strbuf);
 		CHECK_END_OF_SCREEN();
 
 		memset(strbuf, ' ', (size_t) ws_col - 1);
 		strbuf[ws_col - 1] = '\0';
-		console_puts(strbuf);
+		fconsole_puts(out, strbuf);
 		CHECK_END_OF_SCREEN();
 
 		na_cur = lopt.na_1st;
@@ -4235,144 +4922,112 @@ static void dump_print(int ws_row, int ws_col, int if_num)
 
 			if (nlines >= (ws_row - 1)) return;
 
-			printf(" %02X:%02X:%02X:%02X:%02X:%02X",
-				   na_cur->namac[0],
-				   na_cur->namac[1],
-				   na_cur->namac[2],
-				   na_cur->namac[3],
-				   na_cur->namac[4],
-				   na_cur->namac[5]);
-
-			printf("  %3d", na_cur->channel);
-			printf(" %3d", na_cur->power);
-			printf(" %6d", na_cur->ack);
-			printf("  %4d", na_cur->ackps);
-			printf(" %6d", na_cur->cts);
-			printf(" %6d", na_cur->rts_r);
-			printf(" %6d", na_cur->rts_t);
-			printf(" %6d", na_cur->other);
-
-			erase_line(0);
-			putchar('\n');
+			fprintf(out,
+					" %02X:%02X:%02X:%02X:%02X:%02X",
+					na_cur->namac[0],
+					na_cur->namac[1],
+					na_cur->namac[2],
+					na_cur->namac[3],
+					na_cur->namac[4],
+					na_cur->namac[5]);
+
+			fprintf(out, "  %3d", na_cur->channel);
+			fprintf(out, " %3d", na_cur->power);
+			fprintf(out, " %6d", na_cur->ack);
+			fprintf(out, "  %4d", na_cur->ackps);
+			fprintf(out, " %6d", na_cur->cts);
+			fprintf(out, " %6d", na_cur->rts_r);
+			fprintf(out, " %6d", na_cur->rts_t);
+			fprintf(out, " %6d", na_cur->other);
+
+			ferase_line(out, 0);
+			fputc('\n', out);
 
 			na_cur = na_cur->next;
 		}
 	}
 
-	erase_display(0);
+	ferase_display(out, 0);
 }
 
-#define OUI_STR_SIZE 8
-#define MANUF_SIZE 128
-static char *
+/*
+ * Returns the manufacturer of an OUI. The string belongs to the OUI list and
+ * must not be freed. When the whole OUI file was not loaded, the file is read
+ * once per OUI and the answer added to the list.
+ */
+static const char *
 get_manufacturer(unsigned char mac0, unsigned char mac1, unsigned char mac2)
 {
-	char oui[OUI_STR_SIZE + 1];
-	char *manuf, *rmanuf;
-	char * manuf_str;
-	struct oui * ptr;
-	FILE * fp;
+	uint32_t id = ((uint32_t) mac0 << 16) | ((uint32_t) mac1 << 8) | mac2;
+	struct oui oui, found;
 	char buffer[BUFSIZ];
-	char temp[OUI_STR_SIZE + 1];
-	unsigned char a[2];
-	unsigned char b[2];
-	unsigned char c[2];
-	int found = 0;
+	FILE * fp;
+	size_t i;
 
-	if ((manuf = (char *) calloc(1, MANUF_SIZE * sizeof(char))) == NULL)
+	if (lopt.manufLoaded)
 	{
-		perror("calloc failed");
-		return (NULL);
-	}
+		i = oui_find(id);
 
-	snprintf(oui, sizeof(oui), "%02X:%02X:%02X", mac0, mac1, mac2);
+		if (i < lopt.manufCount && lopt.manufList[i].id == id
+			&& lopt.manufList[i].manuf != NULL)
+			return (lopt.manufList[i].manuf);
 
-	if (lopt.manufList != NULL)
-	{
-		// Search in the list
-		ptr = lopt.manufList;
-		while (ptr != NULL)
-		{
-			found = !strncasecmp(ptr->id, oui, OUI_STR_SIZE);
-			if (found)
-			{
-				memcpy(manuf, ptr->manuf, MANUF_SIZE);
-				break;
-			}
-			ptr = ptr->next;
-		}
+		return ("Unknown");
 	}
-	else
+
+	/* the list grows: the display thread may look up at the same time */
+	ALLEGE(pthread_mutex_lock(&(lopt.mx_manuf)) == 0);
+
+	i = oui_find(id);
+
+	if (i < lopt.manufCount && lopt.manufList[i].id == id)
 	{
-		// If the file exist, then query it each time we need to get a
-		// manufacturer.
-		fp = open_oui_file();
+		found = lopt.manufList[i];
+		ALLEGE(pthread_mutex_unlock(&(lopt.mx_manuf)) == 0);
 
-		if (fp != NULL)
-		{
+		return (found.manuf != NULL ? found.manuf : "Unknown");
+	}
 
-			memset(buffer, 0x00, sizeof(buffer));
-			while (fgets(buffer, sizeof(buffer), fp) != NULL)
-			{
-				if (strstr(buffer, "(hex)") == NULL)
-				{
-					continue;
-				}
+	found.id = id;
+	found.order = 0;
+	found.manuf = NULL;
 
-				memset(a, 0x00, sizeof(a));
-				memset(b, 0x00, sizeof(b));
-				memset(c, 0x00, sizeof(c));
-				if (sscanf(buffer,
-						   "%2c-%2c-%2c",
-						   (char *) a,
-						   (char *) b,
-						   (char *) c)
-					== 3)
-				{
-					snprintf(temp,
-							 sizeof(temp),
-							 "%c%c:%c%c:%c%c",
-							 a[0],
-							 a[1],
-							 b[0],
-							 b[1],
-							 c[0],
-							 c[1]);
-					found = !memcmp(temp, oui, strlen(oui));
-					if (found)
-					{
-						manuf_str = get_manufacturer_from_string(buffer);
-						if (manuf_str != NULL)
-						{
-							snprintf(manuf, MANUF_SIZE, "%s", manuf_str);
-							free(manuf_str);
-						}
+	fp = open_oui_file();
 
-						break;
-					}
-				}
-				memset(buffer, 0x00, sizeof(buffer));
+	if (fp != NULL)
+	{
+		memset(buffer, 0x00, sizeof(buffer));
+		while (fgets(buffer, sizeof(buffer), fp) != NULL)
+		{
+			if (parse_oui_line(buffer, &oui) == 0 && oui.id == id)
+			{
+				found.manuf = get_manufacturer_from_string(buffer);
+				break;
 			}
-
-			fclose(fp);
+			memset(buffer, 0x00, sizeof(buffer));
 		}
+
+		fclose(fp);
 	}
 
-	// Not found, use "Unknown".
-	if (!found || *manuf == '\0')
+	/* remember the answer, even when unknown */
+	if (oui_reserve(lopt.manufCount + 1) != 0)
 	{
-		memcpy(manuf, "Unknown", 7);
-		manuf[7] = '\0';
+		ALLEGE(pthread_mutex_unlock(&(lopt.mx_manuf)) == 0);
+		free(found.manuf);
+		return ("Unknown");
 	}
 
-	// Going in a smaller buffer
-	rmanuf = (char *) realloc(manuf, (strlen(manuf) + 1) * sizeof(char));
-	ALLEGE(rmanuf != NULL);
+	memmove(&lopt.manufList[i + 1],
+			&lopt.manufList[i],
+			(lopt.manufCount - i) * sizeof(struct oui));
+	lopt.manufList[i] = found;
+	lopt.manufCount++;
+
+	ALLEGE(pthread_mutex_unlock(&(lopt.mx_manuf)) == 0);
 
-	return (rmanuf);
+	return (found.manuf != NULL ? found.manuf : "Unknown");
 }
-#undef OUI_STR_SIZE
-#undef MANUF_SIZE
 
 /* Read at least one full line from the network.
  *
@@ -4918,6 +5573,874 @@ static void sighandler(int signum)
 	}
 }
 
+/*
+ * Capture pipeline: one reader thread per card queues frames in its ring,
+ * the main thread parses them into the AP/ST lists, the display thread
+ * redraws the screen and the writer thread updates the output files.
+ * Parsing, drawing and writing share the lists under mx_print; the readers
+ * never take it. The screen and the text files are rendered into memory
+ * under the lock and only written out once it is released, so a stalled
+ * terminal or disk does not hold up the parsing.
+ *
+ * In capture-only mode, the pcap writer thread drains the rings instead of
+ * the main thread: it only looks for beacons and EAPOL frames and appends
+ * every frame to the pcap file, PCAP_WRITE_SIZE bytes at a time.
+ */
+
+/* Leaves the signals to the main thread, where the handlers expect them. */
+static void block_signals(void)
+{
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGWINCH);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2);
+	sigaddset(&set, SIGCHLD);
+	sigaddset(&set, SIGALRM);
+
+	ALLEGE(pthread_sigmask(SIG_BLOCK, &set, NULL) == 0);
+}
+
+/* Sleeps usec, noticing do_exit within REFRESH_RATE; 0 once it is set. */
+static int sleep_unless_exit(long usec)
+{
+	long slice;
+
+	while (usec > 0 && !lopt.do_exit)
+	{
+		slice = (usec > REFRESH_RATE) ? REFRESH_RATE : usec;
+		usleep((useconds_t) slice);
+		usec -= slice;
+	}
+
+	return (!lopt.do_exit);
+}
+
+static void capture_notify(void)
+{
+	ALLEGE(pthread_mutex_lock(&(lopt.mx_capture)) == 0);
+	lopt.capture_pending = 1;
+	ALLEGE(pthread_cond_signal(&(lopt.cv_capture)) == 0);
+	ALLEGE(pthread_mutex_unlock(&(lopt.mx_capture)) == 0);
+}
+
+/* Waits up to usec for a reader to queue frames or fail. */
+static void capture_wait(long usec)
+{
+	struct timeval now;
+	struct timespec deadline;
+
+	gettimeofday(&now, NULL);
+	deadline.tv_sec = now.tv_sec + (now.tv_usec + usec) / 1000000;
+	deadline.tv_nsec = ((now.tv_usec + usec) % 1000000) * 1000;
+
+	ALLEGE(pthread_mutex_lock(&(lopt.mx_capture)) == 0);
+	while (!lopt.capture_pending && !lopt.do_exit)
+		if (pthread_cond_timedwait(
+				&(lopt.cv_capture), &(lopt.mx_capture), &deadline)
+			== ETIMEDOUT)
+			break;
+	lopt.capture_pending = 0;
+	ALLEGE(pthread_mutex_unlock(&(lopt.mx_capture)) == 0);
+}
+
+/* Queues a frame, or drops it if the main thread is that far behind or its
+   length is not valid. */
+static void capture_push(struct capture_ring * ring, struct wi_frame * frame)
+{
+	struct capture_record * rec;
+	size_t head, tail, pos, room, need, skip = 0;
+
+	/* read by the main and pcap writer threads */
+	__atomic_add_fetch(&(ring->received), 1, __ATOMIC_RELAXED);
+
+	if (frame->len <= 0 || frame->len > 4096)
+	{
+		__atomic_add_fetch(&(ring->dropped), 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	need = sizeof(*rec) + (((size_t) frame->len + 7) & ~(size_t) 7);
+	head = ring->head;
+	tail = __atomic_load_n(&(ring->tail), __ATOMIC_ACQUIRE);
+	pos = head & (CAPTURE_RING_SIZE - 1);
+	room = CAPTURE_RING_SIZE - pos;
+
+	/* records don't wrap around, pad up to the end instead */
+	if (room < need) skip = room;
+
+	if (head + skip + need - tail > CAPTURE_RING_SIZE)
+	{
+		__atomic_add_fetch(&(ring->dropped), 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (skip > 0)
+	{
+		/* without room for a header, the end is skipped implicitly */
+		if (room >= sizeof(*rec))
+			((struct capture_record *) (ring->buf + pos))->len = -1;
+		head += skip;
+		pos = 0;
+	}
+
+	rec = (struct capture_record *) (ring->buf + pos); //-V1032
+	rec->len = frame->len;
+	rec->ri = frame->ri;
+	memcpy(rec + 1, frame->h80211, (size_t) frame->len);
+
+	/* the kernel timestamp of the frame, when the backend has one */
+	if (frame->ts.tv_sec != 0 || frame->ts.tv_nsec != 0)
+	{
+		rec->tv.tv_sec = frame->ts.tv_sec;
+		rec->tv.tv_usec = (suseconds_t) (frame->ts.tv_nsec / 1000);
+	}
+	else
+		gettimeofday(&(rec->tv), NULL);
+
+	__atomic_store_n(&(ring->head), head + need, __ATOMIC_RELEASE);
+}
+
+/* Notes beacons and EAPOL frames, reporting the first PMKID of a network. */
+static void pcap_writer_classify(struct pcap_writer * pw,
+								 const unsigned char * h80211,
+								 int caplen)
+{
+	const uint8_t rsn_oui[]
+		= {RSN_OUI & 0xff, (RSN_OUI >> 8) & 0xff, (RSN_OUI >> 16) & 0xff};
+	const unsigned char * bssid;
+	struct NW_info * nw;
+	int z, n, pmkid = 0;
+
+	if (caplen < (int) sizeof(struct ieee80211_frame)) return;
+
+	switch (h80211[1] & IEEE80211_FC1_DIR_MASK)
+	{
+		case IEEE80211_FC1_DIR_NODS:
+			bssid = h80211 + 16;
+			break;
+		case IEEE80211_FC1_DIR_TODS:
+			bssid = h80211 + 4;
+			break;
+		default:
+			bssid = h80211 + 10;
+			break;
+	}
+
+	if (h80211[0] == IEEE80211_FC0_SUBTYPE_BEACON)
+	{
+		pw->beacons++;
+	}
+	else
+	{
+		if ((h80211[0] & IEEE80211_FC0_TYPE_MASK) != IEEE80211_FC0_TYPE_DATA
+			|| (h80211[1] & IEEE80211_FC1_WEP) != 0)
+			return;
+
+		z = ((h80211[1] & IEEE80211_FC1_DIR_MASK) != IEEE80211_FC1_DIR_DSTODS)
+				? 24
+				: 30;
+
+		/* Check if 802.11e (QoS) */
+		if ((h80211[0] & 0x80) == 0x80) z += 2;
+
+		/* check ethertype == EAPOL */
+		if (z + 8 + 7 > caplen || h80211[z + 6] != 0x88
+			|| h80211[z + 7] != 0x8E)
+			return;
+
+		pw->eapol++;
+
+		z += 8; // skip LLC header and ethertype
+
+		/* frame 1 carrying a PMKID KDE */
+		if (z + 121 <= caplen && (h80211[z + 6] & 0x08) != 0
+			&& (h80211[z + 6] & 0x40) == 0 && (h80211[z + 6] & 0x80) != 0
+			&& (h80211[z + 5] & 0x01) == 0
+			&& h80211[z + 99] == IEEE80211_ELEMID_VENDOR
+			&& memcmp(rsn_oui, &h80211[z + 101], 3) == 0
+			&& h80211[z + 104] == RSN_CSE_CCMP
+			&& memcmp(ZERO, &h80211[z + 105], 16) != 0) //-V512
+		{
+			pw->pmkid++;
+			pmkid = 1;
+		}
+	}
+
+	nw = (struct NW_info *) mac_table_find(&(pw->nw_index), bssid);
+
+	if (nw == NULL)
+	{
+		nw = (struct NW_info *) calloc(1, sizeof(struct NW_info));
+		if (nw == NULL) return;
+
+		memcpy(nw->bssid, bssid, 6);
+
+		if (mac_table_insert(&(pw->nw_index), bssid, nw) != 0)
+		{
+			free(nw);
+			return;
+		}
+	}
+
+	/* the ESSID is the first tagged parameter of a beacon */
+	if (h80211[0] == IEEE80211_FC0_SUBTYPE_BEACON && nw->essid[0] == '\0'
+		&& caplen > 38 && h80211[36] == 0x00)
+	{
+		n = MIN(ESSID_LENGTH, MIN(h80211[37], caplen - 38));
+		memcpy(nw->essid, h80211 + 38, (size_t) n);
+		nw->essid[n] = '\0';
+
+		for (z = 0; z < n; z++)
+			if ((unsigned char) nw->essid[z] < 0x20) nw->essid[z] = '.';
+	}
+
+	if (h80211[0] == IEEE80211_FC0_SUBTYPE_BEACON) return;
+
+	if (pmkid && !nw->pmkid)
+		nw->pmkid = 1;
+	else if (!pmkid && !nw->eapol)
+		nw->eapol = 1;
+	else
+		return;
+
+	printf("%s: %02X:%02X:%02X:%02X:%02X:%02X %s\n",
+		   pmkid ? "PMKID found" : "EAPOL seen",
+		   nw->bssid[0],
+		   nw->bssid[1],
+		   nw->bssid[2],
+		   nw->bssid[3],
+		   nw->bssid[4],
+		   nw->bssid[5],
+		   nw->essid);
+	fflush(stdout);
+}
+
+/* Writes the buffered pcap records out. */
+static void pcap_writer_flush(struct pcap_writer * pw)
+{
+	if (pw->len == 0) return;
+
+	if (fwrite(pw->buf, 1, pw->len, opt.f_cap) != pw->len
+		|| fflush(opt.f_cap) != 0)
+	{
+		perror("fwrite(pcap records) failed");
+		pw->failed += pw->frames;
+	}
+	else
+		pw->written += pw->frames;
+
+	pw->len = 0;
+	pw->frames = 0;
+}
+
+static void pcap_writer_add(struct pcap_writer * pw,
+							struct capture_record * rec)
+{
+	struct pcap_pkthdr pkh;
+	size_t need = sizeof(pkh) + (size_t) rec->len;
+
+	pcap_writer_classify(pw, (unsigned char *) (rec + 1), rec->len);
+
+	if (pw->len + need > PCAP_WRITE_SIZE) pcap_writer_flush(pw);
+
+	pkh.tv_sec = (int32_t) rec->tv.tv_sec;
+	pkh.tv_usec = (int32_t) rec->tv.tv_usec;
+	pkh.len = pkh.caplen = (uint32_t) rec->len;
+
+	memcpy(pw->buf + pw->len, &pkh, sizeof(pkh));
+	memcpy(pw->buf + pw->len + sizeof(pkh), rec + 1, (size_t) rec->len);
+	pw->len += need;
+	pw->frames++;
+}
+
+/*
+ * Parses up to max frames queued for a card; the caller holds mx_print,
+ * unless in capture-only mode. Returns the number of frames parsed.
+ */
+static int capture_drain(struct capture_ring * ring, int max)
+{
+	struct capture_record * rec;
+	size_t head, tail, pos, room;
+	int nb = 0;
+
+	head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+	tail = ring->tail;
+
+	while (tail != head && nb < max)
+	{
+		pos = tail & (CAPTURE_RING_SIZE - 1);
+		room = CAPTURE_RING_SIZE - pos;
+		rec = (struct capture_record *) (ring->buf + pos); //-V1032
+
+		if (room < sizeof(*rec) || rec->len == -1)
+		{
+			tail += room;
+			continue;
+		}
+
+		if (lopt.capture_only)
+			pcap_writer_add(&(lopt.pcap), rec);
+		else
+			dump_add_packet((unsigned char *) (rec + 1),
+							rec->len,
+							&(rec->ri),
+							ring->card,
+							&(rec->tv));
+
+		tail += sizeof(*rec) + (((size_t) rec->len + 7) & ~(size_t) 7);
+		nb++;
+	}
+
+	__atomic_store_n(&(ring->tail), tail, __ATOMIC_RELEASE);
+
+	return (nb);
+}
+
+static int capture_queued(struct capture_ring * ring)
+{
+	return (__atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE) != ring->tail);
+}
+
+/* Serializes the calls to a card between its reader and the main thread:
+   the probe requests and the monitor, channel and frequency checks. The
+   channel and frequency hoppers are not covered, they run in a fork()ed
+   child that reopens the cards, so they never share a wif with the reader.
+   The lock is only needed because some backends (e.g. the network one)
+   use a single socket for both reads and commands. */
+static void card_lock(int card)
+{
+	if (lopt.rings[card].buf != NULL)
+		ALLEGE(pthread_mutex_lock(&(lopt.rings[card].mx_card)) == 0);
+}
+
+static void card_unlock(int card)
+{
+	if (lopt.rings[card].buf != NULL)
+		ALLEGE(pthread_mutex_unlock(&(lopt.rings[card].mx_card)) == 0);
+}
+
+static THREAD_ENTRY(reader_thread)
+{
+	REQUIRE(arg != NULL);
+
+	struct capture_ring * ring = (struct capture_ring *) arg;
+	struct wi_frame * frames;
+	unsigned char * batch;
+	struct timeval tv;
+	fd_set rfds;
+	int fd, nb, i;
+
+	block_signals();
+
+	frames = (struct wi_frame *) calloc(READ_BATCH, sizeof(struct wi_frame));
+	batch = (unsigned char *) malloc(READ_BATCH * 4096);
+	ALLEGE(frames != NULL && batch != NULL);
+
+	fd = wi_fd(ring->wi);
+
+	while (!__atomic_load_n(&(ring->stop), __ATOMIC_ACQUIRE) && !lopt.do_exit)
+	{
+		/* don't block in the read, to notice stop */
+		FD_ZERO(&rfds);
+		FD_SET(fd, &rfds); // NOLINT(hicpp-signed-bitwise)
+		tv.tv_sec = 0;
+		tv.tv_usec = REFRESH_RATE;
+
+		nb = select(fd + 1, &rfds, NULL, NULL, &tv);
+		if (nb == 0 || (nb < 0 && errno == EINTR)) continue;
+
+		if (nb > 0)
+		{
+			card_lock(ring->card);
+			nb = wi_read_batch(
+				ring->wi, frames, READ_BATCH, batch, READ_BATCH * 4096);
+			card_unlock(ring->card);
+		}
+
+		if (nb < 0)
+		{
+			__atomic_store_n(&(ring->failed), 1, __ATOMIC_RELEASE);
+			capture_notify();
+			break;
+		}
+
+		for (i = 0; i < nb; i++) capture_push(ring, &frames[i]);
+
+		if (nb > 0) capture_notify();
+	}
+
+	free(batch);
+	free(frames);
+
+	return (NULL);
+}
+
+/* Starts reading a card on its own thread. */
+static int capture_start(int card, struct wif * wi)
+{
+	struct capture_ring * ring = &(lopt.rings[card]);
+
+	if (ring->buf == NULL)
+	{
+		ring->buf = (unsigned char *) malloc(CAPTURE_RING_SIZE);
+		if (ring->buf == NULL) return (-1);
+		ALLEGE(pthread_mutex_init(&(ring->mx_card), NULL) == 0);
+	}
+
+	ring->wi = wi;
+	ring->card = card;
+	ring->stop = 0;
+	ring->failed = 0;
+
+	wi_set_rx_ring(wi, lopt.rx_ring);
+
+	if (pthread_create(&(ring->tid), NULL, &reader_thread, ring) != 0)
+		return (-1);
+
+	ring->running = 1;
+
+	return (0);
+}
+
+/* Stops the reader of a card; the frames it queued stay in the ring. */
+static void capture_stop(int card)
+{
+	struct capture_ring * ring = &(lopt.rings[card]);
+
+	if (!ring->running) return;
+
+	__atomic_store_n(&(ring->stop), 1, __ATOMIC_RELEASE);
+	ALLEGE(pthread_join(ring->tid, NULL) == 0);
+	ring->running = 0;
+}
+
+/* Takes mx_print for the display and writer threads. An --offline read holds
+   it for whole batches of frames, and lets go early when they are waiting. */
+static void print_lock(void)
+{
+	__atomic_add_fetch(&(lopt.print_waiters), 1, __ATOMIC_ACQ_REL);
+	ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
+	__atomic_sub_fetch(&(lopt.print_waiters), 1, __ATOMIC_ACQ_REL);
+}
+
+static THREAD_ENTRY(display_thread)
+{
+	UNUSED_PARAM(arg);
+
+	time_t tt2 = time(NULL);
+	char *batt, *elapsed, *old_batt, *old_elapsed;
+	struct text_record screen = {NULL, 0};
+	int slow;
+
+	block_signals();
+
+	while (sleep_unless_exit((lopt.update_s > 0) ? lopt.update_s * 1000000L
+												  : REFRESH_RATE))
+	{
+		batt = elapsed = NULL;
+		slow = (time(NULL) - tt2 > 5);
+
+		if (slow)
+		{
+			/* update the battery state and the elapsed time */
+			tt2 = time(NULL);
+			batt = getBatteryString();
+			elapsed = getStringTimeFromSec(difftime(tt2, lopt.start_time));
+		}
+
+		/* update the window size */
+
+		if (ioctl(0, TIOCGWINSZ, &(lopt.ws)) < 0)
+		{
+			lopt.ws.ws_row = 25;
+			lopt.ws.ws_col = 80;
+		}
+
+		print_lock();
+
+		update_dataps();
+
+		old_batt = old_elapsed = NULL;
+
+		if (slow)
+		{
+			if (lopt.sort_by != SORT_BY_NOTHING)
+			{
+				/* sort the APs by power */
+				ALLEGE(pthread_mutex_lock(&(lopt.mx_sort)) == 0);
+				dump_sort();
+				ALLEGE(pthread_mutex_unlock(&(lopt.mx_sort)) == 0);
+			}
+
+			old_batt = lopt.batt;
+			old_elapsed = lopt.elapsed_time;
+			lopt.batt = batt;
+			lopt.elapsed_time = elapsed;
+		}
+
+		/* display the list of access points we have */
+
+		if (!lopt.do_pause && !lopt.background_mode) screen_render(&screen);
+
+		ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
+
+		if (screen.text != NULL) screen_show(&screen);
+
+		free(old_batt);
+		free(old_elapsed);
+	}
+
+	return (NULL);
+}
+
+static THREAD_ENTRY(writer_thread)
+{
+	UNUSED_PARAM(arg);
+
+	time_t tt1 = time(NULL);
+	time_t tt2 = time(NULL);
+	time_t tt3 = time(NULL);
+	struct text_files text;
+
+	block_signals();
+
+	while (sleep_unless_exit(REFRESH_RATE))
+	{
+		if (time(NULL) - tt1 >= lopt.file_write_interval)
+		{
+			/* update the text output files: only the snapshot is taken
+			   under the lock, the files are replaced outside of it */
+
+			tt1 = time(NULL);
+
+			print_lock();
+
+			dump_write_text_files(lopt.ap_1st,
+								  lopt.st_1st,
+								  lopt.f_encrypt,
+								  lopt.airodump_start_time,
+								  tt1 - lopt.berlin,
+								  &text);
+
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
+
+			dump_save_text_files(&text);
+		}
+
+		if (time(NULL) - tt3 >= 1)
+		{
+			/* drop the records past the retention limits */
+
+			tt3 = time(NULL);
+
+			print_lock();
+			evict_records(tt3);
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
+		}
+
+		if (time(NULL) - tt2 > 5)
+		{
+			/* flush the output files, stdio locks them against the parser */
+
+			tt2 = time(NULL);
+
+			if (opt.f_cap != NULL) fflush(opt.f_cap);
+			if (opt.f_ivs != NULL) fflush(opt.f_ivs);
+			if (opt.f_events != NULL) fflush(opt.f_events);
+		}
+	}
+
+	return (NULL);
+}
+
+/* Prints the capture-only counters. */
+static void pcap_writer_stats(const struct pcap_writer * pw)
+{
+	unsigned long received, dropped;
+	char ts[16];
+	time_t now = time(NULL);
+
+	capture_counters(&received, &dropped);
+	dropped += pw->failed;
+
+	strftime(ts, sizeof(ts), "%H:%M:%S", localtime(&now));
+
+	printf("[%s] received %lu, written %lu, dropped %lu, beacons %lu, "
+		   "networks %lu, EAPOL %lu, PMKID %lu\n",
+		   ts,
+		   received,
+		   pw->written,
+		   dropped,
+		   pw->beacons,
+		   (unsigned long) pw->nw_index.used,
+		   pw->eapol,
+		   pw->pmkid);
+	fflush(stdout);
+}
+
+static THREAD_ENTRY(pcap_writer_thread)
+{
+	UNUSED_PARAM(arg);
+
+	struct pcap_writer * pw = &(lopt.pcap);
+	long interval = (lopt.update_s > 0) ? lopt.update_s : STATS_INTERVAL;
+	time_t tt1 = time(NULL);
+	time_t tt2 = time(NULL);
+	int i, nb, stop;
+
+	block_signals();
+
+	while (1)
+	{
+		/* the readers are stopped, so what is left is all there is */
+		stop = __atomic_load_n(&(pw->stop), __ATOMIC_ACQUIRE);
+
+		for (i = nb = 0; i < lopt.num_cards; i++)
+			nb += capture_drain(&(lopt.rings[i]), DRAIN_BATCH);
+
+		/* write out when idle, and at least once a second */
+		if (nb == 0 || time(NULL) != tt1)
+		{
+			tt1 = time(NULL);
+			pcap_writer_flush(pw);
+		}
+
+		if (time(NULL) - tt2 >= interval)
+		{
+			tt2 = time(NULL);
+			pcap_writer_stats(pw);
+		}
+
+		if (nb > 0) continue;
+		if (stop) break;
+
+		if (lopt.do_exit)
+			usleep(1000);
+		else
+			capture_wait(REFRESH_RATE);
+	}
+
+	pcap_writer_stats(pw);
+
+	return (NULL);
+}
+
+/* Maps the -r input file, so that reading a frame does not cost any system
+   call. Falls back on stdio when the file can't be mapped. */
+static void map_input_file(void)
+{
+#ifdef HAVE_MMAP
+	struct stat st;
+	void * map;
+	int fd = fileno(lopt.f_cap_in);
+
+	if (fd == -1 || fstat(fd, &st) != 0 || st.st_size <= 0
+		|| (uintmax_t) st.st_size > SIZE_MAX)
+		return;
+
+	map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) return;
+
+#ifdef MADV_SEQUENTIAL
+	(void) madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+#endif
+
+	lopt.map_in = (unsigned char *) map;
+	lopt.map_len = (size_t) st.st_size;
+	lopt.map_pos = (size_t) ftell(lopt.f_cap_in);
+#endif
+}
+
+static void unmap_input_file(void)
+{
+#ifdef HAVE_MMAP
+	if (lopt.map_in != NULL) munmap(lopt.map_in, lopt.map_len);
+#endif
+	lopt.map_in = NULL;
+}
+
+/* Copies len bytes of the -r input file to dst. */
+static int read_input(void * dst, size_t len)
+{
+	if (lopt.map_in == NULL) return (fread(dst, len, 1, lopt.f_cap_in) == 1);
+
+	if (lopt.map_len - lopt.map_pos < len) return (0);
+
+	memcpy(dst, lopt.map_in + lopt.map_pos, len);
+	lopt.map_pos += len;
+
+	return (1);
+}
+
+/*
+ * Reads the next frame of the -r input file into h80211 and strips its
+ * capture header, filling ri from it. Returns 1 when a frame was read, 0
+ * when it has to be skipped and -1 at the end of the file.
+ */
+static int read_input_packet(unsigned char * h80211,
+							 size_t size,
+							 struct pcap_pkthdr * pkh,
+							 struct rx_info * ri,
+							 int * len)
+{
+	int n, caplen;
+
+	if (!read_input(pkh, sizeof(*pkh))) return (-1);
+
+	if (lopt.pfh_in.magic == TCPDUMP_CIGAM)
+	{
+		SWAP32(pkh->caplen);
+		SWAP32(pkh->len);
+	}
+
+	n = caplen = pkh->caplen;
+
+	memset(h80211, 0, size);
+
+	if (n <= 0 || n > (int) size) return (-1);
+
+	if (!read_input(h80211, (size_t) n)) return (-1);
+
+	if (lopt.pfh_in.linktype == LINKTYPE_PRISM_HEADER)
+	{
+		if (h80211[7] == 0x40)
+		{
+			n = 64;
+			ri->ri_power = -((int32_t) load32_le(h80211 + 0x33));
+			ri->ri_noise = (int32_t) load32_le(h80211 + 0x33 + 12);
+			ri->ri_rate = load32_le(h80211 + 0x33 + 24) * 500000;
+		}
+		else
+		{
+			n = load32_le(h80211 + 4);
+			ri->ri_mactime = load64_le(h80211 + 0x5C - 48);
+			ri->ri_channel = load32_le(h80211 + 0x5C - 36);
+			ri->ri_power = -((int32_t) load32_le(h80211 + 0x5C));
+			ri->ri_noise = (int32_t) load32_le(h80211 + 0x5C + 12);
+			ri->ri_rate = load32_le(h80211 + 0x5C + 24) * 500000;
+		}
+
+		if (n < 8 || n >= caplen) return (0);
+
+		caplen -= n;
+		memmove(h80211, h80211 + n, (size_t) caplen);
+	}
+
+	if (lopt.pfh_in.linktype == LINKTYPE_RADIOTAP_HDR)
+	{
+		/* remove the radiotap header */
+
+		n = load16_le(h80211 + 2);
+
+		if (n <= 0 || n >= caplen) return (0);
+
+		int got_signal = 0;
+		int got_noise = 0;
+		struct ieee80211_radiotap_iterator iterator;
+		struct ieee80211_radiotap_header * rthdr;
+
+		rthdr = (struct ieee80211_radiotap_header *) h80211;
+
+		if (ieee80211_radiotap_iterator_init(
+				&iterator, rthdr, caplen, NULL)
+			< 0)
+			return (0);
+
+		/* go through the radiotap arguments we have been given
+		 * by the driver
+		 */
+
+		while (ieee80211_radiotap_iterator_next(&iterator) >= 0)
+		{
+			switch (iterator.this_arg_index)
+			{
+				case IEEE80211_RADIOTAP_TSFT:
+					ri->ri_mactime = le64_to_cpu(
+						*((uint64_t *) iterator.this_arg));
+					break;
+
+				case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
+				case IEEE80211_RADIOTAP_DB_ANTSIGNAL:
+					if (!got_signal)
+					{
+						if (*iterator.this_arg < 127)
+							ri->ri_power = *iterator.this_arg;
+						else
+							ri->ri_power = *iterator.this_arg - 255;
+
+						got_signal = 1;
+					}
+					break;
+
+				case IEEE80211_RADIOTAP_DBM_ANTNOISE:
+				case IEEE80211_RADIOTAP_DB_ANTNOISE:
+					if (!got_noise)
+					{
+						if (*iterator.this_arg < 127)
+							ri->ri_noise = *iterator.this_arg;
+						else
+							ri->ri_noise = *iterator.this_arg - 255;
+
+						got_noise = 1;
+					}
+					break;
+
+				case IEEE80211_RADIOTAP_ANTENNA:
+					ri->ri_antenna = *iterator.this_arg;
+					break;
+
+				case IEEE80211_RADIOTAP_CHANNEL:
+					ri->ri_channel = getChannelFromFrequency(
+						le16toh(*(uint16_t *) iterator.this_arg));
+					break;
+
+				case IEEE80211_RADIOTAP_RATE:
+					ri->ri_rate = (*iterator.this_arg) * 500000;
+					break;
+			}
+		}
+
+		caplen -= n;
+		memmove(h80211, h80211 + n, (size_t) caplen);
+	}
+
+	if (lopt.pfh_in.linktype == LINKTYPE_PPI_HDR)
+	{
+		/* remove the PPI header */
+
+		n = load16_le(h80211 + 2);
+
+		if (n <= 0 || n >= caplen) return (0);
+
+		/* for a while Kismet logged broken PPI headers */
+		if (n == 24 && load16_le(h80211 + 8) == 2) n = 32;
+
+		if (n <= 0 || n >= caplen) return (0); //-V560
+
+		caplen -= n;
+		memmove(h80211, h80211 + n, (size_t) caplen);
+	}
+
+	*len = caplen;
+
+	return (1);
+}
+
+/* Notes in the display that the -r input file is done. */
+static void input_finished(void)
+{
+	memset(lopt.message, '\x00', sizeof(lopt.message));
+	snprintf(lopt.message,
+			 sizeof(lopt.message),
+			 "][ Finished reading input file %s.",
+			 opt.s_file);
+	opt.s_file = NULL;
+}
+
 static int send_probe_request(struct wif * wi)
 {
 	REQUIRE(wi != NULL);
@@ -4974,7 +6497,9 @@ static int send_probe_requests(struct wif * wi[], int cards)
 	int i = 0;
 	for (i = 0; i < cards; i++)
 	{
+		card_lock(i);
 		send_probe_request(wi[i]);
+		card_unlock(i);
 	}
 
 	return (0);
@@ -5589,7 +7114,9 @@ static int check_monitor(struct wif * wi[], int * fd_raw, int * fdh, int cards)
 
 	for (i = 0; i < cards; i++)
 	{
+		card_lock(i);
 		monitor = wi_get_monitor(wi[i]);
+		card_unlock(i);
 		if (monitor != 0)
 		{
 			memset(lopt.message, '\x00', sizeof(lopt.message));
@@ -5601,9 +7128,10 @@ static int check_monitor(struct wif * wi[], int * fd_raw, int * fdh, int cards)
 
 			strlcpy(ifname, wi_get_ifname(wi[i]), sizeof(ifname));
 
+			capture_stop(i);
 			wi_close(wi[i]);
 			wi[i] = wi_open(ifname);
-			if (!wi[i])
+			if (!wi[i] || capture_start(i, wi[i]) != 0)
 			{
 				printf("Can't reopen %s\n", ifname);
 				exit(1);
@@ -5621,8 +7149,13 @@ static int check_channel(struct wif * wi[], int cards)
 	int i, chan;
 	for (i = 0; i < cards; i++)
 	{
+		card_lock(i);
 		chan = wi_get_channel(wi[i]);
-		if (opt.ignore_negative_one == 1 && chan == -1) return (0);
+		if (opt.ignore_negative_one == 1 && chan == -1)
+		{
+			card_unlock(i);
+			return (0);
+		}
 		if (lopt.channel[i] != chan)
 		{
 			memset(lopt.message, '\x00', sizeof(lopt.message));
@@ -5637,6 +7170,7 @@ static int check_channel(struct wif * wi[], int cards)
 			wi_set_channel(wi[i], lopt.channel[i]);
 #endif
 		}
+		card_unlock(i);
 	}
 	return (0);
 }
@@ -5646,9 +7180,9 @@ static int check_frequency(struct wif * wi[], int cards)
 	int i, freq;
 	for (i = 0; i < cards; i++)
 	{
+		card_lock(i);
 		freq = wi_get_freq(wi[i]);
-		if (freq < 0) continue;
-		if (lopt.frequency[i] != freq)
+		if (freq >= 0 && lopt.frequency[i] != freq)
 		{
 			memset(lopt.message, '\x00', sizeof(lopt.message));
 			snprintf(lopt.message,
@@ -5658,6 +7192,7 @@ static int check_frequency(struct wif * wi[], int cards)
 					 freq);
 			wi_set_freq(wi[i], lopt.frequency[i]);
 		}
+		card_unlock(i);
 	}
 	return (0);
 }
@@ -5775,7 +7310,7 @@ static int rearrange_frequencies(void)
 
 int main(int argc, char * argv[])
 {
-	long time_slept, cycle_time, cycle_time2;
+	long cycle_time, cycle_time2;
 	char * output_format_string;
 	int caplen = 0, i, j, fdh, chan_count, freq_count;
 	int fd_raw[MAX_CARDS];
@@ -5786,6 +7321,9 @@ int main(int argc, char * argv[])
 	int option_index = 0;
 	char ifnam[64];
 	int wi_read_failed = 0;
+	int queued, ret, batch;
+	unsigned long received[MAX_CARDS] = {0};
+	unsigned long nb_received, nb_dropped;
 	int n = 0;
 	int output_format_first_time = 1;
 #ifdef HAVE_PCRE
@@ -5796,32 +7334,29 @@ int main(int argc, char * argv[])
 	struct AP_info *ap_cur, *ap_next;
 	struct ST_info *st_cur, *st_next;
 	struct NA_info *na_cur, *na_next;
-	struct oui *oui_cur, *oui_next;
+	struct text_files text;
 
 	struct pcap_pkthdr pkh;
 
-	time_t tt1, tt2, start_time;
+	time_t start_time;
 
 	struct wif * wi[MAX_CARDS];
 	struct rx_info ri;
-	unsigned char tmpbuf[4096];
 	unsigned char buffer[4096];
 	unsigned char * h80211;
 	char * iface[MAX_CARDS];
 
 	struct timeval tv0;
 	struct timeval tv1;
-	struct timeval tv2;
 	struct timeval tv3;
 	struct timeval tv4;
+	struct timeval tv_read;
 	struct tm * lt;
 
 	/*
 	struct sockaddr_in provis_addr;
 	*/
 
-	fd_set rfds;
-
 	static const struct option long_options[]
 		= {{"ht20", 0, 0, '2'},
 		   {"ht40-", 0, 0, '3'},
@@ -5854,6 +7389,11 @@ int main(int argc, char * argv[])
 		   {"background", 1, 0, 'K'},
 		   {"min-packets", 1, 0, 'n'},
 		   {"real-time", 0, 0, 'T'},
+		   {"capture-only", 0, &lopt.capture_only, 1},
+		   {"rx-ring", 0, &lopt.rx_ring, 1},
+		   {"offline", 0, &lopt.offline, 1},
+		   {"max-age", 1, 0, 0},
+		   {"max-entries", 1, 0, 0},
 		   {0, 0, 0, 0}};
 
 	pid_t main_pid = getpid();
@@ -5863,6 +7403,7 @@ int main(int argc, char * argv[])
 
 	ALLEGE(pthread_mutex_init(&(lopt.mx_print), NULL) == 0);
 	ALLEGE(pthread_mutex_init(&(lopt.mx_sort), NULL) == 0);
+	ALLEGE(pthread_mutex_init(&(lopt.mx_manuf), NULL) == 0);
 
 	textstyle(TEXT_RESET); //(TEXT_RESET, TEXT_BLACK, TEXT_WHITE);
 
@@ -5872,13 +7413,20 @@ int main(int argc, char * argv[])
 	memset(&opt, 0, sizeof(opt));
 	memset(&lopt, 0, sizeof(lopt));
 
+	slab_pool_init(&lopt.ap_pool, sizeof(struct AP_info));
+	slab_pool_init(&lopt.st_pool, sizeof(struct ST_info));
+	slab_pool_init(&lopt.na_pool, sizeof(struct NA_info));
+	slab_pool_init(&lopt.pkt_pool, sizeof(struct pkt_buf));
+
+	ALLEGE(pthread_mutex_init(&(lopt.mx_capture), NULL) == 0);
+	ALLEGE(pthread_cond_init(&(lopt.cv_capture), NULL) == 0);
+
 	h80211 = NULL;
 	ivs_only = 0;
 	lopt.chanoption = 0;
 	lopt.freqoption = 0;
 	lopt.num_cards = 0;
 	fdh = 0;
-	time_slept = 0;
 	lopt.batt = NULL;
 	lopt.chswitch = 0;
 	opt.usegpsd = 0;
@@ -5890,11 +7438,9 @@ int main(int argc, char * argv[])
 	opt.record_data = 0;
 	opt.f_cap = NULL;
 	opt.f_ivs = NULL;
-	opt.f_txt = NULL;
-	opt.f_kis = NULL;
-	opt.f_kis_xml = NULL;
 	opt.f_gps = NULL;
 	opt.f_logcsv = NULL;
+	opt.f_events = NULL;
 	lopt.keyout = NULL;
 	opt.f_xor = NULL;
 	opt.sk_len = 0;
@@ -5932,6 +7478,7 @@ int main(int argc, char * argv[])
 	opt.output_format_kismet_csv = 1;
 	opt.output_format_kismet_netxml = 1;
 	opt.output_format_log_csv = 1;
+	opt.output_format_events = 0;
 	lopt.gps_valid_interval
 		= 5; // If we dont get a new GPS update in 5 seconds - invalidate it
 	lopt.file_write_interval = 5; // Write file every 5 seconds by default
@@ -6049,6 +7596,33 @@ int main(int argc, char * argv[])
 		{
 			case 0:
 
+				if (strcmp(long_options[option_index].name, "max-age") == 0)
+				{
+					if (is_string_number(optarg))
+						lopt.max_age = (int) strtol(optarg, NULL, 10);
+
+					if (lopt.max_age <= 0)
+					{
+						printf("Error: Maximum age must be a number of "
+							   "seconds greater than 0. Aborting.\n");
+						exit(EXIT_FAILURE);
+					}
+				}
+
+				if (strcmp(long_options[option_index].name, "max-entries")
+					== 0)
+				{
+					if (is_string_number(optarg))
+						lopt.max_entries = (size_t) strtoul(optarg, NULL, 10);
+
+					if (lopt.max_entries == 0)
+					{
+						printf("Error: Maximum number of entries must be "
+							   "greater than 0. Aborting.\n");
+						exit(EXIT_FAILURE);
+					}
+				}
+
 				break;
 
 			case ':':
@@ -6238,6 +7812,7 @@ int main(int argc, char * argv[])
 					opt.output_format_kismet_csv = 0;
 					opt.output_format_kismet_netxml = 0;
 					opt.output_format_log_csv = 0;
+					opt.output_format_events = 0;
 				}
 
 				if (opt.output_format_pcap)
@@ -6414,6 +7989,7 @@ int main(int argc, char * argv[])
 					opt.output_format_kismet_csv = 0;
 					opt.output_format_kismet_netxml = 0;
 					opt.output_format_log_csv = 0;
+					opt.output_format_events = 0;
 				}
 
 				// Parse the value
@@ -6494,6 +8070,11 @@ int main(int argc, char * argv[])
 						{
 							opt.output_format_log_csv = 1;
 						}
+						else if (strncasecmp(output_format_string, "events", 6)
+								 == 0)
+						{
+							opt.output_format_events = 1;
+						}
 						else if (strncasecmp(output_format_string, "default", 7)
 								 == 0)
 						{
@@ -6510,6 +8091,7 @@ int main(int argc, char * argv[])
 							opt.output_format_kismet_csv = 0;
 							opt.output_format_kismet_netxml = 0;
 							opt.output_format_log_csv = 0;
+							opt.output_format_events = 0;
 							opt.usegpsd = 0;
 							ivs_only = 0;
 						}
@@ -6596,6 +8178,33 @@ int main(int argc, char * argv[])
 		return (EXIT_FAILURE);
 	}
 
+	if (lopt.capture_only)
+	{
+		if (lopt.s_iface == NULL || !opt.record_data || !opt.output_format_pcap)
+		{
+			printf("Notice: --capture-only needs an interface and a pcap "
+				   "file \"--write\"\n");
+			printf("\"%s --help\" for help.\n", argv[0]);
+			return (EXIT_FAILURE);
+		}
+
+		/* only the pcap file is kept up to date */
+		opt.output_format_csv = 0;
+		opt.output_format_kismet_csv = 0;
+		opt.output_format_kismet_netxml = 0;
+		opt.output_format_log_csv = 0;
+		opt.output_format_events = 0;
+		lopt.background_mode = 1;
+	}
+
+	if (lopt.offline && (opt.s_file == NULL || lopt.relative_time))
+	{
+		printf("Notice: --offline needs an input file \"-r\" and can't be "
+			   "used with \"-T\"\n");
+		printf("\"%s --help\" for help.\n", argv[0]);
+		return (EXIT_FAILURE);
+	}
+
 	if (lopt.show_wps && lopt.show_manufacturer)
 		lopt.maxsize_essid_seen += lopt.maxsize_wps_seen;
 
@@ -6799,6 +8408,8 @@ int main(int argc, char * argv[])
 					"capture.\n");
 			return (EXIT_FAILURE);
 		}
+
+		if (lopt.offline) map_input_file();
 	}
 
 	/* open or create the output files */
@@ -6820,7 +8431,7 @@ int main(int argc, char * argv[])
 	/* fill oui struct if ram is greater than 32 MB */
 	if (get_ram_size() > MIN_RAM_SIZE_LOAD_OUI_RAM)
 	{
-		lopt.manufList = load_oui_file();
+		load_oui_file();
 	}
 
 	/* start the GPS tracker */
@@ -6837,12 +8448,13 @@ int main(int argc, char * argv[])
 		waitpid(-1, NULL, WNOHANG);
 	}
 
-	hide_cursor();
-	erase_display(2);
+	if (!lopt.capture_only)
+	{
+		hide_cursor();
+		erase_display(2);
+	}
 
 	start_time = time(NULL);
-	tt1 = time(NULL);
-	tt2 = time(NULL);
 	gettimeofday(&tv3, NULL);
 	gettimeofday(&tv4, NULL);
 
@@ -6878,56 +8490,45 @@ int main(int argc, char * argv[])
 		return (EXIT_FAILURE);
 	}
 
-	while (1)
-	{
-		if (lopt.do_exit)
-		{
-			break;
-		}
-
-		if (time(NULL) - tt1 >= lopt.file_write_interval)
-		{
-			/* update the text output files */
+	/* start the capture pipeline */
 
-			tt1 = time(NULL);
-			if (opt.output_format_csv)
-				dump_write_csv(lopt.ap_1st, lopt.st_1st, lopt.f_encrypt);
-			if (opt.output_format_kismet_csv)
-				dump_write_kismet_csv(lopt.ap_1st, lopt.st_1st, lopt.f_encrypt);
-			if (opt.output_format_kismet_netxml)
-				dump_write_kismet_netxml(lopt.ap_1st,
-										 lopt.st_1st,
-										 lopt.f_encrypt,
-										 lopt.airodump_start_time);
-		}
+	lopt.start_time = start_time;
 
-		if (time(NULL) - tt2 > 5)
-		{
-			if (lopt.sort_by != SORT_BY_NOTHING)
+	if (lopt.s_iface != NULL)
+		for (i = 0; i < lopt.num_cards; i++)
+			if (capture_start(i, wi[i]) != 0)
 			{
-				/* sort the APs by power */
-				ALLEGE(pthread_mutex_lock(&(lopt.mx_sort)) == 0);
-				dump_sort();
-				ALLEGE(pthread_mutex_unlock(&(lopt.mx_sort)) == 0);
+				perror("Could not start the capture threads");
+				return (EXIT_FAILURE);
 			}
 
-			/* update the battery state */
-			free(lopt.batt);
-			lopt.batt = NULL;
-
-			tt2 = time(NULL);
-			lopt.batt = getBatteryString();
-
-			/* update elapsed time */
-
-			free(lopt.elapsed_time);
-			lopt.elapsed_time = NULL;
-			lopt.elapsed_time = getStringTimeFromSec(difftime(tt2, start_time));
+	if (lopt.capture_only)
+	{
+		lopt.pcap.buf = (unsigned char *) malloc(PCAP_WRITE_SIZE);
+		if (lopt.pcap.buf == NULL
+			|| pthread_create(&(lopt.pcap.tid), NULL, &pcap_writer_thread, NULL)
+				   != 0)
+		{
+			perror("Could not start the pcap writer thread");
+			return (EXIT_FAILURE);
+		}
+	}
+	else if (pthread_create(&(lopt.display_tid), NULL, &display_thread, NULL)
+				 != 0
+			 || pthread_create(&(lopt.writer_tid), NULL, &writer_thread, NULL)
+					!= 0)
+	{
+		perror("pthread_create failed");
+		return (EXIT_FAILURE);
+	}
 
-			/* flush the output files */
+	gettimeofday(&tv_read, NULL);
 
-			if (opt.f_cap != NULL) fflush(opt.f_cap);
-			if (opt.f_ivs != NULL) fflush(opt.f_ivs);
+	while (1)
+	{
+		if (lopt.do_exit)
+		{
+			break;
 		}
 
 		gettimeofday(&tv1, NULL);
@@ -6948,7 +8549,9 @@ int main(int argc, char * argv[])
 		if (cycle_time > 500000)
 		{
 			gettimeofday(&tv3, NULL);
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 			update_rx_quality();
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
 			if (lopt.s_iface != NULL)
 			{
 				check_monitor(wi, fd_raw, &fdh, lopt.num_cards);
@@ -6957,179 +8560,49 @@ int main(int argc, char * argv[])
 			}
 		}
 
-		if (opt.s_file != NULL)
+		if (opt.s_file != NULL && lopt.offline)
 		{
-			static struct timeval prev_tv = {0, 0};
-
-			/* Read one packet */
-			n = sizeof(pkh);
-
-			if (fread(&pkh, (size_t) n, 1, lopt.f_cap_in) != 1)
-			{
-				memset(lopt.message, '\x00', sizeof(lopt.message));
-				snprintf(lopt.message,
-						 sizeof(lopt.message),
-						 "][ Finished reading input file %s.",
-						 opt.s_file);
-				opt.s_file = NULL;
-				continue;
-			}
-
-			if (lopt.pfh_in.magic == TCPDUMP_CIGAM)
-			{
-				SWAP32(pkh.caplen);
-				SWAP32(pkh.len);
-			}
+			/* parse a batch under a single hold of the lock, and hand it
+			   over as soon as the display or writer thread asks for it */
 
-			n = caplen = pkh.caplen;
-
-			memset(buffer, 0, sizeof(buffer));
-			h80211 = buffer;
-
-			if (n <= 0 || n > (int) sizeof(buffer))
-			{
-				memset(lopt.message, '\x00', sizeof(lopt.message));
-				snprintf(lopt.message,
-						 sizeof(lopt.message),
-						 "][ Finished reading input file %s.",
-						 opt.s_file);
-				opt.s_file = NULL;
-				continue;
-			}
-
-			if (fread(h80211, (size_t) n, 1, lopt.f_cap_in) != 1)
-			{
-				memset(lopt.message, '\x00', sizeof(lopt.message));
-				snprintf(lopt.message,
-						 sizeof(lopt.message),
-						 "][ Finished reading input file %s.",
-						 opt.s_file);
-				opt.s_file = NULL;
-				continue;
-			}
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
 
-			if (lopt.pfh_in.linktype == LINKTYPE_PRISM_HEADER)
+			for (batch = 0; batch < DRAIN_BATCH; batch++)
 			{
-				if (h80211[7] == 0x40)
-				{
-					n = 64;
-					ri.ri_power = -((int32_t) load32_le(h80211 + 0x33));
-					ri.ri_noise = (int32_t) load32_le(h80211 + 0x33 + 12);
-					ri.ri_rate = load32_le(h80211 + 0x33 + 24) * 500000;
-				}
-				else
+				ret = read_input_packet(
+					buffer, sizeof(buffer), &pkh, &ri, &caplen);
+				if (ret < 0)
 				{
-					n = load32_le(h80211 + 4);
-					ri.ri_mactime = load64_le(h80211 + 0x5C - 48);
-					ri.ri_channel = load32_le(h80211 + 0x5C - 36);
-					ri.ri_power = -((int32_t) load32_le(h80211 + 0x5C));
-					ri.ri_noise = (int32_t) load32_le(h80211 + 0x5C + 12);
-					ri.ri_rate = load32_le(h80211 + 0x5C + 24) * 500000;
+					input_finished();
+					lopt.do_exit = 1;
+					break;
 				}
+				if (ret == 0) continue;
 
-				if (n < 8 || n >= caplen) continue;
+				read_pkts++;
+				dump_add_packet(buffer, caplen, &ri, i, NULL);
 
-				memcpy(tmpbuf, h80211, (size_t) caplen);
-				caplen -= n;
-				memcpy(h80211, tmpbuf + n, (size_t) caplen);
+				if (__atomic_load_n(&(lopt.print_waiters), __ATOMIC_ACQUIRE))
+					break;
 			}
 
-			if (lopt.pfh_in.linktype == LINKTYPE_RADIOTAP_HDR)
-			{
-				/* remove the radiotap header */
-
-				n = load16_le(h80211 + 2);
-
-				if (n <= 0 || n >= caplen) continue;
-
-				int got_signal = 0;
-				int got_noise = 0;
-				struct ieee80211_radiotap_iterator iterator;
-				struct ieee80211_radiotap_header * rthdr;
-
-				rthdr = (struct ieee80211_radiotap_header *) h80211;
-
-				if (ieee80211_radiotap_iterator_init(
-						&iterator, rthdr, caplen, NULL)
-					< 0)
-					continue;
-
-				/* go through the radiotap arguments we have been given
-				 * by the driver
-				 */
-
-				while (ieee80211_radiotap_iterator_next(&iterator) >= 0)
-				{
-					switch (iterator.this_arg_index)
-					{
-						case IEEE80211_RADIOTAP_TSFT:
-							ri.ri_mactime = le64_to_cpu(
-								*((uint64_t *) iterator.this_arg));
-							break;
-
-						case IEEE80211_RADIOTAP_DBM_ANTSIGNAL:
-						case IEEE80211_RADIOTAP_DB_ANTSIGNAL:
-							if (!got_signal)
-							{
-								if (*iterator.this_arg < 127)
-									ri.ri_power = *iterator.this_arg;
-								else
-									ri.ri_power = *iterator.this_arg - 255;
-
-								got_signal = 1;
-							}
-							break;
-
-						case IEEE80211_RADIOTAP_DBM_ANTNOISE:
-						case IEEE80211_RADIOTAP_DB_ANTNOISE:
-							if (!got_noise)
-							{
-								if (*iterator.this_arg < 127)
-									ri.ri_noise = *iterator.this_arg;
-								else
-									ri.ri_noise = *iterator.this_arg - 255;
-
-								got_noise = 1;
-							}
-							break;
-
-						case IEEE80211_RADIOTAP_ANTENNA:
-							ri.ri_antenna = *iterator.this_arg;
-							break;
-
-						case IEEE80211_RADIOTAP_CHANNEL:
-							ri.ri_channel = getChannelFromFrequency(
-								le16toh(*(uint16_t *) iterator.this_arg));
-							break;
-
-						case IEEE80211_RADIOTAP_RATE:
-							ri.ri_rate = (*iterator.this_arg) * 500000;
-							break;
-					}
-				}
-
-				memcpy(tmpbuf, h80211, (size_t) caplen);
-				caplen -= n;
-				memcpy(h80211, tmpbuf + n, (size_t) caplen);
-			}
+			/* the waiters block on the mutex, and so does the next batch */
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
+		}
+		else if (opt.s_file != NULL)
+		{
+			static struct timeval prev_tv = {0, 0};
 
-			if (lopt.pfh_in.linktype == LINKTYPE_PPI_HDR)
+			ret = read_input_packet(
+				buffer, sizeof(buffer), &pkh, &ri, &caplen);
+			if (ret < 0)
 			{
-				/* remove the PPI header */
-
-				n = load16_le(h80211 + 2);
-
-				if (n <= 0 || n >= caplen) continue;
-
-				/* for a while Kismet logged broken PPI headers */
-				if (n == 24 && load16_le(h80211 + 8) == 2) n = 32;
-
-				if (n <= 0 || n >= caplen) continue; //-V560
-
-				memcpy(tmpbuf, h80211, (size_t) caplen);
-				caplen -= n;
-				memcpy(h80211, tmpbuf + n, (size_t) caplen);
+				input_finished();
+				continue;
 			}
+			if (ret == 0) continue;
+
+			h80211 = buffer;
 
 			read_pkts++;
 
@@ -7152,134 +8625,85 @@ int main(int argc, char * argv[])
 			// track the packet's timestamp
 			prev_tv.tv_sec = pkh.tv_sec;
 			prev_tv.tv_usec = pkh.tv_usec;
+
+			ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
+			dump_add_packet(h80211, caplen, &ri, i, NULL);
+			ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
 		}
 		else if (lopt.s_iface != NULL)
 		{
-			/* capture one packet */
-
-			FD_ZERO(&rfds);
-			for (i = 0; i < lopt.num_cards; i++)
-			{
-				FD_SET(fd_raw[i], &rfds); // NOLINT(hicpp-signed-bitwise)
-			}
-
-			tv0.tv_sec = lopt.update_s;
-			tv0.tv_usec = (lopt.update_s == 0) ? REFRESH_RATE : 0;
+			/* parse what the reader threads queued */
 
-			gettimeofday(&tv1, NULL);
+			queued = 0;
 
-			if (select(fdh + 1, &rfds, NULL, NULL, &tv0) < 0)
+			for (i = 0; i < lopt.num_cards; i++)
 			{
-				if (errno == EINTR)
+				if (lopt.capture_only)
 				{
-					gettimeofday(&tv2, NULL);
-
-					time_slept += 1000000UL * (tv2.tv_sec - tv1.tv_sec)
-								  + (tv2.tv_usec - tv1.tv_usec);
-
-					continue;
+					/* the pcap writer thread drains the rings */
+					nb_received = __atomic_load_n(&(lopt.rings[i].received),
+												  __ATOMIC_RELAXED);
+					if (nb_received != received[i]) wi_read_failed = 0;
+					received[i] = nb_received;
 				}
-				perror("select failed");
-
-				/* Restore terminal */
-				show_cursor();
-
-				return (EXIT_FAILURE);
-			}
-		}
-		else
-			usleep(1);
-
-		gettimeofday(&tv2, NULL);
-
-		time_slept += 1000000UL * (tv2.tv_sec - tv1.tv_sec)
-					  + (tv2.tv_usec - tv1.tv_usec);
-
-		if (time_slept > REFRESH_RATE && time_slept > lopt.update_s * 1000000)
-		{
-			time_slept = 0;
-
-			update_dataps();
-
-			/* update the window size */
-
-			if (ioctl(0, TIOCGWINSZ, &(lopt.ws)) < 0)
-			{
-				lopt.ws.ws_row = 25;
-				lopt.ws.ws_col = 80;
-			}
-
-			/* display the list of access points we have */
-
-			if (!lopt.do_pause && !lopt.background_mode)
-			{
-				ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
-
-				dump_print(lopt.ws.ws_row, lopt.ws.ws_col, lopt.num_cards);
-
-				ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
-			}
-			continue;
-		}
-
-		if (opt.s_file == NULL && lopt.s_iface != NULL)
-		{
-			for (i = 0; i < lopt.num_cards; i++)
-			{
-				if (FD_ISSET(fd_raw[i], &rfds)) // NOLINT(hicpp-signed-bitwise)
+				else
 				{
+					ALLEGE(pthread_mutex_lock(&(lopt.mx_print)) == 0);
+					if (capture_drain(&(lopt.rings[i]), DRAIN_BATCH) > 0)
+						wi_read_failed = 0;
+					ALLEGE(pthread_mutex_unlock(&(lopt.mx_print)) == 0);
 
-					memset(buffer, 0, sizeof(buffer));
-					h80211 = buffer;
-					if ((caplen = wi_read(
-							 wi[i], NULL, NULL, h80211, sizeof(buffer), &ri))
-						== -1)
+					if (capture_queued(&(lopt.rings[i])))
 					{
-						wi_read_failed++;
-						if (wi_read_failed > 1)
-						{
-							lopt.do_exit = 1;
-							break;
-						}
-						memset(lopt.message, '\x00', sizeof(lopt.message));
-						snprintf(lopt.message,
-								 sizeof(lopt.message),
-								 "][ interface %s down ",
-								 wi_get_ifname(wi[i]));
-
-						// reopen in monitor mode
+						queued = 1;
+						continue;
+					}
+				}
 
-						strlcpy(ifnam, wi_get_ifname(wi[i]), sizeof(ifnam));
+				if (!__atomic_load_n(&(lopt.rings[i].failed), __ATOMIC_ACQUIRE))
+					continue;
 
-						wi_close(wi[i]);
-						wi[i] = wi_open(ifnam);
-						if (!wi[i])
-						{
-							printf("Can't reopen %s\n", ifnam);
+				capture_stop(i);
 
-							/* Restore terminal */
-							show_cursor();
+				wi_read_failed++;
+				if (wi_read_failed > 1)
+				{
+					lopt.do_exit = 1;
+					break;
+				}
+				memset(lopt.message, '\x00', sizeof(lopt.message));
+				snprintf(lopt.message,
+						 sizeof(lopt.message),
+						 "][ interface %s down ",
+						 wi_get_ifname(wi[i]));
 
-							exit(EXIT_FAILURE);
-						}
+				// reopen in monitor mode
 
-						fd_raw[i] = wi_fd(wi[i]);
-						if (fd_raw[i] > fdh) fdh = fd_raw[i];
+				strlcpy(ifnam, wi_get_ifname(wi[i]), sizeof(ifnam));
 
-						break;
-					}
+				wi_close(wi[i]);
+				wi[i] = wi_open(ifnam);
+				if (!wi[i] || capture_start(i, wi[i]) != 0)
+				{
+					printf("Can't reopen %s\n", ifnam);
 
-					read_pkts++;
+					/* Restore terminal */
+					show_cursor();
 
-					wi_read_failed = 0;
-					dump_add_packet(h80211, caplen, &ri, i);
+					exit(EXIT_FAILURE);
 				}
+
+				fd_raw[i] = wi_fd(wi[i]);
+				if (fd_raw[i] > fdh) fdh = fd_raw[i];
 			}
+
+			if (lopt.capture_only)
+				usleep(REFRESH_RATE);
+			else if (!queued)
+				capture_wait(REFRESH_RATE);
 		}
-		else if (opt.s_file != NULL)
-		{
-			dump_add_packet(h80211, caplen, &ri, i);
-		}
+		else
+			usleep(1);
 
 		if (quitting && time(NULL) - quitting_event_ts > 3)
 		{
@@ -7289,6 +8713,33 @@ int main(int argc, char * argv[])
 		}
 	}
 
+	lopt.do_exit = 1;
+
+	gettimeofday(&tv1, NULL);
+	unmap_input_file();
+
+	for (i = 0; i < lopt.num_cards; i++) capture_stop(i);
+
+	if (lopt.capture_only)
+	{
+		/* let the pcap writer empty the rings */
+		__atomic_store_n(&(lopt.pcap.stop), 1, __ATOMIC_RELEASE);
+		pthread_join(lopt.pcap.tid, NULL);
+
+		if (lopt.pcap.nw_index.slots != NULL)
+			for (i = 0; i <= (int) lopt.pcap.nw_index.mask; i++)
+				free(lopt.pcap.nw_index.slots[i].item);
+		mac_table_free(&(lopt.pcap.nw_index));
+		free(lopt.pcap.buf);
+	}
+	else
+	{
+		pthread_join(lopt.display_tid, NULL);
+		pthread_join(lopt.writer_tid, NULL);
+	}
+
+	for (i = 0; i < lopt.num_cards; i++) free(lopt.rings[i].buf);
+
 	if (lopt.batt) free(lopt.batt);
 
 	if (lopt.elapsed_time) free(lopt.elapsed_time);
@@ -7311,30 +8762,31 @@ int main(int argc, char * argv[])
 
 	if (opt.record_data)
 	{
-		if (opt.output_format_csv)
-			dump_write_csv(lopt.ap_1st, lopt.st_1st, lopt.f_encrypt);
-		if (opt.output_format_kismet_csv)
-			dump_write_kismet_csv(lopt.ap_1st, lopt.st_1st, lopt.f_encrypt);
-		if (opt.output_format_kismet_netxml)
-			dump_write_kismet_netxml(lopt.ap_1st,
-									 lopt.st_1st,
-									 lopt.f_encrypt,
-									 lopt.airodump_start_time);
-
-		if (opt.output_format_csv && opt.f_txt != NULL) fclose(opt.f_txt);
-		if (opt.output_format_kismet_csv && opt.f_kis != NULL)
-			fclose(opt.f_kis);
-		if (opt.output_format_kismet_netxml && opt.f_kis_xml != NULL)
-		{
-			fclose(opt.f_kis_xml);
-			free(lopt.airodump_start_time);
-		}
+		/* the last files honor the retention limits too */
+		evict_records(time(NULL));
+
+		dump_write_text_files(lopt.ap_1st,
+							  lopt.st_1st,
+							  lopt.f_encrypt,
+							  lopt.airodump_start_time,
+							  time(NULL) - lopt.berlin,
+							  &text);
+		dump_save_text_files(&text);
+
+		free(lopt.airodump_start_time);
 		if (opt.f_gps != NULL) fclose(opt.f_gps);
 		if (opt.output_format_pcap && opt.f_cap != NULL) fclose(opt.f_cap);
 		if (opt.f_ivs != NULL) fclose(opt.f_ivs);
 		if (opt.f_logcsv != NULL) fclose(opt.f_logcsv);
+		if (opt.f_events != NULL) fclose(opt.f_events);
 	}
 
+	if (opt.f_txt_name) free(opt.f_txt_name);
+
+	if (opt.f_kis_name) free(opt.f_kis_name);
+
+	if (opt.f_kis_xml_name) free(opt.f_kis_xml_name);
+
 	if (!lopt.save_gps)
 	{
 		snprintf((char *) buffer, 4096, "%s-%02d.gps", argv[2], opt.f_index);
@@ -7362,8 +8814,6 @@ int main(int argc, char * argv[])
 
 		list_tail_free(&(ap_cur->packets));
 
-		if (lopt.manufList) free(ap_cur->manuf);
-
 		if (lopt.detect_anomaly) data_wipe(ap_cur->data_root);
 
 		ap_cur = ap_cur->next;
@@ -7375,7 +8825,8 @@ int main(int argc, char * argv[])
 	{
 		// Freeing AP List
 		ap_next = ap_cur->next;
-		free(ap_cur);
+		dump_write_forget(ap_cur->text);
+		slab_free(&lopt.ap_pool, ap_cur);
 		ap_cur = ap_next;
 	}
 
@@ -7384,8 +8835,8 @@ int main(int argc, char * argv[])
 	while (st_cur != NULL)
 	{
 		st_next = st_cur->next;
-		if (lopt.manufList) free(st_cur->manuf);
-		free(st_cur);
+		dump_write_forget(st_cur->text);
+		slab_free(&lopt.st_pool, st_cur);
 		st_cur = st_next;
 	}
 
@@ -7394,23 +8845,42 @@ int main(int argc, char * argv[])
 	while (na_cur != NULL)
 	{
 		na_next = na_cur->next;
-		free(na_cur);
+		slab_free(&lopt.na_pool, na_cur);
 		na_cur = na_next;
 	}
 
-	if (lopt.manufList)
-	{
-		oui_cur = lopt.manufList;
-		while (oui_cur != NULL)
-		{
-			oui_next = oui_cur->next;
-			free(oui_cur);
-			oui_cur = oui_next;
-		}
-	}
+	mac_table_free(&lopt.ap_index);
+	mac_table_free(&lopt.st_index);
+	mac_table_free(&lopt.na_index);
+	free(lopt.sort_buf);
+
+	slab_pool_free(&lopt.ap_pool);
+	slab_pool_free(&lopt.st_pool);
+	slab_pool_free(&lopt.na_pool);
+	slab_pool_free(&lopt.pkt_pool);
+
+	free_oui_list();
 
 	reset_term();
 	show_cursor();
 
+	if (lopt.s_iface != NULL && !lopt.capture_only)
+	{
+		capture_counters(&nb_received, &nb_dropped);
+
+		printf("Received %lu frames, dropped %lu.\n", nb_received, nb_dropped);
+	}
+
+	if (lopt.offline)
+	{
+		double secs = (double) (tv1.tv_sec - tv_read.tv_sec)
+					  + (double) (tv1.tv_usec - tv_read.tv_usec) / 1000000.0;
+
+		printf("Read %lu frames in %.2f seconds (%.0f frames/s).\n",
+			   read_pkts,
+			   secs,
+			   (secs > 0) ? (double) read_pkts / secs : 0.0);
+	}
+
 	return (EXIT_SUCCESS);
 }
@@ -37,8 +37,11 @@
 #include <sys/termios.h>
 #endif
 
+#include <pthread.h>
+
 #include "aircrack-ng/third-party/eapol.h"
 #include "aircrack-ng/support/pcap_local.h"
+#include "aircrack-ng/osdep/osdep.h"
 
 /* some constants */
 
@@ -50,6 +53,12 @@
 
 #define MAX_CARDS 8 /* maximum number of cards to capture from */
 
+#define READ_BATCH 64 /* frames read from a card at once */
+#define CAPTURE_RING_SIZE (4 * 1024 * 1024) /* bytes queued per card */
+#define DRAIN_BATCH 256 /* frames parsed per hold of the list lock */
+#define PCAP_WRITE_SIZE (1024 * 1024) /* pcap bytes written at once */
+#define STATS_INTERVAL 10 /* default delay in s between capture counters */
+
 #define STD_OPN 0x0001u
 #define STD_WEP 0x0002u
 #define STD_WPA 0x0004u
@@ -125,15 +134,12 @@ struct pkt_buf
 	struct timeval ctime; /* capture time */
 };
 
-/* oui struct for list management */
+/* manufacturer of an OUI, kept in an array sorted by id */
 struct oui
 {
-	char id[9]; /* TODO: Don't use ASCII chars to compare, use unsigned char[3]
-				   (later) with the value (hex ascii will have to be converted)
-				   */
-	char
-		manuf[128]; /* TODO: Switch to a char * later to improve memory usage */
-	struct oui * next;
+	uint32_t id; /* first three bytes of the MAC */
+	uint32_t order; /* line in the OUI file          */
+	char * manuf; /* manufacturer, NULL if unknown */
 };
 
 #include "aircrack-ng/support/station.h"
@@ -156,6 +162,92 @@ struct NA_info
 	int rts_t; /* number of RTS frames (tx) */
 	int other; /* number of other frames    */
 	struct timeval tv; /* time for ack per second   */
+	int evicted; /* dropped by the retention sweep */
+};
+
+/* open addressing hash table indexing AP, ST and NA entries by MAC */
+
+struct mac_slot
+{
+	unsigned char mac[6]; /* key, copied to avoid a dereference */
+	void * item; /* indexed entry, NULL when free */
+};
+
+struct mac_table
+{
+	struct mac_slot * slots; /* power of two sized array  */
+	size_t mask; /* number of slots - 1       */
+	size_t used; /* number of indexed entries */
+};
+
+/*
+ * Fixed size objects carved out of large slabs. Freed objects go back on a
+ * free list and are handed out again, so that a capture which keeps dropping
+ * old records stays at the footprint of its busiest moment.
+ */
+struct slab_pool
+{
+	size_t size; /* object size, rounded up    */
+	size_t per_slab; /* objects in each slab       */
+	void * slabs; /* chained by their 1st word  */
+	void * free_list; /* chained by their 1st word  */
+	size_t used; /* objects handed out         */
+};
+
+/*
+ * Frames read by the reader thread of a card, waiting to be parsed by the
+ * main thread (or the pcap writer thread in capture-only mode). It is a
+ * single producer, single consumer ring of variable sized records: head is
+ * only moved by the reader, tail by the consumer.
+ */
+
+struct capture_record
+{
+	struct timeval tv; /* when the frame was read                  */
+	int len; /* frame length, -1 for padding up to the end */
+	struct rx_info ri; /* as returned by wi_read_batch()           */
+	/* followed by the frame, padded to a multiple of 8 bytes */
+};
+
+struct capture_ring
+{
+	unsigned char * buf; /* CAPTURE_RING_SIZE bytes         */
+	size_t head; /* bytes ever queued               */
+	size_t tail; /* bytes ever parsed               */
+	unsigned long received; /* frames read from the card       */
+	unsigned long dropped; /* frames that were not queued     */
+	struct wif * wi; /* card read by the thread         */
+	pthread_mutex_t mx_card; /* serializes the calls to wi      */
+	int card; /* its index                       */
+	pthread_t tid;
+	int running; /* the reader thread was started   */
+	int stop; /* asks the reader thread to quit  */
+	int failed; /* the reader quit on a read error */
+};
+
+/* capture-only mode: frames go from the rings straight to the pcap file */
+
+struct NW_info
+{
+	unsigned char bssid[6]; /* network seen in a beacon or EAPOL frame */
+	char essid[ESSID_LENGTH + 1]; /* from its first beacon              */
+	int eapol; /* an EAPOL frame was reported           */
+	int pmkid; /* a PMKID was reported                  */
+};
+
+struct pcap_writer
+{
+	unsigned char * buf; /* PCAP_WRITE_SIZE bytes of pcap records */
+	size_t len; /* bytes buffered                        */
+	unsigned long frames; /* frames buffered                       */
+	unsigned long written; /* frames written to the pcap file       */
+	unsigned long failed; /* frames lost to write errors           */
+	unsigned long beacons; /* beacon frames                         */
+	unsigned long eapol; /* EAPOL frames                          */
+	unsigned long pmkid; /* EAPOL frames carrying a PMKID         */
+	struct mac_table nw_index; /* networks, by BSSID                    */
+	pthread_t tid;
+	int stop; /* the readers stopped, write the rest   */
 };
 
 #endif
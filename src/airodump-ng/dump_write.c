@@ -128,50 +128,248 @@ static char * format_text_for_csv(const unsigned char * input, size_t len)
 	return (rret) ? (rret) : (ret);
 }
 
-int dump_write_csv(struct AP_info * ap_1st,
-				   struct ST_info * st_1st,
-				   unsigned int f_encrypt)
+/* Every AP and station keeps its last serialization in each text format,
+   which is only rebuilt once the record has been updated: a snapshot then
+   mostly copies cached text instead of formatting every record again. */
+
+FILE * text_record_open(struct text_record * tr)
 {
-	int i, probes_written;
+	FILE * f;
+
+#ifdef HAVE_OPEN_MEMSTREAM
+	f = open_memstream(&tr->text, &tr->len);
+#else
+	UNUSED_PARAM(tr);
+	f = tmpfile();
+#endif
+	ALLEGE(f != NULL);
+
+	return (f);
+}
+
+void text_record_close(FILE * f, struct text_record * tr)
+{
+#ifdef HAVE_OPEN_MEMSTREAM
+	ALLEGE(fclose(f) == 0);
+#else
+	long len = ftell(f);
+
+	ALLEGE(len >= 0);
+	tr->len = (size_t) len;
+	tr->text = (char *) malloc(tr->len + 1);
+	ALLEGE(tr->text != NULL);
+	rewind(f);
+	ALLEGE(fread(tr->text, 1, tr->len, f) == tr->len);
+	tr->text[tr->len] = '\0';
+	fclose(f);
+#endif
+}
+
+static void text_put(FILE * f, const struct text_record * tr)
+{
+	if (tr->len > 0) fwrite(tr->text, 1, tr->len, f);
+}
+
+void dump_write_forget(struct text_record * text)
+{
+	int i;
+
+	for (i = 0; i < NB_TEXT_FORMATS; i++)
+	{
+		free(text[i].text);
+		text[i].text = NULL;
+		text[i].len = 0;
+	}
+}
+
+/* Whether the AP passes the filters of the text output files. */
+static int is_written_ap(struct AP_info * ap_cur, unsigned int f_encrypt)
+{
+	if (memcmp(ap_cur->bssid, BROADCAST, 6) == 0) return (0);
+
+	if (ap_cur->security != 0 && f_encrypt != 0
+		&& ((ap_cur->security & f_encrypt) == 0))
+		return (0);
+
+	return (!is_filtered_essid(ap_cur->essid));
+}
+
+static void csv_print_ap(FILE * f, struct AP_info * ap_cur)
+{
+	int i;
 	struct tm * ltime;
-	struct AP_info * ap_cur;
-	struct ST_info * st_cur;
 	char * temp;
 
-	if (!opt.record_data || !opt.output_format_csv) return (0);
+	fprintf(f,
+			"%02X:%02X:%02X:%02X:%02X:%02X, ",
+			ap_cur->bssid[0],
+			ap_cur->bssid[1],
+			ap_cur->bssid[2],
+			ap_cur->bssid[3],
+			ap_cur->bssid[4],
+			ap_cur->bssid[5]);
 
-	fseek(opt.f_txt, 0, SEEK_SET);
+	ltime = localtime(&ap_cur->tinit);
 
-	fprintf(opt.f_txt,
-			"\r\nBSSID, First time seen, Last time seen, channel, Speed, "
-			"Privacy, Cipher, Authentication, Power, # beacons, # IV, LAN IP, "
-			"ID-length, ESSID, Key\r\n");
+	fprintf(f,
+			"%04d-%02d-%02d %02d:%02d:%02d, ",
+			1900 + ltime->tm_year,
+			1 + ltime->tm_mon,
+			ltime->tm_mday,
+			ltime->tm_hour,
+			ltime->tm_min,
+			ltime->tm_sec);
 
-	ap_cur = ap_1st;
+	ltime = localtime(&ap_cur->tlast);
 
-	while (ap_cur != NULL)
+	fprintf(f,
+			"%04d-%02d-%02d %02d:%02d:%02d, ",
+			1900 + ltime->tm_year,
+			1 + ltime->tm_mon,
+			ltime->tm_mday,
+			ltime->tm_hour,
+			ltime->tm_min,
+			ltime->tm_sec);
+
+	fprintf(f, "%2d, %3d,", ap_cur->channel, ap_cur->max_speed);
+
+	if ((ap_cur->security
+		 & (STD_OPN | STD_WEP | STD_WPA | STD_WPA2 | AUTH_SAE | AUTH_OWE))
+		== 0)
+		fprintf(f, " ");
+	else
 	{
-		if (memcmp(ap_cur->bssid, BROADCAST, 6) == 0)
+		if (ap_cur->security & STD_WPA2)
 		{
-			ap_cur = ap_cur->next;
-			continue;
+			if (ap_cur->security & AUTH_SAE || ap_cur->security & AUTH_OWE)
+				fprintf(f, " WPA3");
+			fprintf(f, " WPA2");
+		}
+		if (ap_cur->security & STD_WPA) fprintf(f, " WPA");
+		if (ap_cur->security & STD_WEP) fprintf(f, " WEP");
+		if (ap_cur->security & STD_OPN) fprintf(f, " OPN");
+	}
+
+	fprintf(f, ",");
+
+	if ((ap_cur->security & ENC_FIELD) == 0)
+		fprintf(f, " ");
+	else
+	{
+		if (ap_cur->security & ENC_CCMP) fprintf(f, " CCMP");
+		if (ap_cur->security & ENC_WRAP) fprintf(f, " WRAP");
+		if (ap_cur->security & ENC_TKIP) fprintf(f, " TKIP");
+		if (ap_cur->security & ENC_WEP104) fprintf(f, " WEP104");
+		if (ap_cur->security & ENC_WEP40) fprintf(f, " WEP40");
+		if (ap_cur->security & ENC_WEP) fprintf(f, " WEP");
+		if (ap_cur->security & ENC_GCMP) fprintf(f, " GCMP");
+		if (ap_cur->security & ENC_GMAC) fprintf(f, " GMAC");
+	}
+
+	fprintf(f, ",");
+
+	if ((ap_cur->security & AUTH_FIELD) == 0)
+		fprintf(f, "   ");
+	else
+	{
+		if (ap_cur->security & AUTH_SAE) fprintf(f, " SAE");
+		if (ap_cur->security & AUTH_MGT) fprintf(f, " MGT");
+		if (ap_cur->security & AUTH_CMAC) fprintf(f, " CMAC");
+		if (ap_cur->security & AUTH_PSK)
+		{
+			if (ap_cur->security & STD_WEP)
+				fprintf(f, " SKA");
+			else
+				fprintf(f, " PSK");
 		}
+		if (ap_cur->security & AUTH_OWE) fprintf(f, " OWE");
+		if (ap_cur->security & AUTH_OPN) fprintf(f, " OPN");
+	}
+
+	fprintf(f,
+			", %3d, %8lu, %8lu, ",
+			ap_cur->avg_power,
+			ap_cur->nb_bcn,
+			ap_cur->nb_data);
+
+	fprintf(f,
+			"%3d.%3d.%3d.%3d, ",
+			ap_cur->lanip[0],
+			ap_cur->lanip[1],
+			ap_cur->lanip[2],
+			ap_cur->lanip[3]);
 
-		if (ap_cur->security != 0 && f_encrypt != 0
-			&& ((ap_cur->security & f_encrypt) == 0))
+	fprintf(f, "%3d, ", ap_cur->ssid_length);
+
+	if (verifyssid(ap_cur->essid))
+		fprintf(f, "%s, ", ap_cur->essid);
+	else
+	{
+		temp = format_text_for_csv(ap_cur->essid, (size_t) ap_cur->ssid_length);
+		if (temp != NULL) //-V547
 		{
-			ap_cur = ap_cur->next;
-			continue;
+			fprintf(f, "%s, ", temp);
+			free(temp);
 		}
+	}
 
-		if (is_filtered_essid(ap_cur->essid))
+	if (ap_cur->key != NULL)
+	{
+		for (i = 0; i < (int) strlen(ap_cur->key); i++)
 		{
-			ap_cur = ap_cur->next;
-			continue;
+			fprintf(f, "%02X", ap_cur->key[i]);
+			if (i < (int) (strlen(ap_cur->key) - 1)) fprintf(f, ":");
 		}
+	}
 
-		fprintf(opt.f_txt,
-				"%02X:%02X:%02X:%02X:%02X:%02X, ",
+	fprintf(f, "\r\n");
+}
+
+static void csv_print_st(FILE * f, struct ST_info * st_cur)
+{
+	int i, probes_written;
+	struct tm * ltime;
+	struct AP_info * ap_cur = st_cur->base;
+	char * temp;
+
+	fprintf(f,
+			"%02X:%02X:%02X:%02X:%02X:%02X, ",
+			st_cur->stmac[0],
+			st_cur->stmac[1],
+			st_cur->stmac[2],
+			st_cur->stmac[3],
+			st_cur->stmac[4],
+			st_cur->stmac[5]);
+
+	ltime = localtime(&st_cur->tinit);
+
+	fprintf(f,
+			"%04d-%02d-%02d %02d:%02d:%02d, ",
+			1900 + ltime->tm_year,
+			1 + ltime->tm_mon,
+			ltime->tm_mday,
+			ltime->tm_hour,
+			ltime->tm_min,
+			ltime->tm_sec);
+
+	ltime = localtime(&st_cur->tlast);
+
+	fprintf(f,
+			"%04d-%02d-%02d %02d:%02d:%02d, ",
+			1900 + ltime->tm_year,
+			1 + ltime->tm_mon,
+			ltime->tm_mday,
+			ltime->tm_hour,
+			ltime->tm_min,
+			ltime->tm_sec);
+
+	fprintf(f, "%3d, %8lu, ", st_cur->power, st_cur->nb_pkt);
+
+	if (!memcmp(ap_cur->bssid, BROADCAST, 6))
+		fprintf(f, "(not associated) ,");
+	else
+		fprintf(f,
+				"%02X:%02X:%02X:%02X:%02X:%02X,",
 				ap_cur->bssid[0],
 				ap_cur->bssid[1],
 				ap_cur->bssid[2],
@@ -179,228 +377,88 @@ int dump_write_csv(struct AP_info * ap_1st,
 				ap_cur->bssid[4],
 				ap_cur->bssid[5]);
 
-		ltime = localtime(&ap_cur->tinit);
-
-		fprintf(opt.f_txt,
-				"%04d-%02d-%02d %02d:%02d:%02d, ",
-				1900 + ltime->tm_year,
-				1 + ltime->tm_mon,
-				ltime->tm_mday,
-				ltime->tm_hour,
-				ltime->tm_min,
-				ltime->tm_sec);
-
-		ltime = localtime(&ap_cur->tlast);
-
-		fprintf(opt.f_txt,
-				"%04d-%02d-%02d %02d:%02d:%02d, ",
-				1900 + ltime->tm_year,
-				1 + ltime->tm_mon,
-				ltime->tm_mday,
-				ltime->tm_hour,
-				ltime->tm_min,
-				ltime->tm_sec);
-
-		fprintf(opt.f_txt, "%2d, %3d,", ap_cur->channel, ap_cur->max_speed);
-
-		if ((ap_cur->security
-			 & (STD_OPN | STD_WEP | STD_WPA | STD_WPA2 | AUTH_SAE | AUTH_OWE))
-			== 0)
-			fprintf(opt.f_txt, " ");
-		else
+	probes_written = 0;
+	for (i = 0; i < NB_PRB; i++)
+	{
+		if (st_cur->ssid_length[i] == 0) continue;
+
+		if (verifyssid((const unsigned char *) st_cur->probes[i]))
 		{
-			if (ap_cur->security & STD_WPA2)
-			{
-				if (ap_cur->security & AUTH_SAE || ap_cur->security & AUTH_OWE)
-					fprintf(opt.f_txt, " WPA3");
-				fprintf(opt.f_txt, " WPA2");
-			}
-			if (ap_cur->security & STD_WPA) fprintf(opt.f_txt, " WPA");
-			if (ap_cur->security & STD_WEP) fprintf(opt.f_txt, " WEP");
-			if (ap_cur->security & STD_OPN) fprintf(opt.f_txt, " OPN");
+			temp = (char *) calloc(
+				1, (st_cur->ssid_length[i] + 1) * sizeof(char));
+			ALLEGE(temp != NULL);
+			memcpy(temp, st_cur->probes[i], st_cur->ssid_length[i] + 1u);
 		}
-
-		fprintf(opt.f_txt, ",");
-
-		if ((ap_cur->security & ENC_FIELD) == 0)
-			fprintf(opt.f_txt, " ");
 		else
 		{
-			if (ap_cur->security & ENC_CCMP) fprintf(opt.f_txt, " CCMP");
-			if (ap_cur->security & ENC_WRAP) fprintf(opt.f_txt, " WRAP");
-			if (ap_cur->security & ENC_TKIP) fprintf(opt.f_txt, " TKIP");
-			if (ap_cur->security & ENC_WEP104) fprintf(opt.f_txt, " WEP104");
-			if (ap_cur->security & ENC_WEP40) fprintf(opt.f_txt, " WEP40");
-			if (ap_cur->security & ENC_WEP) fprintf(opt.f_txt, " WEP");
-			if (ap_cur->security & ENC_GCMP) fprintf(opt.f_txt, " GCMP");
-			if (ap_cur->security & ENC_GMAC) fprintf(opt.f_txt, " GMAC");
+			temp = format_text_for_csv((unsigned char *) st_cur->probes[i],
+									   (size_t) st_cur->ssid_length[i]);
+			ALLEGE(temp != NULL); //-V547
 		}
 
-		fprintf(opt.f_txt, ",");
-
-		if ((ap_cur->security & AUTH_FIELD) == 0)
-			fprintf(opt.f_txt, "   ");
+		if (probes_written == 0)
+		{
+			fprintf(f, "%s", temp);
+			probes_written = 1;
+		}
 		else
 		{
-			if (ap_cur->security & AUTH_SAE) fprintf(opt.f_txt, " SAE");
-			if (ap_cur->security & AUTH_MGT) fprintf(opt.f_txt, " MGT");
-			if (ap_cur->security & AUTH_CMAC) fprintf(opt.f_txt, " CMAC");
-			if (ap_cur->security & AUTH_PSK)
-			{
-				if (ap_cur->security & STD_WEP)
-					fprintf(opt.f_txt, " SKA");
-				else
-					fprintf(opt.f_txt, " PSK");
-			}
-			if (ap_cur->security & AUTH_OWE) fprintf(opt.f_txt, " OWE");
-			if (ap_cur->security & AUTH_OPN) fprintf(opt.f_txt, " OPN");
+			fprintf(f, ",%s", temp);
 		}
 
-		fprintf(opt.f_txt,
-				", %3d, %8lu, %8lu, ",
-				ap_cur->avg_power,
-				ap_cur->nb_bcn,
-				ap_cur->nb_data);
+		free(temp);
+	}
 
-		fprintf(opt.f_txt,
-				"%3d.%3d.%3d.%3d, ",
-				ap_cur->lanip[0],
-				ap_cur->lanip[1],
-				ap_cur->lanip[2],
-				ap_cur->lanip[3]);
+	fprintf(f, "\r\n");
+}
 
-		fprintf(opt.f_txt, "%3d, ", ap_cur->ssid_length);
+static void dump_write_csv(FILE * out,
+						   struct AP_info * ap_1st,
+						   struct ST_info * st_1st,
+						   unsigned int f_encrypt)
+{
+	struct AP_info * ap_cur;
+	struct ST_info * st_cur;
+	FILE * f;
 
-		if (verifyssid(ap_cur->essid))
-			fprintf(opt.f_txt, "%s, ", ap_cur->essid);
-		else
-		{
-			temp = format_text_for_csv(ap_cur->essid,
-									   (size_t) ap_cur->ssid_length);
-			if (temp != NULL) //-V547
-			{
-				fprintf(opt.f_txt, "%s, ", temp);
-				free(temp);
-			}
-		}
+	fprintf(out,
+			"\r\nBSSID, First time seen, Last time seen, channel, Speed, "
+			"Privacy, Cipher, Authentication, Power, # beacons, # IV, LAN IP, "
+			"ID-length, ESSID, Key\r\n");
+
+	for (ap_cur = ap_1st; ap_cur != NULL; ap_cur = ap_cur->next)
+	{
+		if (!is_written_ap(ap_cur, f_encrypt)) continue;
 
-		if (ap_cur->key != NULL)
+		if (ap_cur->text[TEXT_CSV].text == NULL)
 		{
-			for (i = 0; i < (int) strlen(ap_cur->key); i++)
-			{
-				fprintf(opt.f_txt, "%02X", ap_cur->key[i]);
-				if (i < (int) (strlen(ap_cur->key) - 1))
-					fprintf(opt.f_txt, ":");
-			}
+			f = text_record_open(&ap_cur->text[TEXT_CSV]);
+			csv_print_ap(f, ap_cur);
+			text_record_close(f, &ap_cur->text[TEXT_CSV]);
 		}
 
-		fprintf(opt.f_txt, "\r\n");
-
-		ap_cur = ap_cur->next;
+		text_put(out, &ap_cur->text[TEXT_CSV]);
 	}
 
-	fprintf(opt.f_txt,
+	fprintf(out,
 			"\r\nStation MAC, First time seen, Last time seen, "
 			"Power, # packets, BSSID, Probed ESSIDs\r\n");
 
-	st_cur = st_1st;
-
-	while (st_cur != NULL)
+	for (st_cur = st_1st; st_cur != NULL; st_cur = st_cur->next)
 	{
-		ap_cur = st_cur->base;
+		if (st_cur->base->nb_pkt < 2) continue;
 
-		if (ap_cur->nb_pkt < 2)
+		if (st_cur->text[TEXT_CSV].text == NULL)
 		{
-			st_cur = st_cur->next;
-			continue;
+			f = text_record_open(&st_cur->text[TEXT_CSV]);
+			csv_print_st(f, st_cur);
+			text_record_close(f, &st_cur->text[TEXT_CSV]);
 		}
 
-		fprintf(opt.f_txt,
-				"%02X:%02X:%02X:%02X:%02X:%02X, ",
-				st_cur->stmac[0],
-				st_cur->stmac[1],
-				st_cur->stmac[2],
-				st_cur->stmac[3],
-				st_cur->stmac[4],
-				st_cur->stmac[5]);
-
-		ltime = localtime(&st_cur->tinit);
-
-		fprintf(opt.f_txt,
-				"%04d-%02d-%02d %02d:%02d:%02d, ",
-				1900 + ltime->tm_year,
-				1 + ltime->tm_mon,
-				ltime->tm_mday,
-				ltime->tm_hour,
-				ltime->tm_min,
-				ltime->tm_sec);
-
-		ltime = localtime(&st_cur->tlast);
-
-		fprintf(opt.f_txt,
-				"%04d-%02d-%02d %02d:%02d:%02d, ",
-				1900 + ltime->tm_year,
-				1 + ltime->tm_mon,
-				ltime->tm_mday,
-				ltime->tm_hour,
-				ltime->tm_min,
-				ltime->tm_sec);
-
-		fprintf(opt.f_txt, "%3d, %8lu, ", st_cur->power, st_cur->nb_pkt);
-
-		if (!memcmp(ap_cur->bssid, BROADCAST, 6))
-			fprintf(opt.f_txt, "(not associated) ,");
-		else
-			fprintf(opt.f_txt,
-					"%02X:%02X:%02X:%02X:%02X:%02X,",
-					ap_cur->bssid[0],
-					ap_cur->bssid[1],
-					ap_cur->bssid[2],
-					ap_cur->bssid[3],
-					ap_cur->bssid[4],
-					ap_cur->bssid[5]);
-
-		probes_written = 0;
-		for (i = 0; i < NB_PRB; i++)
-		{
-			if (st_cur->ssid_length[i] == 0) continue;
-
-			if (verifyssid((const unsigned char *) st_cur->probes[i]))
-			{
-				temp = (char *) calloc(
-					1, (st_cur->ssid_length[i] + 1) * sizeof(char));
-				ALLEGE(temp != NULL);
-				memcpy(temp, st_cur->probes[i], st_cur->ssid_length[i] + 1u);
-			}
-			else
-			{
-				temp = format_text_for_csv((unsigned char *) st_cur->probes[i],
-										   (size_t) st_cur->ssid_length[i]);
-				ALLEGE(temp != NULL); //-V547
-			}
-
-			if (probes_written == 0)
-			{
-				fprintf(opt.f_txt, "%s", temp);
-				probes_written = 1;
-			}
-			else
-			{
-				fprintf(opt.f_txt, ",%s", temp);
-			}
-
-			free(temp);
-		}
-
-		fprintf(opt.f_txt, "\r\n");
-
-		st_cur = st_cur->next;
+		text_put(out, &st_cur->text[TEXT_CSV]);
 	}
 
-	fprintf(opt.f_txt, "\r\n");
-	fflush(opt.f_txt);
-
-	return (0);
+	fprintf(out, "\r\n");
 }
 
 int dump_write_airodump_ng_logcsv_add_ap(const struct AP_info * ap_cur,
@@ -665,7 +723,8 @@ char * get_manufacturer_from_string(char * buffer)
 #define KISMET_NETXML_TRAILER "</detection-run>"
 
 #define TIME_STR_LENGTH 255
-static int dump_write_kismet_netxml_client_info(struct ST_info * client,
+static int dump_write_kismet_netxml_client_info(FILE * f,
+												struct ST_info * client,
 												int client_no)
 {
 	char first_time[TIME_STR_LENGTH];
@@ -689,7 +748,7 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 	strncpy(last_time, ctime(&client->tlast), TIME_STR_LENGTH - 1);
 	last_time[strlen(last_time) - 1] = 0; // remove new line
 
-	fprintf(opt.f_kis_xml,
+	fprintf(f,
 			"\t\t<wireless-client number=\"%d\" "
 			"type=\"%s\" first-time=\"%s\""
 			" last-time=\"%s\">\n",
@@ -698,7 +757,7 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 			first_time,
 			last_time);
 
-	fprintf(opt.f_kis_xml,
+	fprintf(f,
 			"\t\t\t<client-mac>%02X:%02X:%02X:%02X:%02X:%02X</client-mac>\n",
 			client->stmac[0],
 			client->stmac[1],
@@ -710,7 +769,7 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 	/* Manufacturer, if set using standard oui list */
 	manuf
 		= sanitize_xml((unsigned char *) client->manuf, strlen(client->manuf));
-	fprintf(opt.f_kis_xml,
+	fprintf(f,
 			"\t\t\t<client-manuf>%s</client-manuf>\n",
 			(manuf != NULL) ? manuf : "Unknown");
 	free(manuf);
@@ -721,11 +780,11 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 	{
 		if (client->probes[i][0] == '\0') continue;
 
-		fprintf(opt.f_kis_xml,
+		fprintf(f,
 				"\t\t\t<SSID first-time=\"%s\" last-time=\"%s\">\n",
 				first_time,
 				last_time);
-		fprintf(opt.f_kis_xml,
+		fprintf(f,
 				"\t\t\t\t<type>Probe Request</type>\n"
 				"\t\t\t\t<max-rate>54.000000</max-rate>\n"
 				"\t\t\t\t<packets>1</packets>\n"
@@ -734,11 +793,11 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 							 (size_t) client->ssid_length[i]);
 		if (essid != NULL)
 		{
-			fprintf(opt.f_kis_xml, "\t\t\t\t<ssid>%s</ssid>\n", essid);
+			fprintf(f, "\t\t\t\t<ssid>%s</ssid>\n", essid);
 			free(essid);
 		}
 
-		fprintf(opt.f_kis_xml, "\t\t\t</SSID>\n");
+		fprintf(f, "\t\t\t</SSID>\n");
 
 		++nb_probes_written;
 	}
@@ -746,35 +805,35 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 	// Unassociated client with broadcast probes
 	if (is_unassociated && nb_probes_written == 0)
 	{
-		fprintf(opt.f_kis_xml,
+		fprintf(f,
 				"\t\t\t<SSID first-time=\"%s\" last-time=\"%s\">\n",
 				first_time,
 				last_time);
-		fprintf(opt.f_kis_xml,
+		fprintf(f,
 				"\t\t\t\t<type>Probe Request</type>\n"
 				"\t\t\t\t<max-rate>54.000000</max-rate>\n"
 				"\t\t\t\t<packets>1</packets>\n"
 				"\t\t\t\t<encryption>None</encryption>\n");
-		fprintf(opt.f_kis_xml, "\t\t\t</SSID>\n");
+		fprintf(f, "\t\t\t</SSID>\n");
 	}
 
 	/* Channel
 	   FIXME: Take G.freqoption in account */
-	fprintf(opt.f_kis_xml, "\t\t\t<channel>%d</channel>\n", client->channel);
+	fprintf(f, "\t\t\t<channel>%d</channel>\n", client->channel);
 
 	/* Rate: inaccurate because it's the latest rate seen */
 	client_max_rate = (client->rate_from > client->rate_to) ? client->rate_from
 															: client->rate_to;
-	fprintf(opt.f_kis_xml,
+	fprintf(f,
 			"\t\t\t<maxseenrate>%.6f</maxseenrate>\n",
 			client_max_rate / 1000000.0f);
 
 	/* Those 2 lines always stays the same */
-	fprintf(opt.f_kis_xml, "\t\t\t<carrier>IEEE 802.11b+</carrier>\n");
-	fprintf(opt.f_kis_xml, "\t\t\t<encoding>CCK</encoding>\n");
+	fprintf(f, "\t\t\t<carrier>IEEE 802.11b+</carrier>\n");
+	fprintf(f, "\t\t\t<encoding>CCK</encoding>\n");
 
 	/* Packets */
-	fprintf(opt.f_kis_xml,
+	fprintf(f,
 			"\t\t\t<packets>\n"
 			"\t\t\t\t<LLC>0</LLC>\n"
 			"\t\t\t\t<data>0</data>\n"
@@ -789,7 +848,7 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 	average_power = (client->power == -1) ? 0 : client->power;
 	max_power = (client->best_power == -1) ? average_power : client->best_power;
 
-	fprintf(opt.f_kis_xml,
+	fprintf(f,
 			"\t\t\t<snr-info>\n"
 			"\t\t\t\t<last_signal_dbm>%d</last_signal_dbm>\n"
 			"\t\t\t\t<last_noise_dbm>0</last_noise_dbm>\n"
@@ -814,7 +873,7 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 
 	if (opt.usegpsd)
 	{
-		fprintf(opt.f_kis_xml,
+		fprintf(f,
 				"\t\t\t<gps-info>\n"
 				"\t\t\t\t<min-lat>%.6f</min-lat>\n"
 				"\t\t\t\t<min-lon>%.6f</min-lon>\n"
@@ -847,7 +906,7 @@ static int dump_write_kismet_netxml_client_info(struct ST_info * client,
 				client->gps_loc_best[1],
 				client->gps_loc_best[2]);
 	}
-	fprintf(opt.f_kis_xml, "\t\t</wireless-client>\n");
+	fprintf(f, "\t\t</wireless-client>\n");
 
 	return (0);
 }
@@ -865,492 +924,446 @@ int is_essid_hidden(const uint8_t * essid, const size_t length)
 }
 
 #define NETXML_ENCRYPTION_TAG "%s<encryption>%s</encryption>\n"
-int dump_write_kismet_netxml(struct AP_info * ap_1st,
-							 struct ST_info * st_1st,
-							 unsigned int f_encrypt,
-							 char * airodump_start_time)
+static void netxml_print_ap(FILE * f,
+							struct AP_info * ap_cur,
+							struct ST_info * st_1st)
 {
-	int network_number, average_power, client_max_rate, max_power, client_nbr,
-		fp;
-	off_t fpos;
-	struct AP_info * ap_cur;
+	int average_power, max_power, client_nbr;
 	struct ST_info * st_cur;
 	char first_time[TIME_STR_LENGTH];
 	char last_time[TIME_STR_LENGTH];
 	char * manuf;
 	char * essid = NULL;
 
-	if (!opt.record_data || !opt.output_format_kismet_netxml) return (0);
+	strncpy(first_time, ctime(&ap_cur->tinit), TIME_STR_LENGTH - 1);
+	first_time[strlen(first_time) - 1] = 0; // remove new line
+
+	strncpy(last_time, ctime(&ap_cur->tlast), TIME_STR_LENGTH - 1);
+	last_time[strlen(last_time) - 1] = 0; // remove new line
+
+	fprintf(f,
+			"type=\"infrastructure\" first-time=\"%s\" last-time=\"%s\">\n",
+			first_time,
+			last_time);
 
-	if (fseek(opt.f_kis_xml, 0, SEEK_SET) == -1)
+	fprintf(f,
+			"\t\t<SSID first-time=\"%s\" last-time=\"%s\">\n",
+			first_time,
+			last_time);
+	fprintf(f, "\t\t\t<type>Beacon</type>\n");
+	fprintf(f, "\t\t\t<max-rate>%d.000000</max-rate>\n", ap_cur->max_speed);
+	fprintf(f, "\t\t\t<packets>%lu</packets>\n", ap_cur->nb_bcn);
+	fprintf(f, "\t\t\t<beaconrate>%d</beaconrate>\n", 10);
+
+	// Encryption
+	if (ap_cur->security & STD_OPN)
+		fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "None");
+	else if (ap_cur->security & STD_WEP)
+		fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WEP");
+	else if (ap_cur->security & STD_WPA2 || ap_cur->security & STD_WPA)
 	{
-		return (0);
+		if (ap_cur->security & ENC_TKIP)
+			fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+TKIP");
+		if (ap_cur->security & AUTH_MGT)
+			fprintf(f,
+					NETXML_ENCRYPTION_TAG,
+					"\t\t\t",
+					"WPA+MGT"); // Not a valid value: NetXML does not have a
+		// value for WPA Enterprise
+		if (ap_cur->security & AUTH_PSK)
+			fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+PSK");
+		if (ap_cur->security & AUTH_CMAC)
+			fprintf(f,
+					NETXML_ENCRYPTION_TAG,
+					"\t\t\t",
+					"WPA+PSK+CMAC");
+		if (ap_cur->security & ENC_CCMP)
+			fprintf(f,
+					NETXML_ENCRYPTION_TAG,
+					"\t\t\t",
+					"WPA+AES-CCM");
+		if (ap_cur->security & ENC_WRAP)
+			fprintf(f,
+					NETXML_ENCRYPTION_TAG,
+					"\t\t\t",
+					"WPA+AES-OCB");
+		if (ap_cur->security & ENC_GCMP)
+			fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+GCMP");
+		if (ap_cur->security & ENC_GMAC)
+			fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+GMAC");
+		if (ap_cur->security & AUTH_SAE)
+			fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+SAE");
+		if (ap_cur->security & AUTH_OWE)
+			fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+OWE");
 	}
+	else if (ap_cur->security & ENC_WEP104)
+		fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WEP104");
+	else if (ap_cur->security & ENC_WEP40)
+		fprintf(f, NETXML_ENCRYPTION_TAG, "\t\t\t", "WEP40");
 
-	/* Header and airodump-ng start time */
-	fprintf(opt.f_kis_xml,
-			"%s%s%s",
-			KISMET_NETXML_HEADER_BEGIN,
-			airodump_start_time,
-			KISMET_NETXML_HEADER_END);
+	/* ESSID */
+	if (!is_essid_hidden(ap_cur->essid, (size_t) ap_cur->ssid_length))
+	{
+		essid = sanitize_xml(ap_cur->essid, (size_t) ap_cur->ssid_length);
+	}
 
-	ap_cur = ap_1st;
+	fprintf(f,
+			"\t\t\t<essid cloaked=\"%s\">%s</essid>\n",
+			(essid) ? "false" : "true",
+			(essid) ? essid : "");
+	if (essid)
+	{
+		free(essid);
+		essid = NULL;
+	}
 
-	network_number = 0;
-	while (ap_cur != NULL)
+	/* End of SSID tag */
+	fprintf(f, "\t\t</SSID>\n");
+
+	/* BSSID */
+	fprintf(f,
+			"\t\t<BSSID>%02X:%02X:%02X:%02X:%02X:%02X</BSSID>\n",
+			ap_cur->bssid[0],
+			ap_cur->bssid[1],
+			ap_cur->bssid[2],
+			ap_cur->bssid[3],
+			ap_cur->bssid[4],
+			ap_cur->bssid[5]);
+
+	/* Manufacturer, if set using standard oui list */
+	manuf = sanitize_xml((unsigned char *) ap_cur->manuf, strlen(ap_cur->manuf));
+	fprintf(f, "\t\t<manuf>%s</manuf>\n", (manuf != NULL) ? manuf : "Unknown");
+	free(manuf);
+
+	/* Channel
+	   FIXME: Take G.freqoption in account */
+	fprintf(f,
+			"\t\t<channel>%d</channel>\n",
+			(ap_cur->channel) == -1 ? 0 : ap_cur->channel);
+
+	/* Freq (in Mhz) and total number of packet on that frequency
+	   FIXME: Take G.freqoption in account */
+	fprintf(f,
+			"\t\t<freqmhz>%d %lu</freqmhz>\n",
+			(ap_cur->channel) == -1 ? 0 : getFrequencyFromChannel(
+											  ap_cur->channel),
+			// ap_cur->nb_data + ap_cur->nb_bcn );
+			ap_cur->nb_pkt);
+
+	/* XXX: What about 5.5Mbit */
+	fprintf(f,
+			"\t\t<maxseenrate>%d</maxseenrate>\n",
+			(ap_cur->max_speed == -1) ? 0 : ap_cur->max_speed * 1000);
+
+	/* Those 2 lines always stays the same */
+	fprintf(f, "\t\t<carrier>IEEE 802.11b+</carrier>\n");
+	fprintf(f, "\t\t<encoding>CCK</encoding>\n");
+
+	/* Packets */
+	fprintf(f,
+			"\t\t<packets>\n"
+			"\t\t\t<LLC>%lu</LLC>\n"
+			"\t\t\t<data>%lu</data>\n"
+			"\t\t\t<crypt>0</crypt>\n"
+			"\t\t\t<total>%lu</total>\n"
+			"\t\t\t<fragments>0</fragments>\n"
+			"\t\t\t<retries>0</retries>\n"
+			"\t\t</packets>\n",
+			ap_cur->nb_data,
+			ap_cur->nb_data,
+			// ap_cur->nb_data + ap_cur->nb_bcn );
+			ap_cur->nb_pkt);
+
+	/* XXX: What does that field mean? Is it the total size of data? */
+	fprintf(f, "\t\t<datasize>0</datasize>\n");
+
+
+	/* Client information */
+	client_nbr = 0;
+	for (st_cur = st_1st; st_cur != NULL; st_cur = st_cur->next)
 	{
-		if (memcmp(ap_cur->bssid, BROADCAST, 6) == 0)
+		/* Check if the station is associated to the current AP */
+		if (memcmp(st_cur->stmac, BROADCAST, 6) != 0 && st_cur->base != NULL
+			&& memcmp(st_cur->base->bssid, ap_cur->bssid, 6) == 0)
 		{
-			ap_cur = ap_cur->next;
-			continue;
+			dump_write_kismet_netxml_client_info(f, st_cur, ++client_nbr);
 		}
+	}
 
-		if (ap_cur->security != 0 && f_encrypt != 0
-			&& ((ap_cur->security & f_encrypt) == 0))
-		{
-			ap_cur = ap_cur->next;
-			continue;
-		}
+	/* SNR information */
+	average_power = (ap_cur->avg_power == -1) ? 0 : ap_cur->avg_power;
+	max_power = (ap_cur->best_power == -1) ? average_power : ap_cur->best_power;
+	fprintf(f,
+			"\t\t<snr-info>\n"
+			"\t\t\t<last_signal_dbm>%d</last_signal_dbm>\n"
+			"\t\t\t<last_noise_dbm>0</last_noise_dbm>\n"
+			"\t\t\t<last_signal_rssi>%d</last_signal_rssi>\n"
+			"\t\t\t<last_noise_rssi>0</last_noise_rssi>\n"
+			"\t\t\t<min_signal_dbm>%d</min_signal_dbm>\n"
+			"\t\t\t<min_noise_dbm>0</min_noise_dbm>\n"
+			"\t\t\t<min_signal_rssi>1024</min_signal_rssi>\n"
+			"\t\t\t<min_noise_rssi>1024</min_noise_rssi>\n"
+			"\t\t\t<max_signal_dbm>%d</max_signal_dbm>\n"
+			"\t\t\t<max_noise_dbm>0</max_noise_dbm>\n"
+			"\t\t\t<max_signal_rssi>%d</max_signal_rssi>\n"
+			"\t\t\t<max_noise_rssi>0</max_noise_rssi>\n"
+			"\t\t</snr-info>\n",
+			average_power,
+			average_power,
+			average_power,
+			max_power,
+			max_power);
 
-		if (is_filtered_essid(ap_cur->essid))
-		{
-			ap_cur = ap_cur->next;
-			continue;
-		}
+	/* GPS Coordinates */
+	if (opt.usegpsd)
+	{
+		fprintf(f,
+				"\t\t<gps-info>\n"
+				"\t\t\t<min-lat>%.6f</min-lat>\n"
+				"\t\t\t<min-lon>%.6f</min-lon>\n"
+				"\t\t\t<min-alt>%.6f</min-alt>\n"
+				"\t\t\t<min-spd>%.6f</min-spd>\n"
+				"\t\t\t<max-lat>%.6f</max-lat>\n"
+				"\t\t\t<max-lon>%.6f</max-lon>\n"
+				"\t\t\t<max-alt>%.6f</max-alt>\n"
+				"\t\t\t<max-spd>%.6f</max-spd>\n"
+				"\t\t\t<peak-lat>%.6f</peak-lat>\n"
+				"\t\t\t<peak-lon>%.6f</peak-lon>\n"
+				"\t\t\t<peak-alt>%.6f</peak-alt>\n"
+				"\t\t\t<avg-lat>%.6f</avg-lat>\n"
+				"\t\t\t<avg-lon>%.6f</avg-lon>\n"
+				"\t\t\t<avg-alt>%.6f</avg-alt>\n"
+				"\t\t</gps-info>\n",
+				ap_cur->gps_loc_min[0],
+				ap_cur->gps_loc_min[1],
+				ap_cur->gps_loc_min[2],
+				ap_cur->gps_loc_min[3],
+				ap_cur->gps_loc_max[0],
+				ap_cur->gps_loc_max[1],
+				ap_cur->gps_loc_max[2],
+				ap_cur->gps_loc_max[3],
+				ap_cur->gps_loc_best[0],
+				ap_cur->gps_loc_best[1],
+				ap_cur->gps_loc_best[2],
+				/* Can the "best" be considered as average??? */
+				ap_cur->gps_loc_best[0],
+				ap_cur->gps_loc_best[1],
+				ap_cur->gps_loc_best[2]);
+	}
 
-		++network_number; // Network Number
-		strncpy(first_time, ctime(&ap_cur->tinit), TIME_STR_LENGTH - 1);
-		first_time[strlen(first_time) - 1] = 0; // remove new line
+	/* BSS Timestamp */
+	fprintf(f, "\t\t<bsstimestamp>%llu</bsstimestamp>\n", ap_cur->timestamp);
 
-		strncpy(last_time, ctime(&ap_cur->tlast), TIME_STR_LENGTH - 1);
-		last_time[strlen(last_time) - 1] = 0; // remove new line
+	/* Trailing information */
+	fprintf(f,
+			"\t\t<cdp-device></cdp-device>\n"
+			"\t\t<cdp-portid></cdp-portid>\n");
 
-		fprintf(opt.f_kis_xml,
-				"\t<wireless-network number=\"%d\" type=\"infrastructure\" ",
-				network_number);
-		fprintf(opt.f_kis_xml,
-				"first-time=\"%s\" last-time=\"%s\">\n",
-				first_time,
-				last_time);
+	/* Closing tag for the current wireless network */
+	fprintf(f, "\t</wireless-network>\n");
+}
 
-		fprintf(opt.f_kis_xml,
-				"\t\t<SSID first-time=\"%s\" last-time=\"%s\">\n",
-				first_time,
-				last_time);
-		fprintf(opt.f_kis_xml, "\t\t\t<type>Beacon</type>\n");
-		fprintf(opt.f_kis_xml,
-				"\t\t\t<max-rate>%d.000000</max-rate>\n",
-				ap_cur->max_speed);
-		fprintf(
-			opt.f_kis_xml, "\t\t\t<packets>%lu</packets>\n", ap_cur->nb_bcn);
-		fprintf(opt.f_kis_xml, "\t\t\t<beaconrate>%d</beaconrate>\n", 10);
-
-		// Encryption
-		if (ap_cur->security & STD_OPN)
-			fprintf(opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "None");
-		else if (ap_cur->security & STD_WEP)
-			fprintf(opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WEP");
-		else if (ap_cur->security & STD_WPA2 || ap_cur->security & STD_WPA)
-		{
-			if (ap_cur->security & ENC_TKIP)
-				fprintf(
-					opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+TKIP");
-			if (ap_cur->security & AUTH_MGT)
-				fprintf(opt.f_kis_xml,
-						NETXML_ENCRYPTION_TAG,
-						"\t\t\t",
-						"WPA+MGT"); // Not a valid value: NetXML does not have a
-			// value for WPA Enterprise
-			if (ap_cur->security & AUTH_PSK)
-				fprintf(
-					opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+PSK");
-			if (ap_cur->security & AUTH_CMAC)
-				fprintf(opt.f_kis_xml,
-						NETXML_ENCRYPTION_TAG,
-						"\t\t\t",
-						"WPA+PSK+CMAC");
-			if (ap_cur->security & ENC_CCMP)
-				fprintf(opt.f_kis_xml,
-						NETXML_ENCRYPTION_TAG,
-						"\t\t\t",
-						"WPA+AES-CCM");
-			if (ap_cur->security & ENC_WRAP)
-				fprintf(opt.f_kis_xml,
-						NETXML_ENCRYPTION_TAG,
-						"\t\t\t",
-						"WPA+AES-OCB");
-			if (ap_cur->security & ENC_GCMP)
-				fprintf(
-					opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+GCMP");
-			if (ap_cur->security & ENC_GMAC)
-				fprintf(
-					opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+GMAC");
-			if (ap_cur->security & AUTH_SAE)
-				fprintf(
-					opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+SAE");
-			if (ap_cur->security & AUTH_OWE)
-				fprintf(
-					opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WPA+OWE");
-		}
-		else if (ap_cur->security & ENC_WEP104)
-			fprintf(opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WEP104");
-		else if (ap_cur->security & ENC_WEP40)
-			fprintf(opt.f_kis_xml, NETXML_ENCRYPTION_TAG, "\t\t\t", "WEP40");
+static void netxml_print_probe(FILE * f, struct ST_info * st_cur)
+{
+	int average_power, client_max_rate, max_power;
+	char first_time[TIME_STR_LENGTH];
+	char last_time[TIME_STR_LENGTH];
+	char * manuf;
 
-		/* ESSID */
-		if (!is_essid_hidden(ap_cur->essid, (size_t) ap_cur->ssid_length))
-		{
-			essid = sanitize_xml(ap_cur->essid, (size_t) ap_cur->ssid_length);
-		}
+	strncpy(first_time, ctime(&st_cur->tinit), TIME_STR_LENGTH - 1);
+	first_time[strlen(first_time) - 1] = 0; // remove new line
 
-		fprintf(opt.f_kis_xml,
-				"\t\t\t<essid cloaked=\"%s\">%s</essid>\n",
-				(essid) ? "false" : "true",
-				(essid) ? essid : "");
-		if (essid)
-		{
-			free(essid);
-			essid = NULL;
-		}
+	strncpy(last_time, ctime(&st_cur->tlast), TIME_STR_LENGTH - 1);
+	last_time[strlen(last_time) - 1] = 0; // remove new line
 
-		/* End of SSID tag */
-		fprintf(opt.f_kis_xml, "\t\t</SSID>\n");
+	fprintf(f,
+			"type=\"probe\" first-time=\"%s\" last-time=\"%s\">\n",
+			first_time,
+			last_time);
 
-		/* BSSID */
-		fprintf(opt.f_kis_xml,
-				"\t\t<BSSID>%02X:%02X:%02X:%02X:%02X:%02X</BSSID>\n",
-				ap_cur->bssid[0],
-				ap_cur->bssid[1],
-				ap_cur->bssid[2],
-				ap_cur->bssid[3],
-				ap_cur->bssid[4],
-				ap_cur->bssid[5]);
+	/* BSSID */
+	fprintf(f,
+			"\t\t<BSSID>%02X:%02X:%02X:%02X:%02X:%02X</BSSID>\n",
+			st_cur->stmac[0],
+			st_cur->stmac[1],
+			st_cur->stmac[2],
+			st_cur->stmac[3],
+			st_cur->stmac[4],
+			st_cur->stmac[5]);
 
-		/* Manufacturer, if set using standard oui list */
-		manuf = sanitize_xml((unsigned char *) ap_cur->manuf,
-							 strlen(ap_cur->manuf));
-		fprintf(opt.f_kis_xml,
-				"\t\t<manuf>%s</manuf>\n",
-				(manuf != NULL) ? manuf : "Unknown");
-		free(manuf);
-
-		/* Channel
-		   FIXME: Take G.freqoption in account */
-		fprintf(opt.f_kis_xml,
-				"\t\t<channel>%d</channel>\n",
-				(ap_cur->channel) == -1 ? 0 : ap_cur->channel);
-
-		/* Freq (in Mhz) and total number of packet on that frequency
-		   FIXME: Take G.freqoption in account */
-		fprintf(opt.f_kis_xml,
-				"\t\t<freqmhz>%d %lu</freqmhz>\n",
-				(ap_cur->channel) == -1 ? 0 : getFrequencyFromChannel(
-												  ap_cur->channel),
-				// ap_cur->nb_data + ap_cur->nb_bcn );
-				ap_cur->nb_pkt);
-
-		/* XXX: What about 5.5Mbit */
-		fprintf(opt.f_kis_xml,
-				"\t\t<maxseenrate>%d</maxseenrate>\n",
-				(ap_cur->max_speed == -1) ? 0 : ap_cur->max_speed * 1000);
-
-		/* Those 2 lines always stays the same */
-		fprintf(opt.f_kis_xml, "\t\t<carrier>IEEE 802.11b+</carrier>\n");
-		fprintf(opt.f_kis_xml, "\t\t<encoding>CCK</encoding>\n");
-
-		/* Packets */
-		fprintf(opt.f_kis_xml,
-				"\t\t<packets>\n"
-				"\t\t\t<LLC>%lu</LLC>\n"
-				"\t\t\t<data>%lu</data>\n"
-				"\t\t\t<crypt>0</crypt>\n"
-				"\t\t\t<total>%lu</total>\n"
-				"\t\t\t<fragments>0</fragments>\n"
-				"\t\t\t<retries>0</retries>\n"
-				"\t\t</packets>\n",
-				ap_cur->nb_data,
-				ap_cur->nb_data,
-				// ap_cur->nb_data + ap_cur->nb_bcn );
-				ap_cur->nb_pkt);
-
-		/* XXX: What does that field mean? Is it the total size of data? */
-		fprintf(opt.f_kis_xml, "\t\t<datasize>0</datasize>\n");
-
-		/* Client information */
-		st_cur = st_1st;
-		client_nbr = 0;
-
-		while (st_cur != NULL)
-		{
-			/* Check if the station is associated to the current AP */
-			if (memcmp(st_cur->stmac, BROADCAST, 6) != 0 && st_cur->base != NULL
-				&& memcmp(st_cur->base->bssid, ap_cur->bssid, 6) == 0)
-			{
-				dump_write_kismet_netxml_client_info(st_cur, ++client_nbr);
-			}
+	/* Manufacturer, if set using standard oui list */
+	manuf = sanitize_xml((unsigned char *) st_cur->manuf, strlen(st_cur->manuf));
+	fprintf(f, "\t\t<manuf>%s</manuf>\n", (manuf != NULL) ? manuf : "Unknown");
+	free(manuf);
 
-			/* Next client */
-			st_cur = st_cur->next;
-		}
+	/* Channel
+	   FIXME: Take G.freqoption in account */
+	fprintf(f, "\t\t<channel>%d</channel>\n", st_cur->channel);
 
-		/* SNR information */
-		average_power = (ap_cur->avg_power == -1) ? 0 : ap_cur->avg_power;
-		max_power
-			= (ap_cur->best_power == -1) ? average_power : ap_cur->best_power;
-		fprintf(opt.f_kis_xml,
-				"\t\t<snr-info>\n"
-				"\t\t\t<last_signal_dbm>%d</last_signal_dbm>\n"
-				"\t\t\t<last_noise_dbm>0</last_noise_dbm>\n"
-				"\t\t\t<last_signal_rssi>%d</last_signal_rssi>\n"
-				"\t\t\t<last_noise_rssi>0</last_noise_rssi>\n"
-				"\t\t\t<min_signal_dbm>%d</min_signal_dbm>\n"
-				"\t\t\t<min_noise_dbm>0</min_noise_dbm>\n"
-				"\t\t\t<min_signal_rssi>1024</min_signal_rssi>\n"
-				"\t\t\t<min_noise_rssi>1024</min_noise_rssi>\n"
-				"\t\t\t<max_signal_dbm>%d</max_signal_dbm>\n"
-				"\t\t\t<max_noise_dbm>0</max_noise_dbm>\n"
-				"\t\t\t<max_signal_rssi>%d</max_signal_rssi>\n"
-				"\t\t\t<max_noise_rssi>0</max_noise_rssi>\n"
-				"\t\t</snr-info>\n",
-				average_power,
-				average_power,
-				average_power,
-				max_power,
-				max_power);
-
-		/* GPS Coordinates */
-		if (opt.usegpsd)
-		{
-			fprintf(opt.f_kis_xml,
-					"\t\t<gps-info>\n"
-					"\t\t\t<min-lat>%.6f</min-lat>\n"
-					"\t\t\t<min-lon>%.6f</min-lon>\n"
-					"\t\t\t<min-alt>%.6f</min-alt>\n"
-					"\t\t\t<min-spd>%.6f</min-spd>\n"
-					"\t\t\t<max-lat>%.6f</max-lat>\n"
-					"\t\t\t<max-lon>%.6f</max-lon>\n"
-					"\t\t\t<max-alt>%.6f</max-alt>\n"
-					"\t\t\t<max-spd>%.6f</max-spd>\n"
-					"\t\t\t<peak-lat>%.6f</peak-lat>\n"
-					"\t\t\t<peak-lon>%.6f</peak-lon>\n"
-					"\t\t\t<peak-alt>%.6f</peak-alt>\n"
-					"\t\t\t<avg-lat>%.6f</avg-lat>\n"
-					"\t\t\t<avg-lon>%.6f</avg-lon>\n"
-					"\t\t\t<avg-alt>%.6f</avg-alt>\n"
-					"\t\t</gps-info>\n",
-					ap_cur->gps_loc_min[0],
-					ap_cur->gps_loc_min[1],
-					ap_cur->gps_loc_min[2],
-					ap_cur->gps_loc_min[3],
-					ap_cur->gps_loc_max[0],
-					ap_cur->gps_loc_max[1],
-					ap_cur->gps_loc_max[2],
-					ap_cur->gps_loc_max[3],
-					ap_cur->gps_loc_best[0],
-					ap_cur->gps_loc_best[1],
-					ap_cur->gps_loc_best[2],
-					/* Can the "best" be considered as average??? */
-					ap_cur->gps_loc_best[0],
-					ap_cur->gps_loc_best[1],
-					ap_cur->gps_loc_best[2]);
-		}
+	/* Freq (in Mhz) and total number of packet on that frequency
+	   FIXME: Take G.freqoption in account */
+	fprintf(f,
+			"\t\t<freqmhz>%d %lu</freqmhz>\n",
+			getFrequencyFromChannel(st_cur->channel),
+			st_cur->nb_pkt);
 
-		/* BSS Timestamp */
-		fprintf(opt.f_kis_xml,
-				"\t\t<bsstimestamp>%llu</bsstimestamp>\n",
-				ap_cur->timestamp);
+	/* Rate: inaccurate because it's the latest rate seen */
+	client_max_rate = (st_cur->rate_from > st_cur->rate_to) ? st_cur->rate_from
+															: st_cur->rate_to;
+	fprintf(f,
+			"\t\t<maxseenrate>%.6f</maxseenrate>\n",
+			client_max_rate / 1000000.0f);
 
-		/* Trailing information */
-		fprintf(opt.f_kis_xml,
-				"\t\t<cdp-device></cdp-device>\n"
-				"\t\t<cdp-portid></cdp-portid>\n");
+	fprintf(f, "\t\t<carrier>IEEE 802.11b+</carrier>\n");
+	fprintf(f, "\t\t<encoding>CCK</encoding>\n");
 
-		/* Closing tag for the current wireless network */
-		fprintf(opt.f_kis_xml, "\t</wireless-network>\n");
-		//-------- End of XML
+	/* Packets */
+	fprintf(f,
+			"\t\t<packets>\n"
+			"\t\t\t<LLC>0</LLC>\n"
+			"\t\t\t<data>0</data>\n"
+			"\t\t\t<crypt>0</crypt>\n"
+			"\t\t\t<total>%lu</total>\n"
+			"\t\t\t<fragments>0</fragments>\n"
+			"\t\t\t<retries>0</retries>\n"
+			"\t\t</packets>\n",
+			st_cur->nb_pkt);
+
+	/* XXX: What does that field mean? Is it the total size of data? */
+	fprintf(f, "\t\t<datasize>0</datasize>\n");
 
-		ap_cur = ap_cur->next;
-	}
+	/* SNR information */
+	average_power = (st_cur->power == -1) ? 0 : st_cur->power;
+	max_power = (st_cur->best_power == -1) ? average_power : st_cur->best_power;
+
+	fprintf(f,
+			"\t\t<snr-info>\n"
+			"\t\t\t<last_signal_dbm>%d</last_signal_dbm>\n"
+			"\t\t\t<last_noise_dbm>0</last_noise_dbm>\n"
+			"\t\t\t<last_signal_rssi>%d</last_signal_rssi>\n"
+			"\t\t\t<last_noise_rssi>0</last_noise_rssi>\n"
+			"\t\t\t<min_signal_dbm>%d</min_signal_dbm>\n"
+			"\t\t\t<min_noise_dbm>0</min_noise_dbm>\n"
+			"\t\t\t<min_signal_rssi>1024</min_signal_rssi>\n"
+			"\t\t\t<min_noise_rssi>1024</min_noise_rssi>\n"
+			"\t\t\t<max_signal_dbm>%d</max_signal_dbm>\n"
+			"\t\t\t<max_noise_dbm>0</max_noise_dbm>\n"
+			"\t\t\t<max_signal_rssi>%d</max_signal_rssi>\n"
+			"\t\t\t<max_noise_rssi>0</max_noise_rssi>\n"
+			"\t\t</snr-info>\n",
+			average_power,
+			average_power,
+			average_power,
+			max_power,
+			max_power);
 
-	/* Write all unassociated stations */
-	st_cur = st_1st;
-	while (st_cur != NULL)
+	/* GPS Coordinates for clients */
+
+	if (opt.usegpsd)
 	{
-		/* If not associated and not Broadcast Mac */
-		if (st_cur->base == NULL
-			|| memcmp(st_cur->base->bssid, BROADCAST, 6) == 0)
-		{
-			++network_number; // Network Number
-
-			/* Write new network information */
-			strncpy(first_time, ctime(&st_cur->tinit), TIME_STR_LENGTH - 1);
-			first_time[strlen(first_time) - 1] = 0; // remove new line
-
-			strncpy(last_time, ctime(&st_cur->tlast), TIME_STR_LENGTH - 1);
-			last_time[strlen(last_time) - 1] = 0; // remove new line
-
-			fprintf(opt.f_kis_xml,
-					"\t<wireless-network number=\"%d\" type=\"probe\" ",
-					network_number);
-			fprintf(opt.f_kis_xml,
-					"first-time=\"%s\" last-time=\"%s\">\n",
-					first_time,
-					last_time);
-
-			/* BSSID */
-			fprintf(opt.f_kis_xml,
-					"\t\t<BSSID>%02X:%02X:%02X:%02X:%02X:%02X</BSSID>\n",
-					st_cur->stmac[0],
-					st_cur->stmac[1],
-					st_cur->stmac[2],
-					st_cur->stmac[3],
-					st_cur->stmac[4],
-					st_cur->stmac[5]);
-
-			/* Manufacturer, if set using standard oui list */
-			manuf = sanitize_xml((unsigned char *) st_cur->manuf,
-								 strlen(st_cur->manuf));
-			fprintf(opt.f_kis_xml,
-					"\t\t<manuf>%s</manuf>\n",
-					(manuf != NULL) ? manuf : "Unknown");
-			free(manuf);
-
-			/* Channel
-			   FIXME: Take G.freqoption in account */
-			fprintf(
-				opt.f_kis_xml, "\t\t<channel>%d</channel>\n", st_cur->channel);
-
-			/* Freq (in Mhz) and total number of packet on that frequency
-			   FIXME: Take G.freqoption in account */
-			fprintf(opt.f_kis_xml,
-					"\t\t<freqmhz>%d %lu</freqmhz>\n",
-					getFrequencyFromChannel(st_cur->channel),
-					st_cur->nb_pkt);
-
-			/* Rate: inaccurate because it's the latest rate seen */
-			client_max_rate = (st_cur->rate_from > st_cur->rate_to)
-								  ? st_cur->rate_from
-								  : st_cur->rate_to;
-			fprintf(opt.f_kis_xml,
-					"\t\t<maxseenrate>%.6f</maxseenrate>\n",
-					client_max_rate / 1000000.0f);
-
-			fprintf(opt.f_kis_xml, "\t\t<carrier>IEEE 802.11b+</carrier>\n");
-			fprintf(opt.f_kis_xml, "\t\t<encoding>CCK</encoding>\n");
-
-			/* Packets */
-			fprintf(opt.f_kis_xml,
-					"\t\t<packets>\n"
-					"\t\t\t<LLC>0</LLC>\n"
-					"\t\t\t<data>0</data>\n"
-					"\t\t\t<crypt>0</crypt>\n"
-					"\t\t\t<total>%lu</total>\n"
-					"\t\t\t<fragments>0</fragments>\n"
-					"\t\t\t<retries>0</retries>\n"
-					"\t\t</packets>\n",
-					st_cur->nb_pkt);
-
-			/* XXX: What does that field mean? Is it the total size of data? */
-			fprintf(opt.f_kis_xml, "\t\t<datasize>0</datasize>\n");
-
-			/* SNR information */
-			average_power = (st_cur->power == -1) ? 0 : st_cur->power;
-			max_power = (st_cur->best_power == -1) ? average_power
-												   : st_cur->best_power;
-
-			fprintf(opt.f_kis_xml,
-					"\t\t<snr-info>\n"
-					"\t\t\t<last_signal_dbm>%d</last_signal_dbm>\n"
-					"\t\t\t<last_noise_dbm>0</last_noise_dbm>\n"
-					"\t\t\t<last_signal_rssi>%d</last_signal_rssi>\n"
-					"\t\t\t<last_noise_rssi>0</last_noise_rssi>\n"
-					"\t\t\t<min_signal_dbm>%d</min_signal_dbm>\n"
-					"\t\t\t<min_noise_dbm>0</min_noise_dbm>\n"
-					"\t\t\t<min_signal_rssi>1024</min_signal_rssi>\n"
-					"\t\t\t<min_noise_rssi>1024</min_noise_rssi>\n"
-					"\t\t\t<max_signal_dbm>%d</max_signal_dbm>\n"
-					"\t\t\t<max_noise_dbm>0</max_noise_dbm>\n"
-					"\t\t\t<max_signal_rssi>%d</max_signal_rssi>\n"
-					"\t\t\t<max_noise_rssi>0</max_noise_rssi>\n"
-					"\t\t</snr-info>\n",
-					average_power,
-					average_power,
-					average_power,
-					max_power,
-					max_power);
-
-			/* GPS Coordinates for clients */
-
-			if (opt.usegpsd)
-			{
-				fprintf(opt.f_kis_xml,
-						"\t\t<gps-info>\n"
-						"\t\t\t<min-lat>%.6f</min-lat>\n"
-						"\t\t\t<min-lon>%.6f</min-lon>\n"
-						"\t\t\t<min-alt>%.6f</min-alt>\n"
-						"\t\t\t<min-spd>%.6f</min-spd>\n"
-						"\t\t\t<max-lat>%.6f</max-lat>\n"
-						"\t\t\t<max-lon>%.6f</max-lon>\n"
-						"\t\t\t<max-alt>%.6f</max-alt>\n"
-						"\t\t\t<max-spd>%.6f</max-spd>\n"
-						"\t\t\t<peak-lat>%.6f</peak-lat>\n"
-						"\t\t\t<peak-lon>%.6f</peak-lon>\n"
-						"\t\t\t<peak-alt>%.6f</peak-alt>\n"
-						"\t\t\t<avg-lat>%.6f</avg-lat>\n"
-						"\t\t\t<avg-lon>%.6f</avg-lon>\n"
-						"\t\t\t<avg-alt>%.6f</avg-alt>\n"
-						"\t\t</gps-info>\n",
-						st_cur->gps_loc_min[0],
-						st_cur->gps_loc_min[1],
-						st_cur->gps_loc_min[2],
-						st_cur->gps_loc_min[3],
-						st_cur->gps_loc_max[0],
-						st_cur->gps_loc_max[1],
-						st_cur->gps_loc_max[2],
-						st_cur->gps_loc_max[3],
-						st_cur->gps_loc_best[0],
-						st_cur->gps_loc_best[1],
-						st_cur->gps_loc_best[2],
-						/* Can the "best" be considered as average??? */
-						st_cur->gps_loc_best[0],
-						st_cur->gps_loc_best[1],
-						st_cur->gps_loc_best[2]);
-			}
+		fprintf(f,
+				"\t\t<gps-info>\n"
+				"\t\t\t<min-lat>%.6f</min-lat>\n"
+				"\t\t\t<min-lon>%.6f</min-lon>\n"
+				"\t\t\t<min-alt>%.6f</min-alt>\n"
+				"\t\t\t<min-spd>%.6f</min-spd>\n"
+				"\t\t\t<max-lat>%.6f</max-lat>\n"
+				"\t\t\t<max-lon>%.6f</max-lon>\n"
+				"\t\t\t<max-alt>%.6f</max-alt>\n"
+				"\t\t\t<max-spd>%.6f</max-spd>\n"
+				"\t\t\t<peak-lat>%.6f</peak-lat>\n"
+				"\t\t\t<peak-lon>%.6f</peak-lon>\n"
+				"\t\t\t<peak-alt>%.6f</peak-alt>\n"
+				"\t\t\t<avg-lat>%.6f</avg-lat>\n"
+				"\t\t\t<avg-lon>%.6f</avg-lon>\n"
+				"\t\t\t<avg-alt>%.6f</avg-alt>\n"
+				"\t\t</gps-info>\n",
+				st_cur->gps_loc_min[0],
+				st_cur->gps_loc_min[1],
+				st_cur->gps_loc_min[2],
+				st_cur->gps_loc_min[3],
+				st_cur->gps_loc_max[0],
+				st_cur->gps_loc_max[1],
+				st_cur->gps_loc_max[2],
+				st_cur->gps_loc_max[3],
+				st_cur->gps_loc_best[0],
+				st_cur->gps_loc_best[1],
+				st_cur->gps_loc_best[2],
+				/* Can the "best" be considered as average??? */
+				st_cur->gps_loc_best[0],
+				st_cur->gps_loc_best[1],
+				st_cur->gps_loc_best[2]);
+	}
+
+	fprintf(f, "\t\t<bsstimestamp>0</bsstimestamp>\n");
+
+	/* CDP information */
+	fprintf(f,
+			"\t\t<cdp-device></cdp-device>\n"
+			"\t\t<cdp-portid></cdp-portid>\n");
 
-			fprintf(opt.f_kis_xml, "\t\t<bsstimestamp>0</bsstimestamp>\n");
+	/* Write client information */
+	dump_write_kismet_netxml_client_info(f, st_cur, 1);
 
-			/* CDP information */
-			fprintf(opt.f_kis_xml,
-					"\t\t<cdp-device></cdp-device>\n"
-					"\t\t<cdp-portid></cdp-portid>\n");
+	fprintf(f, "\t</wireless-network>");
+}
 
-			/* Write client information */
-			dump_write_kismet_netxml_client_info(st_cur, 1);
+static void dump_write_kismet_netxml(FILE * out,
+									 struct AP_info * ap_1st,
+									 struct ST_info * st_1st,
+									 unsigned int f_encrypt,
+									 char * airodump_start_time)
+{
+	int network_number;
+	struct AP_info * ap_cur;
+	struct ST_info * st_cur;
+	FILE * f;
 
-			fprintf(opt.f_kis_xml, "\t</wireless-network>");
+	/* Header and airodump-ng start time */
+	fprintf(out,
+			"%s%s%s",
+			KISMET_NETXML_HEADER_BEGIN,
+			airodump_start_time,
+			KISMET_NETXML_HEADER_END);
+
+	network_number = 0;
+	for (ap_cur = ap_1st; ap_cur != NULL; ap_cur = ap_cur->next)
+	{
+		if (!is_written_ap(ap_cur, f_encrypt)) continue;
+
+		if (ap_cur->text[TEXT_NETXML].text == NULL)
+		{
+			f = text_record_open(&ap_cur->text[TEXT_NETXML]);
+			netxml_print_ap(f, ap_cur, st_1st);
+			text_record_close(f, &ap_cur->text[TEXT_NETXML]);
 		}
-		st_cur = st_cur->next;
+
+		fprintf(out, "\t<wireless-network number=\"%d\" ", ++network_number);
+		text_put(out, &ap_cur->text[TEXT_NETXML]);
 	}
-	/* TODO: Also go through na_1st */
 
-	/* Trailing */
-	fprintf(opt.f_kis_xml, "%s\n", KISMET_NETXML_TRAILER);
+	/* Write all unassociated stations */
+	for (st_cur = st_1st; st_cur != NULL; st_cur = st_cur->next)
+	{
+		/* If not associated and not Broadcast Mac */
+		if (st_cur->base != NULL
+			&& memcmp(st_cur->base->bssid, BROADCAST, 6) != 0)
+			continue;
 
-	fflush(opt.f_kis_xml);
+		if (st_cur->text[TEXT_NETXML].text == NULL)
+		{
+			f = text_record_open(&st_cur->text[TEXT_NETXML]);
+			netxml_print_probe(f, st_cur);
+			text_record_close(f, &st_cur->text[TEXT_NETXML]);
+		}
 
-	/* Sometimes there can be crap at the end of the file, so truncating is a
-	   good idea.
-	   XXX: Is this really correct, I hope fileno() won't have any side effect
-	   */
-	fp = fileno(opt.f_kis_xml);
-	fpos = ftell(opt.f_kis_xml);
-	if (fp == -1 || fpos == -1)
-	{
-		return (0);
+		fprintf(out, "\t<wireless-network number=\"%d\" ", ++network_number);
+		text_put(out, &st_cur->text[TEXT_NETXML]);
 	}
-	IGNORE_NZ(ftruncate(fp, fpos));
+	/* TODO: Also go through na_1st */
 
-	return (0);
+	/* Trailing */
+	fprintf(out, "%s\n", KISMET_NETXML_TRAILER);
 }
 #undef TIME_STR_LENGTH
 
@@ -1361,64 +1374,258 @@ int dump_write_kismet_netxml(struct AP_info * ap_1st,
 	"GPSMinAlt;GPSMinSpd;GPSMaxLat;GPSMaxLon;GPSMaxAlt;GPSMaxSpd;GPSBestLat;"  \
 	"GPSBestLon;GPSBestAlt;DataSize;IPType;IP;\n"
 
-int dump_write_kismet_csv(struct AP_info * ap_1st,
-						  struct ST_info * st_1st,
-						  unsigned int f_encrypt)
-{
-	UNUSED_PARAM(st_1st);
 
-	int i, k;
-	struct AP_info * ap_cur;
+static void kismet_print_ap(FILE * f, struct AP_info * ap_cur)
+{
+	int i;
 
-	if (!opt.record_data || !opt.output_format_kismet_csv) return (0);
+	// NetType
+	fprintf(f, "infrastructure;");
 
-	if (fseek(opt.f_kis, 0, SEEK_SET) == -1)
+	// ESSID
+	for (i = 0; i < ap_cur->ssid_length; i++)
 	{
-		return (0);
+		fprintf(f, "%c", ap_cur->essid[i]);
 	}
+	fprintf(f, ";");
 
-	fprintf(opt.f_kis, KISMET_HEADER);
+	// BSSID
+	fprintf(f,
+			"%02X:%02X:%02X:%02X:%02X:%02X;",
+			ap_cur->bssid[0],
+			ap_cur->bssid[1],
+			ap_cur->bssid[2],
+			ap_cur->bssid[3],
+			ap_cur->bssid[4],
+			ap_cur->bssid[5]);
 
-	ap_cur = ap_1st;
+	// Info
+	fprintf(f, ";");
 
-	k = 1;
-	while (ap_cur != NULL)
+	// Channel
+	fprintf(f, "%d;", ap_cur->channel);
+
+	// Cloaked
+	fprintf(f, "No;");
+
+	// Encryption
+	if ((ap_cur->security & (STD_OPN | STD_WEP | STD_WPA | STD_WPA2)) != 0)
 	{
-		if (memcmp(ap_cur->bssid, BROADCAST, 6) == 0)
+		if (ap_cur->security & STD_WPA2)
 		{
-			ap_cur = ap_cur->next;
-			continue;
+			if (ap_cur->security & AUTH_SAE || ap_cur->security & AUTH_OWE)
+				fprintf(f, "WPA3,");
+			else
+				fprintf(f, "WPA2,");
 		}
+		if (ap_cur->security & STD_WPA) fprintf(f, "WPA,");
+		if (ap_cur->security & STD_WEP) fprintf(f, "WEP,");
+		if (ap_cur->security & STD_OPN) fprintf(f, "OPN,");
+	}
 
-		if (ap_cur->security != 0 && f_encrypt != 0
-			&& ((ap_cur->security & f_encrypt) == 0))
-		{
-			ap_cur = ap_cur->next;
-			continue;
-		}
+	if ((ap_cur->security & ENC_FIELD) == 0)
+		fprintf(f, "None,");
+	else
+	{
+		if (ap_cur->security & ENC_CCMP) fprintf(f, "AES-CCM,");
+		if (ap_cur->security & ENC_WRAP) fprintf(f, "WRAP,");
+		if (ap_cur->security & ENC_TKIP) fprintf(f, "TKIP,");
+		if (ap_cur->security & ENC_WEP104) fprintf(f, "WEP104,");
+		if (ap_cur->security & ENC_WEP40) fprintf(f, "WEP40,");
+		if (ap_cur->security & ENC_GCMP) fprintf(f, "GCMP,");
+		if (ap_cur->security & ENC_GMAC) fprintf(f, "GMAC,");
+		if (ap_cur->security & AUTH_SAE) fprintf(f, "SAE,");
+		if (ap_cur->security & AUTH_OWE) fprintf(f, "OWE,");
+	}
+
+	fseek(f, -1, SEEK_CUR);
+	fprintf(f, ";");
 
-		if (is_filtered_essid(ap_cur->essid) || ap_cur->nb_pkt < 2)
+	// Decrypted
+	fprintf(f, "No;");
+
+	// MaxRate
+	fprintf(f, "%d.0;", ap_cur->max_speed);
+
+	// MaxSeenRate
+	fprintf(f, "0;");
+
+	// Beacon
+	fprintf(f, "%lu;", ap_cur->nb_bcn);
+
+	// LLC
+	fprintf(f, "0;");
+
+	// Data
+	fprintf(f, "%lu;", ap_cur->nb_data);
+
+	// Crypt
+	fprintf(f, "0;");
+
+	// Weak
+	fprintf(f, "0;");
+
+	// Total
+	fprintf(f, "%lu;", ap_cur->nb_data);
+
+	// Carrier
+	fprintf(f, ";");
+
+	// Encoding
+	fprintf(f, ";");
+
+	// FirstTime
+	fprintf(f, "%s", ctime(&ap_cur->tinit));
+	fseek(f, -1, SEEK_CUR);
+	fprintf(f, ";");
+
+	// LastTime
+	fprintf(f, "%s", ctime(&ap_cur->tlast));
+	fseek(f, -1, SEEK_CUR);
+	fprintf(f, ";");
+
+	// BestQuality
+	fprintf(f, "%d;", ap_cur->avg_power);
+
+	// BestSignal
+	fprintf(f, "0;");
+
+	// BestNoise
+	fprintf(f, "0;");
+
+	// GPSMinLat
+	fprintf(f, "%.6f;", ap_cur->gps_loc_min[0]);
+
+	// GPSMinLon
+	fprintf(f, "%.6f;", ap_cur->gps_loc_min[1]);
+
+	// GPSMinAlt
+	fprintf(f, "%.6f;", ap_cur->gps_loc_min[2]);
+
+	// GPSMinSpd
+	fprintf(f, "%.6f;", ap_cur->gps_loc_min[3]);
+
+	// GPSMaxLat
+	fprintf(f, "%.6f;", ap_cur->gps_loc_max[0]);
+
+	// GPSMaxLon
+	fprintf(f, "%.6f;", ap_cur->gps_loc_max[1]);
+
+	// GPSMaxAlt
+	fprintf(f, "%.6f;", ap_cur->gps_loc_max[2]);
+
+	// GPSMaxSpd
+	fprintf(f, "%.6f;", ap_cur->gps_loc_max[3]);
+
+	// GPSBestLat
+	fprintf(f, "%.6f;", ap_cur->gps_loc_best[0]);
+
+	// GPSBestLon
+	fprintf(f, "%.6f;", ap_cur->gps_loc_best[1]);
+
+	// GPSBestAlt
+	fprintf(f, "%.6f;", ap_cur->gps_loc_best[2]);
+
+	// DataSize
+	fprintf(f, "0;");
+
+	// IPType
+	fprintf(f, "0;");
+
+	// IP
+	fprintf(f,
+			"%d.%d.%d.%d;",
+			ap_cur->lanip[0],
+			ap_cur->lanip[1],
+			ap_cur->lanip[2],
+			ap_cur->lanip[3]);
+
+	fprintf(f, "\r\n");
+}
+
+static void dump_write_kismet_csv(FILE * out,
+								  struct AP_info * ap_1st,
+								  unsigned int f_encrypt)
+{
+	int k;
+	struct AP_info * ap_cur;
+	FILE * f;
+
+	fprintf(out, KISMET_HEADER);
+
+	k = 1;
+	for (ap_cur = ap_1st; ap_cur != NULL; ap_cur = ap_cur->next)
+	{
+		if (!is_written_ap(ap_cur, f_encrypt) || ap_cur->nb_pkt < 2) continue;
+
+		if (ap_cur->text[TEXT_KISMET_CSV].text == NULL)
 		{
-			ap_cur = ap_cur->next;
-			continue;
+			f = text_record_open(&ap_cur->text[TEXT_KISMET_CSV]);
+			kismet_print_ap(f, ap_cur);
+			text_record_close(f, &ap_cur->text[TEXT_KISMET_CSV]);
 		}
 
 		// Network
-		fprintf(opt.f_kis, "%d;", k);
+		fprintf(out, "%d;", k++);
+		text_put(out, &ap_cur->text[TEXT_KISMET_CSV]);
+	}
+}
 
-		// NetType
-		fprintf(opt.f_kis, "infrastructure;");
+/* Event log states of a record */
+#define TEXT_EVENT_NONE 0
+#define TEXT_EVENT_LIVE 1
+#define TEXT_EVENT_EXPIRED 2
 
-		// ESSID
-		for (i = 0; i < ap_cur->ssid_length; i++)
-		{
-			fprintf(opt.f_kis, "%c", ap_cur->essid[i]);
-		}
-		fprintf(opt.f_kis, ";");
+/* Returns the event to log for a record, NULL if there is none. */
+static const char *
+text_event(int * pending, int * logged, time_t tlast, time_t expired)
+{
+	const char * event = NULL;
+
+	if (*pending)
+	{
+		event = (*logged == TEXT_EVENT_NONE) ? "new" : "update";
+		*logged = TEXT_EVENT_LIVE;
+		*pending = 0;
+	}
+	else if (*logged == TEXT_EVENT_LIVE && tlast < expired)
+	{
+		event = "expire";
+		*logged = TEXT_EVENT_EXPIRED;
+	}
+
+	return (event);
+}
+
+static void dump_write_event(FILE * out,
+							 const char * now,
+							 const char * event,
+							 const char * type,
+							 const uint8_t * mac,
+							 const struct AP_info * ap_cur,
+							 int channel,
+							 int power,
+							 unsigned long nb_pkt)
+{
+	char * temp;
 
-		// BSSID
-		fprintf(opt.f_kis,
-				"%02X:%02X:%02X:%02X:%02X:%02X;",
+	fprintf(out,
+			"%s, %s, %s, %02X:%02X:%02X:%02X:%02X:%02X, ",
+			now,
+			event,
+			type,
+			mac[0],
+			mac[1],
+			mac[2],
+			mac[3],
+			mac[4],
+			mac[5]);
+
+	if (ap_cur == NULL || !memcmp(ap_cur->bssid, BROADCAST, 6))
+		fprintf(out, "(not associated), ");
+	else
+		fprintf(out,
+				"%02X:%02X:%02X:%02X:%02X:%02X, ",
 				ap_cur->bssid[0],
 				ap_cur->bssid[1],
 				ap_cur->bssid[2],
@@ -1426,154 +1633,288 @@ int dump_write_kismet_csv(struct AP_info * ap_1st,
 				ap_cur->bssid[4],
 				ap_cur->bssid[5]);
 
-		// Info
-		fprintf(opt.f_kis, ";");
-
-		// Channel
-		fprintf(opt.f_kis, "%d;", ap_cur->channel);
+	fprintf(out, "%2d, %3d, %8lu, ", channel, power, nb_pkt);
 
-		// Cloaked
-		fprintf(opt.f_kis, "No;");
-
-		// Encryption
-		if ((ap_cur->security & (STD_OPN | STD_WEP | STD_WPA | STD_WPA2)) != 0)
+	/* Only APs are logged with their ESSID */
+	if (ap_cur != NULL && mac == ap_cur->bssid)
+	{
+		if (verifyssid(ap_cur->essid))
+			fprintf(out, "%s", ap_cur->essid);
+		else
 		{
-			if (ap_cur->security & STD_WPA2)
+			temp = format_text_for_csv(ap_cur->essid,
+									   (size_t) ap_cur->ssid_length);
+			if (temp != NULL) //-V547
 			{
-				if (ap_cur->security & AUTH_SAE || ap_cur->security & AUTH_OWE)
-					fprintf(opt.f_kis, "WPA3,");
-				else
-					fprintf(opt.f_kis, "WPA2,");
+				fprintf(out, "%s", temp);
+				free(temp);
 			}
-			if (ap_cur->security & STD_WPA) fprintf(opt.f_kis, "WPA,");
-			if (ap_cur->security & STD_WEP) fprintf(opt.f_kis, "WEP,");
-			if (ap_cur->security & STD_OPN) fprintf(opt.f_kis, "OPN,");
 		}
+	}
 
-		if ((ap_cur->security & ENC_FIELD) == 0)
-			fprintf(opt.f_kis, "None,");
-		else
-		{
-			if (ap_cur->security & ENC_CCMP) fprintf(opt.f_kis, "AES-CCM,");
-			if (ap_cur->security & ENC_WRAP) fprintf(opt.f_kis, "WRAP,");
-			if (ap_cur->security & ENC_TKIP) fprintf(opt.f_kis, "TKIP,");
-			if (ap_cur->security & ENC_WEP104) fprintf(opt.f_kis, "WEP104,");
-			if (ap_cur->security & ENC_WEP40) fprintf(opt.f_kis, "WEP40,");
-			if (ap_cur->security & ENC_GCMP) fprintf(opt.f_kis, "GCMP,");
-			if (ap_cur->security & ENC_GMAC) fprintf(opt.f_kis, "GMAC,");
-			if (ap_cur->security & AUTH_SAE) fprintf(opt.f_kis, "SAE,");
-			if (ap_cur->security & AUTH_OWE) fprintf(opt.f_kis, "OWE,");
-		}
+	fprintf(out, "\r\n");
+}
 
-		fseek(opt.f_kis, -1, SEEK_CUR);
-		fprintf(opt.f_kis, ";");
+static void dump_write_events(FILE * out,
+							  struct AP_info * ap_1st,
+							  struct ST_info * st_1st,
+							  unsigned int f_encrypt,
+							  time_t expired)
+{
+	struct AP_info * ap_cur;
+	struct ST_info * st_cur;
+	const char * event;
+	char now[32];
+	time_t tnow = time(NULL);
+
+	strftime(now, sizeof(now), "%Y-%m-%d %H:%M:%S", localtime(&tnow));
 
-		// Decrypted
-		fprintf(opt.f_kis, "No;");
+	for (ap_cur = ap_1st; ap_cur != NULL; ap_cur = ap_cur->next)
+	{
+		if (!is_written_ap(ap_cur, f_encrypt)) continue;
+
+		event = text_event(&ap_cur->text_pending,
+						   &ap_cur->text_logged,
+						   ap_cur->tlast,
+						   expired);
+		if (event == NULL) continue;
+
+		dump_write_event(out,
+						 now,
+						 event,
+						 "AP",
+						 ap_cur->bssid,
+						 ap_cur,
+						 ap_cur->channel,
+						 ap_cur->avg_power,
+						 ap_cur->nb_pkt);
+	}
+
+	for (st_cur = st_1st; st_cur != NULL; st_cur = st_cur->next)
+	{
+		if (st_cur->base->nb_pkt < 2) continue;
+
+		event = text_event(&st_cur->text_pending,
+						   &st_cur->text_logged,
+						   st_cur->tlast,
+						   expired);
+		if (event == NULL) continue;
+
+		dump_write_event(out,
+						 now,
+						 event,
+						 "Station",
+						 st_cur->stmac,
+						 st_cur->base,
+						 st_cur->channel,
+						 st_cur->power,
+						 st_cur->nb_pkt);
+	}
+}
 
-		// MaxRate
-		fprintf(opt.f_kis, "%d.0;", ap_cur->max_speed);
+/* Logs the last state of an AP, or of a station when st_cur is given, which
+   the retention limits drop from memory. Must be called with the AP and
+   station lists locked. */
+void dump_write_evicted(struct AP_info * ap_cur,
+						struct ST_info * st_cur,
+						unsigned int f_encrypt)
+{
+	char now[32];
+	time_t tnow = time(NULL);
 
-		// MaxSeenRate
-		fprintf(opt.f_kis, "0;");
+	REQUIRE(ap_cur != NULL);
 
-		// Beacon
-		fprintf(opt.f_kis, "%lu;", ap_cur->nb_bcn);
+	if (!opt.record_data || !opt.output_format_events || opt.f_events == NULL)
+		return;
 
-		// LLC
-		fprintf(opt.f_kis, "0;");
+	strftime(now, sizeof(now), "%Y-%m-%d %H:%M:%S", localtime(&tnow));
 
-		// Data
-		fprintf(opt.f_kis, "%lu;", ap_cur->nb_data);
+	if (st_cur != NULL)
+	{
+		if (ap_cur->nb_pkt < 2) return;
+
+		dump_write_event(opt.f_events,
+						 now,
+						 "evict",
+						 "Station",
+						 st_cur->stmac,
+						 ap_cur,
+						 st_cur->channel,
+						 st_cur->power,
+						 st_cur->nb_pkt);
+	}
+	else
+	{
+		if (!is_written_ap(ap_cur, f_encrypt)) return;
+
+		dump_write_event(opt.f_events,
+						 now,
+						 "evict",
+						 "AP",
+						 ap_cur->bssid,
+						 ap_cur,
+						 ap_cur->channel,
+						 ap_cur->avg_power,
+						 ap_cur->nb_pkt);
+	}
+}
 
-		// Crypt
-		fprintf(opt.f_kis, "0;");
+/* Logs the last state of an unknown station (--showack), which the retention
+   limits drop from memory. Its packets are the control and other frames it
+   was seen in. Must be called with the AP and station lists locked. */
+void dump_write_evicted_na(const struct NA_info * na_cur)
+{
+	char now[32];
+	time_t tnow = time(NULL);
+
+	REQUIRE(na_cur != NULL);
+
+	if (!opt.record_data || !opt.output_format_events || opt.f_events == NULL)
+		return;
+
+	strftime(now, sizeof(now), "%Y-%m-%d %H:%M:%S", localtime(&tnow));
+
+	dump_write_event(opt.f_events,
+					 now,
+					 "evict",
+					 "Unknown",
+					 na_cur->namac,
+					 NULL,
+					 na_cur->channel,
+					 na_cur->power,
+					 (unsigned long) (na_cur->ack + na_cur->cts + na_cur->rts_r
+									  + na_cur->rts_t + na_cur->other));
+}
 
-		// Weak
-		fprintf(opt.f_kis, "0;");
+/* Builds the enabled text output files into memory, re-serializing only the
+   records updated since the previous call. Records older than expired are
+   reported as such in the event log. Must be called with the AP and station
+   lists locked; the result is written by dump_save_text_files(). */
+int dump_write_text_files(struct AP_info * ap_1st,
+						  struct ST_info * st_1st,
+						  unsigned int f_encrypt,
+						  char * airodump_start_time,
+						  time_t expired,
+						  struct text_files * out)
+{
+	struct AP_info * ap_cur;
+	struct ST_info * st_cur;
+	FILE * f;
 
-		// Total
-		fprintf(opt.f_kis, "%lu;", ap_cur->nb_data);
+	REQUIRE(out != NULL);
 
-		// Carrier
-		fprintf(opt.f_kis, ";");
+	memset(out, 0, sizeof(*out));
 
-		// Encoding
-		fprintf(opt.f_kis, ";");
+	if (!opt.record_data) return (0);
 
-		// FirstTime
-		fprintf(opt.f_kis, "%s", ctime(&ap_cur->tinit));
-		fseek(opt.f_kis, -1, SEEK_CUR);
-		fprintf(opt.f_kis, ";");
+	/* Stations are part of their AP's netxml record */
+	for (st_cur = st_1st; st_cur != NULL; st_cur = st_cur->next)
+	{
+		if (!st_cur->text_dirty) continue;
 
-		// LastTime
-		fprintf(opt.f_kis, "%s", ctime(&ap_cur->tlast));
-		fseek(opt.f_kis, -1, SEEK_CUR);
-		fprintf(opt.f_kis, ";");
+		if (st_cur->base != NULL) st_cur->base->text_dirty = 1;
 
-		// BestQuality
-		fprintf(opt.f_kis, "%d;", ap_cur->avg_power);
+		dump_write_forget(st_cur->text);
+		st_cur->text_pending = 1;
+		st_cur->text_dirty = 0;
+	}
 
-		// BestSignal
-		fprintf(opt.f_kis, "0;");
+	for (ap_cur = ap_1st; ap_cur != NULL; ap_cur = ap_cur->next)
+	{
+		if (!ap_cur->text_dirty) continue;
 
-		// BestNoise
-		fprintf(opt.f_kis, "0;");
+		dump_write_forget(ap_cur->text);
+		ap_cur->text_pending = 1;
+		ap_cur->text_dirty = 0;
+	}
 
-		// GPSMinLat
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_min[0]);
+	if (opt.output_format_csv)
+	{
+		f = text_record_open(&out->csv);
+		dump_write_csv(f, ap_1st, st_1st, f_encrypt);
+		text_record_close(f, &out->csv);
+	}
 
-		// GPSMinLon
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_min[1]);
+	if (opt.output_format_kismet_csv)
+	{
+		f = text_record_open(&out->kismet_csv);
+		dump_write_kismet_csv(f, ap_1st, f_encrypt);
+		text_record_close(f, &out->kismet_csv);
+	}
 
-		// GPSMinAlt
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_min[2]);
+	if (opt.output_format_kismet_netxml)
+	{
+		f = text_record_open(&out->netxml);
+		dump_write_kismet_netxml(
+			f, ap_1st, st_1st, f_encrypt, airodump_start_time);
+		text_record_close(f, &out->netxml);
+	}
 
-		// GPSMinSpd
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_min[3]);
+	if (opt.output_format_events && opt.f_events != NULL)
+	{
+		f = text_record_open(&out->events);
+		dump_write_events(f, ap_1st, st_1st, f_encrypt, expired);
+		text_record_close(f, &out->events);
+	}
 
-		// GPSMaxLat
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_max[0]);
+	return (0);
+}
 
-		// GPSMaxLon
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_max[1]);
+/* Replaces a snapshot file through a temporary file, so readers never see a
+   partially written one. */
+static int text_save(const char * name, const struct text_record * tr)
+{
+	char * tmp;
+	size_t tmp_len;
+	FILE * f;
+	int ret = 0;
 
-		// GPSMaxAlt
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_max[2]);
+	if (name == NULL || tr->text == NULL) return (0);
 
-		// GPSMaxSpd
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_max[3]);
+	tmp_len = strlen(name) + sizeof(".tmp");
+	tmp = (char *) malloc(tmp_len);
+	ALLEGE(tmp != NULL);
+	snprintf(tmp, tmp_len, "%s.tmp", name);
 
-		// GPSBestLat
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_best[0]);
+	if ((f = fopen(tmp, "wb")) == NULL)
+	{
+		free(tmp);
+		return (1);
+	}
 
-		// GPSBestLon
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_best[1]);
+	if (fwrite(tr->text, 1, tr->len, f) != tr->len) ret = 1;
+	if (fclose(f) != 0) ret = 1;
+	if (ret == 0 && rename(tmp, name) != 0) ret = 1;
+	if (ret != 0) unlink(tmp);
 
-		// GPSBestAlt
-		fprintf(opt.f_kis, "%.6f;", ap_cur->gps_loc_best[2]);
+	free(tmp);
 
-		// DataSize
-		fprintf(opt.f_kis, "0;");
+	return (ret);
+}
 
-		// IPType
-		fprintf(opt.f_kis, "0;");
+/* Writes out and releases a snapshot from dump_write_text_files(). Does not
+   touch the AP and station lists, so it can run without holding their lock. */
+int dump_save_text_files(struct text_files * out)
+{
+	int ret = 0;
 
-		// IP
-		fprintf(opt.f_kis,
-				"%d.%d.%d.%d;",
-				ap_cur->lanip[0],
-				ap_cur->lanip[1],
-				ap_cur->lanip[2],
-				ap_cur->lanip[3]);
+	REQUIRE(out != NULL);
 
-		fprintf(opt.f_kis, "\r\n");
+	ret |= text_save(opt.f_txt_name, &out->csv);
+	ret |= text_save(opt.f_kis_name, &out->kismet_csv);
+	ret |= text_save(opt.f_kis_xml_name, &out->netxml);
 
-		ap_cur = ap_cur->next;
-		k++;
+	if (out->events.text != NULL && opt.f_events != NULL)
+	{
+		text_put(opt.f_events, &out->events);
+		fflush(opt.f_events);
 	}
 
-	fflush(opt.f_kis);
+	free(out->csv.text);
+	free(out->kismet_csv.text);
+	free(out->netxml.text);
+	free(out->events.text);
+	memset(out, 0, sizeof(*out));
 
-	return (0);
+	return (ret);
 }
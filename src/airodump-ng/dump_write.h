@@ -32,9 +32,29 @@
 #ifndef _AIRODUMP_NG_DUMP_WRITE_H_
 #define _AIRODUMP_NG_DUMP_WRITE_H_
 
-int dump_write_csv(struct AP_info * ap_1st,
-				   struct ST_info * st_1st,
-				   unsigned int f_encrypt);
+/* Snapshot of the text output files, built by dump_write_text_files() */
+struct text_files
+{
+	struct text_record csv;
+	struct text_record kismet_csv;
+	struct text_record netxml;
+	struct text_record events;
+};
+
+int dump_write_text_files(struct AP_info * ap_1st,
+						  struct ST_info * st_1st,
+						  unsigned int f_encrypt,
+						  char * airodump_start_time,
+						  time_t expired,
+						  struct text_files * out);
+int dump_save_text_files(struct text_files * out);
+void dump_write_forget(struct text_record * text);
+FILE * text_record_open(struct text_record * tr);
+void text_record_close(FILE * f, struct text_record * tr);
+void dump_write_evicted(struct AP_info * ap_cur,
+						struct ST_info * st_cur,
+						unsigned int f_encrypt);
+void dump_write_evicted_na(const struct NA_info * na_cur);
 int dump_write_airodump_ng_logcsv_add_ap(const struct AP_info * ap_cur,
 										 const int32_t ri_power,
 										 struct tm * tm_gpstime,
@@ -45,12 +65,5 @@ int dump_write_airodump_ng_logcsv_add_client(const struct AP_info * ap_cur,
 											 struct tm * tm_gpstime,
 											 float * gps_loc);
 char * get_manufacturer_from_string(char * buffer);
-int dump_write_kismet_netxml(struct AP_info * ap_1st,
-							 struct ST_info * st_1st,
-							 unsigned int f_encrypt,
-							 char * airodump_start_time);
-int dump_write_kismet_csv(struct AP_info * ap_1st,
-						  struct ST_info * st_1st,
-						  unsigned int f_encrypt);
 
 #endif /* _AIRODUMP_NG_DUMP_WRITE_H_ */
\ No newline at end of file
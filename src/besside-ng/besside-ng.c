@@ -73,6 +73,9 @@
 #include "aircrack-ng/tui/console.h"
 #include "aircrack-ng/support/common.h"
 
+#define WIFI_READ_BATCH 64 /* frames read at once */
+#define WIFI_WRITE_BATCH 32 /* frames written at once */
+
 static int PTW_DEFAULTBF[PTW_KEYHSBYTES]
 	= {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	   0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -155,6 +158,8 @@ static struct conf
 	int cf_do_wep;
 	int cf_do_wpa;
 	char * cf_wpa_server;
+	char * cf_ptw_state;
+	int cf_rx_ring;
 #ifdef HAVE_PCRE
 	pcre * cf_essid_regex;
 #endif
@@ -648,12 +653,29 @@ static void wifi_send(void * p, int len)
 	if (rc == -1) err(1, "wi_write()");
 }
 
-static void deauth_send(struct network * n, unsigned char * mac)
+static void wifi_send_batch(struct wi_frame * frames, int nb)
+{
+	int rc, sent = 0;
+	struct tx_info tx;
+
+	memset(&tx, 0, sizeof(tx));
+
+	while (sent < nb)
+	{
+		rc = wi_write_batch(_state.s_wi, frames + sent, nb - sent, &tx);
+		if (rc == -1) err(1, "wi_write_batch()");
+
+		sent += rc;
+	}
+}
+
+/* Builds the deauth for mac in buf, returns its length. */
+static int deauth_fill(struct network * n, unsigned char * mac, void * buf)
 {
 	REQUIRE(n != NULL);
 	REQUIRE(mac != NULL);
+	REQUIRE(buf != NULL);
 
-	unsigned char buf[sizeof(struct ieee80211_frame) * 16];
 	struct ieee80211_frame * wh = (struct ieee80211_frame *) buf;
 	uint16_t * rc = (uint16_t *) (wh + 1);
 
@@ -671,7 +693,7 @@ static void deauth_send(struct network * n, unsigned char * mac)
 	time_printf(V_VERBOSE, "Sending deauth to %s\n", mac_p);
 	free(mac_p);
 
-	wifi_send(wh, (unsigned long) rc - (unsigned long) wh);
+	return ((int) ((unsigned long) rc - (unsigned long) wh));
 }
 
 static void deauth(void * arg)
@@ -680,17 +702,32 @@ static void deauth(void * arg)
 
 	struct network * n = arg;
 	struct client * c = n->n_clients.c_next;
+	unsigned char buf[WIFI_WRITE_BATCH][sizeof(struct ieee80211_frame) * 16]
+		__attribute__((aligned(8)));
+	struct wi_frame frames[WIFI_WRITE_BATCH];
+	unsigned char * mac = BROADCAST;
+	int nb = 0;
 
 	if (_state.s_state != STATE_ATTACK || _state.s_curnet != n
 		|| n->n_astate != ASTATE_DEAUTH)
 		return;
 
-	deauth_send(n, BROADCAST);
-
-	while (c)
+	/* the broadcast one, then one per client, in as few writes as we can */
+	while (mac != NULL)
 	{
-		deauth_send(n, c->c_mac);
-		c = c->c_next;
+		memset(&frames[nb], 0, sizeof(frames[nb]));
+		frames[nb].h80211 = buf[nb];
+		frames[nb].len = deauth_fill(n, mac, buf[nb]);
+		frames[nb].dlt = LINKTYPE_IEEE802_11;
+
+		mac = c ? c->c_mac : NULL;
+		if (c) c = c->c_next;
+
+		if (++nb == WIFI_WRITE_BATCH || mac == NULL)
+		{
+			wifi_send_batch(frames, nb);
+			nb = 0;
+		}
 	}
 
 	timer_in(_conf.cf_deauthfreq * 1000, deauth, n);
@@ -2395,8 +2432,92 @@ do_wep_crack(struct cracker * c, struct network * n, int len, int limit)
 	IGNORE_LTZ(write(c->cr_pipe[1], key, len));
 }
 
+static void ptw_state_path(char * path, size_t len, struct network * n)
+{
+	REQUIRE(path != NULL);
+	REQUIRE(n != NULL);
+
+	snprintf(path,
+			 len,
+			 "%s/%02X-%02X-%02X-%02X-%02X-%02X.ptw",
+			 _conf.cf_ptw_state,
+			 n->n_bssid[0],
+			 n->n_bssid[1],
+			 n->n_bssid[2],
+			 n->n_bssid[3],
+			 n->n_bssid[4],
+			 n->n_bssid[5]);
+}
+
+/* loads the IVs saved by an earlier run, or by aircrack-ng --ptw-state */
+static void ptw_state_load(struct network * n)
+{
+	REQUIRE(n != NULL);
+
+	char path[PATH_MAX];
+	PTW_attackstate *clean, *vague;
+	FILE * f;
+
+	ptw_state_path(path, sizeof(path), n);
+
+	if ((f = fopen(path, "rb")) == NULL) return;
+
+	/* aircrack-ng saves the clean sessions first, they are all in vague */
+	clean = PTW_loadstate(f);
+	vague = clean ? PTW_loadstate(f) : NULL;
+	fclose(f);
+
+	PTW_freeattackstate(clean);
+
+	if (!vague)
+	{
+		time_printf(V_NORMAL,
+					"Ignoring %s: damaged or saved by another version\n",
+					path);
+		return;
+	}
+
+	PTW_freeattackstate(n->n_ptw);
+	n->n_ptw = vague;
+	n->n_data_count = vague->packets_collected;
+	n->n_crack_next = n->n_data_count + 1;
+
+	time_printf(V_NORMAL, "Loaded %d IVs from %s\n", n->n_data_count, path);
+}
+
+/* runs in the cracker child, whose copy of the IVs can't change under it */
+static void ptw_state_save(struct network * n)
+{
+	REQUIRE(n != NULL);
+
+	char path[PATH_MAX];
+	char tmp[PATH_MAX + 4];
+	PTW_attackstate * clean;
+	FILE * f;
+	int rc;
+
+	ptw_state_path(path, sizeof(path), n);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	if ((f = fopen(tmp, "wb")) == NULL) return;
+
+	/* same layout as aircrack-ng: no clean sessions, then all of them */
+	clean = PTW_newattackstate();
+	if (!clean) err(1, "PTW_newattackstate()");
+
+	rc = PTW_savestate(clean, f);
+	if (rc == 0) rc = PTW_savestate(n->n_ptw, f);
+	if (fclose(f) != 0) rc = -1;
+
+	PTW_freeattackstate(clean);
+
+	if (rc != 0 || rename(tmp, path) != 0) unlink(tmp);
+}
+
 static inline void crack_wep64(struct cracker * c, struct network * n)
 {
+	if (_conf.cf_ptw_state) ptw_state_save(n);
+
 	do_wep_crack(c, n, 5, KEYLIMIT / 10);
 }
 
@@ -2478,6 +2599,8 @@ static int ptw_add(struct network * n,
 	{
 		n->n_ptw = PTW_newattackstate();
 		if (!n->n_ptw) err(1, "PTW_newattackstate()");
+
+		if (_conf.cf_ptw_state) ptw_state_load(n);
 	}
 
 	if (PTW_addsession(n->n_ptw, body, clear, weight, k))
@@ -2607,26 +2730,26 @@ static struct network * network_update(struct ieee80211_frame * wh)
 	return (n);
 }
 
-static void wifi_read(void)
+static void wifi_process(unsigned char * frame, int len, struct rx_info * ri)
 {
 	struct state * s = &_state;
 	unsigned char buf[sizeof(struct ieee80211_frame) * 8];
 	int rd;
-	struct rx_info ri;
 	struct ieee80211_frame * wh = (struct ieee80211_frame *) buf;
 	struct network * n;
 
-	memset(buf, 0, sizeof(buf));
+	/* the handlers expect at most this much, zero padded */
+	rd = MIN(len, (int) sizeof(buf));
 
-	rd = wi_read(s->s_wi, NULL, NULL, buf, sizeof(buf), &ri);
-	if (rd < 0) err(1, "wi_read()");
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, frame, rd);
 
 	if (rd < (int) sizeof(struct ieee80211_frame))
 	{
 		return;
 	}
 
-	s->s_ri = &ri;
+	s->s_ri = ri;
 
 	n = network_update(wh);
 
@@ -2649,6 +2772,20 @@ static void wifi_read(void)
 	}
 }
 
+static void wifi_read(void)
+{
+	struct state * s = &_state;
+	static struct wi_frame frames[WIFI_READ_BATCH];
+	static unsigned char buf[WIFI_READ_BATCH * 4096];
+	int nb, i;
+
+	nb = wi_read_batch(s->s_wi, frames, WIFI_READ_BATCH, buf, sizeof(buf));
+	if (nb < 0) err(1, "wi_read()");
+
+	for (i = 0; i < nb; i++)
+		wifi_process(frames[i].h80211, frames[i].len, &frames[i].ri);
+}
+
 static const char * astate2str(int astate)
 {
 	static char num[16];
@@ -3017,6 +3154,8 @@ static void pwn(void)
 
 	if (!(s->s_wi = wi_open(_conf.cf_ifname))) err(1, "wi_open()");
 
+	wi_set_rx_ring(s->s_wi, _conf.cf_rx_ring);
+
 	if (wi_get_mac(s->s_wi, _state.s_mac) == -1) err(1, "wi_get_mac()");
 
 	gettimeofday(&_state.s_now, NULL);
@@ -3275,6 +3414,8 @@ static void usage(char * prog)
 		   "       -c <chan>             chanlock\n"
 		   "       -p <pps>              flood rate\n"
 		   "       -W                    WPA only\n"
+		   "       -P <dir>              keep the WEP IVs of each AP in dir\n"
+		   "       -r                    read through a kernel ring (Linux)\n"
 		   "       -v                    verbose, -vv for more, etc.\n"
 		   "       -h                    This help screen\n"
 		   "\n",
@@ -3294,7 +3435,7 @@ int main(int argc, char * argv[])
 
 	init_conf();
 
-	while ((ch = getopt(argc, argv, "hb:vWs:c:p:R:")) != -1)
+	while ((ch = getopt(argc, argv, "hb:vWs:c:p:P:rR:")) != -1)
 	{
 		switch (ch)
 		{
@@ -3306,6 +3447,14 @@ int main(int argc, char * argv[])
 				_conf.cf_do_wep = 0;
 				break;
 
+			case 'P':
+				_conf.cf_ptw_state = optarg;
+				break;
+
+			case 'r':
+				_conf.cf_rx_ring = 1;
+				break;
+
 			case 'p':
 				temp = atoi(optarg);
 				if (temp <= 0)
@@ -41,6 +41,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "aircrack-ng/defs.h"
 #include "aircrack-ng/version.h"
@@ -54,11 +55,10 @@
 #include "aircrack-ng/support/common.h"
 #include "aircrack-ng/third-party/eapol.h"
 #include "aircrack-ng/tui/console.h"
+#include "aircrack-ng/adt/circular_queue.h"
 
 #define FAILURE -1
-#define IVS 1
 #define WPA 2
-#define ESSID 3
 
 #include "aircrack-ng/support/station.h"
 
@@ -66,7 +66,6 @@
 
 static struct globals
 {
-	struct AP_info *ap_1st, *ap_end;
 	struct ST_info *st_1st, *st_end;
 
 	unsigned char prev_bssid[6];
@@ -91,13 +90,190 @@ static void usage(int what)
 			   "        Merge ivs files\n");
 }
 
+/* --merge reads each input file in a thread of its own, which hands blocks
+ * of records over to the writer. The writer takes one block from each input
+ * in turn, so the output does not depend on the thread scheduling, and
+ * drops the IVs already written for the same BSSID. */
+
+#define MERGE_BLOCK_SIZE (256 * 1024)
+#define MERGE_QUEUE_LEN 4 /* blocks in flight per input, a power of two */
+#define MERGE_WRITE_BUFFER (1024 * 1024)
+
+/* each record is stored as: BSSID, struct ivs2_pkthdr, payload */
+
+struct merge_block
+{
+	size_t len;
+	unsigned char data[MERGE_BLOCK_SIZE];
+};
+
+struct merge_input
+{
+	const char * filename;
+	FILE * f;
+	pthread_t tid;
+	cqueue_handle_t queue;
+	uint8_t queue_buf[MERGE_QUEUE_LEN * sizeof(struct merge_block *)];
+	volatile int error;
+	int done;
+};
+
+/* IVs already written for one BSSID, per kind of record */
+
+enum
+{
+	MERGE_SEEN_IV,
+	MERGE_SEEN_XOR,
+	MERGE_SEEN_PTW,
+	MERGE_SEEN_KINDS
+};
+
+struct merge_ap
+{
+	unsigned char bssid[6];
+	unsigned char ** seen[MERGE_SEEN_KINDS];
+	int essid_written;
+};
+
+static THREAD_ENTRY(merge_reader)
+{
+	struct merge_input * in = (struct merge_input *) arg;
+	struct merge_block * blk;
+	struct ivs2_pkthdr ivs2;
+	unsigned char bssid[6];
+	unsigned char * p;
+	size_t rec_len;
+
+	memset(bssid, 0, sizeof(bssid));
+
+	blk = (struct merge_block *) malloc(sizeof(*blk));
+	ALLEGE(blk != NULL);
+	blk->len = 0;
+
+	while (fread(&ivs2, sizeof(ivs2), 1, in->f) == 1)
+	{
+		/* the length of a record includes its BSSID, if there is one */
+		if (ivs2.flags & IVS2_BSSID)
+		{
+			if (ivs2.len < sizeof(bssid)
+				|| fread(bssid, sizeof(bssid), 1, in->f) != 1)
+			{
+				in->error = 1;
+				break;
+			}
+			ivs2.len -= sizeof(bssid);
+		}
+
+		rec_len = sizeof(bssid) + sizeof(ivs2) + ivs2.len;
+
+		if (blk->len + rec_len > MERGE_BLOCK_SIZE)
+		{
+			circular_queue_push(in->queue, &blk, sizeof(blk));
+
+			blk = (struct merge_block *) malloc(sizeof(*blk));
+			ALLEGE(blk != NULL);
+			blk->len = 0;
+		}
+
+		p = blk->data + blk->len;
+		ivs2.flags &= ~IVS2_BSSID;
+		memcpy(p, bssid, sizeof(bssid));
+		memcpy(p + sizeof(bssid), &ivs2, sizeof(ivs2));
+
+		if (ivs2.len > 0
+			&& fread(p + sizeof(bssid) + sizeof(ivs2), ivs2.len, 1, in->f)
+				   != 1)
+		{
+			in->error = 1;
+			break;
+		}
+
+		blk->len += rec_len;
+	}
+
+	if (ferror(in->f)) in->error = 1;
+
+	if (blk->len > 0)
+		circular_queue_push(in->queue, &blk, sizeof(blk));
+	else
+		free(blk);
+
+	/* end of this input */
+	blk = NULL;
+	circular_queue_push(in->queue, &blk, sizeof(blk));
+
+	return (NULL);
+}
+
+static struct merge_ap *
+merge_find_ap(struct merge_ap ** aps, size_t * nb_aps, unsigned char * bssid)
+{
+	struct merge_ap * ap;
+	size_t i;
+
+	for (i = 0; i < *nb_aps; i++)
+		if (memcmp((*aps)[i].bssid, bssid, 6) == 0) return (&(*aps)[i]);
+
+	ap = (struct merge_ap *) realloc(*aps, (*nb_aps + 1) * sizeof(*ap));
+	ALLEGE(ap != NULL);
+	*aps = ap;
+
+	ap = &(*aps)[(*nb_aps)++];
+	memset(ap, 0, sizeof(*ap));
+	memcpy(ap->bssid, bssid, 6);
+
+	return (ap);
+}
+
+/* returns 1 if the record should be written */
+
+static int merge_keep(struct merge_ap * ap, struct ivs2_pkthdr * ivs2,
+					  unsigned char * payload)
+{
+	int kind;
+
+	if (ivs2->flags & IVS2_ESSID)
+	{
+		if (ap->essid_written) return (0);
+		ap->essid_written = 1;
+		return (1);
+	}
+
+	if (ivs2->flags & (IVS2_WPA | IVS2_CLR) || ivs2->len < 3) return (1);
+
+	if (ivs2->flags & IVS2_XOR)
+		kind = MERGE_SEEN_XOR;
+	else if (ivs2->flags & IVS2_PTW)
+		kind = MERGE_SEEN_PTW;
+	else
+		kind = MERGE_SEEN_IV;
+
+	if (ap->seen[kind] == NULL)
+	{
+		ap->seen[kind] = uniqueiv_init();
+		ALLEGE(ap->seen[kind] != NULL);
+	}
+
+	if (uniqueiv_check(ap->seen[kind], payload) == IV_PRESENT) return (0);
+
+	ALLEGE(uniqueiv_mark(ap->seen[kind], payload) == 0);
+
+	return (1);
+}
+
 static int merge(int argc, char * argv[])
 {
-	int i, n;
-	unsigned long nbw;
-	unsigned char buffer[1024];
-	FILE *f_in, *f_out;
-	struct ivs2_filehdr fivs2;
+	int i, k, nb_in, nb_done, rc;
+	unsigned long nb_read, nb_written;
+	unsigned char buffer[4];
+	unsigned char prev_bssid[6];
+	int have_prev;
+	FILE * f_out;
+	struct ivs2_filehdr fivs2, first_hdr;
+	struct merge_input * inputs;
+	struct merge_block * blk;
+	struct merge_ap * aps = NULL;
+	size_t nb_aps = 0, pos;
 
 	if (argc < 5)
 	{
@@ -115,268 +291,508 @@ static int merge(int argc, char * argv[])
 		}
 	}
 
-	printf("Creating %s\n", argv[argc - 1]);
+	nb_in = argc - 3;
+	inputs = (struct merge_input *) calloc((size_t) nb_in, sizeof(*inputs));
+	ALLEGE(inputs != NULL);
 
-	if ((f_out = fopen(argv[argc - 1], "wb+")) == NULL)
-	{
-		perror("fopen failed");
-		return (EXIT_FAILURE);
-	}
+	rc = EXIT_FAILURE;
+	f_out = NULL;
 
-	nbw = 0;
+	/* check all the headers before writing anything */
 
-	for (i = 2; i < argc - 1; ++i)
+	for (k = 0; k < nb_in; ++k)
 	{
-		printf("Opening %s\n", argv[i]);
+		struct merge_input * in = &inputs[k];
+
+		in->filename = argv[k + 2];
 
-		if ((f_in = fopen(argv[i], "rb")) == NULL)
+		printf("Opening %s\n", in->filename);
+
+		if ((in->f = fopen(in->filename, "rb")) == NULL)
 		{
-			fclose(f_out);
 			perror("fopen failed");
-			return (EXIT_FAILURE);
+			goto merge_done;
 		}
 
-		if (fread(buffer, 1, 4, f_in) != 4)
+		if (fread(buffer, 1, 4, in->f) != 4)
 		{
-			fclose(f_out);
-			fclose(f_in);
 			perror("fread file header failed");
-			return (EXIT_FAILURE);
+			goto merge_done;
 		}
 
 		if (memcmp(buffer, IVSONLY_MAGIC, 4) == 0)
 		{
-			fclose(f_out);
-			fclose(f_in);
-			printf("%s is an old .ivs file\n", argv[i]);
-			return (EXIT_FAILURE);
+			printf("%s is an old .ivs file\n", in->filename);
+			goto merge_done;
 		}
 
 		if (memcmp(buffer, IVS2_MAGIC, 4) != 0)
 		{
-			fclose(f_out);
-			fclose(f_in);
-			printf("%s is not an .%s file\n", argv[i], IVS2_EXTENSION);
-			return (EXIT_FAILURE);
+			printf("%s is not an .%s file\n", in->filename, IVS2_EXTENSION);
+			goto merge_done;
 		}
 
-		if (fread(&fivs2, 1, sizeof(struct ivs2_filehdr), f_in)
+		if (fread(&fivs2, 1, sizeof(struct ivs2_filehdr), in->f)
 			!= (size_t) sizeof(struct ivs2_filehdr))
 		{
-			fclose(f_out);
-			fclose(f_in);
 			perror("fread file header failed");
-			return (EXIT_FAILURE);
+			goto merge_done;
 		}
 
 		if (fivs2.version > IVS2_VERSION)
 		{
-			fclose(f_out);
-			fclose(f_in);
 			printf("Error, wrong %s version: %d. Supported up to version %d.\n",
 				   IVS2_EXTENSION,
 				   fivs2.version,
 				   IVS2_VERSION);
-			return (EXIT_FAILURE);
+			goto merge_done;
 		}
 
-		if (i == 2)
+		/* the header of the first file is the one written */
+		if (k == 0) memcpy(&first_hdr, &fivs2, sizeof(fivs2));
+	}
+
+	printf("Creating %s\n", argv[argc - 1]);
+
+	if ((f_out = fopen(argv[argc - 1], "wb+")) == NULL)
+	{
+		perror("fopen failed");
+		goto merge_done;
+	}
+
+	setvbuf(f_out, NULL, _IOFBF, MERGE_WRITE_BUFFER);
+
+	(void) fwrite(IVS2_MAGIC, 1, 4, f_out);
+	(void) fwrite(&first_hdr, 1, sizeof(struct ivs2_filehdr), f_out);
+
+	for (k = 0; k < nb_in; ++k)
+	{
+		inputs[k].queue = circular_queue_init(inputs[k].queue_buf,
+											  sizeof(inputs[k].queue_buf),
+											  sizeof(struct merge_block *));
+		ALLEGE(inputs[k].queue != NULL);
+		ALLEGE(pthread_create(&inputs[k].tid, NULL, &merge_reader, &inputs[k])
+			   == 0);
+	}
+
+	nb_read = nb_written = 0;
+	have_prev = 0;
+	nb_done = 0;
+
+	while (nb_done < nb_in)
+	{
+		for (k = 0; k < nb_in; ++k)
 		{
-			(void) fwrite(buffer, 1, 4, f_out);
-			(void) fwrite(&fivs2, 1, sizeof(struct ivs2_filehdr), f_out);
+			struct merge_ap * ap = NULL;
+			void * dst = &blk;
+
+			if (inputs[k].done) continue;
+
+			circular_queue_pop(inputs[k].queue, &dst, sizeof(blk));
+
+			if (blk == NULL)
+			{
+				inputs[k].done = 1;
+				nb_done++;
+				continue;
+			}
+
+			for (pos = 0; pos < blk->len;)
+			{
+				unsigned char * bssid = blk->data + pos;
+				struct ivs2_pkthdr ivs2;
+				unsigned char * payload;
+
+				memcpy(&ivs2, bssid + 6, sizeof(ivs2));
+				payload = bssid + 6 + sizeof(ivs2);
+				pos += 6 + sizeof(ivs2) + ivs2.len;
+
+				nb_read++;
+
+				if (ap == NULL || memcmp(ap->bssid, bssid, 6) != 0)
+					ap = merge_find_ap(&aps, &nb_aps, bssid);
+
+				if (!merge_keep(ap, &ivs2, payload)) continue;
+
+				if (!have_prev || memcmp(prev_bssid, bssid, 6) != 0)
+				{
+					ivs2.flags |= IVS2_BSSID;
+					ivs2.len += 6;
+					memcpy(prev_bssid, bssid, 6);
+					have_prev = 1;
+				}
+
+				(void) fwrite(&ivs2, sizeof(ivs2), 1, f_out);
+				if (ivs2.flags & IVS2_BSSID)
+				{
+					(void) fwrite(bssid, 6, 1, f_out);
+					ivs2.len -= 6;
+				}
+				if (ivs2.len > 0) (void) fwrite(payload, ivs2.len, 1, f_out);
+
+				nb_written++;
+			}
+
+			free(blk);
+
+			printf("%lu records read, %lu written\r", nb_read, nb_written);
+			fflush(stdout);
 		}
+	}
+
+	printf("\n");
 
-		while ((n = fread(buffer, 1, 1024, f_in)) > 0)
+	rc = EXIT_SUCCESS;
+
+	for (k = 0; k < nb_in; ++k)
+	{
+		ALLEGE(pthread_join(inputs[k].tid, NULL) == 0);
+		circular_queue_free(inputs[k].queue);
+
+		if (inputs[k].error)
 		{
-			nbw += n;
-			(void) fwrite(buffer, 1, n, f_out);
-			printf("%lu bytes written\r", nbw);
+			printf("Error reading %s, the rest of it was skipped\n",
+				   inputs[k].filename);
+			rc = EXIT_FAILURE;
 		}
+	}
 
-		fclose(f_in);
+	printf("%lu duplicate records dropped\n", nb_read - nb_written);
 
-		printf("\n");
-	}
+merge_done:
+	for (k = 0; k < nb_in; ++k)
+		if (inputs[k].f != NULL) fclose(inputs[k].f);
+	free(inputs);
 
-	fclose(f_out);
+	for (pos = 0; pos < nb_aps; pos++)
+		for (i = 0; i < MERGE_SEEN_KINDS; i++) uniqueiv_wipe(aps[pos].seen[i]);
+	free(aps);
 
-	return (EXIT_SUCCESS);
+	if (f_out != NULL && fclose(f_out) != 0)
+	{
+		perror("fclose failed");
+		rc = EXIT_FAILURE;
+	}
+
+	return (rc);
 }
 
 // NOTE(jbenden): This is also in airodump-ng.c
-static int dump_add_packet(unsigned char * h80211, unsigned caplen)
+/* --convert reads the capture in a thread of its own and cuts it into
+ * batches of frames. Every worker goes through every batch, but only parses
+ * the frames of the access points it owns (picked by a hash of the BSSID),
+ * so the IVs and the ESSID of an access point are only ever looked at by one
+ * thread. The main thread then writes the records of each batch in capture
+ * order and follows the WPA handshakes, so the output does not depend on the
+ * number of workers. */
+
+#define CONVERT_BATCH_SIZE (4 * 1024 * 1024)
+#define CONVERT_BATCH_FRAMES 16384
+#define CONVERT_BATCHES 4 /* batches in flight */
+#define CONVERT_SLACK 512 /* the EAPOL parser may read past a short frame */
+#define CONVERT_MAX_WORKERS 16
+#define CONVERT_AP_BUCKETS 256 /* per worker */
+#define CONVERT_READ_BUFFER (4 * 1024 * 1024)
+#define CONVERT_WRITE_BUFFER (1024 * 1024)
+
+enum
 {
-	REQUIRE(h80211 != NULL);
+	CONVERT_SKIP, /* nothing to write */
+	CONVERT_RECORD, /* an ESSID or IV record */
+	CONVERT_DATA /* some data, maybe part of a WPA handshake */
+};
 
-	int clen;
-	size_t dlen;
-	size_t i;
-	size_t n;
-	unsigned z;
-	struct ivs2_pkthdr ivs2;
-	unsigned char * p;
+struct convert_frame
+{
+	size_t offset; /* of the 802.11 header, in the batch data */
+	unsigned caplen; /* 0 if the capture header could not be removed */
+	int result;
+	int worker;
+	uint16_t flags; /* of the record, without IVS2_BSSID */
+	size_t rec_offset; /* of the record payload, in the worker's records */
+	size_t rec_len;
 	unsigned char bssid[6];
-	unsigned char stmac[6];
-	unsigned char clear[2048];
-	int weight[16];
-	int num_xor, o;
+};
 
-	struct AP_info * ap_cur = NULL;
-	struct ST_info * st_cur = NULL;
-	struct AP_info * ap_prv = NULL;
-	struct ST_info * st_prv = NULL;
+struct convert_records
+{
+	unsigned char * data;
+	size_t len;
+	size_t size;
+};
 
-	/* skip packets smaller than a 802.11 header */
+struct convert_batch
+{
+	size_t len;
+	size_t nb_frames;
+	int last; /* no batch follows this one */
+	int corrupted; /* stopped at an invalid packet length */
+	int bad_len;
+	int pending; /* workers which have not parsed it yet */
+	struct convert_frame frames[CONVERT_BATCH_FRAMES];
+	struct convert_records records[CONVERT_MAX_WORKERS];
+	unsigned char data[CONVERT_BATCH_SIZE + CONVERT_SLACK];
+};
+
+struct convert_worker
+{
+	int id;
+	pthread_t tid;
+	struct AP_info * aps[CONVERT_AP_BUCKETS];
+};
 
-	if (caplen < sizeof(struct ieee80211_frame)) return (FAILURE);
+static struct convert_state
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct convert_batch * batches[CONVERT_BATCHES];
+	unsigned long nb_read; /* batches handed over by the reader */
+	unsigned long nb_written; /* batches given back by the writer */
+	int nb_workers;
+	int stop;
+	FILE * f_in;
+	struct pcap_file_header pfh;
+} C;
 
-	/* skip (uninteresting) control frames */
+static unsigned convert_hash(const unsigned char * bssid)
+{
+	unsigned h = 2166136261u;
+	int i;
 
-	if ((h80211[0] & IEEE80211_FC0_TYPE_MASK) == IEEE80211_FC0_TYPE_CTL)
-		return (FAILURE);
+	for (i = 0; i < 6; i++) h = (h ^ bssid[i]) * 16777619u;
 
-	/* locate the access point's MAC address */
+	return (h);
+}
 
-	switch (h80211[1] & IEEE80211_FC1_DIR_MASK)
+/* returns the length of the prism/radiotap/PPI header, -1 if invalid */
+
+static int convert_strip(unsigned char * h80211, unsigned caplen)
+{
+	int n = 0;
+
+	if (C.pfh.linktype == LINKTYPE_PRISM_HEADER)
 	{
-		case IEEE80211_FC1_DIR_NODS:
-			memcpy(bssid, h80211 + 16, 6); //-V525
-			break; // Adhoc
-		case IEEE80211_FC1_DIR_TODS:
-			memcpy(bssid, h80211 + 4, 6);
-			break; // ToDS
-		case IEEE80211_FC1_DIR_FROMDS:
-		case IEEE80211_FC1_DIR_DSTODS:
-			memcpy(bssid, h80211 + 10, 6);
-			break;
+		if (h80211[7] == 0x40)
+			n = 64;
+		else
+		{
+			n = *(int *) (h80211 + 4);
+
+			if (C.pfh.magic == TCPDUMP_CIGAM) SWAP32(n);
+		}
+
+		if (n < 8 || n >= (int) caplen) return (-1);
 	}
 
-	/* update our chained list of access points */
+	if (C.pfh.linktype == LINKTYPE_RADIOTAP_HDR)
+	{
+		n = *(unsigned short *) (h80211 + 2);
 
-	ap_cur = G.ap_1st;
-	ap_prv = NULL;
+		if (n <= 0 || n >= (int) caplen) return (-1);
+	}
 
-	while (ap_cur != NULL)
+	if (C.pfh.linktype == LINKTYPE_PPI_HDR)
 	{
-		if (!memcmp(ap_cur->bssid, bssid, 6)) break;
+		/* Remove the PPI header */
 
-		ap_prv = ap_cur;
-		ap_cur = ap_cur->next;
+		n = le16_to_cpu(*(unsigned short *) (h80211 + 2));
+
+		if (n <= 0 || n >= (int) caplen) return (-1);
+
+		/* for a while Kismet logged broken PPI headers */
+		if (n == 24 && le16_to_cpu(*(unsigned short *) (h80211 + 8)) == 2)
+			n = 32;
+
+		if (n >= (int) caplen) return (-1);
 	}
 
-	/* if it's a new access point, add it */
+	return (n);
+}
 
-	if (ap_cur == NULL)
+static THREAD_ENTRY(convert_reader)
+{
+	struct convert_batch * batch;
+	struct convert_frame * fr;
+	struct pcap_pkthdr pkh;
+	unsigned long seq;
+	int n, last = 0, stop;
+
+	UNUSED_PARAM(arg);
+
+	for (seq = 0; !last; seq++)
 	{
-		if (!(ap_cur = (struct AP_info *) malloc(sizeof(struct AP_info))))
+		ALLEGE(pthread_mutex_lock(&C.lock) == 0);
+		while (seq - C.nb_written >= CONVERT_BATCHES && !C.stop)
+			pthread_cond_wait(&C.cond, &C.lock);
+		stop = C.stop;
+		ALLEGE(pthread_mutex_unlock(&C.lock) == 0);
+
+		if (stop) break;
+
+		batch = C.batches[seq % CONVERT_BATCHES];
+		batch->len = 0;
+		batch->nb_frames = 0;
+		batch->corrupted = 0;
+
+		while (batch->nb_frames < CONVERT_BATCH_FRAMES
+			   && batch->len + 65535 <= CONVERT_BATCH_SIZE)
 		{
-			perror("malloc failed");
-			return (FAILURE);
-		}
+			if (fread(&pkh, sizeof(pkh), 1, C.f_in) != 1)
+			{
+				last = 1;
+				break;
+			}
 
-		memset(ap_cur, 0, sizeof(struct AP_info));
+			if (C.pfh.magic == TCPDUMP_CIGAM)
+			{
+				SWAP32(pkh.caplen);
+				SWAP32(pkh.len);
+			}
 
-		if (G.ap_1st == NULL)
-			G.ap_1st = ap_cur;
-		else
-			ap_prv->next = ap_cur;
+			n = pkh.caplen;
 
-		memcpy(ap_cur->bssid, bssid, 6);
+			if (n <= 0 || n > 65535)
+			{
+				batch->corrupted = 1;
+				batch->bad_len = n;
+				last = 1;
+				break;
+			}
 
-		ap_cur->prev = ap_prv;
+			if (fread(batch->data + batch->len, n, 1, C.f_in) != 1)
+			{
+				last = 1;
+				break;
+			}
 
-		ap_cur->uiv_root = uniqueiv_init();
+			fr = &batch->frames[batch->nb_frames++];
+			fr->result = CONVERT_SKIP;
 
-		G.ap_end = ap_cur;
+			n = convert_strip(batch->data + batch->len, pkh.caplen);
 
-		ap_cur->ssid_length = 0;
-		ap_cur->wpa_stored = 0;
-		ap_cur->essid_stored = 0;
-	}
+			fr->offset = batch->len + (n < 0 ? 0 : n);
+			fr->caplen = (n < 0) ? 0 : pkh.caplen - n;
 
-#if 0
-	/* find wpa handshake */
-	if (h80211[0] == 0x10)
-	{
-		/* reset the WPA handshake state */
+			batch->len += pkh.caplen;
+		}
+
+		batch->last = last;
+		batch->pending = C.nb_workers;
 
-		if (st_cur != NULL && st_cur->wpa.state != 0xFF) st_cur->wpa.state = 0;
+		ALLEGE(pthread_mutex_lock(&C.lock) == 0);
+		C.nb_read = seq + 1;
+		ALLEGE(pthread_cond_broadcast(&C.cond) == 0);
+		ALLEGE(pthread_mutex_unlock(&C.lock) == 0);
 	}
-#endif
 
-	/* locate the station MAC in the 802.11 header */
+	return (NULL);
+}
 
-	switch (h80211[1] & IEEE80211_FC1_DIR_MASK)
+static void convert_add_record(struct convert_records * rec,
+							   struct convert_frame * fr,
+							   uint16_t flags,
+							   const void * head,
+							   size_t head_len,
+							   const void * body,
+							   size_t body_len)
+{
+	if (rec->len + head_len + body_len > rec->size)
 	{
-		case IEEE80211_FC1_DIR_NODS:
-
-			/* if management, check that SA != BSSID */
+		rec->size = 2 * rec->size + head_len + body_len;
+		rec->data = (unsigned char *) realloc(rec->data, rec->size);
+		ALLEGE(rec->data != NULL);
+	}
 
-			if (memcmp(h80211 + 10, bssid, 6) == 0) goto skip_station;
+	fr->flags = flags;
+	fr->rec_offset = rec->len;
+	fr->rec_len = head_len + body_len;
 
-			memcpy(stmac, h80211 + 10, 6);
-			break;
+	memcpy(rec->data + rec->len, head, head_len);
+	if (body_len > 0) memcpy(rec->data + rec->len + head_len, body, body_len);
+	rec->len += head_len + body_len;
+}
 
-		case IEEE80211_FC1_DIR_TODS:
+/* Parses what belongs to the access point: its ESSID and its IVs.
+ * Everything to do with the stations is left to the writer. */
 
-			/* ToDS packet, must come from a client */
+static int convert_parse(struct convert_worker * w,
+						 unsigned char * h80211,
+						 unsigned caplen,
+						 struct convert_frame * fr,
+						 struct convert_records * rec)
+{
+	REQUIRE(h80211 != NULL);
 
-			memcpy(stmac, h80211 + 10, 6);
-			break;
+	int clen;
+	size_t dlen;
+	size_t i;
+	size_t n;
+	unsigned z;
+	unsigned h;
+	uint16_t flags;
+	uint16_t len;
+	unsigned char * p;
+	unsigned char bssid[6];
+	unsigned char clear[2048];
+	int weight[16];
+	int num_xor, o;
 
-		case IEEE80211_FC1_DIR_FROMDS:
+	struct AP_info ** bucket;
+	struct AP_info * ap_cur = NULL;
 
-			/* FromDS packet, reject broadcast MACs */
+	/* skip packets smaller than a 802.11 header */
 
-			if (h80211[4] != 0) goto skip_station;
-			memcpy(stmac, h80211 + 4, 6);
-			break;
+	if (caplen < sizeof(struct ieee80211_frame)) return (CONVERT_SKIP);
 
-		case IEEE80211_FC1_DIR_DSTODS:
-			goto skip_station;
-	}
+	/* skip (uninteresting) control frames */
 
-	/* update our chained list of wireless stations */
+	if ((h80211[0] & IEEE80211_FC0_TYPE_MASK) == IEEE80211_FC0_TYPE_CTL)
+		return (CONVERT_SKIP);
 
-	st_cur = G.st_1st;
-	st_prv = NULL;
+	/* locate the access point's MAC address */
 
-	while (st_cur != NULL)
+	switch (h80211[1] & IEEE80211_FC1_DIR_MASK)
 	{
-		if (!memcmp(st_cur->stmac, stmac, 6)) break;
-
-		st_prv = st_cur;
-		st_cur = st_cur->next;
+		case IEEE80211_FC1_DIR_NODS:
+			memcpy(bssid, h80211 + 16, 6); //-V525
+			break; // Adhoc
+		case IEEE80211_FC1_DIR_TODS:
+			memcpy(bssid, h80211 + 4, 6);
+			break; // ToDS
+		case IEEE80211_FC1_DIR_FROMDS:
+		case IEEE80211_FC1_DIR_DSTODS:
+			memcpy(bssid, h80211 + 10, 6);
+			break;
 	}
 
-	/* if it's a new client, add it */
+	/* leave it to the worker owning this access point */
 
-	if (st_cur == NULL)
-	{
-		if (!(st_cur = (struct ST_info *) malloc(sizeof(struct ST_info))))
-		{
-			perror("malloc failed");
-			return (EXIT_FAILURE);
-		}
+	h = convert_hash(bssid);
 
-		memset(st_cur, 0, sizeof(struct ST_info));
+	if ((int) (h % C.nb_workers) != w->id) return (CONVERT_SKIP);
 
-		if (G.st_1st == NULL)
-			G.st_1st = st_cur;
-		else
-			st_prv->next = st_cur;
+	memcpy(fr->bssid, bssid, 6);
+	fr->worker = w->id;
+
+	bucket = &w->aps[(h >> 8) % CONVERT_AP_BUCKETS];
+
+	for (ap_cur = *bucket; ap_cur != NULL; ap_cur = ap_cur->next)
+		if (!memcmp(ap_cur->bssid, bssid, 6)) break;
 
-		memcpy(st_cur->stmac, stmac, 6);
+	/* if it's a new access point, add it */
 
-		st_cur->prev = st_prv;
+	if (ap_cur == NULL)
+	{
+		ap_cur = (struct AP_info *) calloc(1, sizeof(struct AP_info));
+		ALLEGE(ap_cur != NULL);
 
-		G.st_end = st_cur;
-	}
+		memcpy(ap_cur->bssid, bssid, 6);
 
-	if (st_cur->base == NULL || memcmp(ap_cur->bssid, BROADCAST, 6) != 0)
-		st_cur->base = ap_cur;
+		ap_cur->uiv_root = uniqueiv_init();
 
-skip_station:
+		ap_cur->next = *bucket;
+		*bucket = ap_cur;
+	}
 
 	/* packet parsing: Beacon or Probe Response */
 
@@ -401,47 +817,18 @@ skip_station:
 				memset(ap_cur->essid, 0, ESSID_LENGTH + 1);
 				memcpy(ap_cur->essid, p + 2, n);
 
-				if (G.f_ivs != NULL && !ap_cur->essid_stored)
+				if (!ap_cur->essid_stored)
 				{
-					memset(&ivs2, '\x00', sizeof(struct ivs2_pkthdr));
-					ivs2.flags |= IVS2_ESSID;
-					ivs2.len += ap_cur->ssid_length;
-
-					if (memcmp(G.prev_bssid, ap_cur->bssid, 6) != 0)
-					{
-						ivs2.flags |= IVS2_BSSID;
-						ivs2.len += 6;
-						memcpy(G.prev_bssid, ap_cur->bssid, 6);
-					}
-
-					/* write header */
-					if (fwrite(&ivs2, 1, sizeof(struct ivs2_pkthdr), G.f_ivs)
-						!= (size_t) sizeof(struct ivs2_pkthdr))
-					{
-						perror("fwrite(IV header) failed");
-						return (EXIT_FAILURE);
-					}
-
-					/* write BSSID */
-					if (ivs2.flags & IVS2_BSSID)
-					{
-						if (fwrite(ap_cur->bssid, 1, 6, G.f_ivs) != (size_t) 6)
-						{
-							perror("fwrite(IV bssid) failed");
-							return (EXIT_FAILURE);
-						}
-					}
-
-					/* write essid */
-					if (fwrite(ap_cur->essid, 1, ap_cur->ssid_length, G.f_ivs)
-						!= (size_t) ap_cur->ssid_length)
-					{
-						perror("fwrite(IV essid) failed");
-						return (1);
-					}
+					convert_add_record(rec,
+									   fr,
+									   IVS2_ESSID,
+									   ap_cur->essid,
+									   (uint16_t) ap_cur->ssid_length,
+									   NULL,
+									   0);
 
 					ap_cur->essid_stored = 1;
-					return (ESSID);
+					return (CONVERT_RECORD);
 				}
 
 				for (i = 0; i < n; i++)
@@ -474,47 +861,18 @@ skip_station:
 				memset(ap_cur->essid, 0, 33);
 				memcpy(ap_cur->essid, p + 2, n);
 
-				if (G.f_ivs != NULL && !ap_cur->essid_stored)
+				if (!ap_cur->essid_stored)
 				{
-					memset(&ivs2, '\x00', sizeof(struct ivs2_pkthdr));
-					ivs2.flags |= IVS2_ESSID;
-					ivs2.len += ap_cur->ssid_length;
-
-					if (memcmp(G.prev_bssid, ap_cur->bssid, 6) != 0)
-					{
-						ivs2.flags |= IVS2_BSSID;
-						ivs2.len += 6;
-						memcpy(G.prev_bssid, ap_cur->bssid, 6);
-					}
-
-					/* write header */
-					if (fwrite(&ivs2, 1, sizeof(struct ivs2_pkthdr), G.f_ivs)
-						!= (size_t) sizeof(struct ivs2_pkthdr))
-					{
-						perror("fwrite(IV header) failed");
-						return (EXIT_FAILURE);
-					}
-
-					/* write BSSID */
-					if (ivs2.flags & IVS2_BSSID)
-					{
-						if (fwrite(ap_cur->bssid, 1, 6, G.f_ivs) != (size_t) 6)
-						{
-							perror("fwrite(IV bssid) failed");
-							return (EXIT_FAILURE);
-						}
-					}
-
-					/* write essid */
-					if (fwrite(ap_cur->essid, 1, ap_cur->ssid_length, G.f_ivs)
-						!= (size_t) ap_cur->ssid_length)
-					{
-						perror("fwrite(IV essid) failed");
-						return (EXIT_FAILURE);
-					}
+					convert_add_record(rec,
+									   fr,
+									   IVS2_ESSID,
+									   ap_cur->essid,
+									   (uint16_t) ap_cur->ssid_length,
+									   NULL,
+									   0);
 
 					ap_cur->essid_stored = 1;
-					return (ESSID);
+					return (CONVERT_RECORD);
 				}
 
 				for (i = 0; i < n; i++)
@@ -529,444 +887,531 @@ skip_station:
 
 	/* packet parsing: some data */
 
-	if ((h80211[0] & IEEE80211_FC0_TYPE_MASK) == IEEE80211_FC0_TYPE_DATA)
-	{
-		/* check the SNAP header to see if data is encrypted */
+	if ((h80211[0] & IEEE80211_FC0_TYPE_MASK) != IEEE80211_FC0_TYPE_DATA)
+		return (CONVERT_SKIP);
 
-		z = ((h80211[1] & IEEE80211_FC1_DIR_MASK) != IEEE80211_FC1_DIR_DSTODS)
-				? 24
-				: 30;
+	/* check the SNAP header to see if data is encrypted */
 
-		if (z + 26 > caplen) return (FAILURE);
+	z = ((h80211[1] & IEEE80211_FC1_DIR_MASK) != IEEE80211_FC1_DIR_DSTODS)
+			? 24
+			: 30;
 
-		// check if WEP bit set and extended iv
-		if ((h80211[1] & IEEE80211_FC1_WEP) != 0 && (h80211[z + 3] & 0x20) == 0)
-		{
-			/* WEP: check if we've already seen this IV */
+	if (z + 26 > caplen) return (CONVERT_SKIP);
 
-			if (!uniqueiv_check(ap_cur->uiv_root, &h80211[z]))
-			{
-				/* first time seen IVs */
+	// check if WEP bit set and extended iv
+	if ((h80211[1] & IEEE80211_FC1_WEP) == 0 || (h80211[z + 3] & 0x20) != 0)
+		return (CONVERT_DATA);
 
-				if (G.f_ivs != NULL)
-				{
-					memset(&ivs2, '\x00', sizeof(struct ivs2_pkthdr));
-					ivs2.flags = 0;
-					ivs2.len = 0;
-
-					dlen = caplen - 24 - 4 - 4; // original data len
-					if (dlen > 2048) dlen = 2048;
-					// get cleartext + len + 4(iv+idx)
-					num_xor = known_clear(clear, &clen, weight, h80211, dlen);
-					if (num_xor == 1)
-					{
-						ivs2.flags |= IVS2_XOR;
-						ivs2.len += clen + 4;
-						/* reveal keystream (plain^encrypted) */
-						for (n = 0; n < (size_t)(ivs2.len - 4); n++)
-						{
-							clear[n] = (uint8_t)((clear[n] ^ h80211[z + 4 + n])
-												 & 0xFF);
-						}
-						// clear is now the keystream
-					}
-					else
-					{
-						// do it again to get it 2 bytes higher
-						num_xor = known_clear(
-							clear + 2, &clen, weight, h80211, dlen);
-						ivs2.flags |= IVS2_PTW;
-						// len = 4(iv+idx) + 1(num of keystreams) + 1(len per
-						// keystream) + 32*num_xor + 16*sizeof(int)(weight[16])
-						ivs2.len += 4 + 1 + 1 + 32 * num_xor + 16 * sizeof(int);
-						clear[0] = (uint8_t) num_xor;
-						clear[1] = (uint8_t) clen;
-						/* reveal keystream (plain^encrypted) */
-						for (o = 0; o < num_xor; o++)
-						{
-							for (n = 0; n < (size_t)(ivs2.len - 4); n++)
-							{
-								clear[2 + n + o * 32] = (uint8_t)(
-									(clear[2 + n + o * 32] ^ h80211[z + 4 + n])
-									& 0xFF);
-							}
-						}
-						memcpy(clear + 4 + 1 + 1 + 32 * num_xor,
-							   weight,
-							   16 * sizeof(int));
-						// clear is now the keystream
-					}
-
-					if (memcmp(G.prev_bssid, ap_cur->bssid, 6) != 0)
-					{
-						ivs2.flags |= IVS2_BSSID;
-						ivs2.len += 6;
-						memcpy(G.prev_bssid, ap_cur->bssid, 6);
-					}
-
-					if (fwrite(&ivs2, 1, sizeof(struct ivs2_pkthdr), G.f_ivs)
-						!= (size_t) sizeof(struct ivs2_pkthdr))
-					{
-						perror("fwrite(IV header) failed");
-						return (EXIT_FAILURE);
-					}
-
-					if (ivs2.flags & IVS2_BSSID)
-					{
-						if (fwrite(ap_cur->bssid, 1, 6, G.f_ivs) != (size_t) 6)
-						{
-							perror("fwrite(IV bssid) failed");
-							return (EXIT_FAILURE);
-						}
-						ivs2.len -= 6;
-					}
-
-					if (fwrite(h80211 + z, 1, 4, G.f_ivs) != (size_t) 4)
-					{
-						perror("fwrite(IV iv+idx) failed");
-						return (EXIT_FAILURE);
-					}
-					ivs2.len -= 4;
-
-					if (fwrite(clear, 1, ivs2.len, G.f_ivs)
-						!= (size_t) ivs2.len)
-					{
-						perror("fwrite(IV keystream) failed");
-						return (EXIT_FAILURE);
-					}
-				}
+	/* WEP: check if we've already seen this IV */
+
+	if (uniqueiv_check(ap_cur->uiv_root, &h80211[z])) return (CONVERT_DATA);
 
-				uniqueiv_mark(ap_cur->uiv_root, &h80211[z]);
-				return (IVS);
+	/* first time seen IVs; what known_clear() leaves untouched is
+	 * written as well, so start from a clean slate */
+
+	memset(clear, 0, sizeof(clear));
+	memset(weight, 0, sizeof(weight));
+
+	flags = 0;
+	len = 0;
+
+	dlen = caplen - 24 - 4 - 4; // original data len
+	if (dlen > 2048) dlen = 2048;
+	// get cleartext + len + 4(iv+idx)
+	num_xor = known_clear(clear, &clen, weight, h80211, dlen);
+	if (num_xor == 1)
+	{
+		flags |= IVS2_XOR;
+		len += clen + 4;
+		/* reveal keystream (plain^encrypted) */
+		for (n = 0; n < (size_t)(len - 4); n++)
+		{
+			clear[n] = (uint8_t)((clear[n] ^ h80211[z + 4 + n]) & 0xFF);
+		}
+		// clear is now the keystream
+	}
+	else
+	{
+		// do it again to get it 2 bytes higher
+		num_xor = known_clear(clear + 2, &clen, weight, h80211, dlen);
+		flags |= IVS2_PTW;
+		// len = 4(iv+idx) + 1(num of keystreams) + 1(len per
+		// keystream) + 32*num_xor + 16*sizeof(int)(weight[16])
+		len += 4 + 1 + 1 + 32 * num_xor + 16 * sizeof(int);
+		clear[0] = (uint8_t) num_xor;
+		clear[1] = (uint8_t) clen;
+		/* reveal keystream (plain^encrypted) */
+		for (o = 0; o < num_xor; o++)
+		{
+			for (n = 0; n < (size_t)(len - 4); n++)
+			{
+				clear[2 + n + o * 32] = (uint8_t)(
+					(clear[2 + n + o * 32] ^ h80211[z + 4 + n]) & 0xFF);
 			}
 		}
+		memcpy(clear + 4 + 1 + 1 + 32 * num_xor, weight, 16 * sizeof(int));
+		// clear is now the keystream
+	}
+
+	/* IV + index, then the keystream */
+	convert_add_record(rec, fr, flags, h80211 + z, 4, clear, len - 4u);
+
+	uniqueiv_mark(ap_cur->uiv_root, &h80211[z]);
+	return (CONVERT_RECORD);
+}
+
+static THREAD_ENTRY(convert_worker)
+{
+	struct convert_worker * w = (struct convert_worker *) arg;
+	struct convert_batch * batch;
+	struct convert_frame * fr;
+	struct AP_info * ap_cur;
+	unsigned long seq;
+	size_t i;
+	int ret, last, stop;
 
-		z = ((h80211[1] & IEEE80211_FC1_DIR_MASK) != IEEE80211_FC1_DIR_DSTODS)
-				? 24
-				: 30;
+	for (seq = 0;; seq++)
+	{
+		ALLEGE(pthread_mutex_lock(&C.lock) == 0);
+		while (C.nb_read <= seq && !C.stop)
+			pthread_cond_wait(&C.cond, &C.lock);
+		stop = (C.nb_read <= seq);
+		ALLEGE(pthread_mutex_unlock(&C.lock) == 0);
 
-		if (z + 26 > caplen) return (FAILURE);
+		if (stop) break;
 
-		z += 6; // skip LLC header
+		batch = C.batches[seq % CONVERT_BATCHES];
+		batch->records[w->id].len = 0;
 
-		/* check ethertype == EAPOL */
-		if (h80211[z] == 0x88 && h80211[z + 1] == 0x8E
-			&& (h80211[1] & 0x40) != 0x40)
+		for (i = 0; i < batch->nb_frames; i++)
 		{
-			z += 2; // skip ethertype
+			fr = &batch->frames[i];
 
-			if (st_cur == NULL) return (FAILURE);
+			if (fr->caplen == 0) continue;
 
-			/* frame 1: Pairwise == 1, Install == 0, Ack == 1, MIC == 0 */
+			ret = convert_parse(w,
+								batch->data + fr->offset,
+								fr->caplen,
+								fr,
+								&batch->records[w->id]);
+			if (ret != CONVERT_SKIP) fr->result = ret;
+		}
 
-			if ((h80211[z + 6] & 0x08) != 0 && (h80211[z + 6] & 0x40) == 0
-				&& (h80211[z + 6] & 0x80) != 0
-				&& (h80211[z + 5] & 0x01) == 0)
-			{
-				memcpy(st_cur->wpa.anonce, &h80211[z + 17], 32);
-				st_cur->wpa.state = 1;
-			}
+		last = batch->last;
 
-			/* frame 2 or 4: Pairwise == 1, Install == 0, Ack == 0, MIC == 1 */
+		ALLEGE(pthread_mutex_lock(&C.lock) == 0);
+		if (--batch->pending == 0)
+			ALLEGE(pthread_cond_broadcast(&C.cond) == 0);
+		ALLEGE(pthread_mutex_unlock(&C.lock) == 0);
 
-			if (z + 17 + 32 > caplen) return (FAILURE);
+		if (last) break;
+	}
 
-			if ((h80211[z + 6] & 0x08) != 0 && (h80211[z + 6] & 0x40) == 0
-				&& (h80211[z + 6] & 0x80) == 0
-				&& (h80211[z + 5] & 0x01) != 0)
-			{
-				if (memcmp(&h80211[z + 17], ZERO, 32) != 0)
-				{
-					memcpy(st_cur->wpa.snonce, &h80211[z + 17], 32);
-					st_cur->wpa.state |= 2;
-				}
-			}
+	for (i = 0; i < CONVERT_AP_BUCKETS; i++)
+	{
+		while ((ap_cur = w->aps[i]) != NULL)
+		{
+			w->aps[i] = ap_cur->next;
+			uniqueiv_wipe(ap_cur->uiv_root);
+			free(ap_cur);
+		}
+	}
 
-			/* frame 3: Pairwise == 1, Install == 1, Ack == 1, MIC == 1 */
+	return (NULL);
+}
 
-			if ((h80211[z + 6] & 0x08) != 0 && (h80211[z + 6] & 0x40) != 0
-				&& (h80211[z + 6] & 0x80) != 0
-				&& (h80211[z + 5] & 0x01) != 0)
-			{
-				st_cur->wpa.eapol_size
-					= (h80211[z + 2] << 8) + h80211[z + 3] + 4u;
+static int convert_write(uint16_t flags,
+						 const unsigned char * bssid,
+						 const void * data,
+						 size_t len)
+{
+	struct ivs2_pkthdr ivs2;
 
-				if (st_cur->wpa.eapol_size == 0 //-V560
-					|| st_cur->wpa.eapol_size >= sizeof(st_cur->wpa.eapol) - 16)
-				{
-					// ignore packet trying to crash us
-					st_cur->wpa.eapol_size = 0;
-					return (EXIT_SUCCESS);
-				}
+	memset(&ivs2, '\x00', sizeof(struct ivs2_pkthdr));
+	ivs2.flags = flags;
+	ivs2.len = (uint16_t) len;
 
-				if (memcmp(&h80211[z + 17], ZERO, 32) != 0)
-				{
-					memcpy(st_cur->wpa.anonce, &h80211[z + 17], 32);
-					st_cur->wpa.state |= 4;
-				}
+	if (memcmp(G.prev_bssid, bssid, 6) != 0)
+	{
+		ivs2.flags |= IVS2_BSSID;
+		ivs2.len += 6;
+		memcpy(G.prev_bssid, bssid, 6);
+	}
 
-				memcpy(st_cur->wpa.keymic, &h80211[z + 81], 16);
-				memcpy(st_cur->wpa.eapol, &h80211[z], st_cur->wpa.eapol_size);
-				memset(st_cur->wpa.eapol + 81, 0, 16);
-				st_cur->wpa.state |= 8;
-				st_cur->wpa.keyver = (uint8_t)(h80211[z + 6] & 7);
+	if (fwrite(&ivs2, 1, sizeof(struct ivs2_pkthdr), G.f_ivs)
+		!= (size_t) sizeof(struct ivs2_pkthdr))
+	{
+		perror("fwrite(IV header) failed");
+		return (FAILURE);
+	}
 
-				if (st_cur->wpa.state == 15)
-				{
-					memcpy(st_cur->wpa.stmac, st_cur->stmac, 6);
-
-					if (G.f_ivs != NULL)
-					{
-						memset(&ivs2, '\x00', sizeof(struct ivs2_pkthdr));
-						ivs2.flags = 0;
-						ivs2.len = sizeof(struct WPA_hdsk);
-						ivs2.flags |= IVS2_WPA;
-
-						if (memcmp(G.prev_bssid, ap_cur->bssid, 6) != 0)
-						{
-							ivs2.flags |= IVS2_BSSID;
-							ivs2.len += 6;
-							memcpy(G.prev_bssid, ap_cur->bssid, 6);
-						}
-
-						if (fwrite(
-								&ivs2, 1, sizeof(struct ivs2_pkthdr), G.f_ivs)
-							!= (size_t) sizeof(struct ivs2_pkthdr))
-						{
-							perror("fwrite(IV header) failed");
-							return (EXIT_FAILURE);
-						}
-
-						if (ivs2.flags & IVS2_BSSID)
-						{
-							if (fwrite(ap_cur->bssid, 1, 6, G.f_ivs)
-								!= (size_t) 6)
-							{
-								perror("fwrite(IV bssid) failed");
-								return (EXIT_FAILURE);
-							}
-							ivs2.len -= 6;
-						}
-
-						if (fwrite(&(st_cur->wpa),
-								   1,
-								   sizeof(struct WPA_hdsk),
-								   G.f_ivs)
-							!= (size_t) sizeof(struct WPA_hdsk))
-						{
-							perror("fwrite(IV wpa_hdsk) failed");
-							return (EXIT_FAILURE);
-						}
-						return (WPA);
-					}
-				}
-			}
+	if (ivs2.flags & IVS2_BSSID)
+	{
+		if (fwrite(bssid, 1, 6, G.f_ivs) != (size_t) 6)
+		{
+			perror("fwrite(IV bssid) failed");
+			return (FAILURE);
 		}
 	}
 
+	if (fwrite(data, 1, len, G.f_ivs) != len)
+	{
+		perror("fwrite(IV record) failed");
+		return (FAILURE);
+	}
+
 	return (0);
 }
 
-int main(int argc, char * argv[])
+/* Follows the WPA handshake of the station sending or receiving some data,
+ * in capture order. Stations are only looked up here, they have no other
+ * use in the output. Returns FAILURE only if the record can't be written. */
+
+static int convert_eapol(unsigned char * h80211,
+						 unsigned caplen,
+						 const unsigned char * bssid)
 {
-	time_t tt;
-	int n, ret;
-	FILE * f_in;
-	unsigned long nbr;
-	unsigned long nbivs;
-	unsigned char * h80211;
-	unsigned char bssid_cur[6];
-	unsigned char bssid_prv[6];
-	unsigned char buffer[65536];
-	struct pcap_file_header pfh;
-	struct pcap_pkthdr pkh;
-	struct ivs2_filehdr fivs2;
+	REQUIRE(h80211 != NULL);
 
-	if (argc < 4)
+	unsigned z;
+	unsigned char stmac[6];
+
+	struct ST_info * st_cur = NULL;
+	struct ST_info * st_prv = NULL;
+
+	z = ((h80211[1] & IEEE80211_FC1_DIR_MASK) != IEEE80211_FC1_DIR_DSTODS)
+			? 24
+			: 30;
+
+	z += 6; // skip LLC header
+
+	/* check ethertype == EAPOL */
+	if (h80211[z] != 0x88 || h80211[z + 1] != 0x8E
+		|| (h80211[1] & 0x40) == 0x40)
+		return (0);
+
+	z += 2; // skip ethertype
+
+	/* locate the station MAC in the 802.11 header */
+
+	switch (h80211[1] & IEEE80211_FC1_DIR_MASK)
 	{
-		usage(EXIT_SUCCESS);
-		return (EXIT_FAILURE);
+		case IEEE80211_FC1_DIR_NODS:
+
+			/* if management, check that SA != BSSID */
+
+			if (memcmp(h80211 + 10, bssid, 6) == 0) return (0);
+
+			memcpy(stmac, h80211 + 10, 6);
+			break;
+
+		case IEEE80211_FC1_DIR_TODS:
+
+			/* ToDS packet, must come from a client */
+
+			memcpy(stmac, h80211 + 10, 6);
+			break;
+
+		case IEEE80211_FC1_DIR_FROMDS:
+
+			/* FromDS packet, reject broadcast MACs */
+
+			if (h80211[4] != 0) return (0);
+			memcpy(stmac, h80211 + 4, 6);
+			break;
+
+		default:
+			return (0);
 	}
 
-	if (strcmp(argv[1], "--merge") == 0)
+	/* update our chained list of wireless stations */
+
+	st_cur = G.st_1st;
+	st_prv = NULL;
+
+	while (st_cur != NULL)
 	{
-		return (merge(argc, argv));
+		if (!memcmp(st_cur->stmac, stmac, 6)) break;
+
+		st_prv = st_cur;
+		st_cur = st_cur->next;
 	}
-	if (strcmp(argv[1], "--convert") != 0)
+
+	/* if it's a new client, add it */
+
+	if (st_cur == NULL)
 	{
-		usage(EXIT_FAILURE);
-		return (EXIT_FAILURE);
+		st_cur = (struct ST_info *) calloc(1, sizeof(struct ST_info));
+		ALLEGE(st_cur != NULL);
+
+		if (G.st_1st == NULL)
+			G.st_1st = st_cur;
+		else
+			st_prv->next = st_cur;
+
+		memcpy(st_cur->stmac, stmac, 6);
+
+		st_cur->prev = st_prv;
+
+		G.st_end = st_cur;
 	}
 
-	// Check filenames are not empty
-	if (argv[2][0] == 0)
+	/* frame 1: Pairwise == 1, Install == 0, Ack == 1, MIC == 0 */
+
+	if ((h80211[z + 6] & 0x08) != 0 && (h80211[z + 6] & 0x40) == 0
+		&& (h80211[z + 6] & 0x80) != 0
+		&& (h80211[z + 5] & 0x01) == 0)
 	{
-		printf("Invalid pcap file\n");
-		return (EXIT_FAILURE);
+		memcpy(st_cur->wpa.anonce, &h80211[z + 17], 32);
+		st_cur->wpa.state = 1;
 	}
 
-	if (argv[3][0] == 0)
+	/* frame 2 or 4: Pairwise == 1, Install == 0, Ack == 0, MIC == 1 */
+
+	if (z + 17 + 32 > caplen) return (0);
+
+	if ((h80211[z + 6] & 0x08) != 0 && (h80211[z + 6] & 0x40) == 0
+		&& (h80211[z + 6] & 0x80) == 0
+		&& (h80211[z + 5] & 0x01) != 0)
 	{
-		printf("Invalid output file\n");
-		return (EXIT_FAILURE);
+		if (memcmp(&h80211[z + 17], ZERO, 32) != 0)
+		{
+			memcpy(st_cur->wpa.snonce, &h80211[z + 17], 32);
+			st_cur->wpa.state |= 2;
+		}
+	}
+
+	/* frame 3: Pairwise == 1, Install == 1, Ack == 1, MIC == 1 */
+
+	if ((h80211[z + 6] & 0x08) != 0 && (h80211[z + 6] & 0x40) != 0
+		&& (h80211[z + 6] & 0x80) != 0
+		&& (h80211[z + 5] & 0x01) != 0)
+	{
+		st_cur->wpa.eapol_size = (h80211[z + 2] << 8) + h80211[z + 3] + 4u;
+
+		if (st_cur->wpa.eapol_size == 0 //-V560
+			|| st_cur->wpa.eapol_size >= sizeof(st_cur->wpa.eapol) - 16)
+		{
+			// ignore packet trying to crash us
+			st_cur->wpa.eapol_size = 0;
+			return (0);
+		}
+
+		if (memcmp(&h80211[z + 17], ZERO, 32) != 0)
+		{
+			memcpy(st_cur->wpa.anonce, &h80211[z + 17], 32);
+			st_cur->wpa.state |= 4;
+		}
+
+		memcpy(st_cur->wpa.keymic, &h80211[z + 81], 16);
+		memcpy(st_cur->wpa.eapol, &h80211[z], st_cur->wpa.eapol_size);
+		memset(st_cur->wpa.eapol + 81, 0, 16);
+		st_cur->wpa.state |= 8;
+		st_cur->wpa.keyver = (uint8_t)(h80211[z + 6] & 7);
+
+		if (st_cur->wpa.state == 15)
+		{
+			memcpy(st_cur->wpa.stmac, st_cur->stmac, 6);
+
+			if (convert_write(
+					IVS2_WPA, bssid, &(st_cur->wpa), sizeof(struct WPA_hdsk))
+				!= 0)
+				return (FAILURE);
+
+			return (WPA);
+		}
 	}
 
-	memset(bssid_cur, 0, sizeof(bssid_cur)); //-V597
-	memset(bssid_prv, 0, sizeof(bssid_prv)); //-V597
+	return (0);
+}
+
+static int convert(const char * in_name, const char * out_name)
+{
+	time_t tt;
+	int i, ret = EXIT_SUCCESS;
+	unsigned long nbr = 0;
+	unsigned long nbivs = 0;
+	unsigned long seq;
+	size_t j;
+	pthread_t reader;
+	struct convert_worker * workers;
+	struct convert_batch * batch;
+	struct convert_frame * fr;
+	struct convert_records * rec;
+	struct ivs2_filehdr fivs2;
 
 	/* check the input pcap file */
 
-	printf("Opening %s\n", argv[2]);
+	printf("Opening %s\n", in_name);
 
-	if ((f_in = fopen(argv[2], "rb")) == NULL)
+	if ((C.f_in = fopen(in_name, "rb")) == NULL)
 	{
 		perror("fopen failed");
 		return (EXIT_FAILURE);
 	}
 
-	n = sizeof(pfh);
-
-	if (fread(&pfh, 1, n, f_in) != (size_t) n)
+	if (fread(&C.pfh, 1, sizeof(C.pfh), C.f_in) != sizeof(C.pfh))
 	{
 		perror("fread(pcap file header) failed");
-		fclose(f_in);
+		fclose(C.f_in);
 		return (EXIT_FAILURE);
 	}
 
-	if (pfh.magic != TCPDUMP_MAGIC && pfh.magic != TCPDUMP_CIGAM)
+	if (C.pfh.magic != TCPDUMP_MAGIC && C.pfh.magic != TCPDUMP_CIGAM)
 	{
 		printf("\"%s\" isn't a pcap file (expected "
 			   "TCPDUMP_MAGIC).\n",
-			   argv[2]);
-		fclose(f_in);
+			   in_name);
+		fclose(C.f_in);
 		return (EXIT_FAILURE);
 	}
 
-	if (pfh.magic == TCPDUMP_CIGAM) SWAP32(pfh.linktype);
+	if (C.pfh.magic == TCPDUMP_CIGAM) SWAP32(C.pfh.linktype);
 
-	if (pfh.linktype != LINKTYPE_IEEE802_11
-		&& pfh.linktype != LINKTYPE_PRISM_HEADER
-		&& pfh.linktype != LINKTYPE_RADIOTAP_HDR
-		&& pfh.linktype != LINKTYPE_PPI_HDR)
+	if (C.pfh.linktype != LINKTYPE_IEEE802_11
+		&& C.pfh.linktype != LINKTYPE_PRISM_HEADER
+		&& C.pfh.linktype != LINKTYPE_RADIOTAP_HDR
+		&& C.pfh.linktype != LINKTYPE_PPI_HDR)
 	{
 		printf("\"%s\" isn't a regular 802.11 "
 			   "(wireless) capture.\n",
-			   argv[2]);
-		fclose(f_in);
+			   in_name);
+		fclose(C.f_in);
 		return (EXIT_FAILURE);
 	}
 
+	(void) setvbuf(C.f_in, NULL, _IOFBF, CONVERT_READ_BUFFER);
+
 	/* create the output ivs file */
 
-	printf("Creating %s\n", argv[3]);
+	printf("Creating %s\n", out_name);
 
-	if ((G.f_ivs = fopen(argv[3], "wb+")) == NULL)
+	if ((G.f_ivs = fopen(out_name, "wb+")) == NULL)
 	{
 		perror("fopen failed");
-		fclose(f_in);
+		fclose(C.f_in);
 		return (EXIT_FAILURE);
 	}
 
+	(void) setvbuf(G.f_ivs, NULL, _IOFBF, CONVERT_WRITE_BUFFER);
+
 	fivs2.version = IVS2_VERSION;
 
 	(void) fwrite(IVS2_MAGIC, 4, 1, G.f_ivs);
 	(void) fwrite(&fivs2, sizeof(struct ivs2_filehdr), 1, G.f_ivs);
 
-	nbr = 0;
-	tt = time(NULL) - 1;
+	/* start the reader and the workers */
 
-	nbivs = 0;
+	C.nb_workers = get_nb_cpus();
+	if (C.nb_workers < 1) C.nb_workers = 1;
+	if (C.nb_workers > CONVERT_MAX_WORKERS) C.nb_workers = CONVERT_MAX_WORKERS;
 
-	while (1)
+	ALLEGE(pthread_mutex_init(&C.lock, NULL) == 0);
+	ALLEGE(pthread_cond_init(&C.cond, NULL) == 0);
+
+	for (i = 0; i < CONVERT_BATCHES; i++)
 	{
-		if (time(NULL) - tt > 0)
-		{
-			erase_line(0);
-			printf("Read %lu packets...\r", nbr);
-			fflush(stdout);
-			tt = time(NULL);
-		}
+		C.batches[i] = (struct convert_batch *) calloc(1, sizeof(*C.batches[i]));
+		ALLEGE(C.batches[i] != NULL);
+	}
 
-		/* read one packet */
+	workers = (struct convert_worker *) calloc((size_t) C.nb_workers,
+											   sizeof(struct convert_worker));
+	ALLEGE(workers != NULL);
 
-		n = sizeof(pkh);
+	ALLEGE(pthread_create(&reader, NULL, &convert_reader, NULL) == 0);
 
-		if (fread(&pkh, 1, n, f_in) != (size_t) n) break;
+	for (i = 0; i < C.nb_workers; i++)
+	{
+		workers[i].id = i;
+		ALLEGE(pthread_create(&workers[i].tid, NULL, &convert_worker, &workers[i])
+			   == 0);
+	}
 
-		if (pfh.magic == TCPDUMP_CIGAM)
-		{
-			SWAP32(pkh.caplen);
-			SWAP32(pkh.len);
-		}
+	/* write the records in capture order */
 
-		n = pkh.caplen;
+	tt = time(NULL) - 1;
 
-		if (n <= 0 || n > 65535)
+	for (seq = 0;; seq++)
+	{
+		if (time(NULL) - tt > 0)
 		{
-			printf("Corrupted file? Invalid packet length: %d.\n", n);
-			return (EXIT_FAILURE);
+			erase_line(0);
+			printf("Read %lu packets...\r", nbr);
+			fflush(stdout);
+			tt = time(NULL);
 		}
 
-		if (fread(buffer, 1, n, f_in) != (size_t) n) break;
-
-		++nbr;
+		batch = C.batches[seq % CONVERT_BATCHES];
 
-		h80211 = buffer;
+		ALLEGE(pthread_mutex_lock(&C.lock) == 0);
+		while (C.nb_read <= seq || batch->pending > 0)
+			pthread_cond_wait(&C.cond, &C.lock);
+		ALLEGE(pthread_mutex_unlock(&C.lock) == 0);
 
-		/* remove any prism/radiotap header */
-
-		if (pfh.linktype == LINKTYPE_PRISM_HEADER)
+		for (j = 0; j < batch->nb_frames && ret == EXIT_SUCCESS; j++)
 		{
-			if (h80211[7] == 0x40)
-				n = 64;
-			else
-			{
-				n = *(int *) (h80211 + 4);
+			fr = &batch->frames[j];
+			++nbr;
 
-				if (pfh.magic == TCPDUMP_CIGAM) SWAP32(n);
+			if (fr->result == CONVERT_RECORD)
+			{
+				rec = &batch->records[fr->worker];
+
+				if (convert_write(fr->flags,
+								  fr->bssid,
+								  rec->data + fr->rec_offset,
+								  fr->rec_len)
+					!= 0)
+					ret = EXIT_FAILURE;
+				else if (fr->flags & (IVS2_XOR | IVS2_PTW))
+					++nbivs;
+			}
+			else if (fr->result == CONVERT_DATA)
+			{
+				if (convert_eapol(batch->data + fr->offset, fr->caplen, fr->bssid)
+					== FAILURE)
+					ret = EXIT_FAILURE;
 			}
-
-			if (n < 8 || n >= (int) pkh.caplen) continue;
-
-			h80211 += n;
-			pkh.caplen -= n;
 		}
 
-		if (pfh.linktype == LINKTYPE_RADIOTAP_HDR)
+		if (ret == EXIT_SUCCESS && batch->corrupted)
 		{
-			n = *(unsigned short *) (h80211 + 2);
-
-			if (n <= 0 || n >= (int) pkh.caplen) continue;
-
-			h80211 += n;
-			pkh.caplen -= n;
+			printf("Corrupted file? Invalid packet length: %d.\n",
+				   batch->bad_len);
+			ret = EXIT_FAILURE;
 		}
 
-		if (pfh.linktype == LINKTYPE_PPI_HDR)
-		{
-			/* Remove the PPI header */
-
-			n = le16_to_cpu(*(unsigned short *) (h80211 + 2));
+		ALLEGE(pthread_mutex_lock(&C.lock) == 0);
+		C.nb_written = seq + 1;
+		if (ret != EXIT_SUCCESS) C.stop = 1;
+		ALLEGE(pthread_cond_broadcast(&C.cond) == 0);
+		ALLEGE(pthread_mutex_unlock(&C.lock) == 0);
 
-			if (n <= 0 || n >= (int) pkh.caplen) continue;
+		if (batch->last || ret != EXIT_SUCCESS) break;
+	}
 
-			/* for a while Kismet logged broken PPI headers */
-			if (n == 24 && le16_to_cpu(*(unsigned short *) (h80211 + 8)) == 2)
-				n = 32;
+	ALLEGE(pthread_join(reader, NULL) == 0);
+	for (i = 0; i < C.nb_workers; i++)
+		ALLEGE(pthread_join(workers[i].tid, NULL) == 0);
 
-			if (n >= (int) pkh.caplen) continue;
+	free(workers);
 
-			h80211 += n;
-			pkh.caplen -= n;
-		}
+	for (i = 0; i < CONVERT_BATCHES; i++)
+	{
+		for (j = 0; j < CONVERT_MAX_WORKERS; j++)
+			free(C.batches[i]->records[j].data);
+		free(C.batches[i]);
+	}
 
-		ret = dump_add_packet(h80211, pkh.caplen);
+	ALLEGE(pthread_cond_destroy(&C.cond) == 0);
+	ALLEGE(pthread_mutex_destroy(&C.lock) == 0);
 
-		if (ret == IVS) ++nbivs;
-	}
-	fclose(f_in);
+	fclose(C.f_in);
 	fclose(G.f_ivs);
 
+	if (ret != EXIT_SUCCESS) return (ret);
+
 	erase_line(2);
 	printf("Read %lu packets.\n", nbr);
 
@@ -974,9 +1419,43 @@ int main(int argc, char * argv[])
 		printf("Written %lu IVs.\n", nbivs);
 	else
 	{
-		remove(argv[3]);
+		remove(out_name);
 		puts("No IVs written");
 	}
 
 	return (EXIT_SUCCESS);
 }
+
+int main(int argc, char * argv[])
+{
+	if (argc < 4)
+	{
+		usage(EXIT_SUCCESS);
+		return (EXIT_FAILURE);
+	}
+
+	if (strcmp(argv[1], "--merge") == 0)
+	{
+		return (merge(argc, argv));
+	}
+	if (strcmp(argv[1], "--convert") != 0)
+	{
+		usage(EXIT_FAILURE);
+		return (EXIT_FAILURE);
+	}
+
+	// Check filenames are not empty
+	if (argv[2][0] == 0)
+	{
+		printf("Invalid pcap file\n");
+		return (EXIT_FAILURE);
+	}
+
+	if (argv[3][0] == 0)
+	{
+		printf("Invalid output file\n");
+		return (EXIT_FAILURE);
+	}
+
+	return (convert(argv[2], argv[3]));
+}
@@ -26,12 +26,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 
 #include "aircrack-ng/defs.h"
 #include "aircrack-ng/aircrack-ng.h"
 #include "aircrack-ng/support/common.h"
+#include "aircrack-ng/support/pcap_local.h"
+#include "aircrack-ng/ce-wep/uniqueiv.h"
 
-#define IVBUF_SIZE (5UL * 0xFFFFFF)
+#define KEYLEN 13 /* 104-bit key */
+#define MIN_IVS_PER_THREAD 4096
 
 static const int K_COEFF[N_ATTACKS]
 	= {15, 13, 12, 12, 12, 5, 5, 5, 3, 4, 3, 4, 3, 13, 4, 4, -20};
@@ -63,7 +68,7 @@ static void calc_votes(unsigned char * ivbuf,
 	memcpy(K + 3, key, B);
 	memset(votes, 0, sizeof(int) * N_ATTACKS * 256);
 
-	for (xv = 0; xv < nb_ivs; xv += 5)
+	for (xv = 0; xv < nb_ivs * 5; xv += 5)
 	{
 		memcpy(K, &ivbuf[xv], 3); //-V512
 		memcpy(S, R, 256);
@@ -259,45 +264,56 @@ static void calc_votes(unsigned char * ivbuf,
 	}
 }
 
-int main(int argc, char * argv[])
+/* The IVs of one access point: IV, then the first two keystream bytes
+ * XORed with 0xAA (the first two encrypted bytes, if the plaintext is the
+ * SNAP header) */
+
+struct ks_ap
 {
-	FILE * f;
+	unsigned char bssid[6];
+	unsigned char wepkey[KEYLEN];
+	int selected;
+	unsigned char * ivbuf;
 	long nb_ivs;
-	int i, n, B, *vi;
-	unsigned int un;
-	int votes[N_ATTACKS][256];
+	long size;
+	unsigned char ** uiv_root;
+	struct ks_ap * next;
+};
 
-	unsigned char *ivbuf, *s;
-	unsigned char buffer[4096];
-	unsigned char wepkey[16];
+/* votes of a chunk of IVs, for every keybyte */
 
-	vote poll[64][256];
+struct ks_job
+{
+	pthread_t tid;
+	const unsigned char * ivbuf;
+	long nb_ivs;
+	const unsigned char * wepkey;
+	int votes[KEYLEN][N_ATTACKS][256];
+};
 
-	if (argc != 3)
-	{
-		printf("usage: kstats <ivs file> <104-bit key>\n");
-		return (EXIT_FAILURE);
-	}
+static struct ks_ap *ap_1st = NULL, *ap_end = NULL;
 
-	i = 0;
-	s = (unsigned char *) argv[2];
+static int parse_key(const char * s, unsigned char * wepkey)
+{
+	REQUIRE(s != NULL);
+	REQUIRE(wepkey != NULL);
+
+	int i = 0;
+	unsigned int un;
+	char buffer[3];
+
+	if (s[0] == '\0' || s[1] == '\0') return (1);
 
 	buffer[0] = s[0];
 	buffer[1] = s[1];
 	buffer[2] = '\0';
 
-	while (sscanf((char *) buffer, "%x", &un) == 1)
+	while (sscanf(buffer, "%x", &un) == 1)
 	{
-		if (un > 255)
-		{
-			fprintf(stderr, "Invalid wep key.\n");
-			return (EXIT_FAILURE);
-		}
+		if (un > 255 || i >= KEYLEN) return (1);
 
 		wepkey[i++] = (uint8_t) un;
 
-		if (i >= 16) break;
-
 		s += 2;
 
 		if (s[0] == ':' || s[0] == '-') s++;
@@ -308,60 +324,202 @@ int main(int argc, char * argv[])
 		buffer[1] = s[1];
 	}
 
-	if (i != 13)
-	{
-		fprintf(stderr, "Invalid wep key.\n");
-		return (EXIT_FAILURE);
-	}
+	return (i != KEYLEN);
+}
 
-	if ((ivbuf = (unsigned char *) malloc(IVBUF_SIZE)) == NULL)
-	{
-		perror("malloc");
-		return (EXIT_FAILURE);
-	}
+static struct ks_ap * find_ap(const unsigned char * bssid, int add)
+{
+	struct ks_ap * ap;
 
-	memset(ivbuf, 0, IVBUF_SIZE);
+	for (ap = ap_1st; ap != NULL; ap = ap->next)
+		if (memcmp(ap->bssid, bssid, 6) == 0) return (ap);
 
-	if ((f = fopen(argv[1], "rb")) == NULL)
-	{
-		free(ivbuf);
-		perror("fopen");
-		return (EXIT_FAILURE);
-	}
+	if (!add) return (NULL);
 
-	if (fread(buffer, 1, 4, f) != 4)
-	{
-		free(ivbuf);
-		fclose(f);
-		perror("fread header");
-		return (EXIT_FAILURE);
-	}
+	ap = (struct ks_ap *) calloc(1, sizeof(struct ks_ap));
+	ALLEGE(ap != NULL);
+
+	memcpy(ap->bssid, bssid, 6);
+	ap->uiv_root = uniqueiv_init();
+	ALLEGE(ap->uiv_root != NULL);
 
-	if (memcmp(buffer, "\xBF\xCA\x84\xD4", 4) != 0)
+	if (ap_1st == NULL)
+		ap_1st = ap;
+	else
+		ap_end->next = ap;
+	ap_end = ap;
+
+	return (ap);
+}
+
+/* keeps the IVs seen for the first time; returns 1 if one was added */
+
+static int add_iv(const unsigned char * bssid,
+				  int only_selected,
+				  unsigned char * iv,
+				  unsigned char k1,
+				  unsigned char k2)
+{
+	struct ks_ap * ap;
+	unsigned char * p;
+
+	if ((ap = find_ap(bssid, !only_selected)) == NULL) return (0);
+
+	if (uniqueiv_check(ap->uiv_root, iv) != 0) return (0);
+
+	uniqueiv_mark(ap->uiv_root, iv);
+
+	if (ap->nb_ivs == ap->size)
 	{
-		free(ivbuf);
-		fclose(f);
-		fprintf(stderr, "Not an .IVS file\n");
-		return (EXIT_FAILURE);
+		ap->size = (ap->size == 0) ? 65536 : 2 * ap->size;
+		ap->ivbuf = (unsigned char *) realloc(ap->ivbuf, (size_t) ap->size * 5);
+		ALLEGE(ap->ivbuf != NULL);
 	}
 
-	nb_ivs = 0;
+	p = ap->ivbuf + ap->nb_ivs * 5;
+	memcpy(p, iv, 3);
+	p[3] = k1;
+	p[4] = k2;
+	ap->nb_ivs++;
+
+	return (1);
+}
+
+/* old format: the BSSID, or 0xFF if it's the same as the previous one,
+ * then the IV and the first two encrypted bytes */
+
+static void read_ivs(FILE * f, int only_selected)
+{
+	unsigned char bssid[6];
+	unsigned char buffer[6];
+
+	memset(bssid, 0, sizeof(bssid));
 
 	while (1)
 	{
 		if (fread(buffer, 1, 1, f) != 1) break;
 
 		if (buffer[0] != 0xFF)
+		{
 			if (fread(buffer + 1, 1, 5, f) != 5) break;
+			memcpy(bssid, buffer, 6);
+		}
 
 		if (fread(buffer, 1, 5, f) != 5) break;
 
-		memcpy(ivbuf + nb_ivs * 5, buffer, 5); //-V512
+		add_iv(bssid, only_selected, buffer, buffer[3], buffer[4]);
+	}
+}
+
+static void read_ivs2(FILE * f, int only_selected)
+{
+	struct ivs2_filehdr fivs2;
+	struct ivs2_pkthdr ivs2;
+	unsigned char bssid[6];
+	unsigned char buffer[65536];
+
+	memset(bssid, 0, sizeof(bssid));
+
+	if (fread(&fivs2, sizeof(fivs2), 1, f) != 1) return;
+
+	while (fread(&ivs2, sizeof(ivs2), 1, f) == 1)
+	{
+		/* the length of a record includes its BSSID, if there is one */
+		if (ivs2.flags & IVS2_BSSID)
+		{
+			if (ivs2.len < sizeof(bssid) || fread(bssid, sizeof(bssid), 1, f) != 1)
+				break;
+			ivs2.len -= sizeof(bssid);
+		}
+
+		if (ivs2.len > 0 && fread(buffer, ivs2.len, 1, f) != 1) break;
+
+		/* IV + index, then the keystream */
+		if ((ivs2.flags & IVS2_XOR) && ivs2.len >= 6)
+			add_iv(bssid,
+				   only_selected,
+				   buffer,
+				   (uint8_t)(buffer[4] ^ 0xAA),
+				   (uint8_t)(buffer[5] ^ 0xAA));
+
+		/* IV + index, number and length of the keystreams, then these */
+		else if ((ivs2.flags & IVS2_PTW) && ivs2.len >= 8)
+			add_iv(bssid,
+				   only_selected,
+				   buffer,
+				   (uint8_t)(buffer[6] ^ 0xAA),
+				   (uint8_t)(buffer[7] ^ 0xAA));
+	}
+}
+
+static THREAD_ENTRY(vote_thread)
+{
+	struct ks_job * job = (struct ks_job *) arg;
+	int B;
+
+	for (B = 0; B < KEYLEN; B++)
+		calc_votes((unsigned char *) job->ivbuf,
+				   job->nb_ivs,
+				   (unsigned char *) job->wepkey,
+				   B,
+				   job->votes[B]);
+
+	return (NULL);
+}
+
+/* Splits the IVs into one chunk per thread and adds up their votes. */
+
+static void sum_votes(const unsigned char * ivbuf,
+					  long nb_ivs,
+					  const unsigned char * wepkey,
+					  int nbcpu,
+					  struct ks_job * jobs,
+					  int votes[KEYLEN][N_ATTACKS][256])
+{
+	int i, t, nb_threads;
+	int *dst, *src;
+	long first = 0, count;
+
+	nb_threads = (int) (nb_ivs / MIN_IVS_PER_THREAD);
+	if (nb_threads > nbcpu) nb_threads = nbcpu;
+	if (nb_threads < 1) nb_threads = 1;
+
+	for (t = 0; t < nb_threads; t++)
+	{
+		count = nb_ivs / nb_threads + (t < nb_ivs % nb_threads);
+
+		jobs[t].ivbuf = ivbuf + first * 5;
+		jobs[t].nb_ivs = count;
+		jobs[t].wepkey = wepkey;
+		first += count;
+
+		if (t > 0)
+			ALLEGE(pthread_create(&jobs[t].tid, NULL, &vote_thread, &jobs[t])
+				   == 0);
+	}
+
+	vote_thread(&jobs[0]);
+
+	memcpy(votes, jobs[0].votes, sizeof(jobs[0].votes));
+
+	for (t = 1; t < nb_threads; t++)
+	{
+		ALLEGE(pthread_join(jobs[t].tid, NULL) == 0);
+
+		src = (int *) jobs[t].votes;
+		dst = (int *) votes;
 
-		nb_ivs++;
+		for (i = 0; i < KEYLEN * N_ATTACKS * 256; i++) dst[i] += src[i];
 	}
+}
 
-	for (B = 0; B < 13; B++)
+static void show_votes(const unsigned char * wepkey,
+					   int votes[KEYLEN][N_ATTACKS][256])
+{
+	int i, n, B, *vi;
+	vote poll[KEYLEN][256];
+
+	for (B = 0; B < KEYLEN; B++)
 	{
 		for (i = 0; i < 256; i++)
 		{
@@ -369,9 +527,7 @@ int main(int argc, char * argv[])
 			poll[B][i].val = 0;
 		}
 
-		calc_votes(ivbuf, nb_ivs, wepkey, B, votes);
-
-		for (n = 0, vi = (int *) votes; n < N_ATTACKS; n++)
+		for (n = 0, vi = (int *) votes[B]; n < N_ATTACKS; n++)
 			for (i = 0; i < 256; i++, vi++) poll[B][i].val += *vi * K_COEFF[n];
 
 		qsort(poll[B], 256, sizeof(vote), cmp_votes);
@@ -381,34 +537,194 @@ int main(int argc, char * argv[])
 		for (i = 0; i < 256; i++)
 			if (poll[B][i].idx == wepkey[B]) printf("(%4d) ", poll[B][i].val);
 
-		for (i = 0; i < N_ATTACKS; i++) printf("%3d  ", votes[i][wepkey[B]]);
+		for (i = 0; i < N_ATTACKS; i++) printf("%3d  ", votes[B][i][wepkey[B]]);
 
 		printf("\n");
 
 		printf("KB %02d FIRST  %02X(%4d) ", B, poll[B][0].idx, poll[B][0].val);
 
 		for (i = 0; i < N_ATTACKS; i++)
-			printf("%3d  ", votes[i][poll[B][0].idx]);
+			printf("%3d  ", votes[B][i][poll[B][0].idx]);
 
 		printf("\n");
 
 		printf("KB %02d SECOND %02X(%4d) ", B, poll[B][1].idx, poll[B][1].val);
 
 		for (i = 0; i < N_ATTACKS; i++)
-			printf("%3d  ", votes[i][poll[B][1].idx]);
+			printf("%3d  ", votes[B][i][poll[B][1].idx]);
 
 		printf("\n");
 
 		printf("KB %02d THIRD  %02X(%4d) ", B, poll[B][2].idx, poll[B][2].val);
 
 		for (i = 0; i < N_ATTACKS; i++)
-			printf("%3d  ", votes[i][poll[B][2].idx]);
+			printf("%3d  ", votes[B][i][poll[B][2].idx]);
 
 		printf("\n\n");
 	}
+}
+
+static void usage(void)
+{
+	printf("usage: kstats [-b <bssid>[=<104-bit key>]] ... <ivs file> "
+		   "[<ivs file> ...] <104-bit key>\n");
+}
+
+int main(int argc, char * argv[])
+{
+	FILE * f;
+	int i, option, nbcpu, only_selected = 0;
+	long nb_ivs;
+	char * s;
+	unsigned char buffer[4];
+	unsigned char bssid[6];
+	unsigned char wepkey[KEYLEN];
+	unsigned char * ivbuf;
+	struct ks_ap * ap;
+	struct ks_ap * next;
+	struct ks_job * jobs;
+	int(*votes)[N_ATTACKS][256];
+
+	while ((option = getopt(argc, argv, "b:h")) != -1)
+	{
+		switch (option)
+		{
+			case 'b':
+
+				/* the key of this access point follows '=', if any */
+				if ((s = strchr(optarg, '=')) != NULL) *s++ = '\0';
+
+				if (getmac(optarg, 1, bssid) != 0)
+				{
+					fprintf(stderr, "Invalid BSSID: %s\n", optarg);
+					return (EXIT_FAILURE);
+				}
+
+				ap = find_ap(bssid, 1);
+				ap->selected = 1;
+				only_selected = 1;
+
+				if (s != NULL)
+				{
+					if (parse_key(s, ap->wepkey) != 0)
+					{
+						fprintf(stderr, "Invalid wep key.\n");
+						return (EXIT_FAILURE);
+					}
+					ap->selected = 2;
+				}
+				break;
+
+			default:
+				usage();
+				return (EXIT_FAILURE);
+		}
+	}
+
+	if (argc - optind < 2)
+	{
+		usage();
+		return (EXIT_FAILURE);
+	}
+
+	if (parse_key(argv[argc - 1], wepkey) != 0)
+	{
+		fprintf(stderr, "Invalid wep key.\n");
+		return (EXIT_FAILURE);
+	}
+
+	for (ap = ap_1st; ap != NULL; ap = ap->next)
+		if (ap->selected == 1) memcpy(ap->wepkey, wepkey, KEYLEN);
+
+	for (i = optind; i < argc - 1; i++)
+	{
+		if ((f = fopen(argv[i], "rb")) == NULL)
+		{
+			perror("fopen");
+			return (EXIT_FAILURE);
+		}
+
+		if (fread(buffer, 1, 4, f) != 4)
+		{
+			fclose(f);
+			perror("fread header");
+			return (EXIT_FAILURE);
+		}
+
+		if (memcmp(buffer, IVSONLY_MAGIC, 4) == 0)
+			read_ivs(f, only_selected);
+		else if (memcmp(buffer, IVS2_MAGIC, 4) == 0)
+			read_ivs2(f, only_selected);
+		else
+		{
+			fclose(f);
+			fprintf(stderr, "%s: Not an .IVS file\n", argv[i]);
+			return (EXIT_FAILURE);
+		}
+
+		fclose(f);
+	}
+
+	nbcpu = get_nb_cpus();
+	if (nbcpu < 1) nbcpu = 1;
+	if (nbcpu > MAX_THREADS) nbcpu = MAX_THREADS;
+
+	jobs = (struct ks_job *) calloc((size_t) nbcpu, sizeof(struct ks_job));
+	votes = calloc(KEYLEN, sizeof(*votes));
+	ALLEGE(jobs != NULL && votes != NULL);
+
+	if (only_selected)
+	{
+		/* one set of votes per access point, in the order given */
+
+		for (ap = ap_1st; ap != NULL; ap = ap->next)
+		{
+			printf("BSSID %02X:%02X:%02X:%02X:%02X:%02X  %ld IVs\n\n",
+				   ap->bssid[0],
+				   ap->bssid[1],
+				   ap->bssid[2],
+				   ap->bssid[3],
+				   ap->bssid[4],
+				   ap->bssid[5],
+				   ap->nb_ivs);
+
+			sum_votes(ap->ivbuf, ap->nb_ivs, ap->wepkey, nbcpu, jobs, votes);
+			show_votes(ap->wepkey, votes);
+		}
+	}
+	else
+	{
+		/* all the IVs together, whatever their access point */
+
+		for (nb_ivs = 0, ap = ap_1st; ap != NULL; ap = ap->next)
+			nb_ivs += ap->nb_ivs;
+
+		ivbuf = (unsigned char *) malloc((size_t) nb_ivs * 5 + 1);
+		ALLEGE(ivbuf != NULL);
+
+		for (nb_ivs = 0, ap = ap_1st; ap != NULL; ap = ap->next)
+		{
+			if (ap->nb_ivs > 0)
+				memcpy(ivbuf + nb_ivs * 5, ap->ivbuf, (size_t) ap->nb_ivs * 5);
+			nb_ivs += ap->nb_ivs;
+		}
+
+		sum_votes(ivbuf, nb_ivs, wepkey, nbcpu, jobs, votes);
+		show_votes(wepkey, votes);
+
+		free(ivbuf);
+	}
+
+	for (ap = ap_1st; ap != NULL; ap = next)
+	{
+		next = ap->next;
+		uniqueiv_wipe(ap->uiv_root);
+		free(ap->ivbuf);
+		free(ap);
+	}
 
-	free(ivbuf);
-	fclose(f);
+	free(votes);
+	free(jobs);
 
 	return (EXIT_SUCCESS);
 }
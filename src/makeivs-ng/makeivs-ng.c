@@ -29,15 +29,16 @@
 #include <getopt.h>
 #include <time.h>
 #include <float.h>
+#include <strings.h>
+#include <pthread.h>
 
 #include "aircrack-ng/defs.h"
 #include "aircrack-ng/version.h"
+#include "aircrack-ng/crypto/crypto.h"
 #include "aircrack-ng/support/pcap_local.h"
 #include "aircrack-ng/ce-wep/uniqueiv.h"
 #include "aircrack-ng/support/common.h"
 
-#define NULL_MAC "\x00\x00\x00\x00\x00\x00"
-
 static const char usage[] =
 
 	"\n"
@@ -59,9 +60,803 @@ static const char usage[] =
 	"      -n         : Ignores weak IVs\n"
 	"      -p         : Uses prng algorithm to generate IVs\n"
 	"\n"
+	"  Capture options:\n"
+	"      --pcap <file>      : Write a synthetic capture instead\n"
+	"      --aps <num>        : Number of access points (default: 1)\n"
+	"      --stations <num>   : Number of stations per access point\n"
+	"                           (default: 1)\n"
+	"      --frames <num>     : Number of data frames per station\n"
+	"                           (default: 100)\n"
+	"      --encryption <list>: Encryptions of the access points, in\n"
+	"                           turn: wep,tkip,ccmp,pmf (default: all)\n"
+	"      --passphrase <psk> : WPA passphrase (default: password)\n"
+	"      --radiotap         : Add a radiotap header to the frames\n"
+	"      --threads <num>    : Number of threads (default: all CPUs)\n"
+	"\n"
 	"      --help     : Displays this usage screen\n"
 	"\n";
 
+/* --pcap writes a synthetic capture instead of an IVS file. Every station
+ * of every access point sends a beacon, the association, the 4-way
+ * handshake (if WPA) and its data frames. These are cut into units of work
+ * of at most CAP_UNIT_FRAMES data frames, the first unit of a station also
+ * holding the frames before them. Units are made on several threads, each
+ * from its own random generator seeded with the seed, the station and the
+ * unit number, and written in order, so the same options always give the
+ * same capture and a unit never takes more than about CAP_UNIT_FRAMES
+ * full-size frames of memory. */
+
+#define CAP_UNITS_IN_FLIGHT 64
+#define CAP_UNIT_FRAMES 256
+#define CAP_WRITE_BUFFER (1024 * 1024)
+#define CAP_MAX_FRAME 2048
+#define CAP_MAX_PAYLOAD 1400
+#define CAP_FRAME_USEC 1000 /* between two frames of a unit */
+#define CAP_START_TIME 1577836800 /* 2020-01-01 */
+#define CAP_RADIOTAP_LEN 15
+
+enum
+{
+	CAP_WEP,
+	CAP_TKIP,
+	CAP_CCMP,
+	CAP_PMF, /* CCMP, management frame protection required */
+	CAP_KINDS
+};
+
+static const char * cap_kind_names[CAP_KINDS] = {"wep", "tkip", "ccmp", "pmf"};
+
+struct cap_ap
+{
+	unsigned char bssid[6];
+	char essid[33];
+	int kind;
+	int channel;
+	unsigned char pmk[40];
+};
+
+struct cap_unit
+{
+	unsigned char * data;
+	size_t len;
+	size_t size;
+	unsigned long frames;
+	int done;
+};
+
+static struct capture
+{
+	/* options */
+	int nb_aps;
+	int nb_stations; /* per access point */
+	int nb_frames; /* data frames per station */
+	int radiotap;
+	int nb_threads;
+	int kinds[CAP_KINDS];
+	int nb_kinds;
+	char psk[65];
+	unsigned char wepkey[32]; /* IV, then the key */
+	int wepkeylen;
+	unsigned long seed;
+
+	struct cap_ap * aps;
+	unsigned long nb_units;
+	unsigned long station_units; /* units of a station */
+	unsigned long station_span; /* microseconds between two stations */
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned long next_ap;
+	unsigned long next_unit;
+	unsigned long nb_written;
+	struct cap_unit slots[CAP_UNITS_IN_FLIGHT];
+} cap;
+
+static uint64_t cap_rand(uint64_t * state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+	return (z ^ (z >> 31));
+}
+
+static void cap_random(uint64_t * state, unsigned char * buf, size_t len)
+{
+	uint64_t r = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+	{
+		if ((i & 7) == 0) r = cap_rand(state);
+		buf[i] = (uint8_t)(r & 0xFF);
+		r >>= 8;
+	}
+}
+
+static int cap_parse_kinds(const char * list)
+{
+	char * copy;
+	char * name;
+	char * saveptr = NULL;
+	int i;
+
+	cap.nb_kinds = 0;
+
+	copy = strdup(list);
+	ALLEGE(copy != NULL);
+
+	for (name = strtok_r(copy, ",", &saveptr); name != NULL;
+		 name = strtok_r(NULL, ",", &saveptr))
+	{
+		for (i = 0; i < CAP_KINDS; i++)
+			if (strcasecmp(name, cap_kind_names[i]) == 0) break;
+
+		if (i == CAP_KINDS || cap.nb_kinds == CAP_KINDS)
+		{
+			free(copy);
+			return (1);
+		}
+
+		cap.kinds[cap.nb_kinds++] = i;
+	}
+
+	free(copy);
+	return (cap.nb_kinds == 0);
+}
+
+/* appends a frame, with its pcap header and the radiotap header if any */
+
+static void cap_frame(struct cap_unit * unit,
+					  const struct cap_ap * ap,
+					  unsigned long long usec,
+					  const unsigned char * h80211,
+					  size_t len)
+{
+	struct pcap_pkthdr pkh;
+	unsigned char * p;
+	size_t rtap = cap.radiotap ? CAP_RADIOTAP_LEN : 0;
+	size_t need = sizeof(pkh) + rtap + len;
+	int freq = 2407 + 5 * ap->channel;
+
+	if (unit->len + need > unit->size)
+	{
+		unit->size = 2 * unit->size + need;
+		unit->data = (unsigned char *) realloc(unit->data, unit->size);
+		ALLEGE(unit->data != NULL);
+	}
+
+	pkh.tv_sec = (int32_t)(usec / 1000000ULL);
+	pkh.tv_usec = (int32_t)(usec % 1000000ULL);
+	pkh.caplen = pkh.len = (uint32_t)(rtap + len);
+
+	p = unit->data + unit->len;
+	memcpy(p, &pkh, sizeof(pkh));
+	p += sizeof(pkh);
+
+	if (rtap)
+	{
+		/* flags, rate, channel and antenna signal */
+		p[0] = 0;
+		p[1] = 0;
+		p[2] = CAP_RADIOTAP_LEN;
+		p[3] = 0;
+		p[4] = 0x2E;
+		p[5] = p[6] = p[7] = 0;
+		p[8] = 0;
+		p[9] = 0x6C; /* 54 Mbps */
+		p[10] = (uint8_t)(freq & 0xFF);
+		p[11] = (uint8_t)(freq >> 8);
+		p[12] = 0xC0; /* 2 GHz, OFDM */
+		p[13] = 0x00;
+		p[14] = (uint8_t)(-30 - ap->channel); /* dBm */
+		p += rtap;
+	}
+
+	memcpy(p, h80211, len);
+	unit->len += need;
+	unit->frames++;
+}
+
+static size_t cap_header(unsigned char * h80211,
+						 unsigned char fc0,
+						 unsigned char fc1,
+						 const unsigned char * a1,
+						 const unsigned char * a2,
+						 const unsigned char * a3,
+						 unsigned * seq)
+{
+	h80211[0] = fc0;
+	h80211[1] = fc1;
+	h80211[2] = h80211[3] = 0;
+	memcpy(h80211 + 4, a1, 6);
+	memcpy(h80211 + 10, a2, 6);
+	memcpy(h80211 + 16, a3, 6);
+	h80211[22] = (uint8_t)((*seq << 4) & 0xFF);
+	h80211[23] = (uint8_t)((*seq >> 4) & 0xFF);
+	*seq = (*seq + 1) & 0xFFF;
+
+	return (24);
+}
+
+/* the WPA or RSN information element, if any */
+
+static size_t cap_wpa_ie(unsigned char * p, const struct cap_ap * ap)
+{
+	if (ap->kind == CAP_TKIP)
+	{
+		memcpy(p,
+			   "\xDD\x16\x00\x50\xF2\x01\x01\x00\x00\x50\xF2\x02\x01\x00"
+			   "\x00\x50\xF2\x02\x01\x00\x00\x50\xF2\x02",
+			   24);
+		return (24);
+	}
+
+	if (ap->kind == CAP_CCMP || ap->kind == CAP_PMF)
+	{
+		memcpy(p,
+			   "\x30\x14\x01\x00\x00\x0F\xAC\x04\x01\x00\x00\x0F\xAC\x04"
+			   "\x01\x00\x00\x0F\xAC\x02\x00\x00",
+			   22);
+		/* MFPR and MFPC */
+		if (ap->kind == CAP_PMF) p[20] = 0xC0;
+		return (22);
+	}
+
+	return (0);
+}
+
+/* SSID, rates, channel and the WPA or RSN information element */
+
+static size_t cap_ies(unsigned char * p, const struct cap_ap * ap, int channel)
+{
+	size_t n, len = strlen(ap->essid);
+
+	p[0] = 0x00;
+	p[1] = (uint8_t) len;
+	memcpy(p + 2, ap->essid, len);
+	n = 2 + len;
+
+	memcpy(p + n, "\x01\x08\x82\x84\x8B\x96\x0C\x12\x18\x24", 10);
+	n += 10;
+
+	if (channel)
+	{
+		p[n] = 0x03;
+		p[n + 1] = 1;
+		p[n + 2] = (uint8_t) ap->channel;
+		n += 3;
+	}
+
+	return (n + cap_wpa_ie(p + n, ap));
+}
+
+/* An EAPOL-Key frame of the 4-way handshake, with its MIC if it has one;
+ * returns its length from the EAPOL header on. */
+
+static size_t cap_eapol(unsigned char * p,
+						const struct cap_ap * ap,
+						int msg,
+						const unsigned char * nonce,
+						const unsigned char * data,
+						size_t data_len,
+						const unsigned char * ptk)
+{
+	static const uint16_t rsn_info[4] = {0x008A, 0x010A, 0x13CA, 0x030A};
+	static const uint16_t wpa_info[4] = {0x0089, 0x0109, 0x01C9, 0x0109};
+	unsigned char mic[20];
+	uint16_t info;
+	size_t len = 99 + data_len;
+	int rsn = (ap->kind != CAP_TKIP);
+
+	info = rsn ? rsn_info[msg - 1] : wpa_info[msg - 1];
+
+	memset(p, 0, len);
+	p[0] = rsn ? 2 : 1;
+	p[1] = 3; /* key */
+	p[2] = (uint8_t)((len - 4) >> 8);
+	p[3] = (uint8_t)((len - 4) & 0xFF);
+	p[4] = rsn ? 2 : 254;
+	p[5] = (uint8_t)(info >> 8);
+	p[6] = (uint8_t)(info & 0xFF);
+	p[8] = rsn ? 16 : 32;
+	p[16] = (uint8_t)((msg + 1) / 2); /* replay counter */
+	if (msg != 4) memcpy(p + 17, nonce, 32);
+	p[97] = (uint8_t)(data_len >> 8);
+	p[98] = (uint8_t)(data_len & 0xFF);
+	if (data_len > 0) memcpy(p + 99, data, data_len);
+
+	if (msg > 1)
+	{
+		if (rsn)
+			HMAC(EVP_sha1(), ptk, 16, p, len, mic, NULL);
+		else
+			HMAC(EVP_md5(), ptk, 16, p, len, mic, NULL);
+
+		memcpy(p + 81, mic, 16);
+	}
+
+	return (len);
+}
+
+/* LLC/SNAP, IPv4 and UDP headers, then random bytes */
+
+static size_t cap_payload(unsigned char * p, uint64_t * rng)
+{
+	size_t len = 36 + cap_rand(rng) % (CAP_MAX_PAYLOAD - 36);
+	size_t ip_len = len - 8;
+
+	memcpy(p, S_LLC_SNAP_IP, 8);
+	p[8] = 0x45;
+	p[9] = 0x00;
+	p[10] = (uint8_t)(ip_len >> 8);
+	p[11] = (uint8_t)(ip_len & 0xFF);
+	cap_random(rng, p + 12, 4);
+	p[16] = 64; /* TTL */
+	p[17] = 17; /* UDP */
+	p[18] = p[19] = 0;
+	memcpy(p + 20, "\xC0\xA8\x01\x01\xC0\xA8\x01\x64", 8);
+	p[28] = 0x30;
+	p[29] = 0x39;
+	p[30] = 0x30;
+	p[31] = 0x39;
+	p[32] = (uint8_t)((ip_len - 20) >> 8);
+	p[33] = (uint8_t)((ip_len - 20) & 0xFF);
+	p[34] = p[35] = 0;
+	cap_random(rng, p + 36, len - 36);
+
+	return (len);
+}
+
+static void cap_increment(unsigned char * counter, int len)
+{
+	while (--len >= 0 && ++counter[len] == 0)
+		;
+}
+
+/* adds n to a big endian counter */
+
+static void cap_advance(unsigned char * counter, int len, unsigned long n)
+{
+	unsigned long carry = n;
+
+	while (--len >= 0 && carry != 0)
+	{
+		carry += counter[len];
+		counter[len] = (uint8_t)(carry & 0xFF);
+		carry >>= 8;
+	}
+}
+
+static void cap_make_unit(unsigned long u, struct cap_unit * unit)
+{
+	unsigned long st = u / cap.station_units;
+	unsigned long part = u % cap.station_units;
+	unsigned long first = part * CAP_UNIT_FRAMES;
+	unsigned long count = (unsigned long) cap.nb_frames - first;
+	const struct cap_ap * ap = &cap.aps[st / cap.nb_stations];
+	unsigned long long usec
+		= CAP_START_TIME * 1000000ULL
+		  + st * (unsigned long long) cap.station_span;
+	uint64_t rng = cap.seed * 0x100000001B3ULL + st;
+	uint64_t data_rng;
+	unsigned char h80211[CAP_MAX_FRAME];
+	unsigned char stmac[6];
+	unsigned char anonce[32];
+	unsigned char snonce[32];
+	unsigned char data[64];
+	unsigned char pn[6];
+	unsigned char tsc[6];
+	unsigned char wepkey[32];
+	unsigned char pmkid[20];
+	unsigned char pmk_name[20];
+	struct WPA_ST_info wpa;
+	unsigned ap_seq, st_seq;
+	size_t n, len;
+	unsigned long f;
+	int i, to_ds;
+
+	unit->len = 0;
+	unit->frames = 0;
+
+	if (count > CAP_UNIT_FRAMES) count = CAP_UNIT_FRAMES;
+
+	stmac[0] = 0x02;
+	stmac[1] = 0x5A;
+	stmac[2] = (uint8_t)((st >> 24) & 0xFF);
+	stmac[3] = (uint8_t)((st >> 16) & 0xFF);
+	stmac[4] = (uint8_t)((st >> 8) & 0xFF);
+	stmac[5] = (uint8_t)(st & 0xFF);
+
+	ap_seq = (unsigned) (cap_rand(&rng) & 0xFFF);
+	st_seq = (unsigned) (cap_rand(&rng) & 0xFFF);
+
+	/* every unit of a station draws its nonces and keys again, but only
+	 * the first one writes the frames before the data */
+
+	/* beacon */
+
+	n = cap_header(h80211, 0x80, 0, BROADCAST, ap->bssid, ap->bssid, &ap_seq);
+	memcpy(h80211 + n, &usec, 8); /* timestamp */
+	memcpy(h80211 + n + 8, "\x64\x00\x31\x04", 4);
+	n += 12;
+	n += cap_ies(h80211 + n, ap, 1);
+	if (part == 0) cap_frame(unit, ap, usec, h80211, n);
+	usec += CAP_FRAME_USEC;
+
+	/* association request and response */
+
+	n = cap_header(h80211, 0x00, 0, ap->bssid, stmac, ap->bssid, &st_seq);
+	memcpy(h80211 + n, "\x31\x04\x0A\x00", 4);
+	n += 4;
+	n += cap_ies(h80211 + n, ap, 0);
+	if (part == 0) cap_frame(unit, ap, usec, h80211, n);
+	usec += CAP_FRAME_USEC;
+
+	n = cap_header(h80211, 0x10, 0, stmac, ap->bssid, ap->bssid, &ap_seq);
+	h80211[n] = 0x31;
+	h80211[n + 1] = 0x04;
+	h80211[n + 2] = h80211[n + 3] = 0; /* success */
+	h80211[n + 4] = (uint8_t)((u % cap.nb_stations + 1) & 0xFF);
+	h80211[n + 5] = 0xC0;
+	n += 6;
+	memcpy(h80211 + n, "\x01\x08\x82\x84\x8B\x96\x0C\x12\x18\x24", 10);
+	n += 10;
+	if (part == 0) cap_frame(unit, ap, usec, h80211, n);
+	usec += CAP_FRAME_USEC;
+
+	/* 4-way handshake */
+
+	memset(&wpa, 0, sizeof(wpa));
+
+	if (ap->kind != CAP_WEP)
+	{
+		cap_random(&rng, anonce, 32);
+		cap_random(&rng, snonce, 32);
+
+		memcpy(wpa.stmac, stmac, 6);
+		memcpy(wpa.bssid, ap->bssid, 6);
+		memcpy(wpa.anonce, anonce, 32);
+		memcpy(wpa.snonce, snonce, 32);
+		wpa.keyver = (ap->kind == CAP_TKIP) ? 1 : 2;
+		calc_ptk(&wpa, (unsigned char *) ap->pmk);
+
+		for (i = 1; i <= 4; i++)
+		{
+			to_ds = (i % 2 == 0);
+
+			if (to_ds)
+				n = cap_header(
+					h80211, 0x08, 0x01, ap->bssid, stmac, ap->bssid, &st_seq);
+			else
+				n = cap_header(
+					h80211, 0x08, 0x02, stmac, ap->bssid, ap->bssid, &ap_seq);
+
+			memcpy(h80211 + n, "\xAA\xAA\x03\x00\x00\x00\x88\x8E", 8);
+			n += 8;
+
+			len = 0;
+
+			if (i == 1 && ap->kind != CAP_TKIP)
+			{
+				/* PMKID = HMAC-SHA1-128(PMK, "PMK Name" | AA | SPA) */
+				memcpy(pmk_name, "PMK Name", 8);
+				memcpy(pmk_name + 8, ap->bssid, 6);
+				memcpy(pmk_name + 14, stmac, 6);
+				HMAC(EVP_sha1(), ap->pmk, 32, pmk_name, 20, pmkid, NULL);
+
+				memcpy(data, "\xDD\x14\x00\x0F\xAC\x04", 6);
+				memcpy(data + 6, pmkid, 16);
+				len = 22;
+			}
+			else if (i == 2 || (i == 3 && ap->kind == CAP_TKIP))
+				len = cap_wpa_ie(data, ap);
+			else if (i == 3)
+			{
+				/* the wrapped GTK */
+				cap_random(&rng, data, 56);
+				len = 56;
+			}
+
+			n += cap_eapol(h80211 + n,
+						   ap,
+						   i,
+						   (i == 2) ? snonce : anonce,
+						   data,
+						   len,
+						   wpa.ptk);
+			if (part == 0) cap_frame(unit, ap, usec, h80211, n);
+			usec += CAP_FRAME_USEC;
+		}
+	}
+
+	/* data */
+
+	memset(pn, 0, sizeof(pn));
+	memset(tsc, 0, sizeof(tsc));
+	memcpy(wepkey, cap.wepkey, sizeof(wepkey));
+	cap_random(&rng, wepkey, 3);
+
+	/* skip what the units before this one sent */
+
+	cap_advance(pn, 6, first);
+	cap_advance(tsc, 6, first);
+	cap_advance(wepkey, 3, first);
+	ap_seq = (unsigned) ((ap_seq + first) & 0xFFF);
+	st_seq = (unsigned) ((st_seq + first) & 0xFFF);
+	usec += first * (unsigned long long) CAP_FRAME_USEC;
+
+	data_rng = cap_rand(&rng) ^ (part * 0xD6E8FEB86659FD93ULL);
+
+	for (f = 0; f < count; f++)
+	{
+		to_ds = (cap_rand(&data_rng) & 1);
+
+		if (to_ds)
+			n = cap_header(
+				h80211, 0x08, 0x41, ap->bssid, stmac, BROADCAST, &st_seq);
+		else
+			n = cap_header(
+				h80211, 0x08, 0x42, stmac, ap->bssid, ap->bssid, &ap_seq);
+
+		switch (ap->kind)
+		{
+			case CAP_WEP:
+				cap_increment(wepkey, 3);
+				memcpy(h80211 + n, wepkey, 3);
+				h80211[n + 3] = 0;
+				len = cap_payload(h80211 + n + 4, &data_rng);
+				add_icv(h80211, (int) (n + 4 + len), (int) (n + 4));
+				encrypt_wep(h80211 + n + 4,
+							(int) len + 4,
+							wepkey,
+							cap.wepkeylen + 3);
+				n += 4 + len + 4;
+				break;
+
+			case CAP_TKIP:
+				cap_increment(tsc, 6);
+				h80211[n] = tsc[4];
+				h80211[n + 1] = (uint8_t)((tsc[4] | 0x20) & 0x7F);
+				h80211[n + 2] = tsc[5];
+				h80211[n + 3] = 0x20; /* extended IV */
+				h80211[n + 4] = tsc[3];
+				h80211[n + 5] = tsc[2];
+				h80211[n + 6] = tsc[1];
+				h80211[n + 7] = tsc[0];
+				len = cap_payload(h80211 + n + 8, &data_rng);
+				n += 8 + len + 8 + 4; /* MIC and ICV */
+				encrypt_tkip(h80211, (int) n, wpa.ptk);
+				break;
+
+			default:
+				cap_increment(pn, 6);
+				len = cap_payload(h80211 + n, &data_rng);
+				n = (size_t) encrypt_ccmp(
+					h80211, (int) (n + len), wpa.ptk + 32, pn);
+				break;
+		}
+
+		cap_frame(unit, ap, usec, h80211, n);
+		usec += CAP_FRAME_USEC;
+	}
+}
+
+static THREAD_ENTRY(cap_pmk_thread)
+{
+	struct cap_ap * ap;
+	unsigned long i;
+
+	UNUSED_PARAM(arg);
+
+	while (1)
+	{
+		ALLEGE(pthread_mutex_lock(&cap.lock) == 0);
+		i = cap.next_ap++;
+		ALLEGE(pthread_mutex_unlock(&cap.lock) == 0);
+
+		if (i >= (unsigned long) cap.nb_aps) break;
+
+		ap = &cap.aps[i];
+		if (ap->kind != CAP_WEP) calc_pmk(cap.psk, ap->essid, ap->pmk);
+	}
+
+	return (NULL);
+}
+
+static THREAD_ENTRY(cap_unit_thread)
+{
+	struct cap_unit * unit;
+	unsigned long u;
+
+	UNUSED_PARAM(arg);
+
+	while (1)
+	{
+		ALLEGE(pthread_mutex_lock(&cap.lock) == 0);
+		while (cap.next_unit < cap.nb_units
+			   && cap.next_unit - cap.nb_written >= CAP_UNITS_IN_FLIGHT)
+			pthread_cond_wait(&cap.cond, &cap.lock);
+		u = cap.next_unit;
+		if (u < cap.nb_units) cap.next_unit++;
+		ALLEGE(pthread_mutex_unlock(&cap.lock) == 0);
+
+		if (u >= cap.nb_units) break;
+
+		unit = &cap.slots[u % CAP_UNITS_IN_FLIGHT];
+		cap_make_unit(u, unit);
+
+		ALLEGE(pthread_mutex_lock(&cap.lock) == 0);
+		unit->done = 1;
+		ALLEGE(pthread_cond_broadcast(&cap.cond) == 0);
+		ALLEGE(pthread_mutex_unlock(&cap.lock) == 0);
+	}
+
+	return (NULL);
+}
+
+static int make_capture(const char * filename)
+{
+	struct pcap_file_header pfh;
+	struct cap_unit * unit;
+	struct cap_ap * ap;
+	pthread_t * threads;
+	unsigned long u, nb_frames = 0;
+	unsigned long long size = 0;
+	FILE * f_out;
+	int i, ret = EXIT_SUCCESS;
+
+	if (cap.nb_kinds == 0)
+	{
+		for (i = 0; i < CAP_KINDS; i++) cap.kinds[i] = i;
+		cap.nb_kinds = CAP_KINDS;
+	}
+
+	if (cap.psk[0] == '\0') strcpy(cap.psk, "password");
+
+	/* the WEP access points share a key, the one given or a random one */
+
+	if (cap.wepkeylen == 0)
+	{
+		uint64_t rng = cap.seed;
+
+		cap.wepkeylen = 13;
+		cap_random(&rng, cap.wepkey + 3, 13);
+	}
+
+	if (cap.nb_threads < 1) cap.nb_threads = get_nb_cpus();
+	if (cap.nb_threads < 1) cap.nb_threads = 1;
+
+	cap.aps = (struct cap_ap *) calloc((size_t) cap.nb_aps, sizeof(*cap.aps));
+	ALLEGE(cap.aps != NULL);
+
+	for (i = 0; i < cap.nb_aps; i++)
+	{
+		ap = &cap.aps[i];
+		ap->bssid[0] = 0x02;
+		ap->bssid[1] = 0xAC;
+		ap->bssid[2] = (uint8_t)((i >> 24) & 0xFF);
+		ap->bssid[3] = (uint8_t)((i >> 16) & 0xFF);
+		ap->bssid[4] = (uint8_t)((i >> 8) & 0xFF);
+		ap->bssid[5] = (uint8_t)(i & 0xFF);
+		snprintf(ap->essid, sizeof(ap->essid), "synthetic-%d", i);
+		ap->kind = cap.kinds[i % cap.nb_kinds];
+		ap->channel = 1 + i % 11;
+	}
+
+	cap.station_units = ((unsigned long) cap.nb_frames + CAP_UNIT_FRAMES - 1)
+						/ CAP_UNIT_FRAMES;
+	if (cap.station_units == 0) cap.station_units = 1;
+	cap.nb_units
+		= (unsigned long) cap.nb_aps * cap.nb_stations * cap.station_units;
+	cap.station_span = (unsigned long) (cap.nb_frames + 7) * CAP_FRAME_USEC;
+
+	printf("Creating %d access points with %d stations each, "
+		   "%d data frames per station.\n",
+		   cap.nb_aps,
+		   cap.nb_stations,
+		   cap.nb_frames);
+	printf("WPA passphrase: %s\n", cap.psk);
+	printf("WEP key: ");
+	for (i = 0; i < cap.wepkeylen; i++)
+		printf("%02X%c", cap.wepkey[3 + i], (i < cap.wepkeylen - 1) ? ':' : '\n');
+
+	if ((f_out = fopen(filename, "wb+")) == NULL)
+	{
+		perror("fopen");
+		free(cap.aps);
+		return (EXIT_FAILURE);
+	}
+
+	(void) setvbuf(f_out, NULL, _IOFBF, CAP_WRITE_BUFFER);
+
+	memset(&pfh, 0, sizeof(pfh));
+	pfh.magic = TCPDUMP_MAGIC;
+	pfh.version_major = PCAP_VERSION_MAJOR;
+	pfh.version_minor = PCAP_VERSION_MINOR;
+	pfh.snaplen = 65535;
+	pfh.linktype = cap.radiotap ? LINKTYPE_RADIOTAP_HDR : LINKTYPE_IEEE802_11;
+
+	if (fwrite(&pfh, 1, sizeof(pfh), f_out) != sizeof(pfh))
+	{
+		perror("fwrite(pcap file header) failed");
+		fclose(f_out);
+		free(cap.aps);
+		return (EXIT_FAILURE);
+	}
+
+	threads = (pthread_t *) calloc((size_t) cap.nb_threads, sizeof(pthread_t));
+	ALLEGE(threads != NULL);
+
+	ALLEGE(pthread_mutex_init(&cap.lock, NULL) == 0);
+	ALLEGE(pthread_cond_init(&cap.cond, NULL) == 0);
+
+	/* the pairwise master keys first, then the frames */
+
+	for (i = 0; i < cap.nb_threads; i++)
+		ALLEGE(pthread_create(&threads[i], NULL, &cap_pmk_thread, NULL) == 0);
+	for (i = 0; i < cap.nb_threads; i++)
+		ALLEGE(pthread_join(threads[i], NULL) == 0);
+
+	for (i = 0; i < cap.nb_threads; i++)
+		ALLEGE(pthread_create(&threads[i], NULL, &cap_unit_thread, NULL) == 0);
+
+	for (u = 0; u < cap.nb_units; u++)
+	{
+		unit = &cap.slots[u % CAP_UNITS_IN_FLIGHT];
+
+		ALLEGE(pthread_mutex_lock(&cap.lock) == 0);
+		while (!unit->done) pthread_cond_wait(&cap.cond, &cap.lock);
+		ALLEGE(pthread_mutex_unlock(&cap.lock) == 0);
+
+		if (ret == EXIT_SUCCESS
+			&& fwrite(unit->data, 1, unit->len, f_out) != unit->len)
+		{
+			perror("fwrite(frames) failed");
+			ret = EXIT_FAILURE;
+		}
+
+		nb_frames += unit->frames;
+		size += unit->len;
+
+		ALLEGE(pthread_mutex_lock(&cap.lock) == 0);
+		unit->done = 0;
+		cap.nb_written = u + 1;
+		ALLEGE(pthread_cond_broadcast(&cap.cond) == 0);
+		ALLEGE(pthread_mutex_unlock(&cap.lock) == 0);
+
+		if ((u % 1000) == 0)
+		{
+			printf("%2.1f%%\r", ((float) u / (float) cap.nb_units) * 100.0f);
+			fflush(stdout);
+		}
+	}
+
+	for (i = 0; i < cap.nb_threads; i++)
+		ALLEGE(pthread_join(threads[i], NULL) == 0);
+
+	ALLEGE(pthread_cond_destroy(&cap.cond) == 0);
+	ALLEGE(pthread_mutex_destroy(&cap.lock) == 0);
+
+	for (i = 0; i < CAP_UNITS_IN_FLIGHT; i++) free(cap.slots[i].data);
+	free(threads);
+	free(cap.aps);
+
+	if (fclose(f_out) != 0 && ret == EXIT_SUCCESS)
+	{
+		perror("fclose");
+		ret = EXIT_FAILURE;
+	}
+
+	if (ret == EXIT_SUCCESS)
+		printf("Wrote %lu frames (%.2f MB).\n",
+			   nb_frames,
+			   (double) size / (1024.0 * 1024.0));
+
+	return (ret);
+}
+
 int main(int argc, char * argv[])
 {
 	int i, j, k, pre_n, n, count = 100000, length = 16;
@@ -83,6 +878,7 @@ int main(int argc, char * argv[])
 	int maxivs = 0x1000000;
 	unsigned char byte;
 	unsigned char ** uiv_root;
+	char * pcap_filename = NULL;
 
 	static const struct option long_options[] = {{"key", 1, 0, 'k'},
 												 {"write", 1, 0, 'w'},
@@ -95,6 +891,14 @@ int main(int argc, char * argv[])
 												 {"error", 1, 0, 'e'},
 												 {"nofms", 0, 0, 'n'},
 												 {"prng", 0, 0, 'p'},
+												 {"pcap", 1, 0, 'P'},
+												 {"aps", 1, 0, 'A'},
+												 {"stations", 1, 0, 'S'},
+												 {"frames", 1, 0, 'F'},
+												 {"encryption", 1, 0, 'E'},
+												 {"passphrase", 1, 0, 'W'},
+												 {"radiotap", 0, 0, 'R'},
+												 {"threads", 1, 0, 'T'},
 												 {"help", 0, 0, 'H'},
 												 {0, 0, 0, 0}};
 
@@ -103,6 +907,11 @@ int main(int argc, char * argv[])
 	memset(bssid, 0, 6);
 	uiv_root = uniqueiv_init();
 
+	memset(&cap, 0, sizeof(cap));
+	cap.nb_aps = 1;
+	cap.nb_stations = 1;
+	cap.nb_frames = 100;
+
 	/* check the arguments */
 
 	do
@@ -264,6 +1073,62 @@ int main(int argc, char * argv[])
 				filename = strdup(optarg);
 				break;
 
+			case 'P':
+
+				paramUsed = 1;
+				pcap_filename = optarg;
+				break;
+
+			case 'A':
+			case 'S':
+			case 'F':
+			case 'T':
+
+				paramUsed = 1;
+				n = atoi(optarg);
+				if (n < (option == 'F' ? 0 : 1) || n > 0xFFFFFF)
+				{
+					printf("Invalid --%s.\n", long_options[option_index].name);
+					return (EXIT_FAILURE);
+				}
+
+				if (option == 'A')
+					cap.nb_aps = n;
+				else if (option == 'S')
+					cap.nb_stations = n;
+				else if (option == 'F')
+					cap.nb_frames = n;
+				else
+					cap.nb_threads = n;
+				break;
+
+			case 'E':
+
+				paramUsed = 1;
+				if (cap_parse_kinds(optarg) != 0)
+				{
+					printf("Invalid encryption list. [wep,tkip,ccmp,pmf]\n");
+					return (EXIT_FAILURE);
+				}
+				break;
+
+			case 'W':
+
+				paramUsed = 1;
+				if (strlen(optarg) < 8 || strlen(optarg) > 63)
+				{
+					printf("Invalid WPA passphrase. [8-63 characters]\n");
+					return (EXIT_FAILURE);
+				}
+				strcpy(cap.psk, optarg);
+				break;
+
+			case 'R':
+
+				paramUsed = 1;
+				cap.radiotap = 1;
+				break;
+
 			case 'b':
 
 				paramUsed = 1;
@@ -384,6 +1249,23 @@ int main(int argc, char * argv[])
 		return (EXIT_SUCCESS);
 	}
 
+	if (pcap_filename != NULL)
+	{
+		free(filename);
+		uniqueiv_wipe(uiv_root);
+
+		ac_crypto_init();
+
+		cap.seed = (unsigned long) seed;
+		if (crypt)
+		{
+			memcpy(cap.wepkey, K, sizeof(cap.wepkey));
+			cap.wepkeylen = weplen;
+		}
+
+		return (make_capture(pcap_filename));
+	}
+
 	if (count > maxivs)
 	{
 		printf(usage,
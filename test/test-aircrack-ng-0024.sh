@@ -0,0 +1,44 @@
+#!/bin/sh
+
+set -ef
+
+STATE_DIR=$(mktemp -d)
+trap 'rm -rf "${STATE_DIR}"' EXIT
+
+# The first run cracks the key and saves the PTW state
+"${abs_builddir}/../aircrack-ng${EXEEXT}" \
+    ${AIRCRACK_NG_ARGS} \
+    --oneshot \
+    --ptw-state "${STATE_DIR}" \
+    "${abs_srcdir}/wep_64_ptw.cap" \
+    -l /dev/null | \
+        ${GREP} "KEY FOUND" | ${GREP} "1F:1F:1F:1F:1F"
+
+test -s "${STATE_DIR}/00-12-BF-12-32-29.ptw"
+
+# The second run only gets the first beacon of the network (record 26,
+# 16 + 59 bytes at offset 1688): the IVs can only come from the state
+BEACON_CAP="${STATE_DIR}/beacon.cap"
+head -c 24 "${abs_srcdir}/wep_64_ptw.cap" > "${BEACON_CAP}"
+dd if="${abs_srcdir}/wep_64_ptw.cap" bs=1 skip=1688 count=75 \
+    >> "${BEACON_CAP}" 2>/dev/null
+
+"${abs_builddir}/../aircrack-ng${EXEEXT}" \
+    ${AIRCRACK_NG_ARGS} \
+    --oneshot \
+    --ptw-state "${STATE_DIR}" \
+    "${BEACON_CAP}" \
+    -l /dev/null | \
+        ${GREP} "KEY FOUND" | ${GREP} "1F:1F:1F:1F:1F"
+
+# With -b, the capture read before is resumed at its end
+"${abs_builddir}/../aircrack-ng${EXEEXT}" \
+    ${AIRCRACK_NG_ARGS} \
+    --oneshot \
+    --ptw-state "${STATE_DIR}" \
+    -b 00:12:BF:12:32:29 \
+    "${abs_srcdir}/wep_64_ptw.cap" \
+    -l /dev/null | \
+        ${GREP} "Resuming .* at byte 4071637"
+
+exit 0
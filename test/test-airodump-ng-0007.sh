@@ -0,0 +1,46 @@
+#!/bin/sh
+# Airodump-ng: Read a capture at full speed and check the files it writes
+
+set -ef
+
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "${TMP_DIR}"' EXIT
+
+"${abs_builddir}/../airodump-ng${EXEEXT}" \
+    --offline --background 1 \
+    -r "${abs_srcdir}/wpa2-psk-linksys.cap" \
+    -w "${TMP_DIR}/linksys" -o csv,events \
+    > "${TMP_DIR}/airodump.txt" 2>&1
+
+${GREP} "Read 499 frames in " "${TMP_DIR}/airodump.txt"
+
+${GREP} -E "^00:0B:86:C2:A4:85, .*, WPA2, CCMP, PSK, +0, +85, +44, .*, +7, linksys, " \
+    "${TMP_DIR}/linksys-01.csv"
+${GREP} -E "^00:13:CE:55:98:EF, .*, +234, 00:0B:86:C2:A4:85,linksys" \
+    "${TMP_DIR}/linksys-01.csv"
+
+${GREP} ", new, AP, 00:0B:86:C2:A4:85, " "${TMP_DIR}/linksys-01.events.csv"
+${GREP} ", new, Station, 00:13:CE:55:98:EF, " \
+    "${TMP_DIR}/linksys-01.events.csv"
+
+# Six access points with a client each, only two of them may be kept
+"${abs_builddir}/../makeivs-ng${EXEEXT}" \
+    --pcap "${TMP_DIR}/synthetic.cap" \
+    --aps 6 --frames 20 -s 1 \
+    -k 0102030405 > /dev/null
+
+"${abs_builddir}/../airodump-ng${EXEEXT}" \
+    --offline --background 1 --max-entries 2 \
+    -r "${TMP_DIR}/synthetic.cap" \
+    -w "${TMP_DIR}/synthetic" -o csv,events \
+    > "${TMP_DIR}/airodump.txt" 2>&1
+
+${GREP} "Read 154 frames in " "${TMP_DIR}/airodump.txt"
+
+test "$(${GREP} -c "^02:AC:00:00:00:0[0-5], " "${TMP_DIR}/synthetic-01.csv")" -eq 2
+test "$(${GREP} -c "^02:5A:00:00:00:0[0-5], " "${TMP_DIR}/synthetic-01.csv")" -eq 2
+
+test "$(${GREP} -c ", evict, AP, " "${TMP_DIR}/synthetic-01.events.csv")" -ge 4
+test "$(${GREP} -c ", evict, Station, " "${TMP_DIR}/synthetic-01.events.csv")" -ge 4
+
+exit 0
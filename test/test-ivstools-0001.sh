@@ -0,0 +1,18 @@
+#!/bin/sh
+
+set -ef
+
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "${TMP_DIR}"' EXIT
+
+"${abs_builddir}/../ivstools${EXEEXT}" \
+    --convert "${abs_srcdir}/wep_64_ptw.cap" "${TMP_DIR}/ptw.ivs"
+
+# Merging a file with itself drops all of its second copy (IVs and ESSID)
+"${abs_builddir}/../ivstools${EXEEXT}" \
+    --merge "${TMP_DIR}/ptw.ivs" "${TMP_DIR}/ptw.ivs" "${TMP_DIR}/merged.ivs" | \
+        ${GREP} "30567 duplicate records dropped"
+
+cmp "${TMP_DIR}/ptw.ivs" "${TMP_DIR}/merged.ivs"
+
+exit 0
@@ -0,0 +1,23 @@
+#!/bin/sh
+
+set -ef
+
+MD5_BIN="md5sum"
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "${TMP_DIR}"' EXIT
+
+if type "md5" > /dev/null 2>/dev/null ; then
+	MD5_BIN="md5 -q"
+fi
+
+# PTW records with several keystreams, from more than one access point
+"${abs_builddir}/../ivstools${EXEEXT}" \
+    --convert "${abs_srcdir}/capture_wds-01.cap" "${TMP_DIR}/wds.ivs" | \
+        ${GREP} "Written 46 IVs."
+
+if [ "$(${MD5_BIN} "${TMP_DIR}/wds.ivs" | cut -b 1-32)" != 'de9d5503236689afd318d1d4f37a2724' ]; then
+	echo "Unexpected ivs file"
+	exit 1
+fi
+
+exit 0
@@ -0,0 +1,22 @@
+#!/bin/sh
+
+set -ef
+
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "${TMP_DIR}"' EXIT
+
+"${abs_builddir}/../ivstools${EXEEXT}" \
+    --convert "${abs_srcdir}/wep_64_ptw.cap" "${TMP_DIR}/ptw.ivs"
+
+# One set of votes per access point, from an old and an IVS2 file
+"${abs_builddir}/../kstats${EXEEXT}" \
+    -b 00:12:BF:12:32:29=1F1F1F1F1F1F1F1F1F1F1F1F1F \
+    -b 00:11:95:91:78:8C \
+    "${abs_srcdir}/test.ivs" "${TMP_DIR}/ptw.ivs" \
+    AE:5B:7F:3A:03:D0:AF:9B:F6:8D:A5:E2:C7 > "${TMP_DIR}/votes.txt"
+
+${GREP} "BSSID 00:12:BF:12:32:29  30566 IVs" "${TMP_DIR}/votes.txt"
+${GREP} "BSSID 00:11:95:91:78:8C  566693 IVs" "${TMP_DIR}/votes.txt"
+${GREP} "KB 00 FIRST  AE(  50)" "${TMP_DIR}/votes.txt"
+
+exit 0
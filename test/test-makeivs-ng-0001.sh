@@ -0,0 +1,28 @@
+#!/bin/sh
+
+set -ef
+
+TMP_DIR=$(mktemp -d)
+trap 'rm -rf "${TMP_DIR}"' EXIT
+
+# One access point per encryption, with a fixed seed
+"${abs_builddir}/../makeivs-ng${EXEEXT}" \
+    --pcap "${TMP_DIR}/synthetic.cap" \
+    --aps 4 --frames 20 -s 1 --threads 2 \
+    -k 0102030405 > "${TMP_DIR}/makeivs.txt"
+
+${GREP} "Wrote 104 frames" "${TMP_DIR}/makeivs.txt"
+
+"${abs_builddir}/../aircrack-ng${EXEEXT}" \
+    ${AIRCRACK_NG_ARGS} \
+    -q -b 02:AC:00:00:00:02 \
+    -w "${abs_srcdir}/password.lst" \
+    "${TMP_DIR}/synthetic.cap" | \
+        ${GREP} "KEY FOUND! \[ password \]"
+
+"${abs_builddir}/../airdecap-ng${EXEEXT}" \
+    -e synthetic-3 -p password \
+    "${TMP_DIR}/synthetic.cap" | \
+        ${GREP} "Number of decrypted WPA  packets        20"
+
+exit 0